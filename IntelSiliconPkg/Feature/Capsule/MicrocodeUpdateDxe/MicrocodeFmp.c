@@ -409,9 +409,49 @@ FmpSetPackageInfo (
   return EFI_UNSUPPORTED;
 }
 
+/**
+  Sift a FIT microcode entry down a max-heap ordered by MicrocodeEntryPoint.
+
+  @param[in, out] FitMicrocodeInfo  The FIT microcode entries that form the heap.
+  @param[in]      Root              The index of the entry to sift down.
+  @param[in]      Count             The number of entries in the heap.
+
+**/
+VOID
+SiftDownFitMicrocodeInfo (
+  IN OUT FIT_MICROCODE_INFO  *FitMicrocodeInfo,
+  IN     UINTN               Root,
+  IN     UINTN               Count
+  )
+{
+  FIT_MICROCODE_INFO  TempFitMicrocodeEntry;
+  UINTN               Child;
+
+  CopyMem (&TempFitMicrocodeEntry, &FitMicrocodeInfo[Root], sizeof (FIT_MICROCODE_INFO));
+  for (Child = 2 * Root + 1; Child < Count; Child = 2 * Root + 1) {
+    if ((Child + 1 < Count) &&
+        ((UINTN)FitMicrocodeInfo[Child + 1].MicrocodeEntryPoint > (UINTN)FitMicrocodeInfo[Child].MicrocodeEntryPoint))
+    {
+      Child++;
+    }
+
+    if ((UINTN)FitMicrocodeInfo[Child].MicrocodeEntryPoint <= (UINTN)TempFitMicrocodeEntry.MicrocodeEntryPoint) {
+      break;
+    }
+
+    CopyMem (&FitMicrocodeInfo[Root], &FitMicrocodeInfo[Child], sizeof (FIT_MICROCODE_INFO));
+    Root = Child;
+  }
+
+  CopyMem (&FitMicrocodeInfo[Root], &TempFitMicrocodeEntry, sizeof (FIT_MICROCODE_INFO));
+}
+
 /**
   Sort FIT microcode entries based upon MicrocodeEntryPoint, from low to high.
 
+  The entries are heap sorted in place, which takes O(n log n) time whatever
+  the order of the FIT is and needs no extra memory.
+
   @param[in] MicrocodeFmpPrivate private data structure to be initialized.
 
 **/
@@ -420,27 +460,26 @@ SortFitMicrocodeInfo (
   IN MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate
   )
 {
-  FIT_MICROCODE_INFO  *FitMicrocodeEntry;
-  FIT_MICROCODE_INFO  *NextFitMicrocodeEntry;
+  FIT_MICROCODE_INFO  *FitMicrocodeInfo;
   FIT_MICROCODE_INFO  TempFitMicrocodeEntry;
-  FIT_MICROCODE_INFO  *FitMicrocodeEntryEnd;
-
-  FitMicrocodeEntry     = MicrocodeFmpPrivate->FitMicrocodeInfo;
-  NextFitMicrocodeEntry = FitMicrocodeEntry + 1;
-  FitMicrocodeEntryEnd  = MicrocodeFmpPrivate->FitMicrocodeInfo + MicrocodeFmpPrivate->FitMicrocodeEntryCount;
-  while (FitMicrocodeEntry < FitMicrocodeEntryEnd) {
-    while (NextFitMicrocodeEntry < FitMicrocodeEntryEnd) {
-      if (FitMicrocodeEntry->MicrocodeEntryPoint > NextFitMicrocodeEntry->MicrocodeEntryPoint) {
-        CopyMem (&TempFitMicrocodeEntry, FitMicrocodeEntry, sizeof (FIT_MICROCODE_INFO));
-        CopyMem (FitMicrocodeEntry, NextFitMicrocodeEntry, sizeof (FIT_MICROCODE_INFO));
-        CopyMem (NextFitMicrocodeEntry, &TempFitMicrocodeEntry, sizeof (FIT_MICROCODE_INFO));
-      }
+  UINTN               Count;
+  UINTN               Index;
 
-      NextFitMicrocodeEntry = NextFitMicrocodeEntry + 1;
-    }
+  FitMicrocodeInfo = MicrocodeFmpPrivate->FitMicrocodeInfo;
+  Count            = MicrocodeFmpPrivate->FitMicrocodeEntryCount;
+
+  for (Index = Count / 2; Index > 0; Index--) {
+    SiftDownFitMicrocodeInfo (FitMicrocodeInfo, Index - 1, Count);
+  }
 
-    FitMicrocodeEntry     = FitMicrocodeEntry + 1;
-    NextFitMicrocodeEntry = FitMicrocodeEntry + 1;
+  //
+  // Move the highest entry point behind the heap, and restore the heap.
+  //
+  for (Index = Count; Index > 1; Index--) {
+    CopyMem (&TempFitMicrocodeEntry, &FitMicrocodeInfo[0], sizeof (FIT_MICROCODE_INFO));
+    CopyMem (&FitMicrocodeInfo[0], &FitMicrocodeInfo[Index - 1], sizeof (FIT_MICROCODE_INFO));
+    CopyMem (&FitMicrocodeInfo[Index - 1], &TempFitMicrocodeEntry, sizeof (FIT_MICROCODE_INFO));
+    SiftDownFitMicrocodeInfo (FitMicrocodeInfo, 0, Index - 1);
   }
 }
 
@@ -480,7 +519,7 @@ InitializeFitMicrocodeInfo (
     MicrocodeFmpPrivate->FitMicrocodeEntryCount = 0;
   }
 
-  FitPointer = *(UINT64 *)(UINTN)FIT_POINTER_ADDRESS;
+  FitPointer = *(UINT64 *)MicrocodeFmpPrivate->FitPointerAddress;
   if ((FitPointer == 0) ||
       (FitPointer == 0xFFFFFFFFFFFFFFFF) ||
       (FitPointer == 0xEEEEEEEEEEEEEEEE))
@@ -624,9 +663,169 @@ ErrorExit:
   return EFI_DEVICE_ERROR;
 }
 
+/**
+  Sift a Microcode patch index entry down a max-heap ordered by
+  ProcessorSignature, then by MicrocodeIndex.
+
+  @param[in, out] PatchIndex      The Microcode patch index entries that form the heap.
+  @param[in]      Root            The index of the entry to sift down.
+  @param[in]      Count           The number of entries in the heap.
+
+**/
+VOID
+SiftDownMicrocodePatchIndex (
+  IN OUT MICROCODE_PATCH_INDEX_ENTRY  *PatchIndex,
+  IN     UINTN                        Root,
+  IN     UINTN                        Count
+  )
+{
+  MICROCODE_PATCH_INDEX_ENTRY  TempEntry;
+  UINTN                        Child;
+
+  CopyMem (&TempEntry, &PatchIndex[Root], sizeof (MICROCODE_PATCH_INDEX_ENTRY));
+  for (Child = 2 * Root + 1; Child < Count; Child = 2 * Root + 1) {
+    if ((Child + 1 < Count) &&
+        ((PatchIndex[Child + 1].ProcessorSignature > PatchIndex[Child].ProcessorSignature) ||
+         ((PatchIndex[Child + 1].ProcessorSignature == PatchIndex[Child].ProcessorSignature) &&
+          (PatchIndex[Child + 1].MicrocodeIndex > PatchIndex[Child].MicrocodeIndex))))
+    {
+      Child++;
+    }
+
+    if ((PatchIndex[Child].ProcessorSignature < TempEntry.ProcessorSignature) ||
+        ((PatchIndex[Child].ProcessorSignature == TempEntry.ProcessorSignature) &&
+         (PatchIndex[Child].MicrocodeIndex <= TempEntry.MicrocodeIndex)))
+    {
+      break;
+    }
+
+    CopyMem (&PatchIndex[Root], &PatchIndex[Child], sizeof (MICROCODE_PATCH_INDEX_ENTRY));
+    Root = Child;
+  }
+
+  CopyMem (&PatchIndex[Root], &TempEntry, sizeof (MICROCODE_PATCH_INDEX_ENTRY));
+}
+
+/**
+  Build the Microcode patch index, which is sorted by processor signature.
+
+  A patch is verified once. If the previous Microcode information has a patch
+  at the same entrypoint with the same size, and the patch is not in the dirty
+  region, the previous verification result is reused.
+
+  @param[in] MicrocodeFmpPrivate  private data structure to be initialized.
+  @param[in] OldMicrocodeInfo     The previous Microcode information.
+  @param[in] OldMicrocodeCount    The count of the previous Microcode information.
+
+  @return EFI_SUCCESS           Microcode patch index is built.
+  @return EFI_OUT_OF_RESOURCES  No enough resource for the index.
+**/
+EFI_STATUS
+BuildMicrocodePatchIndex (
+  IN MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate,
+  IN MICROCODE_INFO              *OldMicrocodeInfo  OPTIONAL,
+  IN UINTN                       OldMicrocodeCount
+  )
+{
+  UINTN                        MicrocodeIndex;
+  UINTN                        OldIndex;
+  UINTN                        EntryCount;
+  UINTN                        Index;
+  UINTN                        MicrocodeBase;
+  UINTN                        DirtyBase;
+  UINTN                        DirtySize;
+  MICROCODE_INFO               *MicrocodeInfo;
+  MICROCODE_PATCH_INDEX_ENTRY  *PatchIndex;
+  MICROCODE_PATCH_INDEX_ENTRY  TempEntry;
+  UINT32                       AttemptStatus;
+  EFI_STATUS                   Status;
+
+  if (MicrocodeFmpPrivate->MicrocodePatchIndex != NULL) {
+    FreePool (MicrocodeFmpPrivate->MicrocodePatchIndex);
+    MicrocodeFmpPrivate->MicrocodePatchIndex = NULL;
+  }
+
+  MicrocodeFmpPrivate->MicrocodePatchIndexCount = 0;
+
+  DirtyBase = MicrocodeFmpPrivate->DirtyRegionBase;
+  DirtySize = MicrocodeFmpPrivate->DirtyRegionSize;
+
+  //
+  // Both MicrocodeInfo arrays are ordered by entrypoint, so the previous
+  // result is looked up with a single forward walk.
+  //
+  OldIndex   = 0;
+  EntryCount = 0;
+  for (MicrocodeIndex = 0; MicrocodeIndex < MicrocodeFmpPrivate->DescriptorCount; MicrocodeIndex++) {
+    MicrocodeInfo = &MicrocodeFmpPrivate->MicrocodeInfo[MicrocodeIndex];
+    MicrocodeBase = (UINTN)MicrocodeInfo->MicrocodeEntryPoint;
+
+    while ((OldMicrocodeInfo != NULL) && (OldIndex < OldMicrocodeCount) &&
+           ((UINTN)OldMicrocodeInfo[OldIndex].MicrocodeEntryPoint < MicrocodeBase))
+    {
+      OldIndex++;
+    }
+
+    if ((OldMicrocodeInfo != NULL) && (OldIndex < OldMicrocodeCount) &&
+        (OldMicrocodeInfo[OldIndex].MicrocodeEntryPoint == MicrocodeInfo->MicrocodeEntryPoint) &&
+        (OldMicrocodeInfo[OldIndex].TotalSize == MicrocodeInfo->TotalSize) &&
+        ((DirtySize == 0) || (MicrocodeBase >= DirtyBase + DirtySize) || (MicrocodeBase + MicrocodeInfo->TotalSize <= DirtyBase)))
+    {
+      MicrocodeInfo->Verified = OldMicrocodeInfo[OldIndex].Verified;
+    } else {
+      Status                  = CheckMicrocodeFormat (MicrocodeInfo->MicrocodeEntryPoint, MicrocodeInfo->TotalSize, &AttemptStatus, NULL);
+      MicrocodeInfo->Verified = (BOOLEAN)!EFI_ERROR (Status);
+    }
+
+    if (MicrocodeInfo->Verified) {
+      EntryCount += CollectMicrocodePatchSignatures (MicrocodeFmpPrivate, MicrocodeIndex, NULL);
+    }
+  }
+
+  if (EntryCount == 0) {
+    return EFI_SUCCESS;
+  }
+
+  PatchIndex = AllocateZeroPool (EntryCount * sizeof (MICROCODE_PATCH_INDEX_ENTRY));
+  if (PatchIndex == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  EntryCount = 0;
+  for (MicrocodeIndex = 0; MicrocodeIndex < MicrocodeFmpPrivate->DescriptorCount; MicrocodeIndex++) {
+    if (MicrocodeFmpPrivate->MicrocodeInfo[MicrocodeIndex].Verified) {
+      EntryCount += CollectMicrocodePatchSignatures (MicrocodeFmpPrivate, MicrocodeIndex, &PatchIndex[EntryCount]);
+    }
+  }
+
+  //
+  // Heap sort by ProcessorSignature, then by MicrocodeIndex, so the entries
+  // of one signature stay in Microcode region order.
+  //
+  for (Index = EntryCount / 2; Index > 0; Index--) {
+    SiftDownMicrocodePatchIndex (PatchIndex, Index - 1, EntryCount);
+  }
+
+  for (Index = EntryCount; Index > 1; Index--) {
+    CopyMem (&TempEntry, &PatchIndex[0], sizeof (MICROCODE_PATCH_INDEX_ENTRY));
+    CopyMem (&PatchIndex[0], &PatchIndex[Index - 1], sizeof (MICROCODE_PATCH_INDEX_ENTRY));
+    CopyMem (&PatchIndex[Index - 1], &TempEntry, sizeof (MICROCODE_PATCH_INDEX_ENTRY));
+    SiftDownMicrocodePatchIndex (PatchIndex, 0, Index - 1);
+  }
+
+  MicrocodeFmpPrivate->MicrocodePatchIndex      = PatchIndex;
+  MicrocodeFmpPrivate->MicrocodePatchIndexCount = EntryCount;
+
+  return EFI_SUCCESS;
+}
+
 /**
   Initialize Processor Microcode Index.
 
+  Each processor class looks up its signature in the Microcode patch index.
+  A patch is in use if it matches one class, and a class uses the last
+  matched patch in the Microcode region.
+
   @param[in] MicrocodeFmpPrivate private data structure to be initialized.
 **/
 VOID
@@ -634,37 +833,128 @@ InitializedProcessorMicrocodeIndex (
   IN MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate
   )
 {
-  UINTN       CpuIndex;
-  UINTN       MicrocodeIndex;
-  UINTN       TargetCpuIndex;
-  UINT32      AttemptStatus;
-  EFI_STATUS  Status;
+  UINTN                        CpuIndex;
+  UINTN                        ClassIndex;
+  UINTN                        Low;
+  UINTN                        High;
+  UINTN                        Middle;
+  PROCESSOR_CLASS_INFO         *ProcessorClassInfo;
+  MICROCODE_PATCH_INDEX_ENTRY  *PatchIndex;
+
+  PatchIndex = MicrocodeFmpPrivate->MicrocodePatchIndex;
+  for (ClassIndex = 0; ClassIndex < MicrocodeFmpPrivate->ProcessorClassCount; ClassIndex++) {
+    ProcessorClassInfo                 = &MicrocodeFmpPrivate->ProcessorClassInfo[ClassIndex];
+    ProcessorClassInfo->MicrocodeIndex = (UINTN)-1;
 
-  for (CpuIndex = 0; CpuIndex < MicrocodeFmpPrivate->ProcessorCount; CpuIndex++) {
-    if (MicrocodeFmpPrivate->ProcessorInfo[CpuIndex].MicrocodeIndex != (UINTN)-1) {
-      continue;
+    //
+    // Find the first entry of the signature.
+    //
+    Low  = 0;
+    High = MicrocodeFmpPrivate->MicrocodePatchIndexCount;
+    while (Low < High) {
+      Middle = (Low + High) / 2;
+      if (PatchIndex[Middle].ProcessorSignature < ProcessorClassInfo->ProcessorSignature) {
+        Low = Middle + 1;
+      } else {
+        High = Middle;
+      }
     }
 
-    for (MicrocodeIndex = 0; MicrocodeIndex < MicrocodeFmpPrivate->DescriptorCount; MicrocodeIndex++) {
-      if (!MicrocodeFmpPrivate->MicrocodeInfo[MicrocodeIndex].InUse) {
+    for ( ; Low < MicrocodeFmpPrivate->MicrocodePatchIndexCount; Low++) {
+      if (PatchIndex[Low].ProcessorSignature != ProcessorClassInfo->ProcessorSignature) {
+        break;
+      }
+
+      if (((PatchIndex[Low].ProcessorFlags & (1 << ProcessorClassInfo->PlatformId)) == 0) ||
+          (PatchIndex[Low].UpdateRevision < ProcessorClassInfo->MicrocodeRevision))
+      {
         continue;
       }
 
-      TargetCpuIndex = CpuIndex;
-      Status         = VerifyMicrocode (
-                         MicrocodeFmpPrivate,
-                         MicrocodeFmpPrivate->MicrocodeInfo[MicrocodeIndex].MicrocodeEntryPoint,
-                         MicrocodeFmpPrivate->MicrocodeInfo[MicrocodeIndex].TotalSize,
-                         FALSE,
-                         &AttemptStatus,
-                         NULL,
-                         &TargetCpuIndex
-                         );
-      if (!EFI_ERROR (Status)) {
-        MicrocodeFmpPrivate->ProcessorInfo[CpuIndex].MicrocodeIndex = MicrocodeIndex;
+      MicrocodeFmpPrivate->MicrocodeInfo[PatchIndex[Low].MicrocodeIndex].InUse = TRUE;
+      if ((ProcessorClassInfo->MicrocodeIndex == (UINTN)-1) ||
+          (PatchIndex[Low].MicrocodeIndex > ProcessorClassInfo->MicrocodeIndex))
+      {
+        ProcessorClassInfo->MicrocodeIndex = PatchIndex[Low].MicrocodeIndex;
       }
     }
   }
+
+  for (CpuIndex = 0; CpuIndex < MicrocodeFmpPrivate->ProcessorCount; CpuIndex++) {
+    ClassIndex                                                  = MicrocodeFmpPrivate->ProcessorInfo[CpuIndex].ClassIndex;
+    MicrocodeFmpPrivate->ProcessorInfo[CpuIndex].MicrocodeIndex = MicrocodeFmpPrivate->ProcessorClassInfo[ClassIndex].MicrocodeIndex;
+  }
+}
+
+/**
+  Initialize Microcode ImageDescriptor from Microcode information.
+
+  @param[in] MicrocodeFmpPrivate private data structure to be initialized.
+**/
+VOID
+InitializeImageDescriptor (
+  IN MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate
+  )
+{
+  UINTN                          Index;
+  CPU_MICROCODE_HEADER           *MicrocodeEntryPoint;
+  EFI_FIRMWARE_IMAGE_DESCRIPTOR  *ImageDescriptor;
+  UINT64                         ImageAttributes;
+
+  for (Index = 0; Index < MicrocodeFmpPrivate->DescriptorCount; Index++) {
+    MicrocodeEntryPoint = MicrocodeFmpPrivate->MicrocodeInfo[Index].MicrocodeEntryPoint;
+    ImageDescriptor     = &MicrocodeFmpPrivate->ImageDescriptor[Index];
+
+    ImageDescriptor->ImageIndex = (UINT8)(Index + 1);
+    CopyGuid (&ImageDescriptor->ImageTypeId, &gMicrocodeFmpImageTypeIdGuid);
+    ImageDescriptor->ImageId     = LShiftU64 (MicrocodeEntryPoint->ProcessorFlags, 32) + MicrocodeEntryPoint->ProcessorSignature.Uint32;
+    ImageDescriptor->ImageIdName = NULL;
+    ImageDescriptor->Version     = MicrocodeEntryPoint->UpdateRevision;
+    ImageDescriptor->VersionName = NULL;
+    ImageDescriptor->Size        = MicrocodeFmpPrivate->MicrocodeInfo[Index].TotalSize;
+    ImageAttributes              = IMAGE_ATTRIBUTE_IMAGE_UPDATABLE | IMAGE_ATTRIBUTE_RESET_REQUIRED;
+    if (MicrocodeFmpPrivate->MicrocodeInfo[Index].InUse) {
+      ImageAttributes |= IMAGE_ATTRIBUTE_IN_USE;
+    }
+
+    ImageDescriptor->AttributesSupported         = ImageAttributes | IMAGE_ATTRIBUTE_IN_USE;
+    ImageDescriptor->AttributesSetting           = ImageAttributes;
+    ImageDescriptor->Compatibilities             = 0;
+    ImageDescriptor->LowestSupportedImageVersion = MicrocodeEntryPoint->UpdateRevision; // do not support rollback
+    ImageDescriptor->LastAttemptVersion          = 0;
+    ImageDescriptor->LastAttemptStatus           = 0;
+    ImageDescriptor->HardwareInstance            = 0;
+  }
+}
+
+/**
+  Free the Microcode descriptors after a failed initialization, so that the
+  next initialization does not reuse them.
+
+  @param[in] MicrocodeFmpPrivate private data structure.
+**/
+VOID
+FreeMicrocodeDescriptor (
+  IN MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate
+  )
+{
+  if (MicrocodeFmpPrivate->ImageDescriptor != NULL) {
+    FreePool (MicrocodeFmpPrivate->ImageDescriptor);
+    MicrocodeFmpPrivate->ImageDescriptor = NULL;
+  }
+
+  if (MicrocodeFmpPrivate->MicrocodeInfo != NULL) {
+    FreePool (MicrocodeFmpPrivate->MicrocodeInfo);
+    MicrocodeFmpPrivate->MicrocodeInfo = NULL;
+  }
+
+  if (MicrocodeFmpPrivate->MicrocodePatchIndex != NULL) {
+    FreePool (MicrocodeFmpPrivate->MicrocodePatchIndex);
+    MicrocodeFmpPrivate->MicrocodePatchIndex = NULL;
+  }
+
+  MicrocodeFmpPrivate->MicrocodePatchIndexCount = 0;
+  MicrocodeFmpPrivate->DescriptorCount          = 0;
 }
 
 /**
@@ -680,24 +970,28 @@ InitializeMicrocodeDescriptor (
   IN MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate
   )
 {
-  EFI_STATUS  Status;
-  UINT8       CurrentMicrocodeCount;
+  EFI_STATUS      Status;
+  UINT8           CurrentMicrocodeCount;
+  MICROCODE_INFO  *OldMicrocodeInfo;
+  UINTN           OldMicrocodeCount;
+
+  CurrentMicrocodeCount = (UINT8)GetMicrocodeInfo (MicrocodeFmpPrivate, 0, NULL);
 
-  CurrentMicrocodeCount = (UINT8)GetMicrocodeInfo (MicrocodeFmpPrivate, 0, NULL, NULL);
+  //
+  // Keep the previous Microcode information, so that the patches outside of
+  // the dirty region are not verified again.
+  //
+  OldMicrocodeInfo                   = MicrocodeFmpPrivate->MicrocodeInfo;
+  OldMicrocodeCount                  = MicrocodeFmpPrivate->DescriptorCount;
+  MicrocodeFmpPrivate->MicrocodeInfo = NULL;
 
   if (CurrentMicrocodeCount > MicrocodeFmpPrivate->DescriptorCount) {
     if (MicrocodeFmpPrivate->ImageDescriptor != NULL) {
       FreePool (MicrocodeFmpPrivate->ImageDescriptor);
       MicrocodeFmpPrivate->ImageDescriptor = NULL;
     }
-
-    if (MicrocodeFmpPrivate->MicrocodeInfo != NULL) {
-      FreePool (MicrocodeFmpPrivate->MicrocodeInfo);
-      MicrocodeFmpPrivate->MicrocodeInfo = NULL;
-    }
   } else {
     ZeroMem (MicrocodeFmpPrivate->ImageDescriptor, MicrocodeFmpPrivate->DescriptorCount * sizeof (EFI_FIRMWARE_IMAGE_DESCRIPTOR));
-    ZeroMem (MicrocodeFmpPrivate->MicrocodeInfo, MicrocodeFmpPrivate->DescriptorCount * sizeof (MICROCODE_INFO));
   }
 
   MicrocodeFmpPrivate->DescriptorCount = CurrentMicrocodeCount;
@@ -705,27 +999,47 @@ InitializeMicrocodeDescriptor (
   if (MicrocodeFmpPrivate->ImageDescriptor == NULL) {
     MicrocodeFmpPrivate->ImageDescriptor = AllocateZeroPool (MicrocodeFmpPrivate->DescriptorCount * sizeof (EFI_FIRMWARE_IMAGE_DESCRIPTOR));
     if (MicrocodeFmpPrivate->ImageDescriptor == NULL) {
+      if (OldMicrocodeInfo != NULL) {
+        FreePool (OldMicrocodeInfo);
+      }
+
+      FreeMicrocodeDescriptor (MicrocodeFmpPrivate);
       return EFI_OUT_OF_RESOURCES;
     }
   }
 
+  MicrocodeFmpPrivate->MicrocodeInfo = AllocateZeroPool (MicrocodeFmpPrivate->DescriptorCount * sizeof (MICROCODE_INFO));
   if (MicrocodeFmpPrivate->MicrocodeInfo == NULL) {
-    MicrocodeFmpPrivate->MicrocodeInfo = AllocateZeroPool (MicrocodeFmpPrivate->DescriptorCount * sizeof (MICROCODE_INFO));
-    if (MicrocodeFmpPrivate->MicrocodeInfo == NULL) {
-      FreePool (MicrocodeFmpPrivate->ImageDescriptor);
-      return EFI_OUT_OF_RESOURCES;
+    FreeMicrocodeDescriptor (MicrocodeFmpPrivate);
+    if (OldMicrocodeInfo != NULL) {
+      FreePool (OldMicrocodeInfo);
     }
+
+    return EFI_OUT_OF_RESOURCES;
   }
 
-  CurrentMicrocodeCount = (UINT8)GetMicrocodeInfo (MicrocodeFmpPrivate, MicrocodeFmpPrivate->DescriptorCount, MicrocodeFmpPrivate->ImageDescriptor, MicrocodeFmpPrivate->MicrocodeInfo);
+  CurrentMicrocodeCount = (UINT8)GetMicrocodeInfo (MicrocodeFmpPrivate, MicrocodeFmpPrivate->DescriptorCount, MicrocodeFmpPrivate->MicrocodeInfo);
   ASSERT (CurrentMicrocodeCount == MicrocodeFmpPrivate->DescriptorCount);
 
+  Status = BuildMicrocodePatchIndex (MicrocodeFmpPrivate, OldMicrocodeInfo, OldMicrocodeCount);
+  if (OldMicrocodeInfo != NULL) {
+    FreePool (OldMicrocodeInfo);
+  }
+
+  MicrocodeFmpPrivate->DirtyRegionBase = 0;
+  MicrocodeFmpPrivate->DirtyRegionSize = 0;
+  if (EFI_ERROR (Status)) {
+    FreeMicrocodeDescriptor (MicrocodeFmpPrivate);
+    DEBUG ((DEBUG_ERROR, "BuildMicrocodePatchIndex - %r\n", Status));
+    return Status;
+  }
+
   InitializedProcessorMicrocodeIndex (MicrocodeFmpPrivate);
+  InitializeImageDescriptor (MicrocodeFmpPrivate);
 
   Status = InitializeFitMicrocodeInfo (MicrocodeFmpPrivate);
   if (EFI_ERROR (Status)) {
-    FreePool (MicrocodeFmpPrivate->ImageDescriptor);
-    FreePool (MicrocodeFmpPrivate->MicrocodeInfo);
+    FreeMicrocodeDescriptor (MicrocodeFmpPrivate);
     DEBUG ((DEBUG_ERROR, "InitializeFitMicrocodeInfo - %r\n", Status));
     return Status;
   }
@@ -746,12 +1060,17 @@ InitializeProcessorInfo (
   IN MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate
   )
 {
-  EFI_STATUS                Status;
-  EFI_MP_SERVICES_PROTOCOL  *MpService;
-  UINTN                     NumberOfProcessors;
-  UINTN                     NumberOfEnabledProcessors;
-  UINTN                     Index;
-  UINTN                     BspIndex;
+  EFI_STATUS                 Status;
+  EFI_MP_SERVICES_PROTOCOL   *MpService;
+  UINTN                      NumberOfProcessors;
+  UINTN                      NumberOfEnabledProcessors;
+  UINTN                      Index;
+  UINTN                      BspIndex;
+  UINTN                      ClassIndex;
+  UINTN                      SiblingIndex;
+  PROCESSOR_INFO             *ProcessorInfo;
+  PROCESSOR_CLASS_INFO       *ProcessorClassInfo;
+  EFI_PROCESSOR_INFORMATION  ProcessorInformation;
 
   Status = gBS->LocateProtocol (&gEfiMpServiceProtocolGuid, NULL, (VOID **)&MpService);
   ASSERT_EFI_ERROR (Status);
@@ -790,6 +1109,65 @@ InitializeProcessorInfo (
                             );
       ASSERT_EFI_ERROR (Status);
     }
+
+    Status = MpService->GetProcessorInfo (MpService, Index, &ProcessorInformation);
+    ASSERT_EFI_ERROR (Status);
+    MicrocodeFmpPrivate->ProcessorInfo[Index].Location = ProcessorInformation.Location;
+
+    //
+    // Threads of one core share the Microcode. The first enabled thread
+    // loads a new Microcode for the whole core.
+    //
+    MicrocodeFmpPrivate->ProcessorInfo[Index].FirstThreadInCore = FALSE;
+    if ((ProcessorInformation.StatusFlag & PROCESSOR_ENABLED_BIT) != 0) {
+      for (SiblingIndex = 0; SiblingIndex < Index; SiblingIndex++) {
+        ProcessorInfo = &MicrocodeFmpPrivate->ProcessorInfo[SiblingIndex];
+        if (ProcessorInfo->FirstThreadInCore &&
+            (ProcessorInfo->Location.Package == ProcessorInformation.Location.Package) &&
+            (ProcessorInfo->Location.Core == ProcessorInformation.Location.Core))
+        {
+          break;
+        }
+      }
+
+      MicrocodeFmpPrivate->ProcessorInfo[Index].FirstThreadInCore = (BOOLEAN)(SiblingIndex == Index);
+    }
+  }
+
+  //
+  // Group the processors, so that Microcode matching is done once for all
+  // processors of the same signature, platform ID and Microcode revision.
+  //
+  MicrocodeFmpPrivate->ProcessorClassCount = 0;
+  MicrocodeFmpPrivate->ProcessorClassInfo  = AllocateZeroPool (sizeof (PROCESSOR_CLASS_INFO) * MicrocodeFmpPrivate->ProcessorCount);
+  if (MicrocodeFmpPrivate->ProcessorClassInfo == NULL) {
+    FreePool (MicrocodeFmpPrivate->ProcessorInfo);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  for (Index = 0; Index < NumberOfProcessors; Index++) {
+    ProcessorInfo = &MicrocodeFmpPrivate->ProcessorInfo[Index];
+    for (ClassIndex = 0; ClassIndex < MicrocodeFmpPrivate->ProcessorClassCount; ClassIndex++) {
+      ProcessorClassInfo = &MicrocodeFmpPrivate->ProcessorClassInfo[ClassIndex];
+      if ((ProcessorClassInfo->ProcessorSignature == ProcessorInfo->ProcessorSignature) &&
+          (ProcessorClassInfo->PlatformId == ProcessorInfo->PlatformId) &&
+          (ProcessorClassInfo->MicrocodeRevision == ProcessorInfo->MicrocodeRevision))
+      {
+        break;
+      }
+    }
+
+    if (ClassIndex == MicrocodeFmpPrivate->ProcessorClassCount) {
+      ProcessorClassInfo                     = &MicrocodeFmpPrivate->ProcessorClassInfo[ClassIndex];
+      ProcessorClassInfo->ProcessorSignature = ProcessorInfo->ProcessorSignature;
+      ProcessorClassInfo->PlatformId         = ProcessorInfo->PlatformId;
+      ProcessorClassInfo->MicrocodeRevision  = ProcessorInfo->MicrocodeRevision;
+      ProcessorClassInfo->CpuIndex           = Index;
+      ProcessorClassInfo->MicrocodeIndex     = (UINTN)-1;
+      MicrocodeFmpPrivate->ProcessorClassCount++;
+    }
+
+    ProcessorInfo->ClassIndex = ClassIndex;
   }
 
   return EFI_SUCCESS;
@@ -814,17 +1192,22 @@ DumpPrivateInfo (
   DEBUG ((DEBUG_INFO, "ProcessorInfo:\n"));
   DEBUG ((DEBUG_INFO, "  ProcessorCount - 0x%x\n", MicrocodeFmpPrivate->ProcessorCount));
   DEBUG ((DEBUG_INFO, "  BspIndex - 0x%x\n", MicrocodeFmpPrivate->BspIndex));
+  DEBUG ((DEBUG_INFO, "  ProcessorClassCount - 0x%x\n", MicrocodeFmpPrivate->ProcessorClassCount));
 
   ProcessorInfo = MicrocodeFmpPrivate->ProcessorInfo;
   for (Index = 0; Index < MicrocodeFmpPrivate->ProcessorCount; Index++) {
     DEBUG ((
       DEBUG_INFO,
-      "  ProcessorInfo[0x%x] - 0x%08x, 0x%02x, 0x%08x, (0x%x)\n",
+      "  ProcessorInfo[0x%x] - 0x%08x, 0x%02x, 0x%08x, (0x%x), %x/%x/%x%a\n",
       ProcessorInfo[Index].CpuIndex,
       ProcessorInfo[Index].ProcessorSignature,
       ProcessorInfo[Index].PlatformId,
       ProcessorInfo[Index].MicrocodeRevision,
-      ProcessorInfo[Index].MicrocodeIndex
+      ProcessorInfo[Index].MicrocodeIndex,
+      ProcessorInfo[Index].Location.Package,
+      ProcessorInfo[Index].Location.Core,
+      ProcessorInfo[Index].Location.Thread,
+      ProcessorInfo[Index].FirstThreadInCore ? "" : " (sibling)"
       ));
   }
 
@@ -832,6 +1215,7 @@ DumpPrivateInfo (
   MicrocodeInfo = MicrocodeFmpPrivate->MicrocodeInfo;
   DEBUG ((DEBUG_INFO, "  MicrocodeRegion - 0x%x - 0x%x\n", MicrocodeFmpPrivate->MicrocodePatchAddress, MicrocodeFmpPrivate->MicrocodePatchRegionSize));
   DEBUG ((DEBUG_INFO, "  MicrocodeCount - 0x%x\n", MicrocodeFmpPrivate->DescriptorCount));
+  DEBUG ((DEBUG_INFO, "  MicrocodePatchIndexCount - 0x%x\n", MicrocodeFmpPrivate->MicrocodePatchIndexCount));
   for (Index = 0; Index < MicrocodeFmpPrivate->DescriptorCount; Index++) {
     DEBUG ((
       DEBUG_INFO,
@@ -902,6 +1286,10 @@ InitializePrivateData (
   MicrocodeFmpPrivate->Handle    = NULL;
   CopyMem (&MicrocodeFmpPrivate->Fmp, &mFirmwareManagementProtocol, sizeof (EFI_FIRMWARE_MANAGEMENT_PROTOCOL));
 
+  if (MicrocodeFmpPrivate->FitPointerAddress == 0) {
+    MicrocodeFmpPrivate->FitPointerAddress = FIT_POINTER_ADDRESS;
+  }
+
   MicrocodeFmpPrivate->PackageVersion     = 0x1;
   MicrocodeFmpPrivate->PackageVersionName = L"Microcode";
 
@@ -933,6 +1321,7 @@ InitializePrivateData (
   Status = InitializeMicrocodeDescriptor (MicrocodeFmpPrivate);
   if (EFI_ERROR (Status)) {
     FreePool (MicrocodeFmpPrivate->ProcessorInfo);
+    FreePool (MicrocodeFmpPrivate->ProcessorClassInfo);
     DEBUG ((DEBUG_ERROR, "InitializeMicrocodeDescriptor - %r\n", Status));
     return Status;
   }
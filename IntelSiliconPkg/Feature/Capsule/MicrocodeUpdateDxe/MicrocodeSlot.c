@@ -0,0 +1,361 @@
+/** @file
+  A/B staged Microcode slot update.
+
+  Caution: This module requires additional review when modified.
+  This module will have external input - capsule image.
+  The image is expected to be verified by VerifyMicrocode() before a slot
+  update is initialized with it.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+
+#include "MicrocodeSlot.h"
+
+/**
+  Check whether a buffer is erased.
+
+  @param[in]  Buffer            The buffer.
+  @param[in]  Length            The size, in bytes, of Buffer.
+
+  @retval TRUE   Every byte of the buffer is 0xFF.
+  @retval FALSE  Some byte of the buffer is not 0xFF.
+**/
+BOOLEAN
+IsMicrocodeSlotErased (
+  IN CONST UINT8  *Buffer,
+  IN UINTN        Length
+  )
+{
+  UINTN  Index;
+
+  for (Index = 0; Index < Length; Index++) {
+    if (Buffer[Index] != 0xFF) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/**
+  Initialize an A/B Microcode slot update.
+
+  @param[out] Update            The slot update.
+  @param[in]  Flash             The flash that holds the slot.
+  @param[in]  SlotAddress       The flash address of the slot.
+  @param[in]  SlotSize          The size, in bytes, of the slot.
+  @param[in]  CommitSize        The size, in bytes, of the commit area. It must
+                                cover the Microcode header and is clipped to ImageSize.
+  @param[in]  Image             The Microcode image.
+  @param[in]  ImageSize         The size, in bytes, of Image.
+  @param[in]  UpdateRevision    The revision the load test must report.
+
+  @retval EFI_SUCCESS            The slot update is initialized.
+  @retval EFI_INVALID_PARAMETER  The image does not fit in the slot, or CommitSize is 0.
+  @retval EFI_OUT_OF_RESOURCES   There are not enough resources.
+**/
+EFI_STATUS
+InitMicrocodeSlotUpdate (
+  OUT MICROCODE_SLOT_UPDATE  *Update,
+  IN  MICROCODE_SLOT_FLASH   *Flash,
+  IN  UINTN                  SlotAddress,
+  IN  UINTN                  SlotSize,
+  IN  UINTN                  CommitSize,
+  IN  VOID                   *Image,
+  IN  UINTN                  ImageSize,
+  IN  UINT32                 UpdateRevision
+  )
+{
+  ZeroMem (Update, sizeof (*Update));
+
+  if ((ImageSize == 0) || (ImageSize > SlotSize) || (CommitSize == 0)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Update->Buffer = AllocatePages (EFI_SIZE_TO_PAGES (SlotSize));
+  if (Update->Buffer == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Update->State          = MicrocodeSlotIdle;
+  Update->Flash          = Flash;
+  Update->SlotAddress    = SlotAddress;
+  Update->SlotSize       = SlotSize;
+  Update->CommitSize     = MIN (CommitSize, ImageSize);
+  Update->Image          = Image;
+  Update->ImageSize      = ImageSize;
+  Update->UpdateRevision = UpdateRevision;
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Free the resources of an A/B Microcode slot update.
+
+  @param[in]  Update            The slot update.
+**/
+VOID
+FreeMicrocodeSlotUpdate (
+  IN MICROCODE_SLOT_UPDATE  *Update
+  )
+{
+  if (Update->Buffer != NULL) {
+    FreePages (Update->Buffer, EFI_SIZE_TO_PAGES (Update->SlotSize));
+    Update->Buffer = NULL;
+  }
+}
+
+/**
+  Write the new Microcode to the slot, except for the commit area.
+
+  The commit area is written as 0xFF, so a Microcode left in the slot stops
+  being valid, and the slot stays empty until the update is committed.
+
+  @param[in]  Update            The slot update.
+
+  @retval EFI_SUCCESS           The slot is staged.
+  @retval EFI_NOT_READY         The slot update is not in the Idle state.
+  @retval Others                The slot cannot be written.
+**/
+EFI_STATUS
+MicrocodeSlotStage (
+  IN MICROCODE_SLOT_UPDATE  *Update
+  )
+{
+  EFI_STATUS  Status;
+  UINT8       *Buffer;
+
+  if (Update->State != MicrocodeSlotIdle) {
+    return EFI_NOT_READY;
+  }
+
+  Buffer = Update->Buffer;
+  SetMem (Buffer, Update->SlotSize, 0xFF);
+  CopyMem (
+    Buffer + Update->CommitSize,
+    (UINT8 *)Update->Image + Update->CommitSize,
+    Update->ImageSize - Update->CommitSize
+    );
+
+  Update->Written = TRUE;
+  Status          = Update->Flash->Write (Update->Flash->Context, Update->SlotAddress, Buffer, Update->SlotSize);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "MicrocodeSlotStage: Fail to write slot 0x%x - %r\n", Update->SlotAddress, Status));
+    return Status;
+  }
+
+  Update->State = MicrocodeSlotStaged;
+  return EFI_SUCCESS;
+}
+
+/**
+  Read the staged slot back and compare it with the new Microcode.
+
+  @param[in]  Update            The slot update.
+
+  @retval EFI_SUCCESS           The slot matches.
+  @retval EFI_NOT_READY         The slot update is not in the Staged state.
+  @retval EFI_VOLUME_CORRUPTED  The slot does not match.
+  @retval Others                The slot cannot be read.
+**/
+EFI_STATUS
+MicrocodeSlotVerify (
+  IN MICROCODE_SLOT_UPDATE  *Update
+  )
+{
+  EFI_STATUS  Status;
+  UINT8       *Buffer;
+
+  if (Update->State != MicrocodeSlotStaged) {
+    return EFI_NOT_READY;
+  }
+
+  Buffer = Update->Buffer;
+  Status = Update->Flash->Read (Update->Flash->Context, Update->SlotAddress, Buffer, Update->SlotSize);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if (!IsMicrocodeSlotErased (Buffer, Update->CommitSize) ||
+      (CompareMem (
+         Buffer + Update->CommitSize,
+         (UINT8 *)Update->Image + Update->CommitSize,
+         Update->ImageSize - Update->CommitSize
+         ) != 0) ||
+      !IsMicrocodeSlotErased (Buffer + Update->ImageSize, Update->SlotSize - Update->ImageSize))
+  {
+    DEBUG ((DEBUG_ERROR, "MicrocodeSlotVerify: Slot 0x%x does not match the new microcode\n", Update->SlotAddress));
+    return EFI_VOLUME_CORRUPTED;
+  }
+
+  Update->State = MicrocodeSlotVerified;
+  return EFI_SUCCESS;
+}
+
+/**
+  Load the staged Microcode, as read back from flash, on the test processor.
+
+  The commit area is not on flash yet, so it is taken from the image. The
+  rest of the loaded copy is the data read back by MicrocodeSlotVerify().
+
+  @param[in]  Update            The slot update.
+
+  @retval EFI_SUCCESS             The test processor reports the new revision.
+  @retval EFI_NOT_READY           The slot update is not in the Verified state.
+  @retval EFI_SECURITY_VIOLATION  The test processor rejects the Microcode.
+**/
+EFI_STATUS
+MicrocodeSlotLoadTest (
+  IN MICROCODE_SLOT_UPDATE  *Update
+  )
+{
+  UINT32  Revision;
+
+  if (Update->State != MicrocodeSlotVerified) {
+    return EFI_NOT_READY;
+  }
+
+  CopyMem (Update->Buffer, Update->Image, Update->CommitSize);
+  Revision = Update->Flash->LoadTest (Update->Flash->Context, Update->Buffer, Update->ImageSize);
+  if (Revision != Update->UpdateRevision) {
+    DEBUG ((
+      DEBUG_ERROR,
+      "MicrocodeSlotLoadTest: Revision 0x%08x, expected 0x%08x\n",
+      Revision,
+      Update->UpdateRevision
+      ));
+    return EFI_SECURITY_VIOLATION;
+  }
+
+  Update->State = MicrocodeSlotTested;
+  return EFI_SUCCESS;
+}
+
+/**
+  Write the commit area, which activates the new Microcode.
+
+  @param[in]  Update            The slot update.
+
+  @retval EFI_SUCCESS           The update is committed.
+  @retval EFI_NOT_READY         The slot update is not in the Tested state.
+  @retval EFI_DEVICE_ERROR      The commit area does not read back correctly.
+  @retval Others                The commit area cannot be written.
+**/
+EFI_STATUS
+MicrocodeSlotCommit (
+  IN MICROCODE_SLOT_UPDATE  *Update
+  )
+{
+  EFI_STATUS  Status;
+
+  if (Update->State != MicrocodeSlotTested) {
+    return EFI_NOT_READY;
+  }
+
+  Status = Update->Flash->Write (Update->Flash->Context, Update->SlotAddress, Update->Image, Update->CommitSize);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "MicrocodeSlotCommit: Fail to write slot 0x%x - %r\n", Update->SlotAddress, Status));
+    return Status;
+  }
+
+  Status = Update->Flash->Read (Update->Flash->Context, Update->SlotAddress, Update->Buffer, Update->CommitSize);
+  if (EFI_ERROR (Status) || (CompareMem (Update->Buffer, Update->Image, Update->CommitSize) != 0)) {
+    DEBUG ((DEBUG_ERROR, "MicrocodeSlotCommit: Slot 0x%x does not read back\n", Update->SlotAddress));
+    return EFI_DEVICE_ERROR;
+  }
+
+  DEBUG ((DEBUG_INFO, "MicrocodeSlotCommit: Revision 0x%08x committed at 0x%x\n", Update->UpdateRevision, Update->SlotAddress));
+  Update->State = MicrocodeSlotCommitted;
+  return EFI_SUCCESS;
+}
+
+/**
+  Roll the slot update back.
+
+  The commit area is erased first, so the slot stops being a Microcode with
+  one write, and then the rest of the slot is erased.
+
+  @param[in]  Update            The slot update.
+
+  @retval EFI_SUCCESS           The slot is erased.
+  @retval EFI_NOT_READY         Nothing has been written to the slot.
+  @retval Others                The slot cannot be erased.
+**/
+EFI_STATUS
+MicrocodeSlotRollback (
+  IN MICROCODE_SLOT_UPDATE  *Update
+  )
+{
+  EFI_STATUS  Status;
+
+  if (!Update->Written || (Update->State == MicrocodeSlotRolledBack)) {
+    return EFI_NOT_READY;
+  }
+
+  DEBUG ((DEBUG_INFO, "MicrocodeSlotRollback: Erase slot 0x%x in state %d\n", Update->SlotAddress, Update->State));
+
+  SetMem (Update->Buffer, Update->SlotSize, 0xFF);
+  Status = Update->Flash->Write (Update->Flash->Context, Update->SlotAddress, Update->Buffer, Update->CommitSize);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Status = Update->Flash->Write (
+                            Update->Flash->Context,
+                            Update->SlotAddress + Update->CommitSize,
+                            Update->Buffer,
+                            Update->SlotSize - Update->CommitSize
+                            );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Update->State = MicrocodeSlotRolledBack;
+  return EFI_SUCCESS;
+}
+
+/**
+  Stage, verify, load-test and commit a slot update, and roll it back if
+  any of the steps fails.
+
+  @param[in]  Update            The slot update.
+
+  @retval EFI_SUCCESS           The update is committed.
+  @retval Others                The status of the failed step. The slot is rolled back.
+**/
+EFI_STATUS
+MicrocodeSlotRun (
+  IN MICROCODE_SLOT_UPDATE  *Update
+  )
+{
+  EFI_STATUS  Status;
+
+  Status = MicrocodeSlotStage (Update);
+  if (!EFI_ERROR (Status)) {
+    Status = MicrocodeSlotVerify (Update);
+  }
+
+  if (!EFI_ERROR (Status)) {
+    Status = MicrocodeSlotLoadTest (Update);
+  }
+
+  if (!EFI_ERROR (Status)) {
+    Status = MicrocodeSlotCommit (Update);
+  }
+
+  if (EFI_ERROR (Status) && Update->Written) {
+    if (EFI_ERROR (MicrocodeSlotRollback (Update))) {
+      DEBUG ((DEBUG_ERROR, "MicrocodeSlotRun: Fail to roll back slot 0x%x\n", Update->SlotAddress));
+    }
+  }
+
+  return Status;
+}
@@ -0,0 +1,250 @@
+/** @file
+  A/B staged Microcode slot update.
+
+  A new Microcode is written to a slot other than the one in use. The slot
+  is written without its leading commit area, which holds the Microcode
+  header, so it stays an empty slot until the update is committed. The
+  staged slot is read back and verified, and the exact bytes on flash are
+  load-tested on one processor before the commit area is written. Writing
+  the commit area is the single step that activates the new Microcode, and
+  erasing it again rolls the update back. The Microcode in the other slot
+  is never touched and stays available as the rollback copy.
+
+  The state machine only accesses flash through MICROCODE_SLOT_FLASH, so it
+  can run against a simulated flash.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef _MICROCODE_SLOT_H_
+#define _MICROCODE_SLOT_H_
+
+typedef enum {
+  MicrocodeSlotIdle,
+  MicrocodeSlotStaged,
+  MicrocodeSlotVerified,
+  MicrocodeSlotTested,
+  MicrocodeSlotCommitted,
+  MicrocodeSlotRolledBack
+} MICROCODE_SLOT_STATE;
+
+/**
+  Write a range of flash.
+
+  @param[in]  Context       The context of the flash.
+  @param[in]  Address       The flash address to write.
+  @param[in]  Buffer        The data to write.
+  @param[in]  Length        The size, in bytes, of Buffer.
+
+  @retval EFI_SUCCESS       The range is written.
+  @retval Others            The range may be partially written.
+**/
+typedef
+EFI_STATUS
+(*MICROCODE_SLOT_WRITE)(
+  IN VOID   *Context,
+  IN UINTN  Address,
+  IN VOID   *Buffer,
+  IN UINTN  Length
+  );
+
+/**
+  Read a range of flash.
+
+  @param[in]  Context       The context of the flash.
+  @param[in]  Address       The flash address to read.
+  @param[out] Buffer        The buffer to receive the data.
+  @param[in]  Length        The size, in bytes, of Buffer.
+
+  @retval EFI_SUCCESS       The range is read.
+  @retval Others            The range cannot be read.
+**/
+typedef
+EFI_STATUS
+(*MICROCODE_SLOT_READ)(
+  IN  VOID   *Context,
+  IN  UINTN  Address,
+  OUT VOID   *Buffer,
+  IN  UINTN  Length
+  );
+
+/**
+  Load a Microcode on the test processor.
+
+  @param[in]  Context       The context of the flash.
+  @param[in]  Image         The Microcode image. It is 16 bytes aligned.
+  @param[in]  ImageSize     The size, in bytes, of Image.
+
+  @return The Microcode revision of the test processor after the load.
+**/
+typedef
+UINT32
+(*MICROCODE_SLOT_LOAD_TEST)(
+  IN VOID   *Context,
+  IN VOID   *Image,
+  IN UINTN  ImageSize
+  );
+
+typedef struct {
+  MICROCODE_SLOT_WRITE        Write;
+  MICROCODE_SLOT_READ         Read;
+  MICROCODE_SLOT_LOAD_TEST    LoadTest;
+  VOID                        *Context;
+} MICROCODE_SLOT_FLASH;
+
+typedef struct {
+  MICROCODE_SLOT_STATE    State;
+  MICROCODE_SLOT_FLASH    *Flash;
+  UINTN                   SlotAddress;
+  //
+  // The slot size, including the 0xFF padding behind the Microcode.
+  //
+  UINTN                   SlotSize;
+  //
+  // The leading part of the slot written last to commit the update.
+  //
+  UINTN                   CommitSize;
+  VOID                    *Image;
+  UINTN                   ImageSize;
+  UINT32                  UpdateRevision;
+  //
+  // Set once the slot has been written, even if the write failed.
+  //
+  BOOLEAN                 Written;
+  //
+  // A page aligned buffer of SlotSize bytes.
+  //
+  VOID                    *Buffer;
+} MICROCODE_SLOT_UPDATE;
+
+/**
+  Initialize an A/B Microcode slot update.
+
+  @param[out] Update            The slot update.
+  @param[in]  Flash             The flash that holds the slot.
+  @param[in]  SlotAddress       The flash address of the slot.
+  @param[in]  SlotSize          The size, in bytes, of the slot.
+  @param[in]  CommitSize        The size, in bytes, of the commit area. It must
+                                cover the Microcode header and is clipped to ImageSize.
+  @param[in]  Image             The Microcode image.
+  @param[in]  ImageSize         The size, in bytes, of Image.
+  @param[in]  UpdateRevision    The revision the load test must report.
+
+  @retval EFI_SUCCESS            The slot update is initialized.
+  @retval EFI_INVALID_PARAMETER  The image does not fit in the slot, or CommitSize is 0.
+  @retval EFI_OUT_OF_RESOURCES   There are not enough resources.
+**/
+EFI_STATUS
+InitMicrocodeSlotUpdate (
+  OUT MICROCODE_SLOT_UPDATE  *Update,
+  IN  MICROCODE_SLOT_FLASH   *Flash,
+  IN  UINTN                  SlotAddress,
+  IN  UINTN                  SlotSize,
+  IN  UINTN                  CommitSize,
+  IN  VOID                   *Image,
+  IN  UINTN                  ImageSize,
+  IN  UINT32                 UpdateRevision
+  );
+
+/**
+  Free the resources of an A/B Microcode slot update.
+
+  @param[in]  Update            The slot update.
+**/
+VOID
+FreeMicrocodeSlotUpdate (
+  IN MICROCODE_SLOT_UPDATE  *Update
+  );
+
+/**
+  Write the new Microcode to the slot, except for the commit area.
+
+  @param[in]  Update            The slot update.
+
+  @retval EFI_SUCCESS           The slot is staged.
+  @retval EFI_NOT_READY         The slot update is not in the Idle state.
+  @retval Others                The slot cannot be written.
+**/
+EFI_STATUS
+MicrocodeSlotStage (
+  IN MICROCODE_SLOT_UPDATE  *Update
+  );
+
+/**
+  Read the staged slot back and compare it with the new Microcode.
+
+  @param[in]  Update            The slot update.
+
+  @retval EFI_SUCCESS           The slot matches.
+  @retval EFI_NOT_READY         The slot update is not in the Staged state.
+  @retval EFI_VOLUME_CORRUPTED  The slot does not match.
+  @retval Others                The slot cannot be read.
+**/
+EFI_STATUS
+MicrocodeSlotVerify (
+  IN MICROCODE_SLOT_UPDATE  *Update
+  );
+
+/**
+  Load the staged Microcode, as read back from flash, on the test processor.
+
+  @param[in]  Update            The slot update.
+
+  @retval EFI_SUCCESS             The test processor reports the new revision.
+  @retval EFI_NOT_READY           The slot update is not in the Verified state.
+  @retval EFI_SECURITY_VIOLATION  The test processor rejects the Microcode.
+**/
+EFI_STATUS
+MicrocodeSlotLoadTest (
+  IN MICROCODE_SLOT_UPDATE  *Update
+  );
+
+/**
+  Write the commit area, which activates the new Microcode.
+
+  @param[in]  Update            The slot update.
+
+  @retval EFI_SUCCESS           The update is committed.
+  @retval EFI_NOT_READY         The slot update is not in the Tested state.
+  @retval EFI_DEVICE_ERROR      The commit area does not read back correctly.
+  @retval Others                The commit area cannot be written.
+**/
+EFI_STATUS
+MicrocodeSlotCommit (
+  IN MICROCODE_SLOT_UPDATE  *Update
+  );
+
+/**
+  Roll the slot update back.
+
+  The commit area is erased first, so the slot stops being a Microcode with
+  one write, and then the rest of the slot is erased.
+
+  @param[in]  Update            The slot update.
+
+  @retval EFI_SUCCESS           The slot is erased.
+  @retval EFI_NOT_READY         Nothing has been written to the slot.
+  @retval Others                The slot cannot be erased.
+**/
+EFI_STATUS
+MicrocodeSlotRollback (
+  IN MICROCODE_SLOT_UPDATE  *Update
+  );
+
+/**
+  Stage, verify, load-test and commit a slot update, and roll it back if
+  any of the steps fails.
+
+  @param[in]  Update            The slot update.
+
+  @retval EFI_SUCCESS           The update is committed.
+  @retval Others                The status of the failed step. The slot is rolled back.
+**/
+EFI_STATUS
+MicrocodeSlotRun (
+  IN MICROCODE_SLOT_UPDATE  *Update
+  );
+
+#endif
@@ -167,6 +167,215 @@ LoadMicrocodeOnThis (
   }
 }
 
+/**
+  Load Microcode on an Application Processor as part of a parallel load.
+  The function prototype for invoking a function on an Application Processor.
+
+  @param[in,out] Buffer  The pointer to private data buffer.
+**/
+VOID
+EFIAPI
+MicrocodeLoadAllAp (
+  IN OUT VOID  *Buffer
+  )
+{
+  EFI_STATUS                 Status;
+  MICROCODE_LOAD_ALL_BUFFER  *MicrocodeLoadAllBuffer;
+  UINTN                      CpuIndex;
+
+  MicrocodeLoadAllBuffer = Buffer;
+  Status                 = MicrocodeLoadAllBuffer->MpService->WhoAmI (MicrocodeLoadAllBuffer->MpService, &CpuIndex);
+  if (EFI_ERROR (Status) || !MicrocodeLoadAllBuffer->Result[CpuIndex].Load) {
+    return;
+  }
+
+  MicrocodeLoadAllBuffer->Result[CpuIndex].Revision = LoadMicrocode (MicrocodeLoadAllBuffer->Address);
+}
+
+/**
+  Load a verified Microcode on every core it applies to.
+
+  The Application Processors are started in non-blocking mode and the BSP
+  loads its own core while they run. Only the first thread of each core of
+  a processor class that matches the Microcode loads it. The loaded revision
+  of every such thread is collected and only the mismatches are reported.
+
+  @param[in]  MicrocodeFmpPrivate        The Microcode driver private data
+  @param[in]  Image                      The Microcode image buffer. It must be 16 bytes aligned.
+  @param[in]  ImageSize                  The size of Microcode image buffer in bytes.
+
+  @retval EFI_SUCCESS               The Microcode is loaded on all the selected cores.
+  @retval EFI_NOT_FOUND             No core needs the Microcode.
+  @retval EFI_OUT_OF_RESOURCES      There are not enough resources.
+  @retval EFI_DEVICE_ERROR          The Microcode revision of some cores does not match after the load.
+**/
+EFI_STATUS
+LoadMicrocodeOnAllProcessors (
+  IN  MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate,
+  IN  VOID                        *Image,
+  IN  UINTN                       ImageSize
+  )
+{
+  EFI_STATUS                 Status;
+  EFI_MP_SERVICES_PROTOCOL   *MpService;
+  CPU_MICROCODE_HEADER       *MicrocodeEntryPoint;
+  PROCESSOR_INFO             *ProcessorInfo;
+  PROCESSOR_CLASS_INFO       *ProcessorClassInfo;
+  BOOLEAN                    *ClassMatched;
+  MICROCODE_LOAD_RESULT      *Result;
+  MICROCODE_LOAD_ALL_BUFFER  MicrocodeLoadAllBuffer;
+  EFI_EVENT                  WaitEvent;
+  UINTN                      EventIndex;
+  UINTN                      Index;
+  UINTN                      CpuIndex;
+  UINTN                      LoadCount;
+  UINTN                      MismatchCount;
+  UINT32                     LastAttemptStatus;
+
+  MpService           = MicrocodeFmpPrivate->MpService;
+  MicrocodeEntryPoint = Image;
+  ProcessorInfo       = MicrocodeFmpPrivate->ProcessorInfo;
+
+  //
+  // Match the Microcode once per processor class. A class already running
+  // this revision or a newer one is left alone.
+  //
+  ClassMatched = AllocateZeroPool (sizeof (BOOLEAN) * MicrocodeFmpPrivate->ProcessorClassCount);
+  Result       = AllocateZeroPool (sizeof (MICROCODE_LOAD_RESULT) * MicrocodeFmpPrivate->ProcessorCount);
+  if ((ClassMatched == NULL) || (Result == NULL)) {
+    if (ClassMatched != NULL) {
+      FreePool (ClassMatched);
+    }
+
+    if (Result != NULL) {
+      FreePool (Result);
+    }
+
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  for (Index = 0; Index < MicrocodeFmpPrivate->ProcessorClassCount; Index++) {
+    ProcessorClassInfo = &MicrocodeFmpPrivate->ProcessorClassInfo[Index];
+    if (ProcessorClassInfo->MicrocodeRevision >= MicrocodeEntryPoint->UpdateRevision) {
+      continue;
+    }
+
+    CpuIndex            = ProcessorClassInfo->CpuIndex;
+    Status              = VerifyMicrocode (MicrocodeFmpPrivate, Image, ImageSize, FALSE, &LastAttemptStatus, NULL, &CpuIndex);
+    ClassMatched[Index] = (BOOLEAN)!EFI_ERROR (Status);
+  }
+
+  LoadCount = 0;
+  for (Index = 0; Index < MicrocodeFmpPrivate->ProcessorCount; Index++) {
+    if (ProcessorInfo[Index].FirstThreadInCore && ClassMatched[ProcessorInfo[Index].ClassIndex]) {
+      Result[Index].Load = TRUE;
+      LoadCount++;
+    }
+  }
+
+  FreePool (ClassMatched);
+
+  if (LoadCount == 0) {
+    FreePool (Result);
+    return EFI_NOT_FOUND;
+  }
+
+  MicrocodeLoadAllBuffer.MpService = MpService;
+  MicrocodeLoadAllBuffer.Address   = (UINTN)MicrocodeEntryPoint + sizeof (CPU_MICROCODE_HEADER);
+  MicrocodeLoadAllBuffer.Result    = Result;
+
+  //
+  // Start all the Application Processors together without waiting for them,
+  // so that the BSP can load its own core at the same time. Fall back to a
+  // blocking call if the non-blocking mode cannot be used.
+  //
+  Status = gBS->CreateEvent (0, TPL_CALLBACK, NULL, NULL, &WaitEvent);
+  if (EFI_ERROR (Status)) {
+    WaitEvent = NULL;
+  } else {
+    Status = MpService->StartupAllAPs (
+                          MpService,
+                          MicrocodeLoadAllAp,
+                          FALSE,
+                          WaitEvent,
+                          0,
+                          &MicrocodeLoadAllBuffer,
+                          NULL
+                          );
+    if (Status == EFI_UNSUPPORTED) {
+      gBS->CloseEvent (WaitEvent);
+      WaitEvent = NULL;
+    }
+  }
+
+  if (WaitEvent == NULL) {
+    Status = MpService->StartupAllAPs (
+                          MpService,
+                          MicrocodeLoadAllAp,
+                          FALSE,
+                          NULL,
+                          0,
+                          &MicrocodeLoadAllBuffer,
+                          NULL
+                          );
+  }
+
+  //
+  // EFI_NOT_STARTED means there is no enabled Application Processor.
+  //
+  if (EFI_ERROR (Status) && (Status != EFI_NOT_STARTED)) {
+    DEBUG ((DEBUG_ERROR, "LoadMicrocodeOnAllProcessors - StartupAllAPs - %r\n", Status));
+  }
+
+  if (Result[MicrocodeFmpPrivate->BspIndex].Load) {
+    Result[MicrocodeFmpPrivate->BspIndex].Revision = LoadMicrocode (MicrocodeLoadAllBuffer.Address);
+  }
+
+  if (WaitEvent != NULL) {
+    if (!EFI_ERROR (Status)) {
+      gBS->WaitForEvent (1, &WaitEvent, &EventIndex);
+    }
+
+    gBS->CloseEvent (WaitEvent);
+  }
+
+  //
+  // Summarize the result. Only the cores that did not end up with the new
+  // revision are reported one by one.
+  //
+  MismatchCount = 0;
+  for (Index = 0; Index < MicrocodeFmpPrivate->ProcessorCount; Index++) {
+    if (Result[Index].Load && (Result[Index].Revision != MicrocodeEntryPoint->UpdateRevision)) {
+      DEBUG ((
+        DEBUG_ERROR,
+        "  CPU 0x%x (Package 0x%x, Core 0x%x) - Revision 0x%08x, expected 0x%08x\n",
+        Index,
+        ProcessorInfo[Index].Location.Package,
+        ProcessorInfo[Index].Location.Core,
+        Result[Index].Revision,
+        MicrocodeEntryPoint->UpdateRevision
+        ));
+      MismatchCount++;
+    }
+  }
+
+  DEBUG ((
+    DEBUG_INFO,
+    "LoadMicrocodeOnAllProcessors - Revision 0x%08x loaded on 0x%x cores, 0x%x mismatched\n",
+    MicrocodeEntryPoint->UpdateRevision,
+    LoadCount,
+    MismatchCount
+    ));
+
+  FreePool (Result);
+
+  if (MismatchCount != 0) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  return EFI_SUCCESS;
+}
+
 /**
   Collect processor information.
   The function prototype for invoking a function on an Application Processor.
@@ -190,15 +399,14 @@ CollectProcessorInfo (
 /**
   Get current Microcode information.
 
-  The ProcessorInformation (BspIndex/ProcessorCount/ProcessorInfo)
-  in MicrocodeFmpPrivate must be initialized.
+  Only the Microcode headers are walked. The patches are not verified, so
+  InUse and Verified in MicrocodeInfo are left FALSE.
 
   The MicrocodeInformation (DescriptorCount/ImageDescriptor/MicrocodeInfo)
   in MicrocodeFmpPrivate may not be avaiable in this function.
 
   @param[in]   MicrocodeFmpPrivate        The Microcode driver private data
-  @param[in]   DescriptorCount            The count of Microcode ImageDescriptor allocated.
-  @param[out]  ImageDescriptor            Microcode ImageDescriptor
+  @param[in]   DescriptorCount            The count of Microcode information allocated.
   @param[out]  MicrocodeInfo              Microcode information
 
   @return Microcode count
@@ -207,7 +415,6 @@ UINTN
 GetMicrocodeInfo (
   IN  MICROCODE_FMP_PRIVATE_DATA *MicrocodeFmpPrivate,
   IN  UINTN DescriptorCount, OPTIONAL
-  OUT EFI_FIRMWARE_IMAGE_DESCRIPTOR  *ImageDescriptor, OPTIONAL
   OUT MICROCODE_INFO                 *MicrocodeInfo    OPTIONAL
   )
 {
@@ -217,11 +424,6 @@ GetMicrocodeInfo (
   UINTN                 MicrocodeEnd;
   UINTN                 TotalSize;
   UINTN                 Count;
-  UINT64                ImageAttributes;
-  BOOLEAN               IsInUse;
-  EFI_STATUS            Status;
-  UINT32                AttemptStatus;
-  UINTN                 TargetCpuIndex;
 
   MicrocodePatchAddress    = MicrocodeFmpPrivate->MicrocodePatchAddress;
   MicrocodePatchRegionSize = MicrocodeFmpPrivate->MicrocodePatchRegionSize;
@@ -245,42 +447,11 @@ GetMicrocodeInfo (
         TotalSize = MicrocodeEntryPoint->TotalSize;
       }
 
-      TargetCpuIndex = (UINTN)-1;
-      Status         = VerifyMicrocode (MicrocodeFmpPrivate, MicrocodeEntryPoint, TotalSize, FALSE, &AttemptStatus, NULL, &TargetCpuIndex);
-      if (!EFI_ERROR (Status)) {
-        IsInUse = TRUE;
-        ASSERT (TargetCpuIndex < MicrocodeFmpPrivate->ProcessorCount);
-        MicrocodeFmpPrivate->ProcessorInfo[TargetCpuIndex].MicrocodeIndex = Count;
-      } else {
-        IsInUse = FALSE;
-      }
-
-      if ((ImageDescriptor != NULL) && (DescriptorCount > Count)) {
-        ImageDescriptor[Count].ImageIndex = (UINT8)(Count + 1);
-        CopyGuid (&ImageDescriptor[Count].ImageTypeId, &gMicrocodeFmpImageTypeIdGuid);
-        ImageDescriptor[Count].ImageId     = LShiftU64 (MicrocodeEntryPoint->ProcessorFlags, 32) + MicrocodeEntryPoint->ProcessorSignature.Uint32;
-        ImageDescriptor[Count].ImageIdName = NULL;
-        ImageDescriptor[Count].Version     = MicrocodeEntryPoint->UpdateRevision;
-        ImageDescriptor[Count].VersionName = NULL;
-        ImageDescriptor[Count].Size        = TotalSize;
-        ImageAttributes                    = IMAGE_ATTRIBUTE_IMAGE_UPDATABLE | IMAGE_ATTRIBUTE_RESET_REQUIRED;
-        if (IsInUse) {
-          ImageAttributes |= IMAGE_ATTRIBUTE_IN_USE;
-        }
-
-        ImageDescriptor[Count].AttributesSupported         = ImageAttributes | IMAGE_ATTRIBUTE_IN_USE;
-        ImageDescriptor[Count].AttributesSetting           = ImageAttributes;
-        ImageDescriptor[Count].Compatibilities             = 0;
-        ImageDescriptor[Count].LowestSupportedImageVersion = MicrocodeEntryPoint->UpdateRevision; // do not support rollback
-        ImageDescriptor[Count].LastAttemptVersion          = 0;
-        ImageDescriptor[Count].LastAttemptStatus           = 0;
-        ImageDescriptor[Count].HardwareInstance            = 0;
-      }
-
       if ((MicrocodeInfo != NULL) && (DescriptorCount > Count)) {
         MicrocodeInfo[Count].MicrocodeEntryPoint = MicrocodeEntryPoint;
         MicrocodeInfo[Count].TotalSize           = TotalSize;
-        MicrocodeInfo[Count].InUse               = IsInUse;
+        MicrocodeInfo[Count].InUse               = FALSE;
+        MicrocodeInfo[Count].Verified            = FALSE;
       }
     } else {
       //
@@ -325,7 +496,8 @@ GetMatchedProcessor (
   IN OUT UINTN                   *TargetCpuIndex
   )
 {
-  UINTN  Index;
+  UINTN                 Index;
+  PROCESSOR_CLASS_INFO  *ProcessorClassInfo;
 
   if (*TargetCpuIndex != (UINTN)-1) {
     Index = *TargetCpuIndex;
@@ -338,12 +510,17 @@ GetMatchedProcessor (
     }
   }
 
-  for (Index = 0; Index < MicrocodeFmpPrivate->ProcessorCount; Index++) {
-    if ((ProcessorSignature == MicrocodeFmpPrivate->ProcessorInfo[Index].ProcessorSignature) &&
-        ((ProcessorFlags & (1 << MicrocodeFmpPrivate->ProcessorInfo[Index].PlatformId)) != 0))
+  //
+  // Processors in one class match the same Microcode, so only the first
+  // processor of each class is checked.
+  //
+  for (Index = 0; Index < MicrocodeFmpPrivate->ProcessorClassCount; Index++) {
+    ProcessorClassInfo = &MicrocodeFmpPrivate->ProcessorClassInfo[Index];
+    if ((ProcessorSignature == ProcessorClassInfo->ProcessorSignature) &&
+        ((ProcessorFlags & (1 << ProcessorClassInfo->PlatformId)) != 0))
     {
-      *TargetCpuIndex = Index;
-      return &MicrocodeFmpPrivate->ProcessorInfo[Index];
+      *TargetCpuIndex = ProcessorClassInfo->CpuIndex;
+      return &MicrocodeFmpPrivate->ProcessorInfo[ProcessorClassInfo->CpuIndex];
     }
   }
 
@@ -351,59 +528,42 @@ GetMatchedProcessor (
 }
 
 /**
-  Verify Microcode.
+  Check the processor independent format and checksum of a Microcode image.
 
   Caution: This function may receive untrusted input.
 
-  @param[in]  MicrocodeFmpPrivate        The Microcode driver private data
   @param[in]  Image                      The Microcode image buffer.
   @param[in]  ImageSize                  The size of Microcode image buffer in bytes.
-  @param[in]  TryLoad                    Try to load Microcode or not.
   @param[out] LastAttemptStatus          The last attempt status, which will be recorded in ESRT and FMP EFI_FIRMWARE_IMAGE_DESCRIPTOR.
   @param[out] AbortReason                A pointer to a pointer to a null-terminated string providing more
                                          details for the aborted operation. The buffer is allocated by this function
                                          with AllocatePool(), and it is the caller's responsibility to free it with a
                                          call to FreePool().
-  @param[in, out] TargetCpuIndex         On input, the index of target CPU which tries to match the Microcode. (UINTN)-1 means to try all.
-                                         On output, the index of target CPU which matches the Microcode.
 
-  @retval EFI_SUCCESS               The Microcode image passes verification.
-  @retval EFI_VOLUME_CORRUPTED      The Microcode image is corrupted.
+  @retval EFI_SUCCESS               The Microcode image passes the checks.
+  @retval EFI_VOLUME_CORRUPTED      The Microcode image is corrupt.
   @retval EFI_INCOMPATIBLE_VERSION  The Microcode image version is incorrect.
-  @retval EFI_UNSUPPORTED           The Microcode ProcessorSignature or ProcessorFlags is incorrect.
-  @retval EFI_SECURITY_VIOLATION    The Microcode image fails to load.
 **/
 EFI_STATUS
-VerifyMicrocode (
-  IN  MICROCODE_FMP_PRIVATE_DATA *MicrocodeFmpPrivate,
+CheckMicrocodeFormat (
   IN  VOID *Image,
   IN  UINTN ImageSize,
-  IN  BOOLEAN TryLoad,
   OUT UINT32 *LastAttemptStatus,
-  OUT CHAR16 **AbortReason, OPTIONAL
-  IN OUT UINTN                    *TargetCpuIndex
+  OUT CHAR16                     **AbortReason  OPTIONAL
   )
 {
-  UINTN                                Index;
-  CPU_MICROCODE_HEADER                 *MicrocodeEntryPoint;
-  UINTN                                TotalSize;
-  UINTN                                DataSize;
-  UINT32                               CurrentRevision;
-  PROCESSOR_INFO                       *ProcessorInfo;
-  UINT32                               InCompleteCheckSum32;
-  UINT32                               CheckSum32;
-  UINTN                                ExtendedTableLength;
-  UINT32                               ExtendedTableCount;
-  CPU_MICROCODE_EXTENDED_TABLE         *ExtendedTable;
-  CPU_MICROCODE_EXTENDED_TABLE_HEADER  *ExtendedTableHeader;
-  BOOLEAN                              CorrectMicrocode;
+  CPU_MICROCODE_HEADER  *MicrocodeEntryPoint;
+  UINTN                 TotalSize;
+  UINTN                 DataSize;
+  UINT32                CheckSum32;
+
+  MicrocodeEntryPoint = Image;
 
   //
   // Check HeaderVersion
   //
-  MicrocodeEntryPoint = Image;
   if (MicrocodeEntryPoint->HeaderVersion != 0x1) {
-    DEBUG ((DEBUG_ERROR, "VerifyMicrocode - fail on HeaderVersion\n"));
+    DEBUG ((DEBUG_ERROR, "CheckMicrocodeFormat - fail on HeaderVersion\n"));
     *LastAttemptStatus = LAST_ATTEMPT_STATUS_ERROR_INVALID_FORMAT;
     if (AbortReason != NULL) {
       *AbortReason = AllocateCopyPool (sizeof (L"InvalidHeaderVersion"), L"InvalidHeaderVersion");
@@ -416,7 +576,7 @@ VerifyMicrocode (
   // Check LoaderRevision
   //
   if (MicrocodeEntryPoint->LoaderRevision != 0x1) {
-    DEBUG ((DEBUG_ERROR, "VerifyMicrocode - fail on LoaderRevision\n"));
+    DEBUG ((DEBUG_ERROR, "CheckMicrocodeFormat - fail on LoaderRevision\n"));
     *LastAttemptStatus = LAST_ATTEMPT_STATUS_ERROR_INVALID_FORMAT;
     if (AbortReason != NULL) {
       *AbortReason = AllocateCopyPool (sizeof (L"InvalidLoaderVersion"), L"InvalidLoaderVersion");
@@ -435,7 +595,7 @@ VerifyMicrocode (
   }
 
   if (TotalSize <= sizeof (CPU_MICROCODE_HEADER)) {
-    DEBUG ((DEBUG_ERROR, "VerifyMicrocode - TotalSize too small\n"));
+    DEBUG ((DEBUG_ERROR, "CheckMicrocodeFormat - TotalSize too small\n"));
     *LastAttemptStatus = LAST_ATTEMPT_STATUS_ERROR_INVALID_FORMAT;
     if (AbortReason != NULL) {
       *AbortReason = AllocateCopyPool (sizeof (L"InvalidTotalSize"), L"InvalidTotalSize");
@@ -445,7 +605,7 @@ VerifyMicrocode (
   }
 
   if ((TotalSize & (SIZE_1KB - 1)) != 0) {
-    DEBUG ((DEBUG_ERROR, "VerifyMicrocode - TotalSize is not multiples of 1024 bytes (1 KBytes)\n"));
+    DEBUG ((DEBUG_ERROR, "CheckMicrocodeFormat - TotalSize is not multiples of 1024 bytes (1 KBytes)\n"));
     *LastAttemptStatus = LAST_ATTEMPT_STATUS_ERROR_INVALID_FORMAT;
     if (AbortReason != NULL) {
       *AbortReason = AllocateCopyPool (sizeof (L"InvalidTotalSize"), L"InvalidTotalSize");
@@ -455,7 +615,7 @@ VerifyMicrocode (
   }
 
   if (TotalSize != ImageSize) {
-    DEBUG ((DEBUG_ERROR, "VerifyMicrocode - TotalSize not equal to ImageSize\n"));
+    DEBUG ((DEBUG_ERROR, "CheckMicrocodeFormat - TotalSize not equal to ImageSize\n"));
     *LastAttemptStatus = LAST_ATTEMPT_STATUS_ERROR_INVALID_FORMAT;
     if (AbortReason != NULL) {
       *AbortReason = AllocateCopyPool (sizeof (L"InvalidTotalSize"), L"InvalidTotalSize");
@@ -474,7 +634,7 @@ VerifyMicrocode (
   }
 
   if (DataSize > TotalSize - sizeof (CPU_MICROCODE_HEADER)) {
-    DEBUG ((DEBUG_ERROR, "VerifyMicrocode - DataSize too big\n"));
+    DEBUG ((DEBUG_ERROR, "CheckMicrocodeFormat - DataSize too big\n"));
     *LastAttemptStatus = LAST_ATTEMPT_STATUS_ERROR_INVALID_FORMAT;
     if (AbortReason != NULL) {
       *AbortReason = AllocateCopyPool (sizeof (L"InvalidDataSize"), L"InvalidDataSize");
@@ -484,7 +644,7 @@ VerifyMicrocode (
   }
 
   if ((DataSize & 0x3) != 0) {
-    DEBUG ((DEBUG_ERROR, "VerifyMicrocode - DataSize is not multiples of DWORDs\n"));
+    DEBUG ((DEBUG_ERROR, "CheckMicrocodeFormat - DataSize is not multiples of DWORDs\n"));
     *LastAttemptStatus = LAST_ATTEMPT_STATUS_ERROR_INVALID_FORMAT;
     if (AbortReason != NULL) {
       *AbortReason = AllocateCopyPool (sizeof (L"InvalidDataSize"), L"InvalidDataSize");
@@ -496,9 +656,9 @@ VerifyMicrocode (
   //
   // Check CheckSum32
   //
-  CheckSum32 = CalculateSum32 ((UINT32 *)MicrocodeEntryPoint, DataSize + sizeof (CPU_MICROCODE_HEADER));
+  CheckSum32 = MicrocodeCalculateSum32 ((UINT32 *)MicrocodeEntryPoint, DataSize + sizeof (CPU_MICROCODE_HEADER));
   if (CheckSum32 != 0) {
-    DEBUG ((DEBUG_ERROR, "VerifyMicrocode - fail on CheckSum32\n"));
+    DEBUG ((DEBUG_ERROR, "CheckMicrocodeFormat - fail on CheckSum32\n"));
     *LastAttemptStatus = LAST_ATTEMPT_STATUS_ERROR_INVALID_FORMAT;
     if (AbortReason != NULL) {
       *AbortReason = AllocateCopyPool (sizeof (L"InvalidChecksum"), L"InvalidChecksum");
@@ -507,7 +667,73 @@ VerifyMicrocode (
     return EFI_VOLUME_CORRUPTED;
   }
 
-  InCompleteCheckSum32  = CheckSum32;
+  return EFI_SUCCESS;
+}
+
+/**
+  Verify Microcode.
+
+  Caution: This function may receive untrusted input.
+
+  @param[in]  MicrocodeFmpPrivate        The Microcode driver private data
+  @param[in]  Image                      The Microcode image buffer.
+  @param[in]  ImageSize                  The size of Microcode image buffer in bytes.
+  @param[in]  TryLoad                    Try to load Microcode or not.
+  @param[out] LastAttemptStatus          The last attempt status, which will be recorded in ESRT and FMP EFI_FIRMWARE_IMAGE_DESCRIPTOR.
+  @param[out] AbortReason                A pointer to a pointer to a null-terminated string providing more
+                                         details for the aborted operation. The buffer is allocated by this function
+                                         with AllocatePool(), and it is the caller's responsibility to free it with a
+                                         call to FreePool().
+  @param[in, out] TargetCpuIndex         On input, the index of target CPU which tries to match the Microcode. (UINTN)-1 means to try all.
+                                         On output, the index of target CPU which matches the Microcode.
+
+  @retval EFI_SUCCESS               The Microcode image passes verification.
+  @retval EFI_VOLUME_CORRUPTED      The Microcode image is corrupted.
+  @retval EFI_INCOMPATIBLE_VERSION  The Microcode image version is incorrect.
+  @retval EFI_UNSUPPORTED           The Microcode ProcessorSignature or ProcessorFlags is incorrect.
+  @retval EFI_SECURITY_VIOLATION    The Microcode image fails to load.
+**/
+EFI_STATUS
+VerifyMicrocode (
+  IN  MICROCODE_FMP_PRIVATE_DATA *MicrocodeFmpPrivate,
+  IN  VOID *Image,
+  IN  UINTN ImageSize,
+  IN  BOOLEAN TryLoad,
+  OUT UINT32 *LastAttemptStatus,
+  OUT CHAR16 **AbortReason, OPTIONAL
+  IN OUT UINTN                    *TargetCpuIndex
+  )
+{
+  EFI_STATUS                           Status;
+  UINTN                                Index;
+  CPU_MICROCODE_HEADER                 *MicrocodeEntryPoint;
+  UINTN                                TotalSize;
+  UINTN                                DataSize;
+  UINT32                               CurrentRevision;
+  PROCESSOR_INFO                       *ProcessorInfo;
+  UINT32                               InCompleteCheckSum32;
+  UINT32                               CheckSum32;
+  UINTN                                ExtendedTableLength;
+  UINT32                               ExtendedTableCount;
+  CPU_MICROCODE_EXTENDED_TABLE         *ExtendedTable;
+  CPU_MICROCODE_EXTENDED_TABLE_HEADER  *ExtendedTableHeader;
+  BOOLEAN                              CorrectMicrocode;
+
+  MicrocodeEntryPoint = Image;
+  Status              = CheckMicrocodeFormat (Image, ImageSize, LastAttemptStatus, AbortReason);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if (MicrocodeEntryPoint->DataSize == 0) {
+    TotalSize = 2048;
+    DataSize  = 2048 - sizeof (CPU_MICROCODE_HEADER);
+  } else {
+    TotalSize = MicrocodeEntryPoint->TotalSize;
+    DataSize  = MicrocodeEntryPoint->DataSize;
+  }
+
+  InCompleteCheckSum32  = 0;
   InCompleteCheckSum32 -= MicrocodeEntryPoint->ProcessorSignature.Uint32;
   InCompleteCheckSum32 -= MicrocodeEntryPoint->ProcessorFlags;
   InCompleteCheckSum32 -= MicrocodeEntryPoint->Checksum;
@@ -529,7 +755,7 @@ VerifyMicrocode (
       // Calculate Extended Checksum
       //
       if ((ExtendedTableLength > sizeof (CPU_MICROCODE_EXTENDED_TABLE_HEADER)) && ((ExtendedTableLength & 0x3) == 0)) {
-        CheckSum32 = CalculateSum32 ((UINT32 *)ExtendedTableHeader, ExtendedTableLength);
+        CheckSum32 = MicrocodeCalculateSum32 ((UINT32 *)ExtendedTableHeader, ExtendedTableLength);
         if (CheckSum32 != 0) {
           //
           // Checksum incorrect
@@ -624,6 +850,99 @@ VerifyMicrocode (
   return EFI_SUCCESS;
 }
 
+/**
+  Collect the processor signatures supported by a verified Microcode patch.
+
+  The signature in the Microcode header is always collected. The extended
+  signatures are collected if the extended table and the entry checksums
+  are correct.
+
+  @param[in]   MicrocodeFmpPrivate        The Microcode driver private data
+  @param[in]   MicrocodeIndex             The index of the patch in MicrocodeInfo.
+  @param[out]  IndexEntry                 The buffer to receive the index entries.
+
+  @return The number of index entries for the patch.
+**/
+UINTN
+CollectMicrocodePatchSignatures (
+  IN  MICROCODE_FMP_PRIVATE_DATA   *MicrocodeFmpPrivate,
+  IN  UINTN                        MicrocodeIndex,
+  OUT MICROCODE_PATCH_INDEX_ENTRY  *IndexEntry  OPTIONAL
+  )
+{
+  UINTN                                Index;
+  UINTN                                Count;
+  CPU_MICROCODE_HEADER                 *MicrocodeEntryPoint;
+  UINTN                                TotalSize;
+  UINTN                                DataSize;
+  UINT32                               InCompleteCheckSum32;
+  UINT32                               CheckSum32;
+  UINTN                                ExtendedTableLength;
+  UINT32                               ExtendedTableCount;
+  CPU_MICROCODE_EXTENDED_TABLE         *ExtendedTable;
+  CPU_MICROCODE_EXTENDED_TABLE_HEADER  *ExtendedTableHeader;
+
+  MicrocodeEntryPoint = MicrocodeFmpPrivate->MicrocodeInfo[MicrocodeIndex].MicrocodeEntryPoint;
+  TotalSize           = MicrocodeFmpPrivate->MicrocodeInfo[MicrocodeIndex].TotalSize;
+  if (MicrocodeEntryPoint->DataSize == 0) {
+    DataSize = 2048 - sizeof (CPU_MICROCODE_HEADER);
+  } else {
+    DataSize = MicrocodeEntryPoint->DataSize;
+  }
+
+  if (IndexEntry != NULL) {
+    IndexEntry[0].ProcessorSignature = MicrocodeEntryPoint->ProcessorSignature.Uint32;
+    IndexEntry[0].ProcessorFlags     = MicrocodeEntryPoint->ProcessorFlags;
+    IndexEntry[0].UpdateRevision     = MicrocodeEntryPoint->UpdateRevision;
+    IndexEntry[0].MicrocodeIndex     = MicrocodeIndex;
+  }
+
+  Count = 1;
+
+  ExtendedTableLength = TotalSize - (DataSize + sizeof (CPU_MICROCODE_HEADER));
+  if ((ExtendedTableLength <= sizeof (CPU_MICROCODE_EXTENDED_TABLE_HEADER)) || ((ExtendedTableLength & 0x3) != 0)) {
+    return Count;
+  }
+
+  ExtendedTableHeader = (CPU_MICROCODE_EXTENDED_TABLE_HEADER *)((UINT8 *)(MicrocodeEntryPoint) + DataSize + sizeof (CPU_MICROCODE_HEADER));
+  CheckSum32          = MicrocodeCalculateSum32 ((UINT32 *)ExtendedTableHeader, ExtendedTableLength);
+  if (CheckSum32 != 0) {
+    return Count;
+  }
+
+  ExtendedTableCount = ExtendedTableHeader->ExtendedSignatureCount;
+  if (ExtendedTableCount > (ExtendedTableLength - sizeof (CPU_MICROCODE_EXTENDED_TABLE_HEADER)) / sizeof (CPU_MICROCODE_EXTENDED_TABLE)) {
+    return Count;
+  }
+
+  InCompleteCheckSum32  = 0;
+  InCompleteCheckSum32 -= MicrocodeEntryPoint->ProcessorSignature.Uint32;
+  InCompleteCheckSum32 -= MicrocodeEntryPoint->ProcessorFlags;
+  InCompleteCheckSum32 -= MicrocodeEntryPoint->Checksum;
+
+  ExtendedTable = (CPU_MICROCODE_EXTENDED_TABLE *)(ExtendedTableHeader + 1);
+  for (Index = 0; Index < ExtendedTableCount; Index++, ExtendedTable++) {
+    CheckSum32  = InCompleteCheckSum32;
+    CheckSum32 += ExtendedTable->ProcessorSignature.Uint32;
+    CheckSum32 += ExtendedTable->ProcessorFlag;
+    CheckSum32 += ExtendedTable->Checksum;
+    if (CheckSum32 != 0) {
+      continue;
+    }
+
+    if (IndexEntry != NULL) {
+      IndexEntry[Count].ProcessorSignature = ExtendedTable->ProcessorSignature.Uint32;
+      IndexEntry[Count].ProcessorFlags     = ExtendedTable->ProcessorFlag;
+      IndexEntry[Count].UpdateRevision     = MicrocodeEntryPoint->UpdateRevision;
+      IndexEntry[Count].MicrocodeIndex     = MicrocodeIndex;
+    }
+
+    Count++;
+  }
+
+  return Count;
+}
+
 /**
   Get next Microcode entrypoint.
 
@@ -652,183 +971,705 @@ GetNextMicrocode (
     }
   }
 
-  ASSERT (FALSE);
-  return NULL;
+  ASSERT (FALSE);
+  return NULL;
+}
+
+/**
+  Get next FIT Microcode entrypoint.
+
+  FitMicrocodeInfo is sorted by MicrocodeEntryPoint, so the entry is found
+  with a binary search.
+
+  @param[in]  MicrocodeFmpPrivate        The Microcode driver private data
+  @param[in]  MicrocodeEntryPoint        Current Microcode entrypoint
+
+  @return next FIT Microcode entrypoint.
+**/
+CPU_MICROCODE_HEADER *
+GetNextFitMicrocode (
+  IN MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate,
+  IN CPU_MICROCODE_HEADER        *MicrocodeEntryPoint
+  )
+{
+  UINTN  Low;
+  UINTN  High;
+  UINTN  Index;
+
+  Low  = 0;
+  High = MicrocodeFmpPrivate->FitMicrocodeEntryCount;
+  while (Low < High) {
+    Index = Low + (High - Low) / 2;
+    if ((UINTN)MicrocodeFmpPrivate->FitMicrocodeInfo[Index].MicrocodeEntryPoint < (UINTN)MicrocodeEntryPoint) {
+      Low = Index + 1;
+    } else {
+      High = Index;
+    }
+  }
+
+  if ((Low == MicrocodeFmpPrivate->FitMicrocodeEntryCount) ||
+      (MicrocodeFmpPrivate->FitMicrocodeInfo[Low].MicrocodeEntryPoint != MicrocodeEntryPoint))
+  {
+    ASSERT (FALSE);
+    return NULL;
+  }
+
+  if (Low == (UINTN)MicrocodeFmpPrivate->FitMicrocodeEntryCount - 1) {
+    // it is last one
+    return NULL;
+  }
+
+  // return next one
+  return MicrocodeFmpPrivate->FitMicrocodeInfo[Low + 1].MicrocodeEntryPoint;
+}
+
+/**
+  Get the number of flash erase blocks a range of flash spans.
+
+  @param[in]  Address                    The start address of the range.
+  @param[in]  Length                     The size of the range in bytes.
+
+  @return The number of erase blocks the range spans.
+**/
+UINTN
+GetFlashBlockSpan (
+  IN UINTN  Address,
+  IN UINTN  Length
+  )
+{
+  UINTN  BlockSize;
+
+  BlockSize = PcdGet32 (PcdMicrocodeFlashBlockSize);
+  if ((BlockSize == 0) || (Length == 0)) {
+    return 0;
+  }
+
+  return (Address + Length - 1) / BlockSize - Address / BlockSize + 1;
+}
+
+/**
+  Find the FIT Microcode slot to stage a new Microcode in.
+
+  Each FIT Microcode entry owns the flash up to the next FIT Microcode entry,
+  or up to the end of the Microcode region for the last one. Among the slots
+  of the requested kind that are large enough, the one whose write touches
+  the fewest erase blocks is picked, and then the smallest one, so the large
+  slots stay free for large Microcode and less flash is read back on verify.
+  The write touches the blocks of the new image and, for an unused slot,
+  the blocks of the old Microcode it erases. The rest of the slot is 0xFF
+  and is not written.
+
+  @param[in]  MicrocodeFmpPrivate        The Microcode driver private data
+  @param[in]  ImageSize                  The size of Microcode image buffer in bytes.
+  @param[in]  Empty                      TRUE to find an empty slot, FALSE to find
+                                         a slot holding a Microcode no processor uses.
+  @param[in]  ClassMicrocode             If not NULL, only an unused slot holding a
+                                         Microcode with the processor signature of
+                                         ClassMicrocode and a platform ID in common
+                                         with it is picked.
+  @param[out] AvailableSize              Available size of the FIT Microcode slot.
+
+  @return The FIT Microcode entrypoint of the slot, or NULL if there is no such slot.
+**/
+CPU_MICROCODE_HEADER *
+FindFitMicrocodeSlot (
+  IN MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate,
+  IN UINTN                       ImageSize,
+  IN BOOLEAN                     Empty,
+  IN CPU_MICROCODE_HEADER        *ClassMicrocode  OPTIONAL,
+  OUT UINTN                      *AvailableSize
+  )
+{
+  UINTN                 Index;
+  FIT_MICROCODE_INFO    *FitMicrocodeInfo;
+  UINTN                 SlotStart;
+  UINTN                 SlotEnd;
+  UINTN                 SlotSize;
+  UINTN                 UsedSize;
+  UINTN                 BlockSpan;
+  UINTN                 BestBlockSpan;
+  CPU_MICROCODE_HEADER  *BestMicrocodeEntryPoint;
+
+  BestMicrocodeEntryPoint = NULL;
+  BestBlockSpan           = MAX_UINTN;
+  *AvailableSize          = 0;
+
+  for (Index = 0; Index < MicrocodeFmpPrivate->FitMicrocodeEntryCount; Index++) {
+    FitMicrocodeInfo = &MicrocodeFmpPrivate->FitMicrocodeInfo[Index];
+    if (Empty ? !FitMicrocodeInfo->Empty : FitMicrocodeInfo->InUse) {
+      continue;
+    }
+
+    //
+    // InUse only covers the processors in this system, so an unused slot may
+    // hold the Microcode of another processor the flash image supports. A
+    // valid Microcode has a TotalSize.
+    //
+    if (!Empty && (ClassMicrocode != NULL)) {
+      if ((FitMicrocodeInfo->TotalSize == 0) ||
+          (FitMicrocodeInfo->MicrocodeEntryPoint->ProcessorSignature.Uint32 != ClassMicrocode->ProcessorSignature.Uint32) ||
+          ((FitMicrocodeInfo->MicrocodeEntryPoint->ProcessorFlags & ClassMicrocode->ProcessorFlags) == 0))
+      {
+        continue;
+      }
+    }
+
+    //
+    // FitMicrocodeInfo is sorted, so the slot ends at the next entry.
+    //
+    SlotStart = (UINTN)FitMicrocodeInfo->MicrocodeEntryPoint;
+    if (Index + 1 < MicrocodeFmpPrivate->FitMicrocodeEntryCount) {
+      SlotEnd = (UINTN)FitMicrocodeInfo[1].MicrocodeEntryPoint;
+    } else {
+      SlotEnd = (UINTN)MicrocodeFmpPrivate->MicrocodePatchAddress + MicrocodeFmpPrivate->MicrocodePatchRegionSize;
+    }
+
+    SlotSize = SlotEnd - SlotStart;
+    if (SlotSize < ImageSize) {
+      continue;
+    }
+
+    //
+    // An unused entry that is not a valid Microcode has no TotalSize, so the
+    // whole slot is assumed to need erasing.
+    //
+    UsedSize = ImageSize;
+    if (!FitMicrocodeInfo->Empty) {
+      UsedSize = MAX (UsedSize, (FitMicrocodeInfo->TotalSize != 0) ? FitMicrocodeInfo->TotalSize : SlotSize);
+      UsedSize = MIN (UsedSize, SlotSize);
+    }
+
+    BlockSpan = GetFlashBlockSpan (SlotStart, UsedSize);
+    if ((BlockSpan < BestBlockSpan) ||
+        ((BlockSpan == BestBlockSpan) && (SlotSize < *AvailableSize)))
+    {
+      BestMicrocodeEntryPoint = FitMicrocodeInfo->MicrocodeEntryPoint;
+      BestBlockSpan           = BlockSpan;
+      *AvailableSize          = SlotSize;
+    }
+  }
+
+  return BestMicrocodeEntryPoint;
+}
+
+/**
+  Get current Microcode used region size.
+
+  @param[in]  MicrocodeFmpPrivate        The Microcode driver private data
+
+  @return current Microcode used region size.
+**/
+UINTN
+GetCurrentMicrocodeUsedRegionSize (
+  IN MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate
+  )
+{
+  if (MicrocodeFmpPrivate->DescriptorCount == 0) {
+    return 0;
+  }
+
+  return (UINTN)MicrocodeFmpPrivate->MicrocodeInfo[MicrocodeFmpPrivate->DescriptorCount - 1].MicrocodeEntryPoint
+         + (UINTN)MicrocodeFmpPrivate->MicrocodeInfo[MicrocodeFmpPrivate->DescriptorCount - 1].TotalSize
+         - (UINTN)MicrocodeFmpPrivate->MicrocodePatchAddress;
+}
+
+/**
+  Write a range of the Microcode region to flash.
+
+  The written range is added to the dirty region of the Microcode driver, so
+  the patches in it are verified again when the Microcode information is
+  collected next time.
+
+  @param[in]   MicrocodeFmpPrivate  The Microcode driver private data
+  @param[in]   Address              The flash address of Microcode.
+  @param[in]   Image                The Microcode image buffer.
+  @param[in]   ImageSize            The size of Microcode image buffer in bytes.
+  @param[out]  LastAttemptStatus    The last attempt status, which will be recorded in ESRT and FMP EFI_FIRMWARE_IMAGE_DESCRIPTOR.
+
+  @retval EFI_SUCCESS           The Microcode image is updated.
+  @retval EFI_WRITE_PROTECTED   The flash device is read only.
+**/
+EFI_STATUS
+WriteMicrocodeRegion (
+  IN MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate,
+  IN UINT64                      Address,
+  IN VOID                        *Image,
+  IN UINTN                       ImageSize,
+  OUT UINT32                     *LastAttemptStatus
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       DirtyEnd;
+
+  DEBUG ((DEBUG_INFO, "PlatformUpdate:"));
+  DEBUG ((DEBUG_INFO, "  Address - 0x%lx,", Address));
+  DEBUG ((DEBUG_INFO, "  Length - 0x%x\n", ImageSize));
+
+  //
+  // Record the range before writing, because a failed write may leave it
+  // partially updated.
+  //
+  if (MicrocodeFmpPrivate->DirtyRegionSize == 0) {
+    MicrocodeFmpPrivate->DirtyRegionBase = (UINTN)Address;
+    MicrocodeFmpPrivate->DirtyRegionSize = ImageSize;
+  } else {
+    DirtyEnd                             = MAX (MicrocodeFmpPrivate->DirtyRegionBase + MicrocodeFmpPrivate->DirtyRegionSize, (UINTN)Address + ImageSize);
+    MicrocodeFmpPrivate->DirtyRegionBase = MIN (MicrocodeFmpPrivate->DirtyRegionBase, (UINTN)Address);
+    MicrocodeFmpPrivate->DirtyRegionSize = DirtyEnd - MicrocodeFmpPrivate->DirtyRegionBase;
+  }
+
+  Status = MicrocodeFlashWrite (
+             Address,
+             Image,
+             ImageSize
+             );
+  if (!EFI_ERROR (Status)) {
+    *LastAttemptStatus = LAST_ATTEMPT_STATUS_SUCCESS;
+  } else {
+    *LastAttemptStatus = LAST_ATTEMPT_STATUS_ERROR_UNSUCCESSFUL;
+  }
+
+  return Status;
+}
+
+/**
+  Update Microcode.
+
+  The new content is compared with the flash one erase block at a time, and
+  only the runs of blocks that differ are written. The blocks are written in
+  ascending address order.
+
+  @param[in]   MicrocodeFmpPrivate  The Microcode driver private data
+  @param[in]   Address              The flash address of Microcode.
+  @param[in]   Image                The Microcode image buffer.
+  @param[in]   ImageSize            The size of Microcode image buffer in bytes.
+  @param[out]  LastAttemptStatus    The last attempt status, which will be recorded in ESRT and FMP EFI_FIRMWARE_IMAGE_DESCRIPTOR.
+
+  @retval EFI_SUCCESS           The Microcode image is updated.
+  @retval EFI_WRITE_PROTECTED   The flash device is read only.
+**/
+EFI_STATUS
+UpdateMicrocode (
+  IN MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate,
+  IN UINT64                      Address,
+  IN VOID                        *Image,
+  IN UINTN                       ImageSize,
+  OUT UINT32                     *LastAttemptStatus
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       BlockSize;
+  UINTN       Offset;
+  UINTN       ChunkSize;
+  UINTN       RunOffset;
+  UINTN       RunSize;
+  UINTN       WrittenSize;
+
+  BlockSize = PcdGet32 (PcdMicrocodeFlashBlockSize);
+  ASSERT (BlockSize != 0);
+
+  Status             = EFI_SUCCESS;
+  *LastAttemptStatus = LAST_ATTEMPT_STATUS_SUCCESS;
+  RunOffset          = 0;
+  RunSize            = 0;
+  WrittenSize        = 0;
+  for (Offset = 0; Offset < ImageSize; Offset += ChunkSize) {
+    //
+    // A chunk ends at the next erase block boundary of the flash.
+    //
+    ChunkSize = BlockSize - (((UINTN)Address + Offset) % BlockSize);
+    ChunkSize = MIN (ChunkSize, ImageSize - Offset);
+    if (CompareMem ((VOID *)((UINTN)Address + Offset), (UINT8 *)Image + Offset, ChunkSize) != 0) {
+      if (RunSize == 0) {
+        RunOffset = Offset;
+      }
+
+      RunSize += ChunkSize;
+      if (Offset + ChunkSize < ImageSize) {
+        continue;
+      }
+    }
+
+    if (RunSize != 0) {
+      Status = WriteMicrocodeRegion (MicrocodeFmpPrivate, Address + RunOffset, (UINT8 *)Image + RunOffset, RunSize, LastAttemptStatus);
+      if (EFI_ERROR (Status)) {
+        return Status;
+      }
+
+      WrittenSize += RunSize;
+      RunSize      = 0;
+    }
+  }
+
+  DEBUG ((DEBUG_INFO, "UpdateMicrocode: 0x%x of 0x%x bytes changed\n", WrittenSize, ImageSize));
+
+  return Status;
+}
+
+/**
+  Stage a copy of Microcode in the empty tail of the Microcode region.
+
+  While the Microcode is overwritten or moved in place, the staged copy holds
+  valid patches for the same processors, so a power loss in between does not
+  leave them without a Microcode. The Microcode region is walked in 1KB steps
+  over the padding, so the copy is found without a FIT entry.
+
+  @param[in]   MicrocodeFmpPrivate  The Microcode driver private data
+  @param[in]   DataEnd              The end address of the Microcode data after the update.
+  @param[in]   Image                The Microcode patches to stage.
+  @param[in]   ImageSize            The size of Image in bytes.
+  @param[out]  StagedAddress        The flash address of the staged copy, or 0 if there is no room for it.
+  @param[out]  LastAttemptStatus    The last attempt status, which will be recorded in ESRT and FMP EFI_FIRMWARE_IMAGE_DESCRIPTOR.
+
+  @retval EFI_SUCCESS           The Microcode image is staged, or there is no room for it.
+  @retval EFI_WRITE_PROTECTED   The flash device is read only.
+**/
+EFI_STATUS
+StageMicrocode (
+  IN  MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate,
+  IN  UINTN                       DataEnd,
+  IN  VOID                        *Image,
+  IN  UINTN                       ImageSize,
+  OUT UINTN                       *StagedAddress,
+  OUT UINT32                      *LastAttemptStatus
+  )
+{
+  EFI_STATUS      Status;
+  UINTN           Alignment;
+  UINTN           MicrocodeEnd;
+  UINTN           Address;
+  UINTN           Index;
+  MICROCODE_INFO  *MicrocodeInfo;
+
+  *StagedAddress     = 0;
+  *LastAttemptStatus = LAST_ATTEMPT_STATUS_SUCCESS;
+  if (ImageSize == 0) {
+    return EFI_SUCCESS;
+  }
+
+  //
+  // The copy starts on its own erase block, so that erasing it later does
+  // not touch the blocks of the updated Microcode.
+  //
+  Alignment    = MAX ((UINTN)PcdGet32 (PcdMicrocodeFlashBlockSize), SIZE_1KB);
+  MicrocodeEnd = (UINTN)MicrocodeFmpPrivate->MicrocodePatchAddress + MicrocodeFmpPrivate->MicrocodePatchRegionSize;
+  Address      = ALIGN_VALUE (DataEnd, Alignment);
+
+  //
+  // Past DataEnd the region may still hold a patch the update drops, or the
+  // old copy of a patch it moves. A patch in use there has no other copy
+  // while the staged copy is written, so the copy is placed after it.
+  // MicrocodeInfo is in address order.
+  //
+  MicrocodeInfo = MicrocodeFmpPrivate->MicrocodeInfo;
+  for (Index = 0; Index < MicrocodeFmpPrivate->DescriptorCount; Index++) {
+    if (MicrocodeInfo[Index].InUse &&
+        ((UINTN)MicrocodeInfo[Index].MicrocodeEntryPoint < Address + ImageSize) &&
+        ((UINTN)MicrocodeInfo[Index].MicrocodeEntryPoint + MicrocodeInfo[Index].TotalSize > Address))
+    {
+      Address = ALIGN_VALUE ((UINTN)MicrocodeInfo[Index].MicrocodeEntryPoint + MicrocodeInfo[Index].TotalSize, Alignment);
+    }
+  }
+
+  if ((Address >= MicrocodeEnd) || (MicrocodeEnd - Address < ImageSize)) {
+    DEBUG ((DEBUG_INFO, "StageMicrocode: No room to stage the microcode\n"));
+    return EFI_SUCCESS;
+  }
+
+  DEBUG ((DEBUG_INFO, "StageMicrocode: Stage the microcode at 0x%x\n", Address));
+  Status = UpdateMicrocode (MicrocodeFmpPrivate, Address, Image, ImageSize, LastAttemptStatus);
+  if (!EFI_ERROR (Status)) {
+    *StagedAddress = Address;
+  }
+
+  return Status;
 }
 
 /**
-  Get next FIT Microcode entrypoint.
+  Erase a range of the Microcode region.
 
-  @param[in]  MicrocodeFmpPrivate        The Microcode driver private data
-  @param[in]  MicrocodeEntryPoint        Current Microcode entrypoint
+  The blocks already erased are skipped.
 
-  @return next FIT Microcode entrypoint.
+  @param[in]   MicrocodeFmpPrivate  The Microcode driver private data
+  @param[in]   Address              The flash address of the range.
+  @param[in]   Size                 The size of the range in bytes.
+  @param[out]  LastAttemptStatus    The last attempt status, which will be recorded in ESRT and FMP EFI_FIRMWARE_IMAGE_DESCRIPTOR.
+
+  @retval EFI_SUCCESS           The range is erased.
+  @retval EFI_OUT_OF_RESOURCES  There are not enough resources.
+  @retval EFI_WRITE_PROTECTED   The flash device is read only.
 **/
-CPU_MICROCODE_HEADER *
-GetNextFitMicrocode (
-  IN MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate,
-  IN CPU_MICROCODE_HEADER        *MicrocodeEntryPoint
+EFI_STATUS
+EraseMicrocode (
+  IN  MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate,
+  IN  UINTN                       Address,
+  IN  UINTN                       Size,
+  OUT UINT32                      *LastAttemptStatus
   )
 {
-  UINTN  Index;
+  EFI_STATUS  Status;
+  VOID        *EmptyBuffer;
 
-  for (Index = 0; Index < MicrocodeFmpPrivate->FitMicrocodeEntryCount; Index++) {
-    if (MicrocodeEntryPoint == MicrocodeFmpPrivate->FitMicrocodeInfo[Index].MicrocodeEntryPoint) {
-      if (Index == (UINTN)MicrocodeFmpPrivate->FitMicrocodeEntryCount - 1) {
-        // it is last one
-        return NULL;
-      } else {
-        // return next one
-        return MicrocodeFmpPrivate->FitMicrocodeInfo[Index + 1].MicrocodeEntryPoint;
-      }
-    }
+  EmptyBuffer = AllocatePool (Size);
+  if (EmptyBuffer == NULL) {
+    *LastAttemptStatus = LAST_ATTEMPT_STATUS_ERROR_INSUFFICIENT_RESOURCES;
+    return EFI_OUT_OF_RESOURCES;
   }
 
-  ASSERT (FALSE);
-  return NULL;
+  SetMem (EmptyBuffer, Size, 0xFF);
+  Status = UpdateMicrocode (MicrocodeFmpPrivate, Address, EmptyBuffer, Size, LastAttemptStatus);
+  FreePool (EmptyBuffer);
+
+  return Status;
 }
 
 /**
-  Find empty FIT Microcode entrypoint.
+  Overwrite the old Microcode with a new layout that contains the new Microcode.
+
+  The patches of the new layout in [StageOffset, StageOffset + StageSize)
+  are staged first if there is room. This covers the new Microcode, and the
+  patches the new layout moves. The new layout up to DataEnd is then written,
+  and the staged copy is erased in a separate write once it is in place. The
+  0xFF padding of the new layout past DataEnd is written last. If the update
+  fails, the staged copy is kept as the valid patch.
+
+  @param[in]   MicrocodeFmpPrivate  The Microcode driver private data
+  @param[in]   Address              The flash address of the old Microcode.
+  @param[in]   Buffer               The new layout, starting with the new Microcode.
+  @param[in]   BufferSize           The size of the new layout in bytes.
+  @param[in]   DataEnd              The end address of the Microcode data after the update.
+  @param[in]   StageOffset          The offset in Buffer of the patches to stage.
+  @param[in]   StageSize            The size of the patches to stage in bytes, or 0.
+  @param[out]  LastAttemptStatus    The last attempt status, which will be recorded in ESRT and FMP EFI_FIRMWARE_IMAGE_DESCRIPTOR.
 
-  @param[in]  MicrocodeFmpPrivate        The Microcode driver private data
-  @param[in]  ImageSize                  The size of Microcode image buffer in bytes.
-  @param[out] AvailableSize              Available size of the empty FIT Microcode entrypoint.
-
-  @return Empty FIT Microcode entrypoint.
+  @retval EFI_SUCCESS           The Microcode image is updated.
+  @retval EFI_WRITE_PROTECTED   The flash device is read only.
 **/
-CPU_MICROCODE_HEADER *
-FindEmptyFitMicrocode (
-  IN MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate,
-  IN UINTN                       ImageSize,
-  OUT UINTN                      *AvailableSize
+EFI_STATUS
+ReplaceMicrocode (
+  IN  MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate,
+  IN  UINTN                       Address,
+  IN  VOID                        *Buffer,
+  IN  UINTN                       BufferSize,
+  IN  UINTN                       DataEnd,
+  IN  UINTN                       StageOffset,
+  IN  UINTN                       StageSize,
+  OUT UINT32                      *LastAttemptStatus
   )
 {
-  UINTN                 Index;
-  CPU_MICROCODE_HEADER  *MicrocodeEntryPoint;
-  CPU_MICROCODE_HEADER  *NextMicrocodeEntryPoint;
-  VOID                  *MicrocodePatchAddress;
-  UINTN                 MicrocodePatchRegionSize;
+  EFI_STATUS  Status;
+  UINTN       StagedAddress;
+  UINTN       DataSize;
+  UINT32      ClearStatus;
 
-  MicrocodePatchAddress    = MicrocodeFmpPrivate->MicrocodePatchAddress;
-  MicrocodePatchRegionSize = MicrocodeFmpPrivate->MicrocodePatchRegionSize;
+  Status = StageMicrocode (MicrocodeFmpPrivate, DataEnd, (UINT8 *)Buffer + StageOffset, StageSize, &StagedAddress, LastAttemptStatus);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
 
-  for (Index = 0; Index < MicrocodeFmpPrivate->FitMicrocodeEntryCount; Index++) {
-    if (MicrocodeFmpPrivate->FitMicrocodeInfo[Index].Empty) {
-      MicrocodeEntryPoint     = MicrocodeFmpPrivate->FitMicrocodeInfo[Index].MicrocodeEntryPoint;
-      NextMicrocodeEntryPoint = GetNextFitMicrocode (MicrocodeFmpPrivate, MicrocodeEntryPoint);
-      if (NextMicrocodeEntryPoint != NULL) {
-        *AvailableSize = (UINTN)NextMicrocodeEntryPoint - (UINTN)MicrocodeEntryPoint;
-      } else {
-        *AvailableSize = (UINTN)MicrocodePatchAddress + MicrocodePatchRegionSize - (UINTN)MicrocodeEntryPoint;
-      }
+  //
+  // The padding past DataEnd covers the staged copy. It is not written with
+  // the new layout, or a single write could erase the staged copy before the
+  // new layout is in place.
+  //
+  DataSize = MIN (BufferSize, DataEnd - Address);
+  Status   = UpdateMicrocode (MicrocodeFmpPrivate, Address, Buffer, DataSize, LastAttemptStatus);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
 
-      if (*AvailableSize >= ImageSize) {
-        return MicrocodeEntryPoint;
-      }
+  //
+  // The new layout is in place. A staged copy left behind is only a
+  // duplicate, so failing to erase it does not fail the update.
+  //
+  if (StagedAddress != 0) {
+    if (EFI_ERROR (EraseMicrocode (MicrocodeFmpPrivate, StagedAddress, StageSize, &ClearStatus))) {
+      DEBUG ((DEBUG_ERROR, "ReplaceMicrocode: Fail to erase the staged microcode at 0x%x\n", StagedAddress));
     }
   }
 
-  return NULL;
+  if (DataSize < BufferSize) {
+    Status = UpdateMicrocode (MicrocodeFmpPrivate, Address + DataSize, (UINT8 *)Buffer + DataSize, BufferSize - DataSize, LastAttemptStatus);
+  }
+
+  return Status;
 }
 
 /**
-  Find unused FIT Microcode entrypoint.
+  Write a range of the Microcode region for an A/B slot update.
 
-  @param[in]  MicrocodeFmpPrivate        The Microcode driver private data
-  @param[in]  ImageSize                  The size of Microcode image buffer in bytes.
-  @param[out] AvailableSize              Available size of the unused FIT Microcode entrypoint.
+  @param[in]  Context       The MICROCODE_SLOT_CONTEXT of the update.
+  @param[in]  Address       The flash address to write.
+  @param[in]  Buffer        The data to write.
+  @param[in]  Length        The size, in bytes, of Buffer.
 
-  @return Unused FIT Microcode entrypoint.
+  @retval EFI_SUCCESS       The range is written.
+  @retval Others            The range may be partially written.
 **/
-CPU_MICROCODE_HEADER *
-FindUnusedFitMicrocode (
-  IN MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate,
-  IN UINTN                       ImageSize,
-  OUT UINTN                      *AvailableSize
+EFI_STATUS
+MicrocodeSlotFlashWrite (
+  IN VOID   *Context,
+  IN UINTN  Address,
+  IN VOID   *Buffer,
+  IN UINTN  Length
   )
 {
-  UINTN                 Index;
-  CPU_MICROCODE_HEADER  *MicrocodeEntryPoint;
-  CPU_MICROCODE_HEADER  *NextMicrocodeEntryPoint;
-  VOID                  *MicrocodePatchAddress;
-  UINTN                 MicrocodePatchRegionSize;
+  MICROCODE_SLOT_CONTEXT  *SlotContext;
+  UINT32                  LastAttemptStatus;
 
-  MicrocodePatchAddress    = MicrocodeFmpPrivate->MicrocodePatchAddress;
-  MicrocodePatchRegionSize = MicrocodeFmpPrivate->MicrocodePatchRegionSize;
+  SlotContext = Context;
+  return UpdateMicrocode (SlotContext->MicrocodeFmpPrivate, Address, Buffer, Length, &LastAttemptStatus);
+}
 
-  for (Index = 0; Index < MicrocodeFmpPrivate->FitMicrocodeEntryCount; Index++) {
-    if (!MicrocodeFmpPrivate->FitMicrocodeInfo[Index].InUse) {
-      MicrocodeEntryPoint     = MicrocodeFmpPrivate->FitMicrocodeInfo[Index].MicrocodeEntryPoint;
-      NextMicrocodeEntryPoint = GetNextFitMicrocode (MicrocodeFmpPrivate, MicrocodeEntryPoint);
-      if (NextMicrocodeEntryPoint != NULL) {
-        *AvailableSize = (UINTN)NextMicrocodeEntryPoint - (UINTN)MicrocodeEntryPoint;
-      } else {
-        *AvailableSize = (UINTN)MicrocodePatchAddress + MicrocodePatchRegionSize - (UINTN)MicrocodeEntryPoint;
-      }
+/**
+  Read a range of the Microcode region for an A/B slot update.
 
-      if (*AvailableSize >= ImageSize) {
-        return MicrocodeEntryPoint;
-      }
-    }
-  }
+  @param[in]  Context       The MICROCODE_SLOT_CONTEXT of the update.
+  @param[in]  Address       The flash address to read.
+  @param[out] Buffer        The buffer to receive the data.
+  @param[in]  Length        The size, in bytes, of Buffer.
 
-  return NULL;
+  @retval EFI_SUCCESS       The range is read.
+**/
+EFI_STATUS
+MicrocodeSlotFlashRead (
+  IN  VOID   *Context,
+  IN  UINTN  Address,
+  OUT VOID   *Buffer,
+  IN  UINTN  Length
+  )
+{
+  CopyMem (Buffer, (VOID *)Address, Length);
+  return EFI_SUCCESS;
 }
 
 /**
-  Get current Microcode used region size.
+  Load a staged Microcode on the test processor of an A/B slot update.
 
-  @param[in]  MicrocodeFmpPrivate        The Microcode driver private data
+  @param[in]  Context       The MICROCODE_SLOT_CONTEXT of the update.
+  @param[in]  Image         The Microcode image. It is 16 bytes aligned.
+  @param[in]  ImageSize     The size, in bytes, of Image.
 
-  @return current Microcode used region size.
+  @return The Microcode revision of the test processor after the load.
 **/
-UINTN
-GetCurrentMicrocodeUsedRegionSize (
-  IN MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate
+UINT32
+MicrocodeSlotFlashLoadTest (
+  IN VOID   *Context,
+  IN VOID   *Image,
+  IN UINTN  ImageSize
   )
 {
-  if (MicrocodeFmpPrivate->DescriptorCount == 0) {
-    return 0;
-  }
+  MICROCODE_SLOT_CONTEXT  *SlotContext;
+
+  SlotContext = Context;
+  DEBUG ((DEBUG_INFO, "MicrocodeSlotFlashLoadTest: Load on CPU 0x%x\n", SlotContext->LoadTestCpuIndex));
+  return LoadMicrocodeOnThis (
+           SlotContext->MicrocodeFmpPrivate,
+           SlotContext->LoadTestCpuIndex,
+           (UINTN)Image + sizeof (CPU_MICROCODE_HEADER)
+           );
+}
 
-  return (UINTN)MicrocodeFmpPrivate->MicrocodeInfo[MicrocodeFmpPrivate->DescriptorCount - 1].MicrocodeEntryPoint
-         + (UINTN)MicrocodeFmpPrivate->MicrocodeInfo[MicrocodeFmpPrivate->DescriptorCount - 1].TotalSize
-         - (UINTN)MicrocodeFmpPrivate->MicrocodePatchAddress;
+/**
+  Initialize the context of an A/B slot update.
+
+  VerifyMicrocode() has already loaded the new Microcode on the target
+  processor. The staged copy is load-tested on an Application Processor of
+  the same class on another core if there is one, so that the test load
+  really moves a processor to the new revision.
+
+  @param[out] SlotContext                The context of the update.
+  @param[in]  MicrocodeFmpPrivate        The Microcode driver private data
+  @param[in]  TargetCpuIndex             The processor the Microcode was verified on.
+**/
+VOID
+InitMicrocodeSlotContext (
+  OUT MICROCODE_SLOT_CONTEXT      *SlotContext,
+  IN  MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate,
+  IN  UINTN                       TargetCpuIndex
+  )
+{
+  PROCESSOR_INFO  *ProcessorInfo;
+  PROCESSOR_INFO  *TargetInfo;
+  UINTN           Index;
+
+  ZeroMem (SlotContext, sizeof (*SlotContext));
+  SlotContext->MicrocodeFmpPrivate = MicrocodeFmpPrivate;
+  SlotContext->LoadTestCpuIndex    = TargetCpuIndex;
+  SlotContext->Flash.Write         = MicrocodeSlotFlashWrite;
+  SlotContext->Flash.Read          = MicrocodeSlotFlashRead;
+  SlotContext->Flash.LoadTest      = MicrocodeSlotFlashLoadTest;
+  SlotContext->Flash.Context       = SlotContext;
+
+  ProcessorInfo = MicrocodeFmpPrivate->ProcessorInfo;
+  TargetInfo    = &ProcessorInfo[TargetCpuIndex];
+  for (Index = 0; Index < MicrocodeFmpPrivate->ProcessorCount; Index++) {
+    if ((Index != MicrocodeFmpPrivate->BspIndex) &&
+        ProcessorInfo[Index].FirstThreadInCore &&
+        (ProcessorInfo[Index].ClassIndex == TargetInfo->ClassIndex) &&
+        ((ProcessorInfo[Index].Location.Package != TargetInfo->Location.Package) ||
+         (ProcessorInfo[Index].Location.Core != TargetInfo->Location.Core)))
+    {
+      SlotContext->LoadTestCpuIndex = Index;
+      break;
+    }
+  }
 }
 
 /**
-  Update Microcode.
+  Update Microcode in a FIT slot other than the one in use.
 
-  @param[in]   Address            The flash address of Microcode.
-  @param[in]   Image              The Microcode image buffer.
-  @param[in]   ImageSize          The size of Microcode image buffer in bytes.
-  @param[out]  LastAttemptStatus  The last attempt status, which will be recorded in ESRT and FMP EFI_FIRMWARE_IMAGE_DESCRIPTOR.
+  The old Microcode is left in place as the rollback copy. The processors
+  pick the new Microcode by its higher revision.
 
-  @retval EFI_SUCCESS           The Microcode image is updated.
-  @retval EFI_WRITE_PROTECTED   The flash device is read only.
+  @param[in]  SlotContext                The context of the update.
+  @param[in]  SlotAddress                The flash address of the slot.
+  @param[in]  SlotSize                   The size of the slot in bytes.
+  @param[in]  Image                      The Microcode image buffer.
+  @param[in]  ImageSize                  The size of Microcode image buffer in bytes.
+  @param[out] LastAttemptStatus          The last attempt status, which will be recorded in ESRT and FMP EFI_FIRMWARE_IMAGE_DESCRIPTOR.
+
+  @retval EFI_SUCCESS             The Microcode image is written and committed.
+  @retval EFI_OUT_OF_RESOURCES    There are not enough resources.
+  @retval EFI_SECURITY_VIOLATION  The staged Microcode fails to load. The slot is rolled back.
+  @retval Others                  The slot cannot be written. The slot is rolled back.
 **/
 EFI_STATUS
-UpdateMicrocode (
-  IN UINT64   Address,
-  IN VOID     *Image,
-  IN UINTN    ImageSize,
-  OUT UINT32  *LastAttemptStatus
+UpdateMicrocodeSlot (
+  IN  MICROCODE_SLOT_CONTEXT  *SlotContext,
+  IN  UINTN                   SlotAddress,
+  IN  UINTN                   SlotSize,
+  IN  VOID                    *Image,
+  IN  UINTN                   ImageSize,
+  OUT UINT32                  *LastAttemptStatus
   )
 {
   EFI_STATUS  Status;
 
-  DEBUG ((DEBUG_INFO, "PlatformUpdate:"));
-  DEBUG ((DEBUG_INFO, "  Address - 0x%lx,", Address));
-  DEBUG ((DEBUG_INFO, "  Length - 0x%x\n", ImageSize));
-
-  Status = MicrocodeFlashWrite (
-             Address,
+  //
+  // The commit area is the first erase block of the slot, which covers the
+  // Microcode header, so the commit is a single block write.
+  //
+  Status = InitMicrocodeSlotUpdate (
+             &SlotContext->Update,
+             &SlotContext->Flash,
+             SlotAddress,
+             SlotSize,
+             MAX ((UINTN)PcdGet32 (PcdMicrocodeFlashBlockSize), sizeof (CPU_MICROCODE_HEADER)),
              Image,
-             ImageSize
+             ImageSize,
+             ((CPU_MICROCODE_HEADER *)Image)->UpdateRevision
              );
+  if (EFI_ERROR (Status)) {
+    *LastAttemptStatus = LAST_ATTEMPT_STATUS_ERROR_INSUFFICIENT_RESOURCES;
+    return Status;
+  }
+
+  Status = MicrocodeSlotRun (&SlotContext->Update);
   if (!EFI_ERROR (Status)) {
     *LastAttemptStatus = LAST_ATTEMPT_STATUS_SUCCESS;
+  } else if (Status == EFI_SECURITY_VIOLATION) {
+    *LastAttemptStatus = LAST_ATTEMPT_STATUS_ERROR_AUTH_ERROR;
   } else {
     *LastAttemptStatus = LAST_ATTEMPT_STATUS_ERROR_UNSUCCESSFUL;
   }
@@ -839,10 +1680,18 @@ UpdateMicrocode (
 /**
   Update Microcode flash region with FIT.
 
+  An empty FIT slot, or an unused one holding a Microcode for the same
+  processor, is preferred, so that the update is staged and tested before it
+  is committed and the old Microcode stays available for rollback. If there
+  is no such slot, the old Microcode is replaced in situ. An unused slot
+  holding the Microcode of another processor is only taken if the new
+  Microcode does not fit in situ.
+
   @param[in]  MicrocodeFmpPrivate        The Microcode driver private data
   @param[in]  TargetMicrocodeEntryPoint  Target Microcode entrypoint to be updated
   @param[in]  Image                      The Microcode image buffer.
   @param[in]  ImageSize                  The size of Microcode image buffer in bytes.
+  @param[in]  SlotContext                The context used if the update goes to another slot.
   @param[out] LastAttemptStatus          The last attempt status, which will be recorded in ESRT and FMP EFI_FIRMWARE_IMAGE_DESCRIPTOR.
 
   @retval EFI_SUCCESS             The Microcode image is written.
@@ -854,6 +1703,7 @@ UpdateMicrocodeFlashRegionWithFit (
   IN  CPU_MICROCODE_HEADER        *TargetMicrocodeEntryPoint,
   IN  VOID                        *Image,
   IN  UINTN                       ImageSize,
+  IN  MICROCODE_SLOT_CONTEXT      *SlotContext,
   OUT UINT32                      *LastAttemptStatus
   )
 {
@@ -875,15 +1725,40 @@ UpdateMicrocodeFlashRegionWithFit (
   MicrocodePatchAddress    = MicrocodeFmpPrivate->MicrocodePatchAddress;
   MicrocodePatchRegionSize = MicrocodeFmpPrivate->MicrocodePatchRegionSize;
 
-  MicrocodePatchScratchBuffer = AllocateZeroPool (MicrocodePatchRegionSize);
-  if (MicrocodePatchScratchBuffer == NULL) {
-    DEBUG ((DEBUG_ERROR, "Fail to allocate Microcode Scratch buffer\n"));
-    *LastAttemptStatus = LAST_ATTEMPT_STATUS_ERROR_INSUFFICIENT_RESOURCES;
-    return EFI_OUT_OF_RESOURCES;
+  //
+  // Update based on policy
+  //
+
+  //
+  // 1. If there is empty FIT microcode entry with enough space, stage the new
+  //    microcode in the one FindFitMicrocodeSlot() picks.
+  //
+  // +------+------------+------+===================+
+  // |Other | Old Image  | ...  |  Empty FIT entry  |
+  // +------+------------+------+===================+
+  //
+  // +------+------------+------+-----------+-------+
+  // |Other | Old Image  | ...  | New Image |  FF   |
+  // +------+------------+------+-----------+-------+
+  //
+  EmptyFitMicrocodeEntry = FindFitMicrocodeSlot (MicrocodeFmpPrivate, ImageSize, TRUE, NULL, &AvailableSize);
+  if (EmptyFitMicrocodeEntry != NULL) {
+    DEBUG ((DEBUG_INFO, "Stage new microcode in empty FIT microcode entry\n"));
+    return UpdateMicrocodeSlot (SlotContext, (UINTN)EmptyFitMicrocodeEntry, AvailableSize, Image, ImageSize, LastAttemptStatus);
   }
 
-  ScratchBufferPtr  = MicrocodePatchScratchBuffer;
-  ScratchBufferSize = 0;
+  //
+  // 2. If there is unused FIT microcode entry with enough space that holds a
+  //    microcode for the same processor, stage the new microcode in the one
+  //    FindFitMicrocodeSlot() picks. This is usually the rollback copy kept
+  //    by the previous update, which no processor uses once the new
+  //    microcode is loaded.
+  //
+  UnusedFitMicrocodeEntry = FindFitMicrocodeSlot (MicrocodeFmpPrivate, ImageSize, FALSE, (CPU_MICROCODE_HEADER *)Image, &AvailableSize);
+  if (UnusedFitMicrocodeEntry != NULL) {
+    DEBUG ((DEBUG_INFO, "Stage new microcode in unused FIT microcode entry\n"));
+    return UpdateMicrocodeSlot (SlotContext, (UINTN)UnusedFitMicrocodeEntry, AvailableSize, Image, ImageSize, LastAttemptStatus);
+  }
 
   //
   // Target data collection
@@ -931,11 +1806,8 @@ UpdateMicrocodeFlashRegionWithFit (
   //
 
   //
-  // Update based on policy
-  //
-
-  //
-  // 1. If there is enough space to update old one in situ, replace old microcode in situ.
+  // 3. If there is enough space to update old one in situ, replace old microcode in situ.
+  //    There is no free slot, so no rollback copy is kept.
   //
   if (AvailableSize >= ImageSize) {
     DEBUG ((DEBUG_INFO, "Replace old microcode in situ\n"));
@@ -948,33 +1820,20 @@ UpdateMicrocodeFlashRegionWithFit (
     // |Other |New Image|FF| ...  |      Empty        |
     // +------+---------+--+------+===================+
     //
-    // 1.1. Copy new image
-    CopyMem (ScratchBufferPtr, Image, ImageSize);
-    ScratchBufferSize += ImageSize;
-    ScratchBufferPtr   = (UINT8 *)MicrocodePatchScratchBuffer + ScratchBufferSize;
-    // 1.2. Pad 0xFF
-    RestSize = AvailableSize - ImageSize;
-    if (RestSize > 0) {
-      SetMem (ScratchBufferPtr, RestSize, 0xFF);
-      ScratchBufferSize += RestSize;
-      ScratchBufferPtr   = (UINT8 *)MicrocodePatchScratchBuffer + ScratchBufferSize;
+    MicrocodePatchScratchBuffer = AllocateZeroPool (AvailableSize);
+    if (MicrocodePatchScratchBuffer == NULL) {
+      DEBUG ((DEBUG_ERROR, "Fail to allocate Microcode Scratch buffer\n"));
+      *LastAttemptStatus = LAST_ATTEMPT_STATUS_ERROR_INSUFFICIENT_RESOURCES;
+      return EFI_OUT_OF_RESOURCES;
     }
 
-    Status = UpdateMicrocode ((UINTN)TargetMicrocodeEntryPoint, MicrocodePatchScratchBuffer, ScratchBufferSize, LastAttemptStatus);
-    return Status;
-  }
-
-  //
-  // 2. If there is empty FIT microcode entry with enough space, use it.
-  //
-  EmptyFitMicrocodeEntry = FindEmptyFitMicrocode (MicrocodeFmpPrivate, ImageSize, &AvailableSize);
-  if (EmptyFitMicrocodeEntry != NULL) {
-    DEBUG ((DEBUG_INFO, "Use empty FIT microcode entry\n"));
-    // 2.1. Copy new image
+    ScratchBufferPtr  = MicrocodePatchScratchBuffer;
+    ScratchBufferSize = 0;
+    // 3.1. Copy new image
     CopyMem (ScratchBufferPtr, Image, ImageSize);
     ScratchBufferSize += ImageSize;
     ScratchBufferPtr   = (UINT8 *)MicrocodePatchScratchBuffer + ScratchBufferSize;
-    // 2.2. Pad 0xFF
+    // 3.2. Pad 0xFF
     RestSize = AvailableSize - ImageSize;
     if (RestSize > 0) {
       SetMem (ScratchBufferPtr, RestSize, 0xFF);
@@ -982,56 +1841,24 @@ UpdateMicrocodeFlashRegionWithFit (
       ScratchBufferPtr   = (UINT8 *)MicrocodePatchScratchBuffer + ScratchBufferSize;
     }
 
-    Status = UpdateMicrocode ((UINTN)EmptyFitMicrocodeEntry, MicrocodePatchScratchBuffer, ScratchBufferSize, LastAttemptStatus);
-    if (!EFI_ERROR (Status) && (TargetMicrocodeEntryPoint != NULL)) {
-      //
-      // Empty old microcode.
-      //
-      ScratchBufferPtr = MicrocodePatchScratchBuffer;
-      SetMem (ScratchBufferPtr, TargetTotalSize, 0xFF);
-      ScratchBufferSize = TargetTotalSize;
-      ScratchBufferPtr  = (UINT8 *)MicrocodePatchScratchBuffer + ScratchBufferSize;
-      UpdateMicrocode ((UINTN)TargetMicrocodeEntryPoint, MicrocodePatchScratchBuffer, ScratchBufferSize, LastAttemptStatus);
-    }
-
+    Status = UpdateMicrocode (MicrocodeFmpPrivate, (UINTN)TargetMicrocodeEntryPoint, MicrocodePatchScratchBuffer, ScratchBufferSize, LastAttemptStatus);
+    FreePool (MicrocodePatchScratchBuffer);
     return Status;
   }
 
   //
-  // 3. If there is unused microcode entry with enough space, use it.
+  // 4. If there is unused FIT microcode entry with enough space, stage the new
+  //    microcode in the one FindFitMicrocodeSlot() picks. It holds the
+  //    microcode of another processor, so it is only used as the last resort.
   //
-  UnusedFitMicrocodeEntry = FindUnusedFitMicrocode (MicrocodeFmpPrivate, ImageSize, &AvailableSize);
+  UnusedFitMicrocodeEntry = FindFitMicrocodeSlot (MicrocodeFmpPrivate, ImageSize, FALSE, NULL, &AvailableSize);
   if (UnusedFitMicrocodeEntry != NULL) {
-    DEBUG ((DEBUG_INFO, "Use unused FIT microcode entry\n"));
-    // 3.1. Copy new image
-    CopyMem (ScratchBufferPtr, Image, ImageSize);
-    ScratchBufferSize += ImageSize;
-    ScratchBufferPtr   = (UINT8 *)MicrocodePatchScratchBuffer + ScratchBufferSize;
-    // 3.2. Pad 0xFF
-    RestSize = AvailableSize - ImageSize;
-    if (RestSize > 0) {
-      SetMem (ScratchBufferPtr, RestSize, 0xFF);
-      ScratchBufferSize += RestSize;
-      ScratchBufferPtr   = (UINT8 *)MicrocodePatchScratchBuffer + ScratchBufferSize;
-    }
-
-    Status = UpdateMicrocode ((UINTN)UnusedFitMicrocodeEntry, MicrocodePatchScratchBuffer, ScratchBufferSize, LastAttemptStatus);
-    if (!EFI_ERROR (Status) && (TargetMicrocodeEntryPoint != NULL)) {
-      //
-      // Empty old microcode.
-      //
-      ScratchBufferPtr = MicrocodePatchScratchBuffer;
-      SetMem (ScratchBufferPtr, TargetTotalSize, 0xFF);
-      ScratchBufferSize = TargetTotalSize;
-      ScratchBufferPtr  = (UINT8 *)MicrocodePatchScratchBuffer + ScratchBufferSize;
-      UpdateMicrocode ((UINTN)TargetMicrocodeEntryPoint, MicrocodePatchScratchBuffer, ScratchBufferSize, LastAttemptStatus);
-    }
-
-    return Status;
+    DEBUG ((DEBUG_INFO, "Stage new microcode in unused FIT microcode entry of another processor\n"));
+    return UpdateMicrocodeSlot (SlotContext, (UINTN)UnusedFitMicrocodeEntry, AvailableSize, Image, ImageSize, LastAttemptStatus);
   }
 
   //
-  // 4. No usable FIT microcode entry.
+  // 5. No usable FIT microcode entry.
   //
   DEBUG ((DEBUG_ERROR, "No usable FIT microcode entry\n"));
   *LastAttemptStatus = LAST_ATTEMPT_STATUS_ERROR_INSUFFICIENT_RESOURCES;
@@ -1070,6 +1897,7 @@ UpdateMicrocodeFlashRegion (
   UINT8           *ScratchBufferPtr;
   UINTN           ScratchBufferSize;
   UINTN           RestSize;
+  UINTN           DataSize;
   UINTN           AvailableSize;
   VOID            *NextMicrocodeEntryPoint;
   MICROCODE_INFO  *MicrocodeInfo;
@@ -1176,7 +2004,16 @@ UpdateMicrocodeFlashRegion (
       ScratchBufferPtr   = (UINT8 *)MicrocodePatchScratchBuffer + ScratchBufferSize;
     }
 
-    Status = UpdateMicrocode ((UINTN)TargetMicrocodeEntryPoint, MicrocodePatchScratchBuffer, ScratchBufferSize, LastAttemptStatus);
+    Status = ReplaceMicrocode (
+               MicrocodeFmpPrivate,
+               (UINTN)TargetMicrocodeEntryPoint,
+               MicrocodePatchScratchBuffer,
+               ScratchBufferSize,
+               MAX ((UINTN)MicrocodePatchAddress + UsedRegionSize, (UINTN)TargetMicrocodeEntryPoint + ImageSize),
+               0,
+               ImageSize,
+               LastAttemptStatus
+               );
     return Status;
   }
 
@@ -1195,7 +2032,25 @@ UpdateMicrocodeFlashRegion (
       // |Other1|   Other    |Other2| New Image | Empty |
       // +------+------------+------+-----------+=======+
       //
-      Status = UpdateMicrocode ((UINTN)MicrocodePatchAddress + UsedRegionSize, Image, ImageSize, LastAttemptStatus);
+      Status = UpdateMicrocode (MicrocodeFmpPrivate, (UINTN)MicrocodePatchAddress + UsedRegionSize, Image, ImageSize, LastAttemptStatus);
+    } else if (MicrocodePatchRegionSize - UsedRegionSize >= ImageSize) {
+      DEBUG ((DEBUG_INFO, "Append new microcode and remove old microcode\n"));
+      //
+      // Nothing is moved, and the old image is only erased once the new one
+      // is in place.
+      //
+      // +------+------------+------+===================+
+      // |Other | Old Image  | ...  |      Empty        |
+      // +------+------------+------+===================+
+      //
+      // +------+------------+------+-----------+=======+
+      // |Other |     FF     | ...  | New Image | Empty |
+      // +------+------------+------+-----------+=======+
+      //
+      Status = UpdateMicrocode (MicrocodeFmpPrivate, (UINTN)MicrocodePatchAddress + UsedRegionSize, Image, ImageSize, LastAttemptStatus);
+      if (!EFI_ERROR (Status)) {
+        Status = EraseMicrocode (MicrocodeFmpPrivate, (UINTN)TargetMicrocodeEntryPoint, TargetTotalSize, LastAttemptStatus);
+      }
     } else {
       DEBUG ((DEBUG_INFO, "Reorg and replace old microcode\n"));
       //
@@ -1219,7 +2074,20 @@ UpdateMicrocodeFlashRegion (
         ScratchBufferPtr   = (UINT8 *)MicrocodePatchScratchBuffer + ScratchBufferSize;
       }
 
-      Status = UpdateMicrocode ((UINTN)TargetMicrocodeEntryPoint, MicrocodePatchScratchBuffer, ScratchBufferSize, LastAttemptStatus);
+      //
+      // The new image does not fit anywhere else, so only the moved images
+      // can be staged.
+      //
+      Status = ReplaceMicrocode (
+                 MicrocodeFmpPrivate,
+                 (UINTN)TargetMicrocodeEntryPoint,
+                 MicrocodePatchScratchBuffer,
+                 ScratchBufferSize,
+                 MAX ((UINTN)MicrocodePatchAddress + UsedRegionSize, (UINTN)TargetMicrocodeEntryPoint + ScratchBufferSize),
+                 ImageSize,
+                 ScratchBufferSize - ImageSize,
+                 LastAttemptStatus
+                 );
     }
 
     return Status;
@@ -1266,6 +2134,7 @@ UpdateMicrocodeFlashRegion (
     }
 
     // 3.3. Pad 0xFF
+    DataSize = ScratchBufferSize;
     RestSize = MicrocodePatchRegionSize - ScratchBufferSize;
     if (RestSize > 0) {
       SetMem (ScratchBufferPtr, RestSize, 0xFF);
@@ -1273,7 +2142,35 @@ UpdateMicrocodeFlashRegion (
       ScratchBufferPtr   = (UINT8 *)MicrocodePatchScratchBuffer + ScratchBufferSize;
     }
 
-    Status = UpdateMicrocode ((UINTN)MicrocodePatchAddress, MicrocodePatchScratchBuffer, ScratchBufferSize, LastAttemptStatus);
+    //
+    // All the kept images move, so they are staged with the new image past
+    // the new data, if the images dropped there leave room for them. The
+    // dropped images that reach past the new data are erased first, or the
+    // walk over the region could skip the staged copy behind their headers.
+    //
+    for (Index = 0; Index < MicrocodeCount; Index++) {
+      if (MicrocodeInfo[Index].InUse ||
+          ((UINTN)MicrocodeInfo[Index].MicrocodeEntryPoint + MicrocodeInfo[Index].TotalSize <= (UINTN)MicrocodePatchAddress + DataSize))
+      {
+        continue;
+      }
+
+      Status = EraseMicrocode (MicrocodeFmpPrivate, (UINTN)MicrocodeInfo[Index].MicrocodeEntryPoint, MicrocodeInfo[Index].TotalSize, LastAttemptStatus);
+      if (EFI_ERROR (Status)) {
+        return Status;
+      }
+    }
+
+    Status = ReplaceMicrocode (
+               MicrocodeFmpPrivate,
+               (UINTN)MicrocodePatchAddress,
+               MicrocodePatchScratchBuffer,
+               ScratchBufferSize,
+               (UINTN)MicrocodePatchAddress + DataSize,
+               0,
+               DataSize,
+               LastAttemptStatus
+               );
     return Status;
   }
 
@@ -1318,11 +2215,13 @@ MicrocodeWrite (
   OUT CHAR16                      **AbortReason
   )
 {
-  EFI_STATUS            Status;
-  VOID                  *AlignedImage;
-  CPU_MICROCODE_HEADER  *TargetMicrocodeEntryPoint;
-  UINTN                 TargetCpuIndex;
-  UINTN                 TargetMicrcodeIndex;
+  EFI_STATUS              Status;
+  VOID                    *AlignedImage;
+  CPU_MICROCODE_HEADER    *TargetMicrocodeEntryPoint;
+  UINTN                   TargetCpuIndex;
+  UINTN                   TargetMicrcodeIndex;
+  MICROCODE_SLOT_CONTEXT  SlotContext;
+  EFI_STATUS              LoadStatus;
 
   //
   // MCU must be 16 bytes aligned
@@ -1358,12 +2257,14 @@ MicrocodeWrite (
 
   DEBUG ((DEBUG_INFO, "  TargetMicrocodeEntryPoint - 0x%x\n", TargetMicrocodeEntryPoint));
 
+  InitMicrocodeSlotContext (&SlotContext, MicrocodeFmpPrivate, TargetCpuIndex);
   if (MicrocodeFmpPrivate->FitMicrocodeInfo != NULL) {
     Status = UpdateMicrocodeFlashRegionWithFit (
                MicrocodeFmpPrivate,
                TargetMicrocodeEntryPoint,
                AlignedImage,
                ImageSize,
+               &SlotContext,
                LastAttemptStatus
                );
   } else {
@@ -1376,6 +2277,26 @@ MicrocodeWrite (
                );
   }
 
+  //
+  // The new Microcode is in flash. Load it on the rest of the cores too, so
+  // that they do not keep running the old one until the next reset.
+  //
+  if (!EFI_ERROR (Status)) {
+    LoadStatus = LoadMicrocodeOnAllProcessors (MicrocodeFmpPrivate, AlignedImage, ImageSize);
+
+    //
+    // If some cores reject the new Microcode, roll an A/B slot update back,
+    // so that the old Microcode in the other slot is used from the next boot.
+    //
+    if ((LoadStatus == EFI_DEVICE_ERROR) && (SlotContext.Update.State == MicrocodeSlotCommitted)) {
+      DEBUG ((DEBUG_ERROR, "Roll back new microcode at 0x%x\n", SlotContext.Update.SlotAddress));
+      MicrocodeSlotRollback (&SlotContext.Update);
+      *LastAttemptStatus = LAST_ATTEMPT_STATUS_ERROR_UNSUCCESSFUL;
+      Status             = EFI_DEVICE_ERROR;
+    }
+  }
+
+  FreeMicrocodeSlotUpdate (&SlotContext.Update);
   FreePool (AlignedImage);
 
   return Status;
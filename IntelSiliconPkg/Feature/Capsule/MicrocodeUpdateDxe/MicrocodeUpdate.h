@@ -31,11 +31,14 @@
 #include <Library/DevicePathLib.h>
 #include <Library/HobLib.h>
 #include <Library/MicrocodeFlashAccessLib.h>
+#include <Library/MicrocodeChecksumLib.h>
 
 #include <Register/Cpuid.h>
 #include <Register/Msr.h>
 #include <Register/Microcode.h>
 
+#include "MicrocodeSlot.h"
+
 #define MICROCODE_FMP_PRIVATE_DATA_SIGNATURE  SIGNATURE_32('M', 'C', 'U', 'F')
 
 //
@@ -51,8 +54,25 @@ typedef struct {
   CPU_MICROCODE_HEADER    *MicrocodeEntryPoint;
   UINTN                   TotalSize;
   BOOLEAN                 InUse;
+  //
+  // The patch passes the processor independent format and checksum checks.
+  //
+  BOOLEAN                 Verified;
 } MICROCODE_INFO;
 
+//
+// One entry for each processor signature supported by a verified Microcode
+// patch, including the extended signatures. The index is sorted by
+// ProcessorSignature, and entries with the same signature keep the order of
+// the patches in the Microcode region.
+//
+typedef struct {
+  UINT32    ProcessorSignature;
+  UINT32    ProcessorFlags;
+  UINT32    UpdateRevision;
+  UINTN     MicrocodeIndex;
+} MICROCODE_PATCH_INDEX_ENTRY;
+
 typedef struct {
   CPU_MICROCODE_HEADER    *MicrocodeEntryPoint;
   UINTN                   TotalSize;
@@ -61,18 +81,55 @@ typedef struct {
 } FIT_MICROCODE_INFO;
 
 typedef struct {
-  UINTN     CpuIndex;
+  UINTN                        CpuIndex;
+  UINT32                       ProcessorSignature;
+  UINT8                        PlatformId;
+  UINT32                       MicrocodeRevision;
+  UINTN                        MicrocodeIndex;
+  UINTN                        ClassIndex;
+  EFI_CPU_PHYSICAL_LOCATION    Location;
+  //
+  // Threads of one core share the Microcode, so a new patch is only loaded
+  // on the first enabled thread of every core.
+  //
+  BOOLEAN                      FirstThreadInCore;
+} PROCESSOR_INFO;
+
+//
+// Processors with the same signature, platform ID and Microcode revision
+// match the same Microcode patches, so matching is done once per class.
+//
+typedef struct {
   UINT32    ProcessorSignature;
   UINT8     PlatformId;
   UINT32    MicrocodeRevision;
+  //
+  // The first processor of the class.
+  //
+  UINTN     CpuIndex;
   UINTN     MicrocodeIndex;
-} PROCESSOR_INFO;
+} PROCESSOR_CLASS_INFO;
 
 typedef struct {
   UINT64    Address;
   UINT32    Revision;
 } MICROCODE_LOAD_BUFFER;
 
+typedef struct {
+  BOOLEAN    Load;
+  UINT32     Revision;
+} MICROCODE_LOAD_RESULT;
+
+//
+// Buffer shared by all Application Processors in a parallel Microcode load.
+// Each processor finds its own Result entry with WhoAmI().
+//
+typedef struct {
+  EFI_MP_SERVICES_PROTOCOL    *MpService;
+  UINT64                      Address;
+  MICROCODE_LOAD_RESULT       *Result;
+} MICROCODE_LOAD_ALL_BUFFER;
+
 struct _MICROCODE_FMP_PRIVATE_DATA {
   UINT32                                 Signature;
   EFI_FIRMWARE_MANAGEMENT_PROTOCOL       Fmp;
@@ -89,12 +146,40 @@ struct _MICROCODE_FMP_PRIVATE_DATA {
   UINTN                                  BspIndex;
   UINTN                                  ProcessorCount;
   PROCESSOR_INFO                         *ProcessorInfo;
+  UINTN                                  ProcessorClassCount;
+  PROCESSOR_CLASS_INFO                   *ProcessorClassInfo;
   UINT32                                 FitMicrocodeEntryCount;
   FIT_MICROCODE_INFO                     *FitMicrocodeInfo;
+  UINTN                                  MicrocodePatchIndexCount;
+  MICROCODE_PATCH_INDEX_ENTRY            *MicrocodePatchIndex;
+  //
+  // The part of the Microcode region written since the Microcode information
+  // was last collected. Patches outside of it keep their verification result.
+  //
+  UINTN                                  DirtyRegionBase;
+  UINTN                                  DirtyRegionSize;
+  //
+  // The address the FIT pointer is read from. InitializePrivateData() sets
+  // it to FIT_POINTER_ADDRESS unless the caller has set it already.
+  //
+  UINTN                                  FitPointerAddress;
 };
 
 typedef struct _MICROCODE_FMP_PRIVATE_DATA MICROCODE_FMP_PRIVATE_DATA;
 
+//
+// The context of an A/B slot update in a FIT based Microcode region.
+//
+typedef struct {
+  MICROCODE_FMP_PRIVATE_DATA    *MicrocodeFmpPrivate;
+  //
+  // The processor the staged Microcode is load-tested on.
+  //
+  UINTN                         LoadTestCpuIndex;
+  MICROCODE_SLOT_FLASH          Flash;
+  MICROCODE_SLOT_UPDATE         Update;
+} MICROCODE_SLOT_CONTEXT;
+
 #define MICROCODE_FMP_LAST_ATTEMPT_VARIABLE_NAME  L"MicrocodeLastAttemptVar"
 
 /**
@@ -145,15 +230,14 @@ CollectProcessorInfo (
 /**
   Get current Microcode information.
 
-  The ProcessorInformation (BspIndex/ProcessorCount/ProcessorInfo)
-  in MicrocodeFmpPrivate must be initialized.
+  Only the Microcode headers are walked. The patches are not verified, so
+  InUse and Verified in MicrocodeInfo are left FALSE.
 
   The MicrocodeInformation (DescriptorCount/ImageDescriptor/MicrocodeInfo)
   in MicrocodeFmpPrivate may not be avaiable in this function.
 
   @param[in]   MicrocodeFmpPrivate        The Microcode driver private data
-  @param[in]   DescriptorCount            The count of Microcode ImageDescriptor allocated.
-  @param[out]  ImageDescriptor            Microcode ImageDescriptor
+  @param[in]   DescriptorCount            The count of Microcode information allocated.
   @param[out]  MicrocodeInfo              Microcode information
 
   @return Microcode count
@@ -162,10 +246,54 @@ UINTN
 GetMicrocodeInfo (
   IN  MICROCODE_FMP_PRIVATE_DATA *MicrocodeFmpPrivate,
   IN  UINTN DescriptorCount, OPTIONAL
-  OUT EFI_FIRMWARE_IMAGE_DESCRIPTOR  *ImageDescriptor, OPTIONAL
   OUT MICROCODE_INFO                 *MicrocodeInfo    OPTIONAL
   );
 
+/**
+  Check the processor independent format and checksum of a Microcode image.
+
+  Caution: This function may receive untrusted input.
+
+  @param[in]  Image                      The Microcode image buffer.
+  @param[in]  ImageSize                  The size of Microcode image buffer in bytes.
+  @param[out] LastAttemptStatus          The last attempt status, which will be recorded in ESRT and FMP EFI_FIRMWARE_IMAGE_DESCRIPTOR.
+  @param[out] AbortReason                A pointer to a pointer to a null-terminated string providing more
+                                         details for the aborted operation. The buffer is allocated by this function
+                                         with AllocatePool(), and it is the caller's responsibility to free it with a
+                                         call to FreePool().
+
+  @retval EFI_SUCCESS               The Microcode image passes the checks.
+  @retval EFI_VOLUME_CORRUPTED      The Microcode image is corrupt.
+  @retval EFI_INCOMPATIBLE_VERSION  The Microcode image version is incorrect.
+**/
+EFI_STATUS
+CheckMicrocodeFormat (
+  IN  VOID *Image,
+  IN  UINTN ImageSize,
+  OUT UINT32 *LastAttemptStatus,
+  OUT CHAR16                     **AbortReason  OPTIONAL
+  );
+
+/**
+  Collect the processor signatures supported by a verified Microcode patch.
+
+  The signature in the Microcode header is always collected. The extended
+  signatures are collected if the extended table and the entry checksums
+  are correct.
+
+  @param[in]   MicrocodeFmpPrivate        The Microcode driver private data
+  @param[in]   MicrocodeIndex             The index of the patch in MicrocodeInfo.
+  @param[out]  IndexEntry                 The buffer to receive the index entries.
+
+  @return The number of index entries for the patch.
+**/
+UINTN
+CollectMicrocodePatchSignatures (
+  IN  MICROCODE_FMP_PRIVATE_DATA   *MicrocodeFmpPrivate,
+  IN  UINTN                        MicrocodeIndex,
+  OUT MICROCODE_PATCH_INDEX_ENTRY  *IndexEntry  OPTIONAL
+  );
+
 /**
   Verify Microcode.
 
@@ -200,6 +328,30 @@ VerifyMicrocode (
   IN OUT UINTN                    *TargetCpuIndex  OPTIONAL
   );
 
+/**
+  Load a verified Microcode on every core it applies to.
+
+  The Application Processors are started in non-blocking mode and the BSP
+  loads its own core while they run. Only the first thread of each core of
+  a processor class that matches the Microcode loads it. The loaded revision
+  of every such thread is collected and only the mismatches are reported.
+
+  @param[in]  MicrocodeFmpPrivate        The Microcode driver private data
+  @param[in]  Image                      The Microcode image buffer. It must be 16 bytes aligned.
+  @param[in]  ImageSize                  The size of Microcode image buffer in bytes.
+
+  @retval EFI_SUCCESS               The Microcode is loaded on all the selected cores.
+  @retval EFI_NOT_FOUND             No core needs the Microcode.
+  @retval EFI_OUT_OF_RESOURCES      There are not enough resources.
+  @retval EFI_DEVICE_ERROR          The Microcode revision of some cores does not match after the load.
+**/
+EFI_STATUS
+LoadMicrocodeOnAllProcessors (
+  IN  MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate,
+  IN  VOID                        *Image,
+  IN  UINTN                       ImageSize
+  );
+
 /**
   Write Microcode.
 
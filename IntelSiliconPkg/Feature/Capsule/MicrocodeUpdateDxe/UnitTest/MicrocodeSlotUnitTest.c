@@ -0,0 +1,547 @@
+/** @file
+UnitTest for...
+A/B staged Microcode slot update.
+
+The state machine runs against a simulated flash with two slots. The
+simulated processor accepts a Microcode whose dwords sum to zero, and the
+flash can drop the writes after a number of bytes to simulate a power loss.
+
+Copyright (c) Microsoft Corporation.
+SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <Uefi.h>
+#include <Library/DebugLib.h>
+#include <Library/UnitTestLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+
+#include "../MicrocodeSlot.h"
+
+#ifndef INTERNAL_UNIT_TEST
+  #error Make sure to build thie with INTERNAL_UNIT_TEST enabled! Otherwise, some important tests may be skipped!
+#endif
+
+#define UNIT_TEST_NAME     "Microcode Slot UnitTest"
+#define UNIT_TEST_VERSION  "0.9"
+
+/// === TEST DATA ==================================================================================
+
+//
+// Slot A holds the old Microcode and slot B is empty.
+//
+#define TEST_SLOT_SIZE       0x4000
+#define TEST_FLASH_SIZE      (TEST_SLOT_SIZE * 2)
+#define TEST_COMMIT_SIZE     0x1000
+#define TEST_OLD_SIZE        0x3000
+#define TEST_NEW_SIZE        0x3400
+#define TEST_OLD_REVISION    0x10
+#define TEST_NEW_REVISION    0x11
+#define TEST_HEADER_VERSION  0x1
+
+//
+// The step, in bytes, between the simulated power losses.
+//
+#define TEST_POWER_LOSS_STEP  0x200
+
+typedef struct {
+  UINT8      *Base;
+  //
+  // The number of bytes written before the power is lost, or MAX_UINTN.
+  //
+  UINTN      ByteBudget;
+  BOOLEAN    PowerLost;
+  //
+  // A flash offset whose next write is corrupted, or MAX_UINTN.
+  //
+  UINTN      CorruptOffset;
+  UINT32     CpuRevision;
+  UINTN      WriteCount;
+} SIMULATED_FLASH;
+
+STATIC SIMULATED_FLASH  mFlash;
+STATIC UINT8            *mOldImage;
+STATIC UINT8            *mNewImage;
+
+/// === HELPER FUNCTIONS ===========================================================================
+
+/**
+  Write a range of the simulated flash.
+**/
+STATIC
+EFI_STATUS
+SimulatedFlashWrite (
+  IN VOID   *Context,
+  IN UINTN  Address,
+  IN VOID   *Buffer,
+  IN UINTN  Length
+  )
+{
+  SIMULATED_FLASH  *Flash;
+  UINTN            Offset;
+  UINTN            Index;
+
+  Flash  = Context;
+  Offset = Address - (UINTN)Flash->Base;
+  if (Flash->PowerLost || (Offset + Length > TEST_FLASH_SIZE)) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  Flash->WriteCount++;
+  for (Index = 0; Index < Length; Index++) {
+    if (Flash->ByteBudget == 0) {
+      Flash->PowerLost = TRUE;
+      return EFI_DEVICE_ERROR;
+    }
+
+    if (Flash->ByteBudget != MAX_UINTN) {
+      Flash->ByteBudget--;
+    }
+
+    Flash->Base[Offset + Index] = ((UINT8 *)Buffer)[Index];
+    if (Offset + Index == Flash->CorruptOffset) {
+      Flash->Base[Offset + Index] ^= 0x5A;
+      Flash->CorruptOffset         = MAX_UINTN;
+    }
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Read a range of the simulated flash.
+**/
+STATIC
+EFI_STATUS
+SimulatedFlashRead (
+  IN  VOID   *Context,
+  IN  UINTN  Address,
+  OUT VOID   *Buffer,
+  IN  UINTN  Length
+  )
+{
+  CopyMem (Buffer, (VOID *)Address, Length);
+  return EFI_SUCCESS;
+}
+
+/**
+  Return if the simulated processor accepts a Microcode.
+**/
+STATIC
+BOOLEAN
+IsLoadable (
+  IN CONST UINT8  *Image,
+  IN UINTN        ImageSize
+  )
+{
+  return (BOOLEAN)((((UINT32 *)Image)[0] == TEST_HEADER_VERSION) &&
+                   (CalculateSum32 ((UINT32 *)Image, ImageSize) == 0));
+}
+
+/**
+  Load a Microcode on the simulated processor.
+**/
+STATIC
+UINT32
+SimulatedLoadTest (
+  IN VOID   *Context,
+  IN VOID   *Image,
+  IN UINTN  ImageSize
+  )
+{
+  SIMULATED_FLASH  *Flash;
+
+  Flash = Context;
+  if (IsLoadable (Image, ImageSize)) {
+    Flash->CpuRevision = ((UINT32 *)Image)[1];
+  }
+
+  return Flash->CpuRevision;
+}
+
+STATIC MICROCODE_SLOT_FLASH  mSlotFlash = {
+  SimulatedFlashWrite,
+  SimulatedFlashRead,
+  SimulatedLoadTest,
+  &mFlash
+};
+
+/**
+  Build a Microcode image whose dwords sum to zero.
+**/
+STATIC
+UINT8 *
+BuildImage (
+  IN UINTN   ImageSize,
+  IN UINT32  Revision
+  )
+{
+  UINT32  *Image;
+  UINTN   Index;
+  UINTN   Count;
+
+  Image = AllocatePool (ImageSize);
+  if (Image == NULL) {
+    return NULL;
+  }
+
+  Count = ImageSize / sizeof (UINT32);
+  for (Index = 0; Index < Count; Index++) {
+    Image[Index] = (UINT32)(Index * 0x9E3779B9 + Revision);
+  }
+
+  Image[0]         = TEST_HEADER_VERSION;
+  Image[1]         = Revision;
+  Image[Count - 1] = 0;
+  Image[Count - 1] = (UINT32)(0 - CalculateSum32 (Image, ImageSize));
+  return (UINT8 *)Image;
+}
+
+/**
+  Reset the simulated flash with the old Microcode in slot A.
+**/
+STATIC
+VOID
+ResetFlash (
+  VOID
+  )
+{
+  SetMem (mFlash.Base, TEST_FLASH_SIZE, 0xFF);
+  CopyMem (mFlash.Base, mOldImage, TEST_OLD_SIZE);
+  mFlash.ByteBudget    = MAX_UINTN;
+  mFlash.PowerLost     = FALSE;
+  mFlash.CorruptOffset = MAX_UINTN;
+  mFlash.CpuRevision   = TEST_OLD_REVISION;
+  mFlash.WriteCount    = 0;
+}
+
+/**
+  Initialize a slot update of the new Microcode to slot B.
+**/
+STATIC
+EFI_STATUS
+InitSlotBUpdate (
+  OUT MICROCODE_SLOT_UPDATE  *Update
+  )
+{
+  return InitMicrocodeSlotUpdate (
+           Update,
+           &mSlotFlash,
+           (UINTN)mFlash.Base + TEST_SLOT_SIZE,
+           TEST_SLOT_SIZE,
+           TEST_COMMIT_SIZE,
+           mNewImage,
+           TEST_NEW_SIZE,
+           TEST_NEW_REVISION
+           );
+}
+
+/**
+  Return if slot A still holds the old Microcode.
+**/
+STATIC
+BOOLEAN
+IsSlotAIntact (
+  VOID
+  )
+{
+  return (BOOLEAN)(CompareMem (mFlash.Base, mOldImage, TEST_OLD_SIZE) == 0);
+}
+
+/**
+  Return if slot B is erased.
+**/
+STATIC
+BOOLEAN
+IsSlotBErased (
+  VOID
+  )
+{
+  UINTN  Index;
+
+  for (Index = TEST_SLOT_SIZE; Index < TEST_FLASH_SIZE; Index++) {
+    if (mFlash.Base[Index] != 0xFF) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/// === TEST CASES =================================================================================
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+ShouldCommitToOtherSlot (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  MICROCODE_SLOT_UPDATE  Update;
+
+  ResetFlash ();
+  UT_ASSERT_NOT_EFI_ERROR (InitSlotBUpdate (&Update));
+  UT_ASSERT_NOT_EFI_ERROR (MicrocodeSlotRun (&Update));
+  UT_ASSERT_EQUAL (Update.State, MicrocodeSlotCommitted);
+  UT_ASSERT_EQUAL (mFlash.CpuRevision, TEST_NEW_REVISION);
+
+  UT_ASSERT_TRUE (IsSlotAIntact ());
+  UT_ASSERT_MEM_EQUAL (mFlash.Base + TEST_SLOT_SIZE, mNewImage, TEST_NEW_SIZE);
+  UT_ASSERT_EQUAL (mFlash.Base[TEST_SLOT_SIZE + TEST_NEW_SIZE], 0xFF);
+
+  FreeMicrocodeSlotUpdate (&Update);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+ShouldEnforceStateOrder (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  MICROCODE_SLOT_UPDATE  Update;
+
+  ResetFlash ();
+  UT_ASSERT_EQUAL (
+    InitMicrocodeSlotUpdate (&Update, &mSlotFlash, (UINTN)mFlash.Base, TEST_OLD_SIZE - 4, TEST_COMMIT_SIZE, mOldImage, TEST_OLD_SIZE, TEST_OLD_REVISION),
+    EFI_INVALID_PARAMETER
+    );
+
+  UT_ASSERT_NOT_EFI_ERROR (InitSlotBUpdate (&Update));
+  UT_ASSERT_EQUAL (MicrocodeSlotVerify (&Update), EFI_NOT_READY);
+  UT_ASSERT_EQUAL (MicrocodeSlotLoadTest (&Update), EFI_NOT_READY);
+  UT_ASSERT_EQUAL (MicrocodeSlotCommit (&Update), EFI_NOT_READY);
+  UT_ASSERT_EQUAL (MicrocodeSlotRollback (&Update), EFI_NOT_READY);
+  UT_ASSERT_EQUAL (mFlash.WriteCount, 0);
+
+  UT_ASSERT_NOT_EFI_ERROR (MicrocodeSlotStage (&Update));
+  UT_ASSERT_EQUAL (MicrocodeSlotStage (&Update), EFI_NOT_READY);
+  UT_ASSERT_EQUAL (MicrocodeSlotCommit (&Update), EFI_NOT_READY);
+
+  //
+  // A staged slot is not a Microcode yet.
+  //
+  UT_ASSERT_FALSE (IsLoadable (mFlash.Base + TEST_SLOT_SIZE, TEST_NEW_SIZE));
+
+  FreeMicrocodeSlotUpdate (&Update);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+ShouldRollBackCorruptedStage (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  MICROCODE_SLOT_UPDATE  Update;
+
+  ResetFlash ();
+  mFlash.CorruptOffset = TEST_SLOT_SIZE + 0x2345;
+  UT_ASSERT_NOT_EFI_ERROR (InitSlotBUpdate (&Update));
+  UT_ASSERT_EQUAL (MicrocodeSlotRun (&Update), EFI_VOLUME_CORRUPTED);
+  UT_ASSERT_EQUAL (Update.State, MicrocodeSlotRolledBack);
+  UT_ASSERT_EQUAL (mFlash.CpuRevision, TEST_OLD_REVISION);
+
+  UT_ASSERT_TRUE (IsSlotAIntact ());
+  UT_ASSERT_TRUE (IsSlotBErased ());
+
+  FreeMicrocodeSlotUpdate (&Update);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+ShouldRollBackRejectedLoad (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  MICROCODE_SLOT_UPDATE  Update;
+
+  //
+  // The processor rejects a Microcode with a wrong checksum.
+  //
+  ResetFlash ();
+  mNewImage[0x100] ^= 0x01;
+  UT_ASSERT_NOT_EFI_ERROR (InitSlotBUpdate (&Update));
+  UT_ASSERT_EQUAL (MicrocodeSlotRun (&Update), EFI_SECURITY_VIOLATION);
+  mNewImage[0x100] ^= 0x01;
+
+  UT_ASSERT_EQUAL (Update.State, MicrocodeSlotRolledBack);
+  UT_ASSERT_EQUAL (mFlash.CpuRevision, TEST_OLD_REVISION);
+  UT_ASSERT_TRUE (IsSlotAIntact ());
+  UT_ASSERT_TRUE (IsSlotBErased ());
+
+  FreeMicrocodeSlotUpdate (&Update);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+ShouldRollBackCommittedUpdate (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  MICROCODE_SLOT_UPDATE  Update;
+
+  ResetFlash ();
+  UT_ASSERT_NOT_EFI_ERROR (InitSlotBUpdate (&Update));
+  UT_ASSERT_NOT_EFI_ERROR (MicrocodeSlotRun (&Update));
+  UT_ASSERT_TRUE (IsLoadable (mFlash.Base + TEST_SLOT_SIZE, TEST_NEW_SIZE));
+
+  UT_ASSERT_NOT_EFI_ERROR (MicrocodeSlotRollback (&Update));
+  UT_ASSERT_EQUAL (Update.State, MicrocodeSlotRolledBack);
+  UT_ASSERT_EQUAL (MicrocodeSlotRollback (&Update), EFI_NOT_READY);
+
+  UT_ASSERT_TRUE (IsSlotAIntact ());
+  UT_ASSERT_TRUE (IsSlotBErased ());
+  UT_ASSERT_TRUE (IsLoadable (mFlash.Base, TEST_OLD_SIZE));
+
+  FreeMicrocodeSlotUpdate (&Update);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+ShouldSurvivePowerLoss (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  MICROCODE_SLOT_UPDATE  Update;
+  UINTN                  Budget;
+  UINTN                  OldCount;
+  UINTN                  NewCount;
+
+  //
+  // Lose the power after every step of bytes of the whole update. Slot A is
+  // never written, and slot B is either the whole new Microcode or is not
+  // loadable.
+  //
+  OldCount = 0;
+  NewCount = 0;
+  for (Budget = 0; Budget <= TEST_SLOT_SIZE + TEST_COMMIT_SIZE; Budget += TEST_POWER_LOSS_STEP) {
+    ResetFlash ();
+    mFlash.ByteBudget = Budget;
+    UT_ASSERT_NOT_EFI_ERROR (InitSlotBUpdate (&Update));
+    MicrocodeSlotRun (&Update);
+    FreeMicrocodeSlotUpdate (&Update);
+
+    UT_ASSERT_TRUE (IsSlotAIntact ());
+    if (IsLoadable (mFlash.Base + TEST_SLOT_SIZE, TEST_NEW_SIZE)) {
+      UT_ASSERT_MEM_EQUAL (mFlash.Base + TEST_SLOT_SIZE, mNewImage, TEST_NEW_SIZE);
+      NewCount++;
+    } else {
+      OldCount++;
+    }
+  }
+
+  UT_LOG_INFO ("Power loss: 0x%x times old microcode, 0x%x times new microcode\n", OldCount, NewCount);
+  UT_ASSERT_NOT_EQUAL (OldCount, 0);
+  UT_ASSERT_NOT_EQUAL (NewCount, 0);
+
+  return UNIT_TEST_PASSED;
+}
+
+/// === TEST ENGINE ================================================================================
+
+/**
+  Standard UEFI entry point for target based
+  unit test execution from UEFI Shell.
+
+  @param[in]  ImageHandle     The firmware allocated handle for the EFI image.
+  @param[in]  SystemTable     A pointer to the EFI System Table.
+
+  @retval EFI_SUCCESS     The entry point executed successfully.
+  @retval other           Some error occurred when executing this entry point.
+
+**/
+int
+main (
+  )
+{
+  EFI_STATUS                  Status;
+  UNIT_TEST_FRAMEWORK_HANDLE  Framework = NULL;
+  UNIT_TEST_SUITE_HANDLE      SlotTests;
+
+  DEBUG ((DEBUG_INFO, "%a v%a\n", UNIT_TEST_NAME, UNIT_TEST_VERSION));
+
+  mFlash.Base = AllocatePool (TEST_FLASH_SIZE);
+  mOldImage   = BuildImage (TEST_OLD_SIZE, TEST_OLD_REVISION);
+  mNewImage   = BuildImage (TEST_NEW_SIZE, TEST_NEW_REVISION);
+  if ((mFlash.Base == NULL) || (mOldImage == NULL) || (mNewImage == NULL)) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto EXIT;
+  }
+
+  //
+  // Start setting up the test framework for running the tests.
+  //
+  Status = InitUnitTestFramework (&Framework, UNIT_TEST_NAME, gEfiCallerBaseName, UNIT_TEST_VERSION);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in InitUnitTestFramework. Status = %r\n", Status));
+    goto EXIT;
+  }
+
+  Status = CreateUnitTestSuite (&SlotTests, Framework, "Microcode Slot Tests", "MicrocodeSlot", NULL, NULL);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in CreateUnitTestSuite for SlotTests\n"));
+    Status = EFI_OUT_OF_RESOURCES;
+    goto EXIT;
+  }
+
+  AddTestCase (SlotTests, "Should commit the new microcode to the other slot", "MicrocodeSlot.Commit", ShouldCommitToOtherSlot, NULL, NULL, NULL);
+  AddTestCase (SlotTests, "Should run the steps in order only", "MicrocodeSlot.StateOrder", ShouldEnforceStateOrder, NULL, NULL, NULL);
+  AddTestCase (SlotTests, "Should roll back a corrupted stage", "MicrocodeSlot.CorruptedStage", ShouldRollBackCorruptedStage, NULL, NULL, NULL);
+  AddTestCase (SlotTests, "Should roll back a microcode the processor rejects", "MicrocodeSlot.RejectedLoad", ShouldRollBackRejectedLoad, NULL, NULL, NULL);
+  AddTestCase (SlotTests, "Should roll back a committed update", "MicrocodeSlot.RollbackCommitted", ShouldRollBackCommittedUpdate, NULL, NULL, NULL);
+  AddTestCase (SlotTests, "Should keep a loadable microcode on power loss", "MicrocodeSlot.PowerLoss", ShouldSurvivePowerLoss, NULL, NULL, NULL);
+
+  //
+  // Execute the tests.
+  //
+  Status = RunAllTestSuites (Framework);
+
+EXIT:
+  if (Framework != NULL) {
+    FreeUnitTestFramework (Framework);
+  }
+
+  if (mFlash.Base != NULL) {
+    FreePool (mFlash.Base);
+  }
+
+  if (mOldImage != NULL) {
+    FreePool (mOldImage);
+  }
+
+  if (mNewImage != NULL) {
+    FreePool (mNewImage);
+  }
+
+  return Status;
+}
@@ -0,0 +1,1039 @@
+/** @file
+UnitTest for...
+Microcode FMP update driver.
+
+The driver runs against a synthetic Microcode region with hundreds of
+patches. The flash, CPUID, the MSRs and the MP services are simulated, so
+the time and the flash operations of GetImageInfo(), CheckImage() and
+SetImage() can be reported on the host.
+
+Copyright (c) Microsoft Corporation.
+SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <time.h>
+#include <cmocka.h>
+
+#include <Library/UnitTestLib.h>
+#include <Library/UnitTestHostBaseLib.h>
+
+#include "../MicrocodeUpdate.h"
+
+#ifndef INTERNAL_UNIT_TEST
+  #error Make sure to build thie with INTERNAL_UNIT_TEST enabled! Otherwise, some important tests may be skipped!
+#endif
+
+#define UNIT_TEST_NAME     "Microcode Update Benchmark"
+#define UNIT_TEST_VERSION  "0.9"
+
+/// === TEST DATA ==================================================================================
+
+//
+// The Microcode region. DescriptorCount is a UINT8, so the region holds a
+// little less than 256 patches.
+//
+#define BENCHMARK_REGION_SIZE       SIZE_1MB
+#define BENCHMARK_PATCH_COUNT       200
+#define BENCHMARK_PATCH_SIZE        0xC00
+#define BENCHMARK_SIGNATURE_COUNT   50
+#define BENCHMARK_EMPTY_SLOT_COUNT  8
+#define BENCHMARK_SLOT_SIZE         SIZE_8KB
+
+//
+// Every fourth patch has an extended signature table.
+//
+#define BENCHMARK_EXTENDED_SIGNATURE_COUNT  2
+#define BENCHMARK_EXTENDED_SIGNATURE_STEP   0x1000
+
+//
+// The simulated processors. Two threads share each core.
+//
+#define BENCHMARK_CPU_SIGNATURE   0x000906EA
+#define BENCHMARK_PLATFORM_ID     1
+#define BENCHMARK_CPU_COUNT       16
+#define BENCHMARK_THREAD_COUNT    2
+#define BENCHMARK_BASE_REVISION   0x100
+#define BENCHMARK_NEW_REVISION    0x200
+#define BENCHMARK_ITERATIONS      64
+
+typedef struct {
+  UINTN    FlashWriteCount;
+  UINTN    FlashWriteBytes;
+  UINTN    FlashBlockCount;
+  UINTN    ApCallCount;
+  UINTN    VariableWriteCount;
+} BENCHMARK_COUNTERS;
+
+STATIC UINT8                           *mRegion;
+STATIC FIRMWARE_INTERFACE_TABLE_ENTRY  *mFit;
+STATIC UINT64                          mFitPointer;
+STATIC UINT32                          mCoreRevision[BENCHMARK_CPU_COUNT / BENCHMARK_THREAD_COUNT];
+STATIC UINTN                           mCurrentCpu;
+STATIC BENCHMARK_COUNTERS              mCounters;
+STATIC UINT8                           mEvent;
+
+//
+// The context of the SetImage() cases: describe the region with the FIT.
+//
+STATIC BOOLEAN  mWithFit    = TRUE;
+STATIC BOOLEAN  mWithoutFit = FALSE;
+
+EFI_BOOT_SERVICES     *gBS;
+EFI_RUNTIME_SERVICES  *gRT;
+
+/// === INTERNAL PROTOTYPES ========================================================================
+
+EFI_STATUS
+InitializePrivateData (
+  IN MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate
+  );
+
+EFI_STATUS
+InitializeMicrocodeDescriptor (
+  IN MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate
+  );
+
+EFI_STATUS
+InitializeFitMicrocodeInfo (
+  IN MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate
+  );
+
+/// === MOCKS ======================================================================================
+
+/**
+  Perform microcode write opreation on the simulated flash.
+**/
+EFI_STATUS
+EFIAPI
+MicrocodeFlashWrite (
+  IN EFI_PHYSICAL_ADDRESS  FlashAddress,
+  IN VOID                  *Buffer,
+  IN UINTN                 Length
+  )
+{
+  UINTN  BlockSize;
+  UINTN  Offset;
+
+  Offset = (UINTN)FlashAddress - (UINTN)mRegion;
+  if (((UINTN)FlashAddress < (UINTN)mRegion) || (Offset + Length > BENCHMARK_REGION_SIZE)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  BlockSize = PcdGet32 (PcdMicrocodeFlashBlockSize);
+  mCounters.FlashWriteCount++;
+  mCounters.FlashWriteBytes += Length;
+  mCounters.FlashBlockCount += (Offset + Length + BlockSize - 1) / BlockSize - Offset / BlockSize;
+  CopyMem (mRegion + Offset, Buffer, Length);
+  return EFI_SUCCESS;
+}
+
+/**
+  Retrieve CPUID information of the simulated processor.
+**/
+UINT32
+EFIAPI
+MockAsmCpuid (
+  IN  UINT32  Index,
+  OUT UINT32  *RegisterEax   OPTIONAL,
+  OUT UINT32  *RegisterEbx   OPTIONAL,
+  OUT UINT32  *RegisterEcx   OPTIONAL,
+  OUT UINT32  *RegisterEdx   OPTIONAL
+  )
+{
+  if (RegisterEax != NULL) {
+    *RegisterEax = (Index == CPUID_VERSION_INFO) ? BENCHMARK_CPU_SIGNATURE : 0;
+  }
+
+  if (RegisterEbx != NULL) {
+    *RegisterEbx = 0;
+  }
+
+  if (RegisterEcx != NULL) {
+    *RegisterEcx = 0;
+  }
+
+  if (RegisterEdx != NULL) {
+    *RegisterEdx = 0;
+  }
+
+  return Index;
+}
+
+/**
+  Read an MSR of the simulated processor the code runs on.
+**/
+UINT64
+EFIAPI
+MockAsmReadMsr64 (
+  IN UINT32  Index
+  )
+{
+  switch (Index) {
+    case MSR_IA32_PLATFORM_ID:
+      return LShiftU64 (BENCHMARK_PLATFORM_ID, 50);
+    case MSR_IA32_BIOS_SIGN_ID:
+      return LShiftU64 (mCoreRevision[mCurrentCpu / BENCHMARK_THREAD_COUNT], 32);
+    default:
+      return 0;
+  }
+}
+
+/**
+  Write an MSR of the simulated processor the code runs on.
+
+  The update trigger loads a Microcode for the processor with a higher
+  revision on the whole core.
+**/
+UINT64
+EFIAPI
+MockAsmWriteMsr64 (
+  IN UINT32  Index,
+  IN UINT64  Value
+  )
+{
+  CPU_MICROCODE_HEADER  *MicrocodeEntryPoint;
+  UINT32                *Revision;
+
+  if (Index == MSR_IA32_BIOS_UPDT_TRIG) {
+    MicrocodeEntryPoint = (CPU_MICROCODE_HEADER *)((UINTN)Value - sizeof (CPU_MICROCODE_HEADER));
+    Revision            = &mCoreRevision[mCurrentCpu / BENCHMARK_THREAD_COUNT];
+    if ((MicrocodeEntryPoint->ProcessorSignature.Uint32 == BENCHMARK_CPU_SIGNATURE) &&
+        ((MicrocodeEntryPoint->ProcessorFlags & (1 << BENCHMARK_PLATFORM_ID)) != 0) &&
+        (MicrocodeEntryPoint->UpdateRevision > *Revision))
+    {
+      *Revision = MicrocodeEntryPoint->UpdateRevision;
+    }
+  }
+
+  return Value;
+}
+
+/**
+  Run a procedure on a simulated processor.
+**/
+STATIC
+VOID
+RunOnProcessor (
+  IN EFI_AP_PROCEDURE  Procedure,
+  IN UINTN             ProcessorNumber,
+  IN VOID              *ProcedureArgument
+  )
+{
+  mCurrentCpu = ProcessorNumber;
+  Procedure (ProcedureArgument);
+  mCurrentCpu = 0;
+  mCounters.ApCallCount++;
+}
+
+EFI_STATUS
+EFIAPI
+MockGetNumberOfProcessors (
+  IN  EFI_MP_SERVICES_PROTOCOL  *This,
+  OUT UINTN                     *NumberOfProcessors,
+  OUT UINTN                     *NumberOfEnabledProcessors
+  )
+{
+  *NumberOfProcessors        = BENCHMARK_CPU_COUNT;
+  *NumberOfEnabledProcessors = BENCHMARK_CPU_COUNT;
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+MockGetProcessorInfo (
+  IN  EFI_MP_SERVICES_PROTOCOL   *This,
+  IN  UINTN                      ProcessorNumber,
+  OUT EFI_PROCESSOR_INFORMATION  *ProcessorInfoBuffer
+  )
+{
+  if (ProcessorNumber >= BENCHMARK_CPU_COUNT) {
+    return EFI_NOT_FOUND;
+  }
+
+  ZeroMem (ProcessorInfoBuffer, sizeof (*ProcessorInfoBuffer));
+  ProcessorInfoBuffer->ProcessorId     = ProcessorNumber;
+  ProcessorInfoBuffer->StatusFlag      = PROCESSOR_ENABLED_BIT | PROCESSOR_HEALTH_STATUS_BIT;
+  ProcessorInfoBuffer->Location.Core   = (UINT32)(ProcessorNumber / BENCHMARK_THREAD_COUNT);
+  ProcessorInfoBuffer->Location.Thread = (UINT32)(ProcessorNumber % BENCHMARK_THREAD_COUNT);
+  if (ProcessorNumber == 0) {
+    ProcessorInfoBuffer->StatusFlag |= PROCESSOR_AS_BSP_BIT;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Run a procedure on all the simulated Application Processors, one after
+  another. The wait event, if any, is signaled on return.
+**/
+EFI_STATUS
+EFIAPI
+MockStartupAllAPs (
+  IN  EFI_MP_SERVICES_PROTOCOL  *This,
+  IN  EFI_AP_PROCEDURE          Procedure,
+  IN  BOOLEAN                   SingleThread,
+  IN  EFI_EVENT                 WaitEvent               OPTIONAL,
+  IN  UINTN                     TimeoutInMicroSeconds,
+  IN  VOID                      *ProcedureArgument      OPTIONAL,
+  OUT UINTN                     **FailedCpuList         OPTIONAL
+  )
+{
+  UINTN  Index;
+
+  if (FailedCpuList != NULL) {
+    *FailedCpuList = NULL;
+  }
+
+  for (Index = 1; Index < BENCHMARK_CPU_COUNT; Index++) {
+    RunOnProcessor (Procedure, Index, ProcedureArgument);
+  }
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+MockStartupThisAP (
+  IN  EFI_MP_SERVICES_PROTOCOL  *This,
+  IN  EFI_AP_PROCEDURE          Procedure,
+  IN  UINTN                     ProcessorNumber,
+  IN  EFI_EVENT                 WaitEvent               OPTIONAL,
+  IN  UINTN                     TimeoutInMicroseconds,
+  IN  VOID                      *ProcedureArgument      OPTIONAL,
+  OUT BOOLEAN                   *Finished               OPTIONAL
+  )
+{
+  if ((ProcessorNumber == 0) || (ProcessorNumber >= BENCHMARK_CPU_COUNT)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  RunOnProcessor (Procedure, ProcessorNumber, ProcedureArgument);
+  if (Finished != NULL) {
+    *Finished = TRUE;
+  }
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+MockSwitchBSP (
+  IN EFI_MP_SERVICES_PROTOCOL  *This,
+  IN UINTN                     ProcessorNumber,
+  IN BOOLEAN                   EnableOldBSP
+  )
+{
+  return EFI_UNSUPPORTED;
+}
+
+EFI_STATUS
+EFIAPI
+MockEnableDisableAP (
+  IN EFI_MP_SERVICES_PROTOCOL  *This,
+  IN UINTN                     ProcessorNumber,
+  IN BOOLEAN                   EnableAP,
+  IN UINT32                    *HealthFlag OPTIONAL
+  )
+{
+  return EFI_UNSUPPORTED;
+}
+
+EFI_STATUS
+EFIAPI
+MockWhoAmI (
+  IN  EFI_MP_SERVICES_PROTOCOL  *This,
+  OUT UINTN                     *ProcessorNumber
+  )
+{
+  *ProcessorNumber = mCurrentCpu;
+  return EFI_SUCCESS;
+}
+
+STATIC EFI_MP_SERVICES_PROTOCOL  mMpServices = {
+  MockGetNumberOfProcessors,
+  MockGetProcessorInfo,
+  MockStartupAllAPs,
+  MockStartupThisAP,
+  MockSwitchBSP,
+  MockEnableDisableAP,
+  MockWhoAmI
+};
+
+EFI_STATUS
+EFIAPI
+MockCreateEvent (
+  IN  UINT32            Type,
+  IN  EFI_TPL           NotifyTpl,
+  IN  EFI_EVENT_NOTIFY  NotifyFunction  OPTIONAL,
+  IN  VOID              *NotifyContext  OPTIONAL,
+  OUT EFI_EVENT         *Event
+  )
+{
+  *Event = &mEvent;
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+MockWaitForEvent (
+  IN  UINTN      NumberOfEvents,
+  IN  EFI_EVENT  *Event,
+  OUT UINTN      *Index
+  )
+{
+  *Index = 0;
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+MockCloseEvent (
+  IN EFI_EVENT  Event
+  )
+{
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+MockLocateProtocol (
+  IN  EFI_GUID  *Protocol,
+  IN  VOID      *Registration  OPTIONAL,
+  OUT VOID      **Interface
+  )
+{
+  if (!CompareGuid (Protocol, &gEfiMpServiceProtocolGuid)) {
+    return EFI_NOT_FOUND;
+  }
+
+  *Interface = &mMpServices;
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+EFIAPI
+MockGetVariable (
+  IN     CHAR16    *VariableName,
+  IN     EFI_GUID  *VendorGuid,
+  OUT    UINT32    *Attributes  OPTIONAL,
+  IN OUT UINTN     *DataSize,
+  OUT    VOID      *Data        OPTIONAL
+  )
+{
+  return EFI_NOT_FOUND;
+}
+
+EFI_STATUS
+EFIAPI
+MockSetVariable (
+  IN  CHAR16    *VariableName,
+  IN  EFI_GUID  *VendorGuid,
+  IN  UINT32    Attributes,
+  IN  UINTN     DataSize,
+  IN  VOID      *Data
+  )
+{
+  mCounters.VariableWriteCount++;
+  return EFI_SUCCESS;
+}
+
+STATIC EFI_BOOT_SERVICES     mBootServices;
+STATIC EFI_RUNTIME_SERVICES  mRuntimeServices;
+
+/// === HELPER FUNCTIONS ===========================================================================
+
+/**
+  Build a Microcode patch of BENCHMARK_PATCH_SIZE bytes.
+
+  @param[out] MicrocodeEntryPoint     The buffer to build the patch in.
+  @param[in]  ProcessorSignature      The processor signature of the patch.
+  @param[in]  UpdateRevision          The revision of the patch.
+  @param[in]  ExtendedSignatureCount  The number of extended signatures, or 0.
+**/
+STATIC
+VOID
+BuildMicrocodePatch (
+  OUT CPU_MICROCODE_HEADER  *MicrocodeEntryPoint,
+  IN  UINT32                ProcessorSignature,
+  IN  UINT32                UpdateRevision,
+  IN  UINT32                ExtendedSignatureCount
+  )
+{
+  UINT32                               *Data;
+  UINTN                                DataSize;
+  UINTN                                ExtendedTableLength;
+  UINTN                                Index;
+  CPU_MICROCODE_EXTENDED_TABLE_HEADER  *ExtendedTableHeader;
+  CPU_MICROCODE_EXTENDED_TABLE         *ExtendedTable;
+
+  ExtendedTableLength = 0;
+  if (ExtendedSignatureCount != 0) {
+    ExtendedTableLength = sizeof (CPU_MICROCODE_EXTENDED_TABLE_HEADER) + ExtendedSignatureCount * sizeof (CPU_MICROCODE_EXTENDED_TABLE);
+  }
+
+  DataSize = BENCHMARK_PATCH_SIZE - sizeof (CPU_MICROCODE_HEADER) - ExtendedTableLength;
+  ZeroMem (MicrocodeEntryPoint, sizeof (CPU_MICROCODE_HEADER));
+  Data = (UINT32 *)(MicrocodeEntryPoint + 1);
+  for (Index = 0; Index < DataSize / sizeof (UINT32); Index++) {
+    Data[Index] = (UINT32)(UpdateRevision * 0x9E3779B9 + ProcessorSignature + Index);
+  }
+
+  MicrocodeEntryPoint->HeaderVersion             = 0x1;
+  MicrocodeEntryPoint->UpdateRevision            = UpdateRevision;
+  MicrocodeEntryPoint->ProcessorSignature.Uint32 = ProcessorSignature;
+  MicrocodeEntryPoint->LoaderRevision            = 0x1;
+  MicrocodeEntryPoint->ProcessorFlags            = 1 << BENCHMARK_PLATFORM_ID;
+  MicrocodeEntryPoint->DataSize                  = (UINT32)DataSize;
+  MicrocodeEntryPoint->TotalSize                 = BENCHMARK_PATCH_SIZE;
+  MicrocodeEntryPoint->Checksum                  = 0 - CalculateSum32 ((UINT32 *)MicrocodeEntryPoint, DataSize + sizeof (CPU_MICROCODE_HEADER));
+
+  if (ExtendedSignatureCount == 0) {
+    return;
+  }
+
+  ExtendedTableHeader = (CPU_MICROCODE_EXTENDED_TABLE_HEADER *)((UINT8 *)Data + DataSize);
+  ZeroMem (ExtendedTableHeader, ExtendedTableLength);
+  ExtendedTableHeader->ExtendedSignatureCount = ExtendedSignatureCount;
+  ExtendedTable                               = (CPU_MICROCODE_EXTENDED_TABLE *)(ExtendedTableHeader + 1);
+  for (Index = 0; Index < ExtendedSignatureCount; Index++) {
+    ExtendedTable[Index].ProcessorSignature.Uint32 = ProcessorSignature + (UINT32)(BENCHMARK_EXTENDED_SIGNATURE_STEP * (Index + 1));
+    ExtendedTable[Index].ProcessorFlag             = MicrocodeEntryPoint->ProcessorFlags;
+    ExtendedTable[Index].Checksum                  = MicrocodeEntryPoint->Checksum +
+                                                     MicrocodeEntryPoint->ProcessorSignature.Uint32 +
+                                                     MicrocodeEntryPoint->ProcessorFlags -
+                                                     ExtendedTable[Index].ProcessorSignature.Uint32 -
+                                                     ExtendedTable[Index].ProcessorFlag;
+  }
+
+  ExtendedTableHeader->ExtendedChecksum = 0 - CalculateSum32 ((UINT32 *)ExtendedTableHeader, ExtendedTableLength);
+}
+
+/**
+  Build the synthetic Microcode region, and the FIT that describes it.
+
+  Patch N targets signature BENCHMARK_CPU_SIGNATURE + N % BENCHMARK_SIGNATURE_COUNT
+  with revision BENCHMARK_BASE_REVISION + N / BENCHMARK_SIGNATURE_COUNT, so a few
+  patches match the simulated processor. The FIT lists the patches and the
+  empty slots behind them in descending address order, which is the worst
+  case for sorting them.
+
+  @retval TRUE   The region is built.
+  @retval FALSE  There are not enough resources.
+**/
+STATIC
+BOOLEAN
+BuildMicrocodeRegion (
+  VOID
+  )
+{
+  UINTN  Index;
+  UINTN  EntryCount;
+  UINTN  EntryIndex;
+  UINTN  SlotBase;
+
+  mRegion = AllocatePages (EFI_SIZE_TO_PAGES (BENCHMARK_REGION_SIZE));
+  if (mRegion == NULL) {
+    return FALSE;
+  }
+
+  EntryCount = 1 + BENCHMARK_PATCH_COUNT + BENCHMARK_EMPTY_SLOT_COUNT;
+  mFit       = AllocateZeroPool (EntryCount * sizeof (FIRMWARE_INTERFACE_TABLE_ENTRY));
+  if (mFit == NULL) {
+    FreePages (mRegion, EFI_SIZE_TO_PAGES (BENCHMARK_REGION_SIZE));
+    mRegion = NULL;
+    return FALSE;
+  }
+
+  SetMem (mRegion, BENCHMARK_REGION_SIZE, 0xFF);
+  for (Index = 0; Index < BENCHMARK_PATCH_COUNT; Index++) {
+    BuildMicrocodePatch (
+      (CPU_MICROCODE_HEADER *)(mRegion + Index * BENCHMARK_PATCH_SIZE),
+      BENCHMARK_CPU_SIGNATURE + (UINT32)(Index % BENCHMARK_SIGNATURE_COUNT),
+      BENCHMARK_BASE_REVISION + (UINT32)(Index / BENCHMARK_SIGNATURE_COUNT),
+      ((Index % 4) == 3) ? BENCHMARK_EXTENDED_SIGNATURE_COUNT : 0
+      );
+  }
+
+  mFit[0].Address = FIT_TYPE_00_SIGNATURE;
+  mFit[0].Size[0] = (UINT8)EntryCount;
+  mFit[0].Size[1] = (UINT8)(EntryCount >> 8);
+  mFit[0].Version = 0x0100;
+  mFit[0].Type    = FIT_TYPE_00_HEADER;
+
+  SlotBase   = ALIGN_VALUE (BENCHMARK_PATCH_COUNT * BENCHMARK_PATCH_SIZE, BENCHMARK_SLOT_SIZE);
+  EntryIndex = 1;
+  for (Index = BENCHMARK_EMPTY_SLOT_COUNT; Index > 0; Index--) {
+    mFit[EntryIndex].Address = (UINTN)mRegion + SlotBase + (Index - 1) * BENCHMARK_SLOT_SIZE;
+    mFit[EntryIndex].Version = 0x0100;
+    mFit[EntryIndex].Type    = FIT_TYPE_01_MICROCODE;
+    EntryIndex++;
+  }
+
+  for (Index = BENCHMARK_PATCH_COUNT; Index > 0; Index--) {
+    mFit[EntryIndex].Address = (UINTN)mRegion + (Index - 1) * BENCHMARK_PATCH_SIZE;
+    mFit[EntryIndex].Version = 0x0100;
+    mFit[EntryIndex].Type    = FIT_TYPE_01_MICROCODE;
+    EntryIndex++;
+  }
+
+  mFitPointer = (UINTN)mFit;
+  return TRUE;
+}
+
+/**
+  Free the synthetic Microcode region and the FIT.
+**/
+STATIC
+VOID
+FreeMicrocodeRegion (
+  VOID
+  )
+{
+  if (mRegion != NULL) {
+    FreePages (mRegion, EFI_SIZE_TO_PAGES (BENCHMARK_REGION_SIZE));
+    mRegion = NULL;
+  }
+
+  if (mFit != NULL) {
+    FreePool (mFit);
+    mFit = NULL;
+  }
+}
+
+/**
+  Build the region, reset the simulated platform and start the driver on it.
+
+  @param[in]  UseFit      Describe the region with the FIT.
+
+  @return The driver private data, or NULL on failure.
+**/
+STATIC
+MICROCODE_FMP_PRIVATE_DATA *
+StartMicrocodeFmp (
+  IN BOOLEAN  UseFit
+  )
+{
+  MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate;
+  UINTN                       Index;
+  EFI_STATUS                  Status;
+
+  if (!BuildMicrocodeRegion ()) {
+    return NULL;
+  }
+
+  if (!UseFit) {
+    mFitPointer = 0;
+  }
+
+  PatchPcdSet64 (PcdCpuMicrocodePatchAddress, (UINTN)mRegion);
+  PatchPcdSet64 (PcdCpuMicrocodePatchRegionSize, BENCHMARK_REGION_SIZE);
+
+  for (Index = 0; Index < ARRAY_SIZE (mCoreRevision); Index++) {
+    mCoreRevision[Index] = BENCHMARK_BASE_REVISION;
+  }
+
+  mCurrentCpu = 0;
+  ZeroMem (&mCounters, sizeof (mCounters));
+
+  MicrocodeFmpPrivate = AllocateZeroPool (sizeof (MICROCODE_FMP_PRIVATE_DATA));
+  if (MicrocodeFmpPrivate == NULL) {
+    FreeMicrocodeRegion ();
+    return NULL;
+  }
+
+  MicrocodeFmpPrivate->FitPointerAddress = (UINTN)&mFitPointer;
+  Status                                 = InitializePrivateData (MicrocodeFmpPrivate);
+  if (EFI_ERROR (Status)) {
+    FreePool (MicrocodeFmpPrivate);
+    FreeMicrocodeRegion ();
+    return NULL;
+  }
+
+  return MicrocodeFmpPrivate;
+}
+
+/**
+  Free the driver private data and the region.
+
+  @param[in]  MicrocodeFmpPrivate  The driver private data.
+**/
+STATIC
+VOID
+StopMicrocodeFmp (
+  IN MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate
+  )
+{
+  if (MicrocodeFmpPrivate->ImageDescriptor != NULL) {
+    FreePool (MicrocodeFmpPrivate->ImageDescriptor);
+  }
+
+  if (MicrocodeFmpPrivate->MicrocodeInfo != NULL) {
+    FreePool (MicrocodeFmpPrivate->MicrocodeInfo);
+  }
+
+  if (MicrocodeFmpPrivate->MicrocodePatchIndex != NULL) {
+    FreePool (MicrocodeFmpPrivate->MicrocodePatchIndex);
+  }
+
+  if (MicrocodeFmpPrivate->FitMicrocodeInfo != NULL) {
+    FreePool (MicrocodeFmpPrivate->FitMicrocodeInfo);
+  }
+
+  FreePool (MicrocodeFmpPrivate->ProcessorInfo);
+  FreePool (MicrocodeFmpPrivate->ProcessorClassInfo);
+  FreePool (MicrocodeFmpPrivate);
+  FreeMicrocodeRegion ();
+}
+
+/**
+  Report the time of an operation.
+
+  @param[in]  Name        The name of the operation.
+  @param[in]  Elapsed     The clock ticks spent in all the iterations.
+  @param[in]  Iterations  The number of iterations.
+**/
+STATIC
+VOID
+ReportTime (
+  IN CONST CHAR8  *Name,
+  IN clock_t      Elapsed,
+  IN UINTN        Iterations
+  )
+{
+  UT_LOG_INFO (
+    "%a: %ld us per call\n",
+    Name,
+    DivU64x64Remainder (MultU64x32 ((UINT64)Elapsed, 1000000), MultU64x32 ((UINT64)CLOCKS_PER_SEC, (UINT32)Iterations), NULL)
+    );
+}
+
+/**
+  Report the flash operations and the processor calls counted so far.
+
+  @param[in]  Name        The name of the operation.
+**/
+STATIC
+VOID
+ReportCounters (
+  IN CONST CHAR8  *Name
+  )
+{
+  UT_LOG_INFO (
+    "%a: 0x%x flash writes, 0x%x bytes, 0x%x blocks, 0x%x AP calls, 0x%x variable writes\n",
+    Name,
+    mCounters.FlashWriteCount,
+    mCounters.FlashWriteBytes,
+    mCounters.FlashBlockCount,
+    mCounters.ApCallCount,
+    mCounters.VariableWriteCount
+    );
+}
+
+/**
+  Build the new Microcode for the simulated processor.
+
+  @return The new Microcode image, or NULL on failure.
+**/
+STATIC
+CPU_MICROCODE_HEADER *
+BuildNewMicrocode (
+  VOID
+  )
+{
+  CPU_MICROCODE_HEADER  *Image;
+
+  Image = AllocatePool (BENCHMARK_PATCH_SIZE);
+  if (Image != NULL) {
+    BuildMicrocodePatch (Image, BENCHMARK_CPU_SIGNATURE, BENCHMARK_NEW_REVISION, 0);
+  }
+
+  return Image;
+}
+
+/// === TEST CASES =================================================================================
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+BenchmarkInitialize (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate;
+  UINTN                       Iteration;
+  EFI_STATUS                  Status;
+  clock_t                     Start;
+  clock_t                     Elapsed;
+
+  Start               = clock ();
+  MicrocodeFmpPrivate = StartMicrocodeFmp (TRUE);
+  Elapsed             = clock () - Start;
+  UT_ASSERT_NOT_NULL (MicrocodeFmpPrivate);
+  ReportTime ("Driver start", Elapsed, 1);
+  ReportCounters ("Driver start");
+
+  UT_ASSERT_EQUAL (MicrocodeFmpPrivate->DescriptorCount, BENCHMARK_PATCH_COUNT);
+  UT_ASSERT_EQUAL (MicrocodeFmpPrivate->FitMicrocodeEntryCount, BENCHMARK_PATCH_COUNT + BENCHMARK_EMPTY_SLOT_COUNT);
+  UT_ASSERT_EQUAL (MicrocodeFmpPrivate->ProcessorClassCount, 1);
+  UT_ASSERT_EQUAL (MicrocodeFmpPrivate->ProcessorClassInfo[0].MicrocodeIndex, BENCHMARK_PATCH_COUNT - BENCHMARK_SIGNATURE_COUNT);
+
+  //
+  // A rescan without a dirty region reuses every verification result.
+  //
+  Start = clock ();
+  for (Iteration = 0; Iteration < BENCHMARK_ITERATIONS; Iteration++) {
+    Status = InitializeMicrocodeDescriptor (MicrocodeFmpPrivate);
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+  }
+
+  ReportTime ("Region rescan", clock () - Start, BENCHMARK_ITERATIONS);
+
+  //
+  // Resort the FIT information from descending order every time.
+  //
+  Start = clock ();
+  for (Iteration = 0; Iteration < BENCHMARK_ITERATIONS; Iteration++) {
+    Status = InitializeFitMicrocodeInfo (MicrocodeFmpPrivate);
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+  }
+
+  ReportTime ("FIT collect and sort", clock () - Start, BENCHMARK_ITERATIONS);
+
+  StopMicrocodeFmp (MicrocodeFmpPrivate);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+BenchmarkGetImageInfo (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  MICROCODE_FMP_PRIVATE_DATA     *MicrocodeFmpPrivate;
+  EFI_FIRMWARE_IMAGE_DESCRIPTOR  *ImageInfo;
+  UINTN                          ImageInfoSize;
+  UINT32                         DescriptorVersion;
+  UINT8                          DescriptorCount;
+  UINTN                          DescriptorSize;
+  UINT32                         PackageVersion;
+  CHAR16                         *PackageVersionName;
+  UINTN                          Iteration;
+  EFI_STATUS                     Status;
+  clock_t                        Start;
+
+  MicrocodeFmpPrivate = StartMicrocodeFmp (TRUE);
+  UT_ASSERT_NOT_NULL (MicrocodeFmpPrivate);
+
+  ImageInfo = NULL;
+  Start     = clock ();
+  for (Iteration = 0; Iteration < BENCHMARK_ITERATIONS; Iteration++) {
+    ImageInfoSize = 0;
+    Status        = FmpGetImageInfo (&MicrocodeFmpPrivate->Fmp, &ImageInfoSize, NULL, NULL, NULL, NULL, NULL, NULL);
+    UT_ASSERT_STATUS_EQUAL (Status, EFI_BUFFER_TOO_SMALL);
+
+    ImageInfo = AllocatePool (ImageInfoSize);
+    UT_ASSERT_NOT_NULL (ImageInfo);
+    Status = FmpGetImageInfo (
+               &MicrocodeFmpPrivate->Fmp,
+               &ImageInfoSize,
+               ImageInfo,
+               &DescriptorVersion,
+               &DescriptorCount,
+               &DescriptorSize,
+               &PackageVersion,
+               &PackageVersionName
+               );
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+    UT_ASSERT_EQUAL (DescriptorCount, BENCHMARK_PATCH_COUNT);
+    FreePool (PackageVersionName);
+    FreePool (ImageInfo);
+  }
+
+  ReportTime ("GetImageInfo", clock () - Start, BENCHMARK_ITERATIONS);
+
+  StopMicrocodeFmp (MicrocodeFmpPrivate);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+BenchmarkCheckImage (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate;
+  CPU_MICROCODE_HEADER        *Image;
+  UINT32                      ImageUpdatable;
+  UINT32                      LastAttemptStatus;
+  UINTN                       TargetCpuIndex;
+  UINTN                       Iteration;
+  EFI_STATUS                  Status;
+  clock_t                     Start;
+
+  MicrocodeFmpPrivate = StartMicrocodeFmp (TRUE);
+  UT_ASSERT_NOT_NULL (MicrocodeFmpPrivate);
+  Image = BuildNewMicrocode ();
+  UT_ASSERT_NOT_NULL (Image);
+
+  Status = FmpCheckImage (&MicrocodeFmpPrivate->Fmp, 1, Image, BENCHMARK_PATCH_SIZE, &ImageUpdatable);
+  UT_ASSERT_STATUS_EQUAL (Status, EFI_UNSUPPORTED);
+
+  //
+  // CheckImage() is not supported, so time the check SetImage() starts with.
+  //
+  Start = clock ();
+  for (Iteration = 0; Iteration < BENCHMARK_ITERATIONS; Iteration++) {
+    TargetCpuIndex = (UINTN)-1;
+    Status         = VerifyMicrocode (MicrocodeFmpPrivate, Image, BENCHMARK_PATCH_SIZE, FALSE, &LastAttemptStatus, NULL, &TargetCpuIndex);
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+  }
+
+  ReportTime ("CheckImage", clock () - Start, BENCHMARK_ITERATIONS);
+  UT_ASSERT_EQUAL (mCounters.FlashWriteCount, 0);
+
+  FreePool (Image);
+  StopMicrocodeFmp (MicrocodeFmpPrivate);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+BenchmarkSetImage (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  BOOLEAN                     UseFit;
+  MICROCODE_FMP_PRIVATE_DATA  *MicrocodeFmpPrivate;
+  CPU_MICROCODE_HEADER        *Image;
+  CHAR16                      *AbortReason;
+  UINTN                       Index;
+  EFI_STATUS                  Status;
+  clock_t                     Start;
+  clock_t                     Elapsed;
+
+  UseFit              = *(BOOLEAN *)Context;
+  MicrocodeFmpPrivate = StartMicrocodeFmp (UseFit);
+  UT_ASSERT_NOT_NULL (MicrocodeFmpPrivate);
+  Image = BuildNewMicrocode ();
+  UT_ASSERT_NOT_NULL (Image);
+
+  ZeroMem (&mCounters, sizeof (mCounters));
+  Start   = clock ();
+  Status  = FmpSetImage (&MicrocodeFmpPrivate->Fmp, 1, Image, BENCHMARK_PATCH_SIZE, NULL, NULL, &AbortReason);
+  Elapsed = clock () - Start;
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  ReportTime (UseFit ? "SetImage with FIT" : "SetImage without FIT", Elapsed, 1);
+  ReportCounters (UseFit ? "SetImage with FIT" : "SetImage without FIT");
+
+  //
+  // Every core runs the new revision, and the region holds it.
+  //
+  for (Index = 0; Index < ARRAY_SIZE (mCoreRevision); Index++) {
+    UT_ASSERT_EQUAL (mCoreRevision[Index], BENCHMARK_NEW_REVISION);
+  }
+
+  for (Index = 0; Index < MicrocodeFmpPrivate->DescriptorCount; Index++) {
+    if (MicrocodeFmpPrivate->ImageDescriptor[Index].Version == BENCHMARK_NEW_REVISION) {
+      break;
+    }
+  }
+
+  UT_ASSERT_TRUE (Index < MicrocodeFmpPrivate->DescriptorCount);
+  UT_ASSERT_EQUAL (mCounters.VariableWriteCount, 1);
+  UT_ASSERT_NOT_EQUAL (mCounters.FlashWriteCount, 0);
+
+  FreePool (Image);
+  StopMicrocodeFmp (MicrocodeFmpPrivate);
+  return UNIT_TEST_PASSED;
+}
+
+/// === TEST ENGINE ================================================================================
+
+/**
+  Standard UEFI entry point for target based
+  unit test execution from UEFI Shell.
+
+  @param[in]  ImageHandle     The firmware allocated handle for the EFI image.
+  @param[in]  SystemTable     A pointer to the EFI System Table.
+
+  @retval EFI_SUCCESS     The entry point executed successfully.
+  @retval other           Some error occurred when executing this entry point.
+
+**/
+int
+main (
+  )
+{
+  EFI_STATUS                  Status;
+  UNIT_TEST_FRAMEWORK_HANDLE  Framework = NULL;
+  UNIT_TEST_SUITE_HANDLE      BenchmarkTests;
+
+  DEBUG ((DEBUG_INFO, "%a v%a\n", UNIT_TEST_NAME, UNIT_TEST_VERSION));
+
+  //
+  // Route the driver to the simulated platform.
+  //
+  gUnitTestHostBaseLib.X86->AsmCpuid      = MockAsmCpuid;
+  gUnitTestHostBaseLib.X86->AsmReadMsr64  = MockAsmReadMsr64;
+  gUnitTestHostBaseLib.X86->AsmWriteMsr64 = MockAsmWriteMsr64;
+
+  mBootServices.CreateEvent    = MockCreateEvent;
+  mBootServices.WaitForEvent   = MockWaitForEvent;
+  mBootServices.CloseEvent     = MockCloseEvent;
+  mBootServices.LocateProtocol = MockLocateProtocol;
+  mRuntimeServices.GetVariable = MockGetVariable;
+  mRuntimeServices.SetVariable = MockSetVariable;
+  gBS                          = &mBootServices;
+  gRT                          = &mRuntimeServices;
+
+  //
+  // Start setting up the test framework for running the tests.
+  //
+  Status = InitUnitTestFramework (&Framework, UNIT_TEST_NAME, gEfiCallerBaseName, UNIT_TEST_VERSION);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in InitUnitTestFramework. Status = %r\n", Status));
+    goto EXIT;
+  }
+
+  Status = CreateUnitTestSuite (&BenchmarkTests, Framework, "Microcode Update Benchmarks", "MicrocodeUpdate", NULL, NULL);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in CreateUnitTestSuite for BenchmarkTests\n"));
+    Status = EFI_OUT_OF_RESOURCES;
+    goto EXIT;
+  }
+
+  AddTestCase (BenchmarkTests, "Should report the region scan and FIT sort time", "MicrocodeUpdate.Initialize", BenchmarkInitialize, NULL, NULL, NULL);
+  AddTestCase (BenchmarkTests, "Should report the GetImageInfo time", "MicrocodeUpdate.GetImageInfo", BenchmarkGetImageInfo, NULL, NULL, NULL);
+  AddTestCase (BenchmarkTests, "Should report the CheckImage time", "MicrocodeUpdate.CheckImage", BenchmarkCheckImage, NULL, NULL, NULL);
+  AddTestCase (BenchmarkTests, "Should report the SetImage cost with FIT", "MicrocodeUpdate.SetImageFit", BenchmarkSetImage, NULL, NULL, &mWithFit);
+  AddTestCase (BenchmarkTests, "Should report the SetImage cost without FIT", "MicrocodeUpdate.SetImage", BenchmarkSetImage, NULL, NULL, &mWithoutFit);
+
+  //
+  // Execute the tests.
+  //
+  Status = RunAllTestSuites (Framework);
+
+EXIT:
+  if (Framework != NULL) {
+    FreeUnitTestFramework (Framework);
+  }
+
+  return Status;
+}
@@ -102,6 +102,58 @@ FvbGetVolumeAttributes (
   return FvbInstance->FvHeader.Attributes;
 }
 
+/**
+  Build the LBA map of a FVB instance from the block map of its FV header.
+
+  Each block map entry gets the first LBA it describes and the offset of that
+  LBA in the FV, so FvbGetLbaAddress() does not walk the block map.
+
+  @param[in, out] FvbInstance     The FVB instance. FvHeader and NumOfBlocks must be set.
+
+  @retval EFI_SUCCESS             The LBA map is built.
+  @retval EFI_OUT_OF_RESOURCES    There is not enough memory for the LBA map.
+
+**/
+EFI_STATUS
+FvbInitializeLbaMap (
+  IN OUT EFI_FVB_INSTANCE  *FvbInstance
+  )
+{
+  EFI_FV_BLOCK_MAP_ENTRY  *BlockMap;
+  FVB_LBA_MAP_ENTRY       *LbaMap;
+  UINTN                   NumOfEntries;
+  UINTN                   Index;
+  EFI_LBA                 StartLba;
+  UINTN                   Offset;
+
+  NumOfEntries = 0;
+  for (BlockMap = FvbInstance->FvHeader.BlockMap; BlockMap->NumBlocks != 0; BlockMap++) {
+    NumOfEntries++;
+  }
+
+  LbaMap = AllocateZeroPool (NumOfEntries * sizeof (FVB_LBA_MAP_ENTRY));
+  if (LbaMap == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  StartLba = 0;
+  Offset   = 0;
+  BlockMap = FvbInstance->FvHeader.BlockMap;
+  for (Index = 0; Index < NumOfEntries; Index++) {
+    LbaMap[Index].StartLba    = StartLba;
+    LbaMap[Index].Offset      = Offset;
+    LbaMap[Index].BlockLength = BlockMap[Index].Length;
+
+    StartLba += BlockMap[Index].NumBlocks;
+    Offset   += (UINTN)BlockMap[Index].NumBlocks * BlockMap[Index].Length;
+  }
+
+  FvbInstance->LbaMap             = LbaMap;
+  FvbInstance->NumOfLbaMapEntries = NumOfEntries;
+
+  return EFI_SUCCESS;
+}
+
 /**
   Retrieves the starting address of an LBA in an FV. It also
   return a few other attribut of the FV.
@@ -135,6 +187,53 @@ FvbGetLbaAddress (
   EFI_LBA                 StartLba;
   EFI_LBA                 NextLba;
   EFI_FV_BLOCK_MAP_ENTRY  *BlockMap;
+  FVB_LBA_MAP_ENTRY       *LbaMap;
+  UINTN                   Low;
+  UINTN                   High;
+  UINTN                   Index;
+
+  LbaMap = FvbInstance->LbaMap;
+  if (LbaMap != NULL) {
+    if (Lba >= FvbInstance->NumOfBlocks) {
+      return EFI_INVALID_PARAMETER;
+    }
+
+    //
+    // Find the last map entry that starts at or before Lba. Most FVs have a
+    // single map entry, so the search usually ends at once.
+    //
+    Low  = 0;
+    High = FvbInstance->NumOfLbaMapEntries;
+    while (High - Low > 1) {
+      Index = Low + (High - Low) / 2;
+      if (LbaMap[Index].StartLba <= Lba) {
+        Low = Index;
+      } else {
+        High = Index;
+      }
+    }
+
+    if (Low + 1 < FvbInstance->NumOfLbaMapEntries) {
+      NextLba = LbaMap[Low + 1].StartLba;
+    } else {
+      NextLba = FvbInstance->NumOfBlocks;
+    }
+
+    if (LbaAddress != NULL) {
+      *LbaAddress = FvbInstance->FvBase + LbaMap[Low].Offset +
+                    (UINTN)MultU64x32 (Lba - LbaMap[Low].StartLba, LbaMap[Low].BlockLength);
+    }
+
+    if (LbaLength != NULL) {
+      *LbaLength = LbaMap[Low].BlockLength;
+    }
+
+    if (NumOfBlocks != NULL) {
+      *NumOfBlocks = (UINTN)(NextLba - Lba);
+    }
+
+    return EFI_SUCCESS;
+  }
 
   StartLba = 0;
   Offset   = 0;
@@ -262,6 +361,148 @@ FvbReadBlock (
   }
 }
 
+/**
+  Write a list of ranges with a vectored write.
+
+  @param[in]      WriteVector     The ranges to write.
+  @param[in]      VectorCount     The number of ranges in WriteVector.
+  @param[in]      Address         The starting physical address of the whole write.
+  @param[in,out]  NumBytes        On error, the number of bytes in front of the range
+                                  that failed, which hold the new data.
+
+  @retval         EFI_SUCCESS     The ranges are written.
+  @retval         Others          The status of SpiFlashWriteVector().
+
+**/
+EFI_STATUS
+FvbWriteVector (
+  IN     SPI_FLASH_WRITE_VECTOR  *WriteVector,
+  IN     UINTN                   VectorCount,
+  IN     UINTN                   Address,
+  IN OUT UINTN                   *NumBytes
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       Index;
+
+  Status = SpiFlashWriteVector (WriteVector, VectorCount);
+  if (EFI_ERROR (Status)) {
+    for (Index = 0; Index < VectorCount; Index++) {
+      if (WriteVector[Index].NumBytes == 0) {
+        *NumBytes = WriteVector[Index].Address - Address;
+        break;
+      }
+    }
+  }
+
+  return Status;
+}
+
+/**
+  Write only the flash pages of a range that differ from the new data.
+
+  The flash is memory mapped, so each page is compared in place. Pages that
+  already hold the new data are skipped and counted in WriteSkippedBytes,
+  and the runs of pages that differ are written with vectored writes.
+
+  @param[in]      Address         The starting physical address of the write.
+  @param[in,out]  NumBytes        On input, the number of bytes to write. On output,
+                                  the number of bytes that hold the new data.
+  @param[in]      Buffer          The source data buffer for the write.
+
+  @retval         EFI_SUCCESS     The range holds the new data.
+  @retval         Others          The status of SpiFlashWriteVector() or SpiFlashLock().
+
+**/
+EFI_STATUS
+FvbWriteChangedPages (
+  IN     UINTN  Address,
+  IN OUT UINTN  *NumBytes,
+  IN     UINT8  *Buffer
+  )
+{
+  SPI_FLASH_WRITE_VECTOR  WriteVector[FVB_WRITE_VECTOR_COUNT];
+  UINTN                   VectorCount;
+  UINTN                   Offset;
+  UINTN                   PageSize;
+  UINTN                   PageLength;
+  EFI_STATUS              Status;
+
+  PageSize = mFvbModuleGlobal.FlashPageSize;
+  if (PageSize == 0) {
+    PageSize = FVB_FLASH_PAGE_SIZE;
+  }
+
+  VectorCount = 0;
+  Offset      = 0;
+  while (Offset < *NumBytes) {
+    PageLength = PageSize - ((Address + Offset) & (PageSize - 1));
+    PageLength = MIN (PageLength, *NumBytes - Offset);
+
+    if (CompareMem ((VOID *)(Address + Offset), Buffer + Offset, PageLength) == 0) {
+      mFvbModuleGlobal.WriteSkippedBytes += PageLength;
+    } else if ((VectorCount != 0) &&
+               (WriteVector[VectorCount - 1].Address + WriteVector[VectorCount - 1].NumBytes == Address + Offset))
+    {
+      WriteVector[VectorCount - 1].NumBytes += (UINT32)PageLength;
+    } else {
+      if (VectorCount == FVB_WRITE_VECTOR_COUNT) {
+        Status = FvbWriteVector (WriteVector, VectorCount, Address, NumBytes);
+        if (EFI_ERROR (Status)) {
+          return Status;
+        }
+
+        VectorCount = 0;
+      }
+
+      WriteVector[VectorCount].Address  = Address + Offset;
+      WriteVector[VectorCount].NumBytes = (UINT32)PageLength;
+      WriteVector[VectorCount].Buffer   = Buffer + Offset;
+      VectorCount++;
+    }
+
+    Offset += PageLength;
+  }
+
+  //
+  // The flash is locked after every write, also when no page was written.
+  //
+  if (VectorCount == 0) {
+    return SpiFlashLock ();
+  }
+
+  return FvbWriteVector (WriteVector, VectorCount, Address, NumBytes);
+}
+
+/**
+  Check whether a range of flash is erased.
+
+  @param[in]  Address         The starting physical address of the range.
+  @param[in]  Length          The size of the range in bytes.
+
+  @retval     TRUE            Every byte of the range is 0xFF.
+  @retval     FALSE           Some byte of the range is not 0xFF.
+
+**/
+BOOLEAN
+FvbIsErased (
+  IN UINTN  Address,
+  IN UINTN  Length
+  )
+{
+  CONST UINT8  *Flash;
+  UINTN        Index;
+
+  Flash = (CONST UINT8 *)Address;
+  for (Index = 0; Index < Length; Index++) {
+    if (Flash[Index] != 0xFF) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
 /**
   Writes specified number of bytes from the input buffer to the block.
 
@@ -295,6 +536,7 @@ FvbWriteBlock (
   EFI_FVB_ATTRIBUTES_2  Attributes;
   UINTN                 LbaAddress;
   UINTN                 LbaLength;
+  UINT64                WriteSkippedBytes;
   EFI_STATUS            Status;
   BOOLEAN               BadBufferSize = FALSE;
 
@@ -338,18 +580,20 @@ FvbWriteBlock (
     BadBufferSize = TRUE;
   }
 
-  Status = SpiFlashWrite (LbaAddress + BlockOffset, (UINT32 *)NumBytes, Buffer);
-  if (EFI_ERROR (Status)) {
-    return Status;
+  //
+  // Only the pages that differ are written. The vectored write takes the
+  // lock and flushes the cache once for all of them.
+  //
+  WriteSkippedBytes = mFvbModuleGlobal.WriteSkippedBytes;
+  Status            = FvbWriteChangedPages (LbaAddress + BlockOffset, NumBytes, Buffer);
+  if (mFvbModuleGlobal.WriteSkippedBytes - WriteSkippedBytes < *NumBytes) {
+    FvbWearCountProgram (FvbInstance, Lba);
   }
 
-  Status = SpiFlashLock ();
   if (EFI_ERROR (Status)) {
     return Status;
   }
 
-  WriteBackInvalidateDataCacheRange ((VOID *)(LbaAddress + BlockOffset), *NumBytes);
-
   if (!EFI_ERROR (Status) && BadBufferSize) {
     return EFI_BAD_BUFFER_SIZE;
   } else {
@@ -358,10 +602,15 @@ FvbWriteBlock (
 }
 
 /**
-  Erases and initializes a firmware volume block.
+  Erases and initializes a run of contiguous firmware volume blocks.
+
+  Blocks that are already erased are skipped and counted in
+  EraseSkippedBytes. Each run of blocks between them is erased with a single
+  SpiFlashBlockErase() call, and the lock is taken once for the whole run.
 
   @param[in]    FvbInstance       The pointer to the EFI_FVB_INSTANCE
-  @param[in]    Lba               The logical block index to be erased
+  @param[in]    Lba               The first logical block index to be erased
+  @param[in]    NumOfLba          The number of logical blocks to be erased
 
   @retval   EFI_SUCCESS           The erase request was successfully completed
   @retval   EFI_ACCESS_DENIED     The firmware volume is in the WriteDisabled state
@@ -374,12 +623,19 @@ FvbWriteBlock (
 EFI_STATUS
 FvbEraseBlock (
   IN EFI_FVB_INSTANCE  *FvbInstance,
-  IN EFI_LBA           Lba
+  IN EFI_LBA           Lba,
+  IN UINTN             NumOfLba
   )
 {
   EFI_FVB_ATTRIBUTES_2  Attributes;
   UINTN                 LbaAddress;
   UINTN                 LbaLength;
+  UINTN                 EraseAddress;
+  UINTN                 EraseLength;
+  UINTN                 EraseIndex;
+  UINTN                 Length;
+  UINTN                 Index;
+  BOOLEAN               Erased;
   EFI_STATUS            Status;
 
   //
@@ -392,26 +648,52 @@ FvbEraseBlock (
   }
 
   //
-  // Get the starting address of the block for erase.
+  // The blocks of a FV are contiguous on flash, so the blocks that are not
+  // erased yet form runs of flash between the erased ones.
   //
-  Status = FvbGetLbaAddress (FvbInstance, Lba, &LbaAddress, &LbaLength, NULL);
-  if (EFI_ERROR (Status)) {
-    return Status;
-  }
+  EraseAddress = 0;
+  EraseLength  = 0;
+  EraseIndex   = 0;
+  Erased       = FALSE;
+  for (Index = 0; Index <= NumOfLba; Index++) {
+    if (Index < NumOfLba) {
+      Status = FvbGetLbaAddress (FvbInstance, Lba + Index, &LbaAddress, &LbaLength, NULL);
+      if (EFI_ERROR (Status)) {
+        return Status;
+      }
 
-  Status = SpiFlashBlockErase (LbaAddress, &LbaLength);
-  if (EFI_ERROR (Status)) {
-    return Status;
-  }
+      if (!FvbIsErased (LbaAddress, LbaLength)) {
+        if (EraseLength == 0) {
+          EraseAddress = LbaAddress;
+          EraseIndex   = Index;
+        }
 
-  Status = SpiFlashLock ();
-  if (EFI_ERROR (Status)) {
-    return Status;
+        EraseLength += LbaLength;
+        continue;
+      }
+
+      mFvbModuleGlobal.EraseSkippedBytes += LbaLength;
+    }
+
+    if (EraseLength != 0) {
+      Length = EraseLength;
+      Status = SpiFlashBlockErase (EraseAddress, &Length);
+      WriteBackInvalidateDataCacheRange ((VOID *)EraseAddress, Length);
+      FvbWearCountErase (FvbInstance, Lba + EraseIndex, Index - EraseIndex);
+      if (EFI_ERROR (Status)) {
+        return Status;
+      }
+
+      EraseLength = 0;
+      Erased      = TRUE;
+    }
   }
 
-  WriteBackInvalidateDataCacheRange ((VOID *)LbaAddress, LbaLength);
+  if (!Erased) {
+    return EFI_SUCCESS;
+  }
 
-  return Status;
+  return SpiFlashLock ();
 }
 
 /**
@@ -838,6 +1120,8 @@ FvbProtocolEraseBlocks (
   VA_LIST           Args;
   EFI_LBA           StartingLba;
   UINTN             NumOfLba;
+  EFI_LBA           RunLba;
+  UINTN             RunNumOfLba;
   EFI_STATUS        Status;
 
   DEBUG ((DEBUG_INFO, "FvbProtocolEraseBlocks: \n"));
@@ -871,6 +1155,12 @@ FvbProtocolEraseBlocks (
 
   VA_END (Args);
 
+  //
+  // Merge the ranges of the list that touch each other into runs, and erase
+  // each run at once.
+  //
+  RunLba      = 0;
+  RunNumOfLba = 0;
   VA_START (Args, This);
   do {
     StartingLba = VA_ARG (Args, EFI_LBA);
@@ -880,20 +1170,35 @@ FvbProtocolEraseBlocks (
 
     NumOfLba = VA_ARG (Args, UINT32);
 
-    while ( NumOfLba > 0 ) {
-      Status = FvbEraseBlock (FvbInstance, StartingLba);
+    if ((RunNumOfLba != 0) && (StartingLba == RunLba + RunNumOfLba)) {
+      RunNumOfLba += NumOfLba;
+      continue;
+    }
+
+    if ((RunNumOfLba != 0) && (StartingLba + NumOfLba == RunLba)) {
+      RunLba       = StartingLba;
+      RunNumOfLba += NumOfLba;
+      continue;
+    }
+
+    if (RunNumOfLba != 0) {
+      Status = FvbEraseBlock (FvbInstance, RunLba, RunNumOfLba);
       if ( EFI_ERROR (Status)) {
         VA_END (Args);
         return Status;
       }
-
-      StartingLba++;
-      NumOfLba--;
     }
+
+    RunLba      = StartingLba;
+    RunNumOfLba = NumOfLba;
   } while (1);
 
   VA_END (Args);
 
+  if (RunNumOfLba != 0) {
+    return FvbEraseBlock (FvbInstance, RunLba, RunNumOfLba);
+  }
+
   return EFI_SUCCESS;
 }
 
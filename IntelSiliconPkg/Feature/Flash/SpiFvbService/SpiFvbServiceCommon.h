@@ -16,6 +16,7 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 #include <Pi/PiFirmwareVolume.h>
 #include <Protocol/DevicePath.h>
 #include <Protocol/FirmwareVolumeBlock.h>
+#include <Protocol/SpiFvbWear.h>
 
 #include <Library/BaseLib.h>
 #include <Library/DebugLib.h>
@@ -45,10 +46,51 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 
 #define FVB_INSTANCE_SIGNATURE  SIGNATURE_32('F','V','B','I')
 
+//
+// The page program size of the flash device, which is the unit a write is
+// compared with the flash in, when the geometry of the device is not known.
+//
+#define FVB_FLASH_PAGE_SIZE  0x100
+
+//
+// The number of ranges FvbWriteBlock() writes with one vectored write.
+//
+#define FVB_WRITE_VECTOR_COUNT  8
+
+//
+// One entry of the FV block map, with the first LBA it describes and the
+// offset of that LBA in the FV precomputed.
+//
+typedef struct {
+  EFI_LBA    StartLba;
+  UINTN      Offset;
+  UINT32     BlockLength;
+} FVB_LBA_MAP_ENTRY;
+
+//
+// The wear counters of one block.
+//
+typedef struct {
+  UINT32    EraseCount;
+  UINT32    ProgramCount;
+} FVB_WEAR_COUNT;
+
 typedef struct {
   UINT32                                Signature;
   UINTN                                 FvBase;
   UINTN                                 NumOfBlocks;
+  //
+  // The block map as prefix sums, built by FvbInitializeLbaMap(). It is NULL
+  // if the map could not be built, and FvbGetLbaAddress() walks the block
+  // map of FvHeader instead.
+  //
+  FVB_LBA_MAP_ENTRY                     *LbaMap;
+  UINTN                                 NumOfLbaMapEntries;
+  //
+  // The wear counters of the blocks. It is NULL if the blocks of the
+  // instance are not counted.
+  //
+  FVB_WEAR_COUNT                        *WearCount;
   EFI_DEVICE_PATH_PROTOCOL              *DevicePath;
   EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL    FvbProtocol;
   EFI_FIRMWARE_VOLUME_HEADER            FvHeader;
@@ -57,6 +99,19 @@ typedef struct {
 typedef struct {
   EFI_FVB_INSTANCE    *FvbInstance;
   UINT32              NumFv;
+  //
+  // The page program size from the geometry of the flash device, or 0 to
+  // use FVB_FLASH_PAGE_SIZE.
+  //
+  UINT32              FlashPageSize;
+  //
+  // Bytes not written because the flash already held them.
+  //
+  UINT64              WriteSkippedBytes;
+  //
+  // Bytes not erased because the flash was already erased.
+  //
+  UINT64              EraseSkippedBytes;
 } FVB_GLOBAL;
 
 //
@@ -151,6 +206,202 @@ GetFvbInfo (
   OUT EFI_FIRMWARE_VOLUME_HEADER  **FvbInfo
   );
 
+/**
+  Build the LBA map of a FVB instance from the block map of its FV header.
+
+  @param[in, out] FvbInstance     The FVB instance. FvHeader and NumOfBlocks must be set.
+
+  @retval EFI_SUCCESS             The LBA map is built.
+  @retval EFI_OUT_OF_RESOURCES    There is not enough memory for the LBA map.
+
+**/
+EFI_STATUS
+FvbInitializeLbaMap (
+  IN OUT EFI_FVB_INSTANCE  *FvbInstance
+  );
+
+/**
+  Retrieves the starting address of an LBA in an FV.
+
+  @param[in]  FvbInstance     The pointer to the EFI_FVB_INSTANCE.
+  @param[in]  Lba             The logical block address
+  @param[out] LbaAddress      On output, contains the physical starting address
+                              of the Lba
+  @param[out] LbaLength       On output, contains the length of the block
+  @param[out] NumOfBlocks     On output, the number of consecutive blocks
+                              starting with Lba that have the size of Lba
+
+  @retval   EFI_SUCCESS Successfully returns
+  @retval   EFI_INVALID_PARAMETER Instance not found
+
+**/
+EFI_STATUS
+FvbGetLbaAddress (
+  IN  EFI_FVB_INSTANCE  *FvbInstance,
+  IN  EFI_LBA           Lba,
+  OUT UINTN             *LbaAddress,
+  OUT UINTN             *LbaLength,
+  OUT UINTN             *NumOfBlocks
+  );
+
+/**
+  Get the EFI_FVB_ATTRIBUTES_2 of a FV.
+
+  @param[in]  FvbInstance The pointer to the EFI_FVB_INSTANCE.
+
+  @return     Attributes of the FV identified by FvbInstance.
+
+**/
+EFI_FVB_ATTRIBUTES_2
+FvbGetVolumeAttributes (
+  IN EFI_FVB_INSTANCE  *FvbInstance
+  );
+
+/**
+  Writes specified number of bytes from the input buffer to the block.
+
+  @param[in]  FvbInstance           The pointer to the EFI_FVB_INSTANCE
+  @param[in]  Lba                   The starting logical block index to write to
+  @param[in]  BlockOffset           Offset into the block at which to begin writing
+  @param[in]  NumBytes              Pointer that on input contains the total size of
+                                    the buffer. On output, it contains the total number
+                                    of bytes actually written
+  @param[in]  Buffer                Pointer to a caller allocated buffer that contains
+                                    the source for the write
+  @retval     EFI_SUCCESS           The firmware volume was written successfully
+  @retval     EFI_BAD_BUFFER_SIZE   Write attempted across a LBA boundary. On output,
+                                    NumBytes contains the total number of bytes
+                                    actually written
+  @retval     EFI_ACCESS_DENIED     The firmware volume is in the WriteDisabled state
+  @retval     EFI_DEVICE_ERROR      The block device is not functioning correctly and
+                                    could not be written
+  @retval     EFI_INVALID_PARAMETER Instance not found, or NumBytes, Buffer are NULL
+
+**/
+EFI_STATUS
+FvbWriteBlock (
+  IN EFI_FVB_INSTANCE  *FvbInstance,
+  IN EFI_LBA           Lba,
+  IN UINTN             BlockOffset,
+  IN OUT UINTN         *NumBytes,
+  IN UINT8             *Buffer
+  );
+
+/**
+  Check whether a range of flash is erased.
+
+  @param[in]  Address         The starting physical address of the range.
+  @param[in]  Length          The size of the range in bytes.
+
+  @retval     TRUE            Every byte of the range is 0xFF.
+  @retval     FALSE           Some byte of the range is not 0xFF.
+
+**/
+BOOLEAN
+FvbIsErased (
+  IN UINTN  Address,
+  IN UINTN  Length
+  );
+
+/**
+  Start counting the erases and programs of the blocks of a FVB instance.
+
+  @param[in, out] FvbInstance     The FVB instance. NumOfBlocks must be set.
+
+  @retval EFI_SUCCESS             The blocks of the instance are counted.
+  @retval EFI_OUT_OF_RESOURCES    There is not enough memory for the counters.
+
+**/
+EFI_STATUS
+FvbInitializeWearCount (
+  IN OUT EFI_FVB_INSTANCE  *FvbInstance
+  );
+
+/**
+  Count the erase of a run of blocks, and save the counters to flash when
+  the save interval is reached.
+
+  @param[in]  FvbInstance         The FVB instance.
+  @param[in]  Lba                 The first block of the run.
+  @param[in]  NumOfLba            The number of blocks in the run.
+
+**/
+VOID
+FvbWearCountErase (
+  IN EFI_FVB_INSTANCE  *FvbInstance,
+  IN EFI_LBA           Lba,
+  IN UINTN             NumOfLba
+  );
+
+/**
+  Count a write that programmed a block.
+
+  @param[in]  FvbInstance         The FVB instance.
+  @param[in]  Lba                 The block.
+
+**/
+VOID
+FvbWearCountProgram (
+  IN EFI_FVB_INSTANCE  *FvbInstance,
+  IN EFI_LBA           Lba
+  );
+
+/**
+  Set up the flash area the wear counters are saved in, and restore the
+  counters of the last save.
+
+  The area is split in two halves. The saves are appended to one half, and
+  when it is full, the other half is erased and the saves continue there,
+  so a power loss never loses both the old and the new counters.
+
+  @param[in]  Base                The memory mapped flash address of the area.
+  @param[in]  Size                The size of the area. 0 disables the saves.
+  @param[in]  SaveInterval        The number of block erases between two saves. 0 only
+                                  saves when FvbWearSave() is called.
+
+  @retval EFI_SUCCESS             The area is ready, or the saves are disabled.
+  @retval EFI_INVALID_PARAMETER   The halves of the area are not multiples of 4KB.
+  @retval EFI_OUT_OF_RESOURCES    There is not enough memory for a save.
+
+**/
+EFI_STATUS
+FvbWearInitializeLog (
+  IN UINTN   Base,
+  IN UINTN   Size,
+  IN UINT32  SaveInterval
+  );
+
+/**
+  Save the wear counters of every FVB instance to flash.
+
+  @retval EFI_SUCCESS             The counters are saved.
+  @retval EFI_UNSUPPORTED         No flash area is set up for the counters.
+  @retval Others                  The counters could not be written to flash.
+
+**/
+EFI_STATUS
+FvbWearSave (
+  VOID
+  );
+
+/**
+  Get the wear counters of every block of the FVB instances.
+
+  @param[in, out] BlockCount      On input, the number of entries in Blocks. On output,
+                                  the number of blocks with counters.
+  @param[out]     Blocks          The counters of the blocks.
+
+  @retval EFI_SUCCESS             Blocks is filled.
+  @retval EFI_BUFFER_TOO_SMALL    Blocks is too small. BlockCount is the number of entries needed.
+  @retval EFI_INVALID_PARAMETER   BlockCount is NULL, or Blocks is NULL and *BlockCount is not 0.
+
+**/
+EFI_STATUS
+FvbWearGetCounters (
+  IN OUT UINTN               *BlockCount,
+  OUT    SPI_FVB_WEAR_BLOCK  *Blocks
+  );
+
 /**
   Get the total size of the firmware volume on flash used for variable store operations.
 
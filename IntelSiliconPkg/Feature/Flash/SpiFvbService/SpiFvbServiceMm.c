@@ -12,6 +12,9 @@
 #include <Library/MmServicesTableLib.h>
 #include <Library/UefiDriverEntryPoint.h>
 #include <Protocol/SmmFirmwareVolumeBlock.h>
+#include <Protocol/MmReadyToLock.h>
+
+#include "SpiFvbServiceMm.h"
 
 /**
   The function installs EFI_FIRMWARE_VOLUME_BLOCK protocol
@@ -95,6 +98,159 @@ InstallFvbProtocol (
   ASSERT_EFI_ERROR (Status);
 }
 
+/**
+  Get the wear counters of every block.
+
+  @param[in]      This            The protocol instance.
+  @param[in, out] BlockCount      On input, the number of entries in Blocks. On output,
+                                  the number of blocks with counters.
+  @param[out]     Blocks          The counters of the blocks.
+
+  @retval EFI_SUCCESS             Blocks is filled.
+  @retval EFI_BUFFER_TOO_SMALL    Blocks is too small. BlockCount is the number of entries needed.
+  @retval EFI_INVALID_PARAMETER   BlockCount is NULL, or Blocks is NULL and *BlockCount is not 0.
+
+**/
+EFI_STATUS
+EFIAPI
+FvbWearProtocolGetCounters (
+  IN     SPI_FVB_WEAR_PROTOCOL  *This,
+  IN OUT UINTN                  *BlockCount,
+  OUT    SPI_FVB_WEAR_BLOCK     *Blocks
+  )
+{
+  return FvbWearGetCounters (BlockCount, Blocks);
+}
+
+/**
+  Save the wear counters to flash now.
+
+  @param[in]      This            The protocol instance.
+
+  @retval EFI_SUCCESS             The counters are saved.
+  @retval EFI_UNSUPPORTED         No flash area is reserved for the counters.
+  @retval Others                  The counters could not be written to flash.
+
+**/
+EFI_STATUS
+EFIAPI
+FvbWearProtocolSave (
+  IN SPI_FVB_WEAR_PROTOCOL  *This
+  )
+{
+  return FvbWearSave ();
+}
+
+SPI_FVB_WEAR_PROTOCOL  mFvbWearProtocol = {
+  FvbWearProtocolGetCounters,
+  FvbWearProtocolSave
+};
+
+//
+// Set when MM is locked. From then on the MMI handler only reports the
+// counters, so neither third party code in BDS nor the OS can make the
+// service erase and program the flash.
+//
+STATIC BOOLEAN  mFvbWearMmiReadOnly = FALSE;
+
+/**
+  Make the wear MMI handler read-only when MM is locked.
+
+  @param[in]  Protocol            Points to the protocol's unique identifier.
+  @param[in]  Interface           Points to the interface instance.
+  @param[in]  Handle              The handle on which the interface was installed.
+
+  @retval EFI_SUCCESS             The MMI handler is read-only.
+
+**/
+EFI_STATUS
+EFIAPI
+FvbWearReadyToLockNotify (
+  IN CONST EFI_GUID  *Protocol,
+  IN VOID            *Interface,
+  IN EFI_HANDLE      Handle
+  )
+{
+  mFvbWearMmiReadOnly = TRUE;
+  return EFI_SUCCESS;
+}
+
+/**
+  Report or save the wear counters for a caller outside MM. The counters
+  are only saved on request before MM is locked.
+
+  @param[in]      DispatchHandle  The unique handle assigned to this handler by MmiHandlerRegister().
+  @param[in]      Context         Points to an optional handler context which was specified when the
+                                  handler was registered.
+  @param[in, out] CommBuffer      A pointer to a collection of data in memory that will
+                                  be conveyed from a non-MM environment into an MM environment.
+  @param[in, out] CommBufferSize  The size of the CommBuffer.
+
+  @retval EFI_SUCCESS             The MMI is handled. The status of the function is in the
+                                  ReturnStatus of the communicate header.
+
+**/
+EFI_STATUS
+EFIAPI
+FvbWearMmiHandler (
+  IN     EFI_HANDLE  DispatchHandle,
+  IN     CONST VOID  *Context         OPTIONAL,
+  IN OUT VOID        *CommBuffer      OPTIONAL,
+  IN OUT UINTN       *CommBufferSize  OPTIONAL
+  )
+{
+  SPI_FVB_WEAR_COMMUNICATE_HEADER  *Header;
+  UINTN                            BufferSize;
+  UINTN                            BlockCount;
+  UINT64                           Function;
+  EFI_STATUS                       Status;
+
+  if ((CommBuffer == NULL) || (CommBufferSize == NULL)) {
+    return EFI_SUCCESS;
+  }
+
+  //
+  // The buffer is outside MM and can change under the handler, so its size
+  // and its function are read once.
+  //
+  BufferSize = *CommBufferSize;
+  if ((BufferSize < sizeof (SPI_FVB_WEAR_COMMUNICATE_HEADER)) ||
+      !FvbIsBufferOutsideMmValid ((UINTN)CommBuffer, BufferSize))
+  {
+    DEBUG ((DEBUG_ERROR, "FvbWearMmiHandler: Invalid communicate buffer\n"));
+    return EFI_SUCCESS;
+  }
+
+  Header   = (SPI_FVB_WEAR_COMMUNICATE_HEADER *)CommBuffer;
+  Function = Header->Function;
+  switch (Function) {
+    case SPI_FVB_WEAR_FUNCTION_GET_COUNTERS:
+      BlockCount = (BufferSize - sizeof (SPI_FVB_WEAR_COMMUNICATE_HEADER)) / sizeof (SPI_FVB_WEAR_BLOCK);
+      Status     = FvbWearGetCounters (
+                     &BlockCount,
+                     (BlockCount == 0) ? NULL : (SPI_FVB_WEAR_BLOCK *)(Header + 1)
+                     );
+      Header->BlockCount = BlockCount;
+      break;
+
+    case SPI_FVB_WEAR_FUNCTION_SAVE:
+      if (mFvbWearMmiReadOnly) {
+        Status = EFI_ACCESS_DENIED;
+      } else {
+        Status = FvbWearSave ();
+      }
+
+      break;
+
+    default:
+      Status = EFI_UNSUPPORTED;
+      break;
+  }
+
+  Header->ReturnStatus = (UINT64)Status;
+  return EFI_SUCCESS;
+}
+
 /**
   The function does the necessary initialization work for
   Firmware Volume Block Driver.
@@ -116,6 +272,10 @@ FvbInitialize (
   UINT32                      BytesWritten;
   UINTN                       BytesErased;
   UINT64                      NvStorageFvSize;
+  VOID                        *Registration;
+  EFI_HANDLE                  MmiHandle;
+  EFI_HANDLE                  WearHandle;
+  SPI_FLASH_GEOMETRY          Geometry;
 
   Status = GetVariableFlashNvStorageInfo (&BaseAddress, &NvStorageFvSize);
   if (EFI_ERROR (Status)) {
@@ -269,6 +429,13 @@ FvbInitialize (
     FvbInstance            = mFvbModuleGlobal.FvbInstance;
     mFvbModuleGlobal.NumFv = 0;
 
+    //
+    // Compare writes with the flash in the page size of the flash device.
+    //
+    if (!EFI_ERROR (SpiFlashGetGeometry (&Geometry))) {
+      mFvbModuleGlobal.FlashPageSize = Geometry.PageSize;
+    }
+
     for (Idx = 0; ; Idx++) {
       if ((mPlatformFvBaseAddress[Idx].FvSize == 0) && (mPlatformFvBaseAddress[Idx].FvBase == 0)) {
         break;
@@ -306,6 +473,16 @@ FvbInitialize (
         FvbInstance->NumOfBlocks += PtrBlockMapEntry->NumBlocks;
       }
 
+      Status = FvbInitializeLbaMap (FvbInstance);
+      if (EFI_ERROR (Status)) {
+        DEBUG ((DEBUG_WARN, "WARNING - No LBA map for the FV in 0x%x - %r\n", FvbInstance->FvBase, Status));
+      }
+
+      Status = FvbInitializeWearCount (FvbInstance);
+      if (EFI_ERROR (Status)) {
+        DEBUG ((DEBUG_WARN, "WARNING - No wear counters for the FV in 0x%x - %r\n", FvbInstance->FvBase, Status));
+      }
+
       //
       // Add a FVB Protocol Instance
       //
@@ -319,5 +496,31 @@ FvbInitialize (
                                          FvHeader->HeaderLength +
                                          (sizeof (EFI_FVB_INSTANCE) - sizeof (EFI_FIRMWARE_VOLUME_HEADER)));
     }
+
+    //
+    // Restore the wear counters of the last save, and report them.
+    //
+    Status = FvbWearInitializeLog (
+               PcdGet32 (PcdSpiFvbWearLogBase),
+               PcdGet32 (PcdSpiFvbWearLogSize),
+               PcdGet32 (PcdSpiFvbWearSaveInterval)
+               );
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_WARN, "WARNING - The wear counters are not saved - %r\n", Status));
+    }
+
+    WearHandle = NULL;
+    Status     = gMmst->MmInstallProtocolInterface (
+                          &WearHandle,
+                          &gSpiFvbWearProtocolGuid,
+                          EFI_NATIVE_INTERFACE,
+                          &mFvbWearProtocol
+                          );
+    ASSERT_EFI_ERROR (Status);
+
+    Status = gMmst->MmiHandlerRegister (FvbWearMmiHandler, &gSpiFvbWearProtocolGuid, &MmiHandle);
+    ASSERT_EFI_ERROR (Status);
+    Status = gMmst->MmRegisterProtocolNotify (&gEfiMmReadyToLockProtocolGuid, FvbWearReadyToLockNotify, &Registration);
+    ASSERT_EFI_ERROR (Status);
   }
 }
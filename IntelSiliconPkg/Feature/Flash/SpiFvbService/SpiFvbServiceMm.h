@@ -9,6 +9,23 @@
 #ifndef _SPI_FVB_SERVICE_MM_H_
 #define _SPI_FVB_SERVICE_MM_H_
 
+/**
+  Check that a buffer is entirely outside MM memory, so it can be used as a
+  communicate buffer.
+
+  @param[in]  Buffer              The address of the buffer.
+  @param[in]  Length              The size of the buffer in bytes.
+
+  @retval TRUE                    The buffer is valid.
+  @retval FALSE                   The buffer overlaps MM memory, or is invalid.
+
+**/
+BOOLEAN
+FvbIsBufferOutsideMmValid (
+  IN UINTN   Buffer,
+  IN UINT64  Length
+  );
+
 /**
   The function does the necessary initialization work for
   Firmware Volume Block Driver.
@@ -9,6 +9,27 @@
 
 #include "SpiFvbServiceCommon.h"
 #include "SpiFvbServiceMm.h"
+#include <Library/SmmMemLib.h>
+
+/**
+  Check that a buffer is entirely outside MM memory, so it can be used as a
+  communicate buffer.
+
+  @param[in]  Buffer              The address of the buffer.
+  @param[in]  Length              The size of the buffer in bytes.
+
+  @retval TRUE                    The buffer is valid.
+  @retval FALSE                   The buffer overlaps MM memory, or is invalid.
+
+**/
+BOOLEAN
+FvbIsBufferOutsideMmValid (
+  IN UINTN   Buffer,
+  IN UINT64  Length
+  )
+{
+  return SmmIsBufferOutsideSmmValid ((EFI_PHYSICAL_ADDRESS)Buffer, Length);
+}
 
 /**
   The driver Traditional MM entry point.
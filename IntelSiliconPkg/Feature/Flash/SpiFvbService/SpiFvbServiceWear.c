@@ -0,0 +1,571 @@
+/** @file
+  Wear counters of the firmware volume blocks.
+
+  Every erase and every write that programs a block is counted per block.
+  The counters are saved to a reserved flash area as an append log: each
+  save is a record with a sequence number and a CRC32, and the newest valid
+  record is restored when the service starts.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include "SpiFvbServiceCommon.h"
+
+#define FVB_WEAR_LOG_SIGNATURE  SIGNATURE_32 ('F', 'W', 'L', 'G')
+
+//
+// The header of a saved record. The FVB_WEAR_COUNT of every counted block
+// follow it, in the order of the FVB instances and of their blocks.
+//
+typedef struct {
+  UINT32    Signature;
+  UINT32    Sequence;
+  UINT32    BlockCount;
+  //
+  // The CRC32 of the whole record, computed with this field 0.
+  //
+  UINT32    Crc32;
+} FVB_WEAR_LOG_RECORD;
+
+typedef struct {
+  UINTN                  Base;
+  UINTN                  HalfSize;
+  //
+  // The half the records are appended to, and the offset of the next
+  // record in it.
+  //
+  UINTN                  Half;
+  UINTN                  Offset;
+  //
+  // TRUE if the half holds a valid record. Only then may the other half be
+  // erased, as it may hold the only one otherwise.
+  //
+  BOOLEAN                HalfHasRecord;
+  UINT32                 Sequence;
+  UINT32                 SaveInterval;
+  UINT32                 ErasesSinceSave;
+  //
+  // The buffer a record is built or checked in. It is NULL if the saves are
+  // disabled.
+  //
+  FVB_WEAR_LOG_RECORD    *Record;
+  UINTN                  RecordSize;
+} FVB_WEAR_LOG;
+
+STATIC FVB_WEAR_LOG  mFvbWearLog;
+
+/**
+  Get the FVB instance that follows another one. The instances are packed
+  one after the other, each with its variable sized FV header.
+
+  @param[in]  FvbInstance         The FVB instance.
+
+  @return The next FVB instance.
+
+**/
+STATIC
+EFI_FVB_INSTANCE *
+FvbWearNextInstance (
+  IN EFI_FVB_INSTANCE  *FvbInstance
+  )
+{
+  return (EFI_FVB_INSTANCE *)((UINTN)((UINT8 *)FvbInstance) +
+                              FvbInstance->FvHeader.HeaderLength +
+                              (sizeof (EFI_FVB_INSTANCE) - sizeof (EFI_FIRMWARE_VOLUME_HEADER)));
+}
+
+/**
+  Check whether a flash area overlaps a firmware volume of the FVB
+  instances.
+
+  @param[in]  Base                The memory mapped flash address of the area.
+  @param[in]  Size                The size of the area.
+
+  @retval TRUE                    The area overlaps a firmware volume.
+  @retval FALSE                   The area is outside every firmware volume.
+
+**/
+STATIC
+BOOLEAN
+FvbWearIsAreaInFv (
+  IN UINTN  Base,
+  IN UINTN  Size
+  )
+{
+  EFI_FVB_INSTANCE  *FvbInstance;
+  UINTN             Index;
+
+  FvbInstance = mFvbModuleGlobal.FvbInstance;
+  for (Index = 0; Index < mFvbModuleGlobal.NumFv; Index++) {
+    if ((Base < FvbInstance->FvBase + FvbInstance->FvHeader.FvLength) &&
+        (FvbInstance->FvBase < Base + Size))
+    {
+      return TRUE;
+    }
+
+    FvbInstance = FvbWearNextInstance (FvbInstance);
+  }
+
+  return FALSE;
+}
+
+/**
+  Get the number of blocks that are counted.
+
+  @return The number of blocks of the FVB instances with wear counters.
+
+**/
+STATIC
+UINTN
+FvbWearBlockCount (
+  VOID
+  )
+{
+  EFI_FVB_INSTANCE  *FvbInstance;
+  UINTN             BlockCount;
+  UINTN             Index;
+
+  BlockCount  = 0;
+  FvbInstance = mFvbModuleGlobal.FvbInstance;
+  for (Index = 0; Index < mFvbModuleGlobal.NumFv; Index++) {
+    if (FvbInstance->WearCount != NULL) {
+      BlockCount += FvbInstance->NumOfBlocks;
+    }
+
+    FvbInstance = FvbWearNextInstance (FvbInstance);
+  }
+
+  return BlockCount;
+}
+
+/**
+  Copy the counters between the FVB instances and the record buffer.
+
+  @param[in]  ToRecord            TRUE to copy the counters to the record, FALSE to
+                                  restore them from the record.
+
+**/
+STATIC
+VOID
+FvbWearCopyCounters (
+  IN BOOLEAN  ToRecord
+  )
+{
+  EFI_FVB_INSTANCE  *FvbInstance;
+  FVB_WEAR_COUNT    *Counters;
+  UINTN             Size;
+  UINTN             Index;
+
+  Counters    = (FVB_WEAR_COUNT *)(mFvbWearLog.Record + 1);
+  FvbInstance = mFvbModuleGlobal.FvbInstance;
+  for (Index = 0; Index < mFvbModuleGlobal.NumFv; Index++) {
+    if (FvbInstance->WearCount != NULL) {
+      Size = FvbInstance->NumOfBlocks * sizeof (FVB_WEAR_COUNT);
+      if (ToRecord) {
+        CopyMem (Counters, FvbInstance->WearCount, Size);
+      } else {
+        CopyMem (FvbInstance->WearCount, Counters, Size);
+      }
+
+      Counters += FvbInstance->NumOfBlocks;
+    }
+
+    FvbInstance = FvbWearNextInstance (FvbInstance);
+  }
+}
+
+/**
+  Check the record at an offset of a half of the log. The record is read
+  into the record buffer.
+
+  @param[in]  Half                The half of the log.
+  @param[in]  Offset              The offset of the record in the half.
+
+  @retval TRUE                    The record is complete and has the counters of all
+                                  the counted blocks.
+  @retval FALSE                   There is no valid record at Offset.
+
+**/
+STATIC
+BOOLEAN
+FvbWearIsRecordValid (
+  IN UINTN  Half,
+  IN UINTN  Offset
+  )
+{
+  FVB_WEAR_LOG_RECORD  *Record;
+  UINT32               Crc32;
+
+  if (Offset + mFvbWearLog.RecordSize > mFvbWearLog.HalfSize) {
+    return FALSE;
+  }
+
+  Record = mFvbWearLog.Record;
+  CopyMem (Record, (VOID *)(mFvbWearLog.Base + Half * mFvbWearLog.HalfSize + Offset), mFvbWearLog.RecordSize);
+  if ((Record->Signature != FVB_WEAR_LOG_SIGNATURE) ||
+      (Record->BlockCount != (mFvbWearLog.RecordSize - sizeof (FVB_WEAR_LOG_RECORD)) / sizeof (FVB_WEAR_COUNT)))
+  {
+    return FALSE;
+  }
+
+  Crc32         = Record->Crc32;
+  Record->Crc32 = 0;
+  return (BOOLEAN)(CalculateCrc32 (Record, mFvbWearLog.RecordSize) == Crc32);
+}
+
+/**
+  Find the last valid record of a half of the log.
+
+  @param[in]  Half                The half of the log.
+  @param[out] Offset              The offset of the last valid record.
+  @param[out] End                 The offset a new record can be appended at. It is the
+                                  size of the half if the records are followed by
+                                  anything but erased flash.
+
+  @retval TRUE                    The half has a valid record.
+  @retval FALSE                   The half has no valid record.
+
+**/
+STATIC
+BOOLEAN
+FvbWearScanHalf (
+  IN  UINTN  Half,
+  OUT UINTN  *Offset,
+  OUT UINTN  *End
+  )
+{
+  BOOLEAN  Found;
+  UINTN    Next;
+
+  Found   = FALSE;
+  *Offset = 0;
+  for (Next = 0; FvbWearIsRecordValid (Half, Next); Next += mFvbWearLog.RecordSize) {
+    *Offset = Next;
+    Found   = TRUE;
+  }
+
+  if ((Next + mFvbWearLog.RecordSize <= mFvbWearLog.HalfSize) &&
+      FvbIsErased (mFvbWearLog.Base + Half * mFvbWearLog.HalfSize + Next, mFvbWearLog.RecordSize))
+  {
+    *End = Next;
+  } else {
+    *End = mFvbWearLog.HalfSize;
+  }
+
+  return Found;
+}
+
+/**
+  Start counting the erases and programs of the blocks of a FVB instance.
+
+  @param[in, out] FvbInstance     The FVB instance. NumOfBlocks must be set.
+
+  @retval EFI_SUCCESS             The blocks of the instance are counted.
+  @retval EFI_OUT_OF_RESOURCES    There is not enough memory for the counters.
+
+**/
+EFI_STATUS
+FvbInitializeWearCount (
+  IN OUT EFI_FVB_INSTANCE  *FvbInstance
+  )
+{
+  FvbInstance->WearCount = AllocateZeroPool (FvbInstance->NumOfBlocks * sizeof (FVB_WEAR_COUNT));
+  if (FvbInstance->WearCount == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Count the erase of a run of blocks, and save the counters to flash when
+  the save interval is reached.
+
+  @param[in]  FvbInstance         The FVB instance.
+  @param[in]  Lba                 The first block of the run.
+  @param[in]  NumOfLba            The number of blocks in the run.
+
+**/
+VOID
+FvbWearCountErase (
+  IN EFI_FVB_INSTANCE  *FvbInstance,
+  IN EFI_LBA           Lba,
+  IN UINTN             NumOfLba
+  )
+{
+  UINTN  Index;
+
+  if (FvbInstance->WearCount == NULL) {
+    return;
+  }
+
+  for (Index = 0; Index < NumOfLba; Index++) {
+    FvbInstance->WearCount[Lba + Index].EraseCount++;
+  }
+
+  mFvbWearLog.ErasesSinceSave += (UINT32)NumOfLba;
+  if ((mFvbWearLog.Record != NULL) &&
+      (mFvbWearLog.SaveInterval != 0) &&
+      (mFvbWearLog.ErasesSinceSave >= mFvbWearLog.SaveInterval))
+  {
+    //
+    // A failed save is retried at the next erase. It does not fail the erase.
+    //
+    FvbWearSave ();
+  }
+}
+
+/**
+  Count a write that programmed a block.
+
+  @param[in]  FvbInstance         The FVB instance.
+  @param[in]  Lba                 The block.
+
+**/
+VOID
+FvbWearCountProgram (
+  IN EFI_FVB_INSTANCE  *FvbInstance,
+  IN EFI_LBA           Lba
+  )
+{
+  if (FvbInstance->WearCount != NULL) {
+    FvbInstance->WearCount[Lba].ProgramCount++;
+  }
+}
+
+/**
+  Set up the flash area the wear counters are saved in, and restore the
+  counters of the last save.
+
+  The area is split in two halves. The saves are appended to one half, and
+  when it is full, the other half is erased and the saves continue there,
+  so a power loss never loses both the old and the new counters.
+
+  @param[in]  Base                The memory mapped flash address of the area.
+  @param[in]  Size                The size of the area. 0 disables the saves.
+  @param[in]  SaveInterval        The number of block erases between two saves. 0 only
+                                  saves when FvbWearSave() is called.
+
+  @retval EFI_SUCCESS             The area is ready, or the saves are disabled.
+  @retval EFI_INVALID_PARAMETER   The halves of the area are not multiples of 4KB.
+  @retval EFI_ACCESS_DENIED       The area overlaps a firmware volume of the FVB
+                                  instances. The saves are disabled.
+  @retval EFI_OUT_OF_RESOURCES    There is not enough memory for a save.
+
+**/
+EFI_STATUS
+FvbWearInitializeLog (
+  IN UINTN   Base,
+  IN UINTN   Size,
+  IN UINT32  SaveInterval
+  )
+{
+  BOOLEAN  Found[2];
+  UINTN    Offset[2];
+  UINTN    End[2];
+  UINT32   Sequence[2];
+  UINTN    Half;
+
+  if (mFvbWearLog.Record != NULL) {
+    FreePool (mFvbWearLog.Record);
+  }
+
+  ZeroMem (&mFvbWearLog, sizeof (mFvbWearLog));
+  if (Size == 0) {
+    return EFI_SUCCESS;
+  }
+
+  if (((Size % (2 * SIZE_4KB)) != 0) || (Base > MAX_UINTN - Size)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // The saves erase and program the area behind the back of the FVB
+  // instances, so it must not hold any of their data.
+  //
+  if (FvbWearIsAreaInFv (Base, Size)) {
+    return EFI_ACCESS_DENIED;
+  }
+
+  mFvbWearLog.RecordSize = sizeof (FVB_WEAR_LOG_RECORD) + FvbWearBlockCount () * sizeof (FVB_WEAR_COUNT);
+  if (mFvbWearLog.RecordSize > Size / 2) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  mFvbWearLog.Record = AllocatePool (mFvbWearLog.RecordSize);
+  if (mFvbWearLog.Record == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  mFvbWearLog.Base         = Base;
+  mFvbWearLog.HalfSize     = Size / 2;
+  mFvbWearLog.SaveInterval = SaveInterval;
+
+  for (Half = 0; Half < 2; Half++) {
+    Sequence[Half] = 0;
+    Found[Half]    = FvbWearScanHalf (Half, &Offset[Half], &End[Half]);
+    if (Found[Half]) {
+      FvbWearIsRecordValid (Half, Offset[Half]);
+      Sequence[Half] = mFvbWearLog.Record->Sequence;
+    }
+  }
+
+  if (!Found[0] && !Found[1]) {
+    //
+    // Nothing was saved yet. The first save goes to half 0, and erases it
+    // unless it is already erased.
+    //
+    mFvbWearLog.Offset = End[0];
+    return EFI_SUCCESS;
+  }
+
+  Half = (Found[1] && (!Found[0] || (Sequence[1] > Sequence[0]))) ? 1 : 0;
+  FvbWearIsRecordValid (Half, Offset[Half]);
+  FvbWearCopyCounters (FALSE);
+
+  mFvbWearLog.Half          = Half;
+  mFvbWearLog.Offset        = End[Half];
+  mFvbWearLog.HalfHasRecord = TRUE;
+  mFvbWearLog.Sequence      = Sequence[Half];
+  DEBUG ((DEBUG_INFO, "FvbWearInitializeLog: Restored save %d from half %d\n", Sequence[Half], Half));
+  return EFI_SUCCESS;
+}
+
+/**
+  Save the wear counters of every FVB instance to flash.
+
+  @retval EFI_SUCCESS             The counters are saved.
+  @retval EFI_UNSUPPORTED         No flash area is set up for the counters.
+  @retval Others                  The counters could not be written to flash.
+
+**/
+EFI_STATUS
+FvbWearSave (
+  VOID
+  )
+{
+  FVB_WEAR_LOG_RECORD  *Record;
+  UINTN                Address;
+  UINTN                Length;
+  UINT32               NumBytes;
+  EFI_STATUS           Status;
+
+  Record = mFvbWearLog.Record;
+  if (Record == NULL) {
+    return EFI_UNSUPPORTED;
+  }
+
+  Record->Signature  = FVB_WEAR_LOG_SIGNATURE;
+  Record->Sequence   = mFvbWearLog.Sequence + 1;
+  Record->BlockCount = (UINT32)((mFvbWearLog.RecordSize - sizeof (FVB_WEAR_LOG_RECORD)) / sizeof (FVB_WEAR_COUNT));
+  Record->Crc32      = 0;
+  FvbWearCopyCounters (TRUE);
+  Record->Crc32 = CalculateCrc32 (Record, mFvbWearLog.RecordSize);
+
+  //
+  // When the half is full, the saves move to the other half. The records of
+  // the full half stay until the first record of the other half is written.
+  // A half without a valid record, after a failed save, is erased and
+  // written again instead, so the other half keeps its records.
+  //
+  Address = mFvbWearLog.Base + mFvbWearLog.Half * mFvbWearLog.HalfSize + mFvbWearLog.Offset;
+  if ((mFvbWearLog.Offset + mFvbWearLog.RecordSize > mFvbWearLog.HalfSize) ||
+      !FvbIsErased (Address, mFvbWearLog.RecordSize))
+  {
+    if (mFvbWearLog.HalfHasRecord) {
+      mFvbWearLog.Half ^= 1;
+    }
+
+    mFvbWearLog.Offset        = 0;
+    mFvbWearLog.HalfHasRecord = FALSE;
+    Address                   = mFvbWearLog.Base + mFvbWearLog.Half * mFvbWearLog.HalfSize;
+    Length             = mFvbWearLog.HalfSize;
+    Status             = SpiFlashBlockErase (Address, &Length);
+    WriteBackInvalidateDataCacheRange ((VOID *)Address, Length);
+    if (EFI_ERROR (Status)) {
+      mFvbWearLog.Offset = mFvbWearLog.HalfSize;
+      SpiFlashLock ();
+      return Status;
+    }
+  }
+
+  NumBytes = (UINT32)mFvbWearLog.RecordSize;
+  Status   = SpiFlashWrite (Address, &NumBytes, (UINT8 *)Record);
+  WriteBackInvalidateDataCacheRange ((VOID *)Address, mFvbWearLog.RecordSize);
+  if (EFI_ERROR (Status)) {
+    //
+    // The half may hold a partial record now. The next save moves to the
+    // other half if this one holds a valid record, and erases this one
+    // again otherwise.
+    //
+    mFvbWearLog.Offset = mFvbWearLog.HalfSize;
+  } else {
+    mFvbWearLog.Offset         += mFvbWearLog.RecordSize;
+    mFvbWearLog.HalfHasRecord   = TRUE;
+    mFvbWearLog.Sequence        = Record->Sequence;
+    mFvbWearLog.ErasesSinceSave = 0;
+  }
+
+  SpiFlashLock ();
+  return Status;
+}
+
+/**
+  Get the wear counters of every block of the FVB instances.
+
+  @param[in, out] BlockCount      On input, the number of entries in Blocks. On output,
+                                  the number of blocks with counters.
+  @param[out]     Blocks          The counters of the blocks.
+
+  @retval EFI_SUCCESS             Blocks is filled.
+  @retval EFI_BUFFER_TOO_SMALL    Blocks is too small. BlockCount is the number of entries needed.
+  @retval EFI_INVALID_PARAMETER   BlockCount is NULL, or Blocks is NULL and *BlockCount is not 0.
+
+**/
+EFI_STATUS
+FvbWearGetCounters (
+  IN OUT UINTN               *BlockCount,
+  OUT    SPI_FVB_WEAR_BLOCK  *Blocks
+  )
+{
+  EFI_FVB_INSTANCE  *FvbInstance;
+  UINTN             Count;
+  UINTN             Index;
+  UINTN             Lba;
+  UINTN             LbaAddress;
+  UINTN             LbaLength;
+
+  if ((BlockCount == NULL) || ((Blocks == NULL) && (*BlockCount != 0))) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Count = FvbWearBlockCount ();
+  if (*BlockCount < Count) {
+    *BlockCount = Count;
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  *BlockCount = Count;
+  FvbInstance = mFvbModuleGlobal.FvbInstance;
+  for (Index = 0; Index < mFvbModuleGlobal.NumFv; Index++) {
+    if (FvbInstance->WearCount != NULL) {
+      for (Lba = 0; Lba < FvbInstance->NumOfBlocks; Lba++) {
+        LbaAddress = 0;
+        LbaLength  = 0;
+        FvbGetLbaAddress (FvbInstance, Lba, &LbaAddress, &LbaLength, NULL);
+        Blocks->Address      = LbaAddress;
+        Blocks->Length       = (UINT32)LbaLength;
+        Blocks->EraseCount   = FvbInstance->WearCount[Lba].EraseCount;
+        Blocks->ProgramCount = FvbInstance->WearCount[Lba].ProgramCount;
+        Blocks->Reserved     = 0;
+        Blocks++;
+      }
+    }
+
+    FvbInstance = FvbWearNextInstance (FvbInstance);
+  }
+
+  return EFI_SUCCESS;
+}
@@ -0,0 +1,287 @@
+/** @file
+  Host emulator of a SPI NOR flash behind PCH_SPI2_PROTOCOL.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+
+#include "SpiFlashEmulator.h"
+
+//
+// Typical latencies of a SPI NOR part: quad read at about 50MB/s, 0.7ms
+// page program, and 45ms/120ms/150ms for the 4KB/32KB/64KB erases.
+//
+STATIC CONST SPI_FLASH_EMULATOR_TIMING  mDefaultTiming = {
+  20,
+  700000,
+  { 45000000, 120000000, 150000000 }
+};
+
+STATIC CONST UINT32  mEraseTypeSize[SpiFlashEmulatorEraseTypeMax] = {
+  SIZE_4KB,
+  SIZE_32KB,
+  SIZE_64KB
+};
+
+/**
+  Get the emulator of a PCH_SPI2_PROTOCOL instance.
+**/
+#define SPI_FLASH_EMULATOR_FROM_THIS(a)  BASE_CR (a, SPI_FLASH_EMULATOR, Spi2)
+
+/**
+  Check that a range is inside the flash.
+
+  @param[in]  Emulator        The emulator.
+  @param[in]  Address         The start of the range.
+  @param[in]  ByteCount       The size of the range in bytes.
+
+  @retval TRUE   The range is inside the flash.
+  @retval FALSE  The range is outside the flash.
+**/
+STATIC
+BOOLEAN
+IsInFlash (
+  IN SPI_FLASH_EMULATOR  *Emulator,
+  IN UINT32              Address,
+  IN UINT32              ByteCount
+  )
+{
+  return (Address <= Emulator->Size) && (ByteCount <= Emulator->Size - Address);
+}
+
+/**
+  Read data from the emulated flash.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+EmulatorFlashRead (
+  IN     PCH_SPI2_PROTOCOL  *This,
+  IN     EFI_GUID           *FlashRegionGuid,
+  IN     UINT32             Address,
+  IN     UINT32             ByteCount,
+  OUT    UINT8              *Buffer
+  )
+{
+  SPI_FLASH_EMULATOR  *Emulator;
+
+  Emulator = SPI_FLASH_EMULATOR_FROM_THIS (This);
+  Emulator->Stats.ProtocolCallCount++;
+  if (!IsInFlash (Emulator, Address, ByteCount) || (Buffer == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  CopyMem (Buffer, Emulator->Flash + Address, ByteCount);
+  Emulator->Stats.ReadBytes += ByteCount;
+  Emulator->Stats.Time      += MultU64x32 (Emulator->Timing.ReadByte, ByteCount);
+  return EFI_SUCCESS;
+}
+
+/**
+  Program data to the emulated flash.
+
+  The program is rejected without changing the flash if it would set any
+  bit from 0 to 1. Each page the range touches costs one page program.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+EmulatorFlashWrite (
+  IN     PCH_SPI2_PROTOCOL  *This,
+  IN     EFI_GUID           *FlashRegionGuid,
+  IN     UINT32             Address,
+  IN     UINT32             ByteCount,
+  IN     UINT8              *Buffer
+  )
+{
+  SPI_FLASH_EMULATOR  *Emulator;
+  UINT32              Index;
+  UINT64              PageCount;
+
+  Emulator = SPI_FLASH_EMULATOR_FROM_THIS (This);
+  Emulator->Stats.ProtocolCallCount++;
+  if (!IsInFlash (Emulator, Address, ByteCount) || (Buffer == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (ByteCount == 0) {
+    return EFI_SUCCESS;
+  }
+
+  if (Emulator->FailProgramCount > 0) {
+    Emulator->FailProgramCount--;
+    return EFI_DEVICE_ERROR;
+  }
+
+  for (Index = 0; Index < ByteCount; Index++) {
+    if ((Buffer[Index] & ~Emulator->Flash[Address + Index]) != 0) {
+      Emulator->Stats.ProgramErrorCount++;
+      return EFI_DEVICE_ERROR;
+    }
+  }
+
+  for (Index = 0; Index < ByteCount; Index++) {
+    Emulator->Flash[Address + Index] &= Buffer[Index];
+  }
+
+  PageCount = (Address + ByteCount - 1) / SPI_FLASH_EMULATOR_PAGE_SIZE - Address / SPI_FLASH_EMULATOR_PAGE_SIZE + 1;
+
+  Emulator->Stats.ProgramBytes     += ByteCount;
+  Emulator->Stats.PageProgramCount += PageCount;
+  Emulator->Stats.Time             += MultU64x64 (Emulator->Timing.ProgramPage, PageCount);
+  return EFI_SUCCESS;
+}
+
+/**
+  Erase some area of the emulated flash.
+
+  The range must be 4KB aligned. Like the PCH SPI controller, the emulator
+  uses the largest erase the part supports that is aligned at the current
+  address and fits in the rest of the range.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+EmulatorFlashErase (
+  IN     PCH_SPI2_PROTOCOL  *This,
+  IN     EFI_GUID           *FlashRegionGuid,
+  IN     UINT32             Address,
+  IN     UINT32             ByteCount
+  )
+{
+  SPI_FLASH_EMULATOR             *Emulator;
+  SPI_FLASH_EMULATOR_ERASE_TYPE  EraseType;
+  UINT32                         EraseSize;
+
+  Emulator = SPI_FLASH_EMULATOR_FROM_THIS (This);
+  Emulator->Stats.ProtocolCallCount++;
+  if (!IsInFlash (Emulator, Address, ByteCount) ||
+      ((Address & (SIZE_4KB - 1)) != 0) ||
+      ((ByteCount & (SIZE_4KB - 1)) != 0))
+  {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  while (ByteCount > 0) {
+    EraseType = SpiFlashEmulatorErase64KB;
+    while (EraseType > SpiFlashEmulatorErase4KB) {
+      EraseSize = mEraseTypeSize[EraseType];
+      if (((Emulator->EraseSizes & EraseSize) != 0) &&
+          ((Address & (EraseSize - 1)) == 0) &&
+          (ByteCount >= EraseSize))
+      {
+        break;
+      }
+
+      EraseType--;
+    }
+
+    EraseSize = mEraseTypeSize[EraseType];
+    SetMem (Emulator->Flash + Address, EraseSize, 0xFF);
+
+    Emulator->Stats.EraseCount[EraseType]++;
+    Emulator->Stats.EraseBytes += EraseSize;
+    Emulator->Stats.Time       += Emulator->Timing.Erase[EraseType];
+
+    Address   += EraseSize;
+    ByteCount -= EraseSize;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Get the base and the size of a flash region. The whole emulated flash is
+  the BIOS region.
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+EmulatorGetRegionAddress (
+  IN     PCH_SPI2_PROTOCOL  *This,
+  IN     EFI_GUID           *FlashRegionGuid,
+  OUT    UINT32             *BaseAddress,
+  OUT    UINT32             *RegionSize
+  )
+{
+  SPI_FLASH_EMULATOR  *Emulator;
+
+  Emulator     = SPI_FLASH_EMULATOR_FROM_THIS (This);
+  *BaseAddress = 0;
+  *RegionSize  = (UINT32)Emulator->Size;
+  return EFI_SUCCESS;
+}
+
+/**
+  Create an erased flash emulator with the timing of a typical SPI NOR part.
+
+  @param[in]  Size            The size of the flash in bytes. It must be a multiple of 64KB.
+  @param[in]  EraseSizes      The erase sizes the part supports, in addition to 4KB.
+
+  @return The emulator, or NULL if there is not enough memory.
+**/
+SPI_FLASH_EMULATOR *
+SpiFlashEmulatorCreate (
+  IN UINTN   Size,
+  IN UINT32  EraseSizes
+  )
+{
+  SPI_FLASH_EMULATOR  *Emulator;
+
+  Emulator = AllocateZeroPool (sizeof (SPI_FLASH_EMULATOR));
+  if (Emulator == NULL) {
+    return NULL;
+  }
+
+  Emulator->Flash = AllocatePages (EFI_SIZE_TO_PAGES (Size));
+  if (Emulator->Flash == NULL) {
+    FreePool (Emulator);
+    return NULL;
+  }
+
+  SetMem (Emulator->Flash, Size, 0xFF);
+  Emulator->Size       = Size;
+  Emulator->EraseSizes = EraseSizes | SIZE_4KB;
+  CopyMem (&Emulator->Timing, &mDefaultTiming, sizeof (mDefaultTiming));
+
+  Emulator->Spi2.Revision         = PCH_SPI_SERVICES_REVISION;
+  Emulator->Spi2.FlashRead        = EmulatorFlashRead;
+  Emulator->Spi2.FlashWrite       = EmulatorFlashWrite;
+  Emulator->Spi2.FlashErase       = EmulatorFlashErase;
+  Emulator->Spi2.GetRegionAddress = EmulatorGetRegionAddress;
+
+  return Emulator;
+}
+
+/**
+  Free a flash emulator.
+
+  @param[in]  Emulator        The emulator.
+**/
+VOID
+SpiFlashEmulatorDestroy (
+  IN SPI_FLASH_EMULATOR  *Emulator
+  )
+{
+  FreePages (Emulator->Flash, EFI_SIZE_TO_PAGES (Emulator->Size));
+  FreePool (Emulator);
+}
+
+/**
+  Clear the statistics of a flash emulator.
+
+  @param[in]  Emulator        The emulator.
+**/
+VOID
+SpiFlashEmulatorResetStats (
+  IN SPI_FLASH_EMULATOR  *Emulator
+  )
+{
+  ZeroMem (&Emulator->Stats, sizeof (Emulator->Stats));
+}
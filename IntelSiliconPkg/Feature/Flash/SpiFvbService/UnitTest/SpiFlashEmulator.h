@@ -0,0 +1,108 @@
+/** @file
+  Host emulator of a SPI NOR flash behind PCH_SPI2_PROTOCOL.
+
+  The flash is a buffer in host memory, so it can also be read as memory
+  mapped flash. The emulator enforces the rules of NOR flash: a program
+  can only clear bits, and an erase sets whole aligned sectors back to
+  0xFF. Every operation advances a simulated clock by the latency of the
+  flash part, and is counted in the statistics.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef _SPI_FLASH_EMULATOR_H_
+#define _SPI_FLASH_EMULATOR_H_
+
+#include <Uefi.h>
+#include <Protocol/Spi2.h>
+
+#define SPI_FLASH_EMULATOR_PAGE_SIZE  0x100
+
+typedef enum {
+  SpiFlashEmulatorErase4KB,
+  SpiFlashEmulatorErase32KB,
+  SpiFlashEmulatorErase64KB,
+  SpiFlashEmulatorEraseTypeMax
+} SPI_FLASH_EMULATOR_ERASE_TYPE;
+
+///
+/// The latencies of the flash part, in nanoseconds.
+///
+typedef struct {
+  UINT64    ReadByte;
+  UINT64    ProgramPage;
+  UINT64    Erase[SpiFlashEmulatorEraseTypeMax];
+} SPI_FLASH_EMULATOR_TIMING;
+
+typedef struct {
+  //
+  // The simulated time spent in flash operations, in nanoseconds.
+  //
+  UINT64    Time;
+  UINT64    ReadBytes;
+  UINT64    ProgramBytes;
+  UINT64    PageProgramCount;
+  UINT64    EraseCount[SpiFlashEmulatorEraseTypeMax];
+  UINT64    EraseBytes;
+  //
+  // Programs rejected because they would set a bit from 0 to 1.
+  //
+  UINT64    ProgramErrorCount;
+  UINT64    ProtocolCallCount;
+} SPI_FLASH_EMULATOR_STATS;
+
+typedef struct {
+  PCH_SPI2_PROTOCOL            Spi2;
+  UINT8                        *Flash;
+  UINTN                        Size;
+  //
+  // The erase sizes the part supports. Bit N set means 2^N bytes. The
+  // 4KB erase is always supported.
+  //
+  UINT32                       EraseSizes;
+  SPI_FLASH_EMULATOR_TIMING    Timing;
+  SPI_FLASH_EMULATOR_STATS     Stats;
+  //
+  // The number of the next programs that fail with EFI_DEVICE_ERROR
+  // without changing the flash.
+  //
+  UINT32                       FailProgramCount;
+} SPI_FLASH_EMULATOR;
+
+/**
+  Create an erased flash emulator with the timing of a typical SPI NOR part.
+
+  @param[in]  Size            The size of the flash in bytes. It must be a multiple of 64KB.
+  @param[in]  EraseSizes      The erase sizes the part supports, in addition to 4KB.
+
+  @return The emulator, or NULL if there is not enough memory.
+**/
+SPI_FLASH_EMULATOR *
+SpiFlashEmulatorCreate (
+  IN UINTN   Size,
+  IN UINT32  EraseSizes
+  );
+
+/**
+  Free a flash emulator.
+
+  @param[in]  Emulator        The emulator.
+**/
+VOID
+SpiFlashEmulatorDestroy (
+  IN SPI_FLASH_EMULATOR  *Emulator
+  );
+
+/**
+  Clear the statistics of a flash emulator.
+
+  @param[in]  Emulator        The emulator.
+**/
+VOID
+SpiFlashEmulatorResetStats (
+  IN SPI_FLASH_EMULATOR  *Emulator
+  );
+
+#endif
@@ -0,0 +1,1004 @@
+/** @file
+UnitTest for...
+SPI flash FVB service.
+
+The FVB service and the SMM SPI flash common library run against an
+emulated SPI NOR flash. The tests check the NOR programming rules through
+the whole stack, and report the simulated flash time, the write
+amplification and the erase counts of a fault tolerant write workload.
+
+Copyright (c) Microsoft Corporation.
+SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <Library/UnitTestLib.h>
+
+#include "../SpiFvbServiceCommon.h"
+#include "../../../../Library/SmmSpiFlashCommonLib/SpiFlashReadCache.h"
+#include "../../../../Library/SmmSpiFlashCommonLib/SpiFlashStreamRead.h"
+#include "SpiFlashEmulator.h"
+
+#ifndef INTERNAL_UNIT_TEST
+  #error Make sure to build thie with INTERNAL_UNIT_TEST enabled! Otherwise, some important tests may be skipped!
+#endif
+
+#define UNIT_TEST_NAME     "SPI FVB Service Host Test"
+#define UNIT_TEST_VERSION  "0.9"
+
+/// === TEST DATA ==================================================================================
+
+//
+// The emulated flash holds one FV of 4KB blocks.
+//
+#define HOST_FLASH_SIZE      SIZE_256KB
+#define HOST_FV_BLOCK_SIZE   SIZE_4KB
+#define HOST_FV_BLOCK_COUNT  (HOST_FLASH_SIZE / HOST_FV_BLOCK_SIZE)
+
+//
+// The fault tolerant write layout: a 64KB variable store, a spare area of
+// the same size behind it, and one working block.
+//
+#define FTW_NV_LBA            0
+#define FTW_SPARE_LBA         16
+#define FTW_AREA_LBA_COUNT    16
+#define FTW_AREA_SIZE         (FTW_AREA_LBA_COUNT * HOST_FV_BLOCK_SIZE)
+#define FTW_WORKING_LBA       32
+#define FTW_WORKING_REC_SIZE  16
+#define FTW_VARIABLE_COUNT    32
+#define FTW_UPDATE_COUNT      4096
+
+//
+// The variable store holds fixed size records. The state byte only clears
+// bits, as in the variable driver.
+//
+#define FTW_RECORD_SIZE     64
+#define FTW_RECORD_ADDED    0x7F
+#define FTW_RECORD_DELETED  0x3F
+#define FTW_WORKING_DONE    0x3F
+
+//
+// The wear counters are saved in the last 64KB of the flash, which the
+// test cases do not write through the FVB protocol.
+//
+#define WEAR_LOG_OFFSET  (HOST_FLASH_SIZE - SIZE_64KB)
+#define WEAR_LOG_SIZE    SIZE_64KB
+
+//
+// The blocks of the FV in the wear test, which ends where the area starts.
+//
+#define WEAR_FV_BLOCK_COUNT  (WEAR_LOG_OFFSET / HOST_FV_BLOCK_SIZE)
+
+typedef struct {
+  UINT8     State;
+  UINT8     Id;
+  UINT16    Sequence;
+  UINT8     Data[FTW_RECORD_SIZE - 4];
+} FTW_RECORD;
+
+typedef struct {
+  UINT8     *Shadow;
+  UINTN     NextOffset;
+  UINTN     LiveOffset[FTW_VARIABLE_COUNT];
+  UINTN     WorkingOffset;
+  UINT16    Sequence;
+  UINT64    RequestedBytes;
+  UINT32    ReclaimCount;
+} FTW_WORKLOAD;
+
+STATIC UINT32  mEraseSizes4KB = SIZE_4KB;
+STATIC UINT32  mEraseSizesAll = SIZE_4KB | SIZE_32KB | SIZE_64KB;
+STATIC UINT8   mPattern[FTW_RECORD_SIZE];
+
+STATIC SPI_FLASH_EMULATOR  *mEmulator;
+STATIC EFI_FVB_INSTANCE    *mFvbInstance;
+
+//
+// The globals of the SMM SPI flash common library.
+//
+extern PCH_SPI2_PROTOCOL  *mSpi2Protocol;
+extern UINTN              mBiosAreaBaseAddress;
+extern UINTN              mBiosSize;
+extern UINTN              mBiosOffset;
+
+/// === HELPER FUNCTIONS ===========================================================================
+
+/**
+  Start the FVB service on an erased emulated flash.
+
+  @param[in]  EraseSizes      The erase sizes of the flash part.
+
+  @return The FVB protocol of the flash, or NULL on failure.
+**/
+STATIC
+EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL *
+StartSpiFvb (
+  IN UINT32  EraseSizes
+  )
+{
+  EFI_FIRMWARE_VOLUME_HEADER  *FvHeader;
+
+  mEmulator = SpiFlashEmulatorCreate (HOST_FLASH_SIZE, EraseSizes);
+  if (mEmulator == NULL) {
+    return NULL;
+  }
+
+  mSpi2Protocol        = &mEmulator->Spi2;
+  mBiosAreaBaseAddress = (UINTN)mEmulator->Flash;
+  mBiosSize            = HOST_FLASH_SIZE;
+  mBiosOffset          = 0;
+  SpiFlashStreamReadInitialize ();
+
+  //
+  // FvHeader ends with the first block map entry, so only the terminator
+  // is allocated behind the instance.
+  //
+  mFvbInstance = AllocateZeroPool (sizeof (EFI_FVB_INSTANCE) + sizeof (EFI_FV_BLOCK_MAP_ENTRY));
+  if (mFvbInstance == NULL) {
+    SpiFlashEmulatorDestroy (mEmulator);
+    return NULL;
+  }
+
+  FvHeader                        = &mFvbInstance->FvHeader;
+  FvHeader->FvLength              = HOST_FLASH_SIZE;
+  FvHeader->Signature             = EFI_FVH_SIGNATURE;
+  FvHeader->Attributes            = EFI_FVB2_READ_STATUS | EFI_FVB2_WRITE_STATUS;
+  FvHeader->HeaderLength          = sizeof (EFI_FIRMWARE_VOLUME_HEADER) + sizeof (EFI_FV_BLOCK_MAP_ENTRY);
+  FvHeader->Revision              = EFI_FVH_REVISION;
+  FvHeader->BlockMap[0].NumBlocks = HOST_FV_BLOCK_COUNT;
+  FvHeader->BlockMap[0].Length    = HOST_FV_BLOCK_SIZE;
+
+  mFvbInstance->Signature   = FVB_INSTANCE_SIGNATURE;
+  mFvbInstance->FvBase      = (UINTN)mEmulator->Flash;
+  mFvbInstance->NumOfBlocks = HOST_FV_BLOCK_COUNT;
+  CopyMem (&mFvbInstance->FvbProtocol, &mFvbProtocolTemplate, sizeof (EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL));
+  if (EFI_ERROR (FvbInitializeLbaMap (mFvbInstance))) {
+    FreePool (mFvbInstance);
+    SpiFlashEmulatorDestroy (mEmulator);
+    return NULL;
+  }
+
+  ZeroMem (&mFvbModuleGlobal, sizeof (mFvbModuleGlobal));
+  mFvbModuleGlobal.FvbInstance = mFvbInstance;
+  mFvbModuleGlobal.NumFv       = 1;
+
+  return &mFvbInstance->FvbProtocol;
+}
+
+/**
+  Stop the FVB service and free the emulated flash.
+**/
+STATIC
+VOID
+StopSpiFvb (
+  VOID
+  )
+{
+  ZeroMem (&mFvbModuleGlobal, sizeof (mFvbModuleGlobal));
+  FreePool (mFvbInstance->LbaMap);
+  FreePool (mFvbInstance);
+  SpiFlashEmulatorDestroy (mEmulator);
+  mFvbInstance  = NULL;
+  mEmulator     = NULL;
+  mSpi2Protocol = NULL;
+}
+
+/**
+  Report the flash operations counted by the emulator.
+
+  @param[in]  Name            The name of the operation.
+  @param[in]  RequestedBytes  The bytes the caller asked to write.
+**/
+STATIC
+VOID
+ReportFlashStats (
+  IN CONST CHAR8  *Name,
+  IN UINT64       RequestedBytes
+  )
+{
+  SPI_FLASH_EMULATOR_STATS  *Stats;
+  UINT64                    Amplification;
+
+  Stats         = &mEmulator->Stats;
+  Amplification = 0;
+  if (RequestedBytes != 0) {
+    Amplification = DivU64x64Remainder (MultU64x32 (Stats->ProgramBytes, 100), RequestedBytes, NULL);
+  }
+
+  UT_LOG_INFO (
+    "%a: %ld us flash time, 0x%lx bytes requested, 0x%lx programmed in 0x%lx pages, %ld.%02ld write amplification\n",
+    Name,
+    DivU64x32 (Stats->Time, 1000),
+    RequestedBytes,
+    Stats->ProgramBytes,
+    Stats->PageProgramCount,
+    DivU64x32 (Amplification, 100),
+    ModU64x32 (Amplification, 100)
+    );
+  UT_LOG_INFO (
+    "%a: 0x%lx 4KB, 0x%lx 32KB and 0x%lx 64KB erases, 0x%lx bytes erased, 0x%lx skipped, 0x%lx write bytes skipped\n",
+    Name,
+    Stats->EraseCount[SpiFlashEmulatorErase4KB],
+    Stats->EraseCount[SpiFlashEmulatorErase32KB],
+    Stats->EraseCount[SpiFlashEmulatorErase64KB],
+    Stats->EraseBytes,
+    mFvbModuleGlobal.EraseSkippedBytes,
+    mFvbModuleGlobal.WriteSkippedBytes
+    );
+}
+
+/**
+  Write a range of the FV that may cross blocks.
+
+  @param[in]  Fvb             The FVB protocol.
+  @param[in]  Lba             The first block of the range.
+  @param[in]  Offset          The offset of the range in the first block.
+  @param[in]  Buffer          The data to write.
+  @param[in]  Length          The size, in bytes, of Buffer.
+
+  @return The status of the first write that fails.
+**/
+STATIC
+EFI_STATUS
+WriteFv (
+  IN EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL  *Fvb,
+  IN EFI_LBA                             Lba,
+  IN UINTN                               Offset,
+  IN UINT8                               *Buffer,
+  IN UINTN                               Length
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       NumBytes;
+
+  Lba    += Offset / HOST_FV_BLOCK_SIZE;
+  Offset %= HOST_FV_BLOCK_SIZE;
+  while (Length > 0) {
+    NumBytes = MIN (Length, HOST_FV_BLOCK_SIZE - Offset);
+    Status   = Fvb->Write (Fvb, Lba, Offset, &NumBytes, Buffer);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    Buffer += NumBytes;
+    Length -= NumBytes;
+    Offset  = 0;
+    Lba++;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Read a range of the FV that may cross blocks.
+
+  @param[in]  Fvb             The FVB protocol.
+  @param[in]  Lba             The first block of the range.
+  @param[out] Buffer          The buffer to receive the data.
+  @param[in]  Length          The size, in bytes, of Buffer.
+
+  @return The status of the first read that fails.
+**/
+STATIC
+EFI_STATUS
+ReadFv (
+  IN  EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL  *Fvb,
+  IN  EFI_LBA                             Lba,
+  OUT UINT8                               *Buffer,
+  IN  UINTN                               Length
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       NumBytes;
+
+  while (Length > 0) {
+    NumBytes = MIN (Length, HOST_FV_BLOCK_SIZE);
+    Status   = Fvb->Read (Fvb, Lba, 0, &NumBytes, Buffer);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    Buffer += NumBytes;
+    Length -= NumBytes;
+    Lba++;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Write a fault tolerant write record to the working block, and erase the
+  working block first if it is full.
+
+  @param[in]      Fvb             The FVB protocol.
+  @param[in, out] Workload        The workload.
+
+  @return The status of the write.
+**/
+STATIC
+EFI_STATUS
+FtwWriteWorkingRecord (
+  IN     EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL  *Fvb,
+  IN OUT FTW_WORKLOAD                        *Workload
+  )
+{
+  UINT8       Record[FTW_WORKING_REC_SIZE];
+  EFI_STATUS  Status;
+
+  if (Workload->WorkingOffset + FTW_WORKING_REC_SIZE > HOST_FV_BLOCK_SIZE) {
+    Status = Fvb->EraseBlocks (Fvb, (EFI_LBA)FTW_WORKING_LBA, (UINT32)1, EFI_LBA_LIST_TERMINATOR);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    Workload->WorkingOffset = 0;
+  }
+
+  SetMem (Record, sizeof (Record), (UINT8)Workload->ReclaimCount);
+  Record[0] = FTW_RECORD_ADDED;
+  return WriteFv (Fvb, FTW_WORKING_LBA, Workload->WorkingOffset, Record, sizeof (Record));
+}
+
+/**
+  Compact the live records of the variable store through the spare area.
+
+  @param[in]      Fvb             The FVB protocol.
+  @param[in, out] Workload        The workload.
+
+  @return The status of the first flash operation that fails.
+**/
+STATIC
+EFI_STATUS
+FtwReclaim (
+  IN     EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL  *Fvb,
+  IN OUT FTW_WORKLOAD                        *Workload
+  )
+{
+  UINT8       *Image;
+  UINT8       Done;
+  UINTN       Offset;
+  UINTN       Index;
+  EFI_STATUS  Status;
+
+  Image = AllocatePool (FTW_AREA_SIZE);
+  if (Image == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  SetMem (Image, FTW_AREA_SIZE, 0xFF);
+  Offset = 0;
+  for (Index = 0; Index < FTW_VARIABLE_COUNT; Index++) {
+    if (Workload->LiveOffset[Index] != MAX_UINTN) {
+      CopyMem (Image + Offset, Workload->Shadow + Workload->LiveOffset[Index], FTW_RECORD_SIZE);
+      Workload->LiveOffset[Index] = Offset;
+      Offset                     += FTW_RECORD_SIZE;
+    }
+  }
+
+  //
+  // Record the write in the working block, write the new store to the
+  // spare area, then erase the target and copy the spare area back.
+  //
+  Status = FtwWriteWorkingRecord (Fvb, Workload);
+  if (!EFI_ERROR (Status)) {
+    Status = Fvb->EraseBlocks (Fvb, (EFI_LBA)FTW_SPARE_LBA, (UINT32)FTW_AREA_LBA_COUNT, EFI_LBA_LIST_TERMINATOR);
+  }
+
+  if (!EFI_ERROR (Status)) {
+    Status = WriteFv (Fvb, FTW_SPARE_LBA, 0, Image, FTW_AREA_SIZE);
+  }
+
+  if (!EFI_ERROR (Status)) {
+    Status = ReadFv (Fvb, FTW_SPARE_LBA, Image, FTW_AREA_SIZE);
+  }
+
+  if (!EFI_ERROR (Status)) {
+    Status = Fvb->EraseBlocks (Fvb, (EFI_LBA)FTW_NV_LBA, (UINT32)FTW_AREA_LBA_COUNT, EFI_LBA_LIST_TERMINATOR);
+  }
+
+  if (!EFI_ERROR (Status)) {
+    Status = WriteFv (Fvb, FTW_NV_LBA, 0, Image, FTW_AREA_SIZE);
+  }
+
+  if (!EFI_ERROR (Status)) {
+    Done   = FTW_WORKING_DONE;
+    Status = WriteFv (Fvb, FTW_WORKING_LBA, Workload->WorkingOffset, &Done, sizeof (Done));
+  }
+
+  CopyMem (Workload->Shadow, Image, FTW_AREA_SIZE);
+  Workload->NextOffset     = Offset;
+  Workload->WorkingOffset += FTW_WORKING_REC_SIZE;
+  Workload->ReclaimCount++;
+
+  FreePool (Image);
+  return Status;
+}
+
+/**
+  Update one variable: append its new record and delete the old one.
+
+  @param[in]      Fvb             The FVB protocol.
+  @param[in, out] Workload        The workload.
+  @param[in]      Id              The variable to update.
+
+  @return The status of the first flash operation that fails.
+**/
+STATIC
+EFI_STATUS
+FtwUpdateVariable (
+  IN     EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL  *Fvb,
+  IN OUT FTW_WORKLOAD                        *Workload,
+  IN     UINT8                               Id
+  )
+{
+  FTW_RECORD  Record;
+  UINT8       State;
+  EFI_STATUS  Status;
+
+  if (Workload->NextOffset + FTW_RECORD_SIZE > FTW_AREA_SIZE) {
+    Status = FtwReclaim (Fvb, Workload);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+  }
+
+  Record.State    = FTW_RECORD_ADDED;
+  Record.Id       = Id;
+  Record.Sequence = Workload->Sequence++;
+  SetMem (Record.Data, sizeof (Record.Data), (UINT8)(Record.Sequence ^ Id));
+
+  Status = WriteFv (Fvb, FTW_NV_LBA, Workload->NextOffset, (UINT8 *)&Record, sizeof (Record));
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  CopyMem (Workload->Shadow + Workload->NextOffset, &Record, sizeof (Record));
+  Workload->RequestedBytes += sizeof (Record);
+
+  if (Workload->LiveOffset[Id] != MAX_UINTN) {
+    State  = FTW_RECORD_DELETED;
+    Status = WriteFv (Fvb, FTW_NV_LBA, Workload->LiveOffset[Id], &State, sizeof (State));
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    Workload->Shadow[Workload->LiveOffset[Id]] = State;
+    Workload->RequestedBytes                  += sizeof (State);
+  }
+
+  Workload->LiveOffset[Id] = Workload->NextOffset;
+  Workload->NextOffset    += FTW_RECORD_SIZE;
+  return EFI_SUCCESS;
+}
+
+/// === TEST CASES =================================================================================
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+ProgramOnlyClearsBits (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL  *Fvb;
+  UINT8                               Buffer[FTW_RECORD_SIZE];
+  UINTN                               NumBytes;
+  EFI_STATUS                          Status;
+
+  Fvb = StartSpiFvb (mEraseSizesAll);
+  UT_ASSERT_NOT_NULL (Fvb);
+
+  NumBytes = sizeof (mPattern);
+  Status   = Fvb->Write (Fvb, 40, 0x80, &NumBytes, mPattern);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_MEM_EQUAL (mEmulator->Flash + 40 * HOST_FV_BLOCK_SIZE + 0x80, mPattern, sizeof (mPattern));
+
+  //
+  // Setting any bit back to 1 needs an erase, so the program is rejected
+  // and the flash keeps the old data.
+  //
+  SetMem (Buffer, sizeof (Buffer), 0xFF);
+  NumBytes = sizeof (Buffer);
+  Status   = Fvb->Write (Fvb, 40, 0x80, &NumBytes, Buffer);
+  UT_ASSERT_STATUS_EQUAL (Status, EFI_DEVICE_ERROR);
+  UT_ASSERT_EQUAL (mEmulator->Stats.ProgramErrorCount, 1);
+  UT_ASSERT_MEM_EQUAL (mEmulator->Flash + 40 * HOST_FV_BLOCK_SIZE + 0x80, mPattern, sizeof (mPattern));
+
+  //
+  // Clearing more bits is a valid program.
+  //
+  ZeroMem (Buffer, sizeof (Buffer));
+  NumBytes = sizeof (Buffer);
+  Status   = Fvb->Write (Fvb, 40, 0x80, &NumBytes, Buffer);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_MEM_EQUAL (mEmulator->Flash + 40 * HOST_FV_BLOCK_SIZE + 0x80, Buffer, sizeof (Buffer));
+
+  StopSpiFvb ();
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+UnchangedWriteIsSkipped (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL  *Fvb;
+  UINT8                               *Buffer;
+  UINTN                               NumBytes;
+  UINTN                               Index;
+  EFI_STATUS                          Status;
+
+  Fvb = StartSpiFvb (mEraseSizesAll);
+  UT_ASSERT_NOT_NULL (Fvb);
+  Buffer = AllocatePool (HOST_FV_BLOCK_SIZE);
+  UT_ASSERT_NOT_NULL (Buffer);
+
+  for (Index = 0; Index < HOST_FV_BLOCK_SIZE; Index++) {
+    Buffer[Index] = (UINT8)Index;
+  }
+
+  NumBytes = HOST_FV_BLOCK_SIZE;
+  Status   = Fvb->Write (Fvb, 8, 0, &NumBytes, Buffer);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_EQUAL (mEmulator->Stats.ProgramBytes, HOST_FV_BLOCK_SIZE);
+  UT_ASSERT_EQUAL (mEmulator->Stats.PageProgramCount, HOST_FV_BLOCK_SIZE / SPI_FLASH_EMULATOR_PAGE_SIZE);
+
+  //
+  // Rewriting the same data programs nothing, and a change in one page
+  // programs that page only.
+  //
+  SpiFlashEmulatorResetStats (mEmulator);
+  NumBytes = HOST_FV_BLOCK_SIZE;
+  Status   = Fvb->Write (Fvb, 8, 0, &NumBytes, Buffer);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_EQUAL (mEmulator->Stats.ProgramBytes, 0);
+  UT_ASSERT_EQUAL (mFvbModuleGlobal.WriteSkippedBytes, HOST_FV_BLOCK_SIZE);
+
+  Buffer[0x345] = 0;
+  NumBytes      = HOST_FV_BLOCK_SIZE;
+  Status        = Fvb->Write (Fvb, 8, 0, &NumBytes, Buffer);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_EQUAL (mEmulator->Stats.ProgramBytes, SPI_FLASH_EMULATOR_PAGE_SIZE);
+  UT_ASSERT_EQUAL (mEmulator->Stats.PageProgramCount, 1);
+  UT_ASSERT_MEM_EQUAL (mEmulator->Flash + 8 * HOST_FV_BLOCK_SIZE, Buffer, HOST_FV_BLOCK_SIZE);
+
+  FreePool (Buffer);
+  StopSpiFvb ();
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+EraseMergesRuns (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  UINT32                              EraseSizes;
+  EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL  *Fvb;
+  UINTN                               Lba;
+  UINTN                               NumBytes;
+  EFI_STATUS                          Status;
+
+  EraseSizes = *(UINT32 *)Context;
+  Fvb        = StartSpiFvb (EraseSizes);
+  UT_ASSERT_NOT_NULL (Fvb);
+
+  for (Lba = FTW_SPARE_LBA; Lba < FTW_SPARE_LBA + FTW_AREA_LBA_COUNT; Lba++) {
+    NumBytes = sizeof (mPattern);
+    Status   = Fvb->Write (Fvb, Lba, 0, &NumBytes, mPattern);
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+  }
+
+  //
+  // Two adjacent LBA ranges are merged into one run, which is sent to the
+  // flash controller as one request.
+  //
+  SpiFlashEmulatorResetStats (mEmulator);
+  Status = Fvb->EraseBlocks (
+                  Fvb,
+                  (EFI_LBA)FTW_SPARE_LBA,
+                  (UINT32)(FTW_AREA_LBA_COUNT / 2),
+                  (EFI_LBA)(FTW_SPARE_LBA + FTW_AREA_LBA_COUNT / 2),
+                  (UINT32)(FTW_AREA_LBA_COUNT / 2),
+                  EFI_LBA_LIST_TERMINATOR
+                  );
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  ReportFlashStats ((EraseSizes & SIZE_64KB) != 0 ? "64KB erase" : "4KB erase", 0);
+  UT_ASSERT_EQUAL (mEmulator->Stats.EraseBytes, FTW_AREA_SIZE);
+  UT_ASSERT_EQUAL (mEmulator->Stats.ProtocolCallCount, 1);
+
+  //
+  // The blocks are erased now, so erasing them again issues no erase.
+  //
+  SpiFlashEmulatorResetStats (mEmulator);
+  Status = Fvb->EraseBlocks (Fvb, (EFI_LBA)FTW_SPARE_LBA, (UINT32)FTW_AREA_LBA_COUNT, EFI_LBA_LIST_TERMINATOR);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_EQUAL (mEmulator->Stats.EraseBytes, 0);
+  UT_ASSERT_EQUAL (mFvbModuleGlobal.EraseSkippedBytes, FTW_AREA_SIZE);
+
+  StopSpiFvb ();
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+ReadCacheIsCoherent (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL  *Fvb;
+  UINT8                               Erased[FTW_RECORD_SIZE];
+  UINT8                               Buffer[FTW_RECORD_SIZE];
+  UINT8                               *Block;
+  UINTN                               NumBytes;
+  UINT32                              Length;
+  EFI_STATUS                          Status;
+
+  Fvb = StartSpiFvb (mEraseSizesAll);
+  UT_ASSERT_NOT_NULL (Fvb);
+  Status = SpiFlashReadCacheInitialize (4);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  SetMem (Erased, sizeof (Erased), 0xFF);
+  Block = AllocatePool (2 * HOST_FV_BLOCK_SIZE);
+  UT_ASSERT_NOT_NULL (Block);
+
+  //
+  // A small read fills the cache with its block, and the next read of the
+  // block hits. A read of a whole block bypasses the cache.
+  //
+  NumBytes = sizeof (Buffer);
+  Status   = Fvb->Read (Fvb, 2, 0, &NumBytes, Buffer);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  NumBytes = sizeof (Buffer);
+  Status   = Fvb->Read (Fvb, 2, sizeof (Buffer), &NumBytes, Buffer);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  NumBytes = HOST_FV_BLOCK_SIZE;
+  Status   = Fvb->Read (Fvb, 3, 0, &NumBytes, Block);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_EQUAL (mSpiFlashReadCache.MissCount, 1);
+  UT_ASSERT_EQUAL (mSpiFlashReadCache.HitCount, 1);
+
+  //
+  // The reads that bypass the cache are streamed, with an unaligned head
+  // and a partial tail.
+  //
+  NumBytes = sizeof (mPattern);
+  Status   = Fvb->Write (Fvb, 3, 0x40, &NumBytes, mPattern);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  Length = HOST_FV_BLOCK_SIZE + 0x23;
+  Status = SpiFlashRead (mFvbInstance->FvBase + 3 * HOST_FV_BLOCK_SIZE + 1, &Length, Block);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_MEM_EQUAL (Block, mEmulator->Flash + 3 * HOST_FV_BLOCK_SIZE + 1, HOST_FV_BLOCK_SIZE + 0x23);
+  UT_ASSERT_MEM_EQUAL (Block + 0x3F, mPattern, sizeof (mPattern));
+
+  //
+  // Writes and erases update the cached block, so it keeps hitting.
+  //
+  NumBytes = sizeof (mPattern);
+  Status   = Fvb->Write (Fvb, 2, 0, &NumBytes, mPattern);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  NumBytes = sizeof (Buffer);
+  Status   = Fvb->Read (Fvb, 2, 0, &NumBytes, Buffer);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_MEM_EQUAL (Buffer, mPattern, sizeof (Buffer));
+
+  Status = Fvb->EraseBlocks (Fvb, (EFI_LBA)2, (UINT32)1, EFI_LBA_LIST_TERMINATOR);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  NumBytes = sizeof (Buffer);
+  Status   = Fvb->Read (Fvb, 2, 0, &NumBytes, Buffer);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_MEM_EQUAL (Buffer, Erased, sizeof (Buffer));
+  UT_ASSERT_EQUAL (mSpiFlashReadCache.MissCount, 1);
+  UT_ASSERT_EQUAL (mSpiFlashReadCache.HitCount, 3);
+
+  //
+  // A program the flash rejects drops the cached block.
+  //
+  NumBytes = sizeof (mPattern);
+  Status   = Fvb->Write (Fvb, 2, 0, &NumBytes, mPattern);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  Length = sizeof (Erased);
+  Status = SpiFlashWrite (mFvbInstance->FvBase + 2 * HOST_FV_BLOCK_SIZE, &Length, Erased);
+  UT_ASSERT_EQUAL (Status, EFI_DEVICE_ERROR);
+  NumBytes = sizeof (Buffer);
+  Status   = Fvb->Read (Fvb, 2, 0, &NumBytes, Buffer);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_MEM_EQUAL (Buffer, mEmulator->Flash + 2 * HOST_FV_BLOCK_SIZE, sizeof (Buffer));
+  UT_ASSERT_EQUAL (mSpiFlashReadCache.MissCount, 2);
+
+  //
+  // Blocks 2 and 6 share an entry of the 4 block cache.
+  //
+  NumBytes = sizeof (Buffer);
+  Status   = Fvb->Read (Fvb, 6, 0, &NumBytes, Buffer);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  NumBytes = sizeof (Buffer);
+  Status   = Fvb->Read (Fvb, 2, 0, &NumBytes, Buffer);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_MEM_EQUAL (Buffer, mPattern, sizeof (Buffer));
+  UT_ASSERT_EQUAL (mSpiFlashReadCache.MissCount, 4);
+
+  FreePool (Block);
+  SpiFlashReadCacheFree ();
+  StopSpiFvb ();
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+WearIsCountedAndSaved (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL  *Fvb;
+  SPI_FVB_WEAR_BLOCK                  *Blocks;
+  UINTN                               BlockCount;
+  UINTN                               NumBytes;
+  UINTN                               Index;
+  UINTN                               LogBase;
+  UINTN                               RecordSize;
+  EFI_STATUS                          Status;
+
+  Fvb = StartSpiFvb (mEraseSizesAll);
+  UT_ASSERT_NOT_NULL (Fvb);
+
+  //
+  // The area is refused while the FV covers it.
+  //
+  Status = FvbWearInitializeLog (mFvbInstance->FvBase + WEAR_LOG_OFFSET, WEAR_LOG_SIZE, 0);
+  UT_ASSERT_EQUAL (Status, EFI_ACCESS_DENIED);
+  mFvbInstance->FvHeader.FvLength              = WEAR_LOG_OFFSET;
+  mFvbInstance->FvHeader.BlockMap[0].NumBlocks = WEAR_FV_BLOCK_COUNT;
+  mFvbInstance->NumOfBlocks                    = WEAR_FV_BLOCK_COUNT;
+
+  Status = FvbInitializeWearCount (mFvbInstance);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  Status = FvbWearInitializeLog (mFvbInstance->FvBase + WEAR_LOG_OFFSET, WEAR_LOG_SIZE, 0);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  Blocks = AllocatePool (WEAR_FV_BLOCK_COUNT * sizeof (SPI_FVB_WEAR_BLOCK));
+  UT_ASSERT_NOT_NULL (Blocks);
+
+  //
+  // A write counts as a program only if it programs the flash, and an erase
+  // only counts the blocks that were not erased already.
+  //
+  for (Index = 0; Index < 2; Index++) {
+    NumBytes = sizeof (mPattern);
+    Status   = Fvb->Write (Fvb, 2, 0, &NumBytes, mPattern);
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+  }
+
+  Status = Fvb->EraseBlocks (Fvb, (EFI_LBA)2, (UINT32)2, EFI_LBA_LIST_TERMINATOR);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  BlockCount = 0;
+  Status     = FvbWearGetCounters (&BlockCount, NULL);
+  UT_ASSERT_EQUAL (Status, EFI_BUFFER_TOO_SMALL);
+  UT_ASSERT_EQUAL (BlockCount, WEAR_FV_BLOCK_COUNT);
+  Status = FvbWearGetCounters (&BlockCount, Blocks);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_EQUAL (Blocks[2].Address, mFvbInstance->FvBase + 2 * HOST_FV_BLOCK_SIZE);
+  UT_ASSERT_EQUAL (Blocks[2].Length, HOST_FV_BLOCK_SIZE);
+  UT_ASSERT_EQUAL (Blocks[2].ProgramCount, 1);
+  UT_ASSERT_EQUAL (Blocks[2].EraseCount, 1);
+  UT_ASSERT_EQUAL (Blocks[3].ProgramCount, 0);
+  UT_ASSERT_EQUAL (Blocks[3].EraseCount, 0);
+
+  //
+  // The saved counters are restored when the service starts again, also
+  // after the saves have moved to the other half of the area.
+  //
+  for (Index = 0; Index < (WEAR_LOG_SIZE / 2) / (WEAR_FV_BLOCK_COUNT * sizeof (FVB_WEAR_COUNT)); Index++) {
+    Status = FvbWearSave ();
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+  }
+
+  UT_ASSERT_TRUE (mEmulator->Stats.EraseCount[SpiFlashEmulatorErase32KB] > 0);
+  ZeroMem (mFvbInstance->WearCount, WEAR_FV_BLOCK_COUNT * sizeof (FVB_WEAR_COUNT));
+  Status = FvbWearInitializeLog (mFvbInstance->FvBase + WEAR_LOG_OFFSET, WEAR_LOG_SIZE, 1);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_EQUAL (mFvbInstance->WearCount[2].ProgramCount, 1);
+  UT_ASSERT_EQUAL (mFvbInstance->WearCount[2].EraseCount, 1);
+
+  //
+  // With a save interval of 1, every erase saves the counters.
+  //
+  NumBytes = sizeof (mPattern);
+  Status   = Fvb->Write (Fvb, 4, 0, &NumBytes, mPattern);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  Status = Fvb->EraseBlocks (Fvb, (EFI_LBA)4, (UINT32)1, EFI_LBA_LIST_TERMINATOR);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  ZeroMem (mFvbInstance->WearCount, WEAR_FV_BLOCK_COUNT * sizeof (FVB_WEAR_COUNT));
+  Status = FvbWearInitializeLog (mFvbInstance->FvBase + WEAR_LOG_OFFSET, WEAR_LOG_SIZE, 1);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_EQUAL (mFvbInstance->WearCount[4].ProgramCount, 1);
+  UT_ASSERT_EQUAL (mFvbInstance->WearCount[4].EraseCount, 1);
+  UT_ASSERT_EQUAL (mFvbInstance->WearCount[2].EraseCount, 1);
+
+  //
+  // Failed saves never erase the only half with a valid record. Half 0
+  // gets one record followed by garbage, so the next save moves to half 1,
+  // and the writes to half 1 fail.
+  //
+  LogBase  = mFvbInstance->FvBase + WEAR_LOG_OFFSET;
+  NumBytes = WEAR_LOG_SIZE;
+  Status   = SpiFlashBlockErase (LogBase, &NumBytes);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  Status = FvbWearInitializeLog (LogBase, WEAR_LOG_SIZE, 0);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  SpiFlashEmulatorResetStats (mEmulator);
+  Status = FvbWearSave ();
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  RecordSize = (UINTN)mEmulator->Stats.ProgramBytes;
+  SetMem ((VOID *)(LogBase + RecordSize), WEAR_LOG_SIZE / 2 - RecordSize, 0);
+  Status = FvbWearInitializeLog (LogBase, WEAR_LOG_SIZE, 0);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+
+  mEmulator->FailProgramCount = 2;
+  for (Index = 0; Index < 2; Index++) {
+    Status = FvbWearSave ();
+    UT_ASSERT_EQUAL (Status, EFI_DEVICE_ERROR);
+  }
+
+  ZeroMem (mFvbInstance->WearCount, WEAR_FV_BLOCK_COUNT * sizeof (FVB_WEAR_COUNT));
+  Status = FvbWearInitializeLog (LogBase, WEAR_LOG_SIZE, 0);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_EQUAL (mFvbInstance->WearCount[4].EraseCount, 1);
+
+  //
+  // The next save that works goes to half 1.
+  //
+  Status = FvbWearSave ();
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_FALSE (FvbIsErased (LogBase + WEAR_LOG_SIZE / 2, RecordSize));
+  ZeroMem (mFvbInstance->WearCount, WEAR_FV_BLOCK_COUNT * sizeof (FVB_WEAR_COUNT));
+  Status = FvbWearInitializeLog (LogBase, WEAR_LOG_SIZE, 0);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_EQUAL (mFvbInstance->WearCount[4].EraseCount, 1);
+
+  FreePool (Blocks);
+  FvbWearInitializeLog (0, 0, 0);
+  FreePool (mFvbInstance->WearCount);
+  StopSpiFvb ();
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+FtwWorkload (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  UINT32                              EraseSizes;
+  EFI_FIRMWARE_VOLUME_BLOCK_PROTOCOL  *Fvb;
+  FTW_WORKLOAD                        Workload;
+  UINT8                               *Store;
+  UINTN                               Index;
+  EFI_STATUS                          Status;
+
+  EraseSizes = *(UINT32 *)Context;
+  Fvb        = StartSpiFvb (EraseSizes);
+  UT_ASSERT_NOT_NULL (Fvb);
+
+  ZeroMem (&Workload, sizeof (Workload));
+  Workload.Shadow = AllocatePool (FTW_AREA_SIZE);
+  Store           = AllocatePool (FTW_AREA_SIZE);
+  UT_ASSERT_NOT_NULL (Workload.Shadow);
+  UT_ASSERT_NOT_NULL (Store);
+  SetMem (Workload.Shadow, FTW_AREA_SIZE, 0xFF);
+  SetMem (Workload.LiveOffset, sizeof (Workload.LiveOffset), 0xFF);
+
+  //
+  // A few variables are updated much more often than the others.
+  //
+  for (Index = 0; Index < FTW_UPDATE_COUNT; Index++) {
+    Status = FtwUpdateVariable (Fvb, &Workload, (UINT8)((Index % 4 == 0) ? (Index / 4) % FTW_VARIABLE_COUNT : Index % 4));
+    UT_ASSERT_NOT_EFI_ERROR (Status);
+  }
+
+  ReportFlashStats ((EraseSizes & SIZE_64KB) != 0 ? "FTW with 64KB erase" : "FTW with 4KB erase", Workload.RequestedBytes);
+  UT_LOG_INFO ("FTW: 0x%x updates, 0x%x reclaims\n", FTW_UPDATE_COUNT, Workload.ReclaimCount);
+
+  UT_ASSERT_NOT_EQUAL (Workload.ReclaimCount, 0);
+  UT_ASSERT_EQUAL (mEmulator->Stats.ProgramErrorCount, 0);
+
+  Status = ReadFv (Fvb, FTW_NV_LBA, Store, FTW_AREA_SIZE);
+  UT_ASSERT_NOT_EFI_ERROR (Status);
+  UT_ASSERT_MEM_EQUAL (Store, Workload.Shadow, FTW_AREA_SIZE);
+
+  FreePool (Store);
+  FreePool (Workload.Shadow);
+  StopSpiFvb ();
+  return UNIT_TEST_PASSED;
+}
+
+/// === TEST ENGINE ================================================================================
+
+/**
+  Standard UEFI entry point for target based
+  unit test execution from UEFI Shell.
+
+  @param[in]  ImageHandle     The firmware allocated handle for the EFI image.
+  @param[in]  SystemTable     A pointer to the EFI System Table.
+
+  @retval EFI_SUCCESS     The entry point executed successfully.
+  @retval other           Some error occurred when executing this entry point.
+
+**/
+int
+main (
+  )
+{
+  EFI_STATUS                  Status;
+  UNIT_TEST_FRAMEWORK_HANDLE  Framework = NULL;
+  UNIT_TEST_SUITE_HANDLE      SpiFvbTests;
+  UINTN                       Index;
+
+  DEBUG ((DEBUG_INFO, "%a v%a\n", UNIT_TEST_NAME, UNIT_TEST_VERSION));
+
+  for (Index = 0; Index < sizeof (mPattern); Index++) {
+    mPattern[Index] = (UINT8)(0xA5 ^ Index);
+  }
+
+  //
+  // Start setting up the test framework for running the tests.
+  //
+  Status = InitUnitTestFramework (&Framework, UNIT_TEST_NAME, gEfiCallerBaseName, UNIT_TEST_VERSION);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in InitUnitTestFramework. Status = %r\n", Status));
+    goto EXIT;
+  }
+
+  Status = CreateUnitTestSuite (&SpiFvbTests, Framework, "SPI FVB Service Host Tests", "SpiFvbService", NULL, NULL);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in CreateUnitTestSuite for SpiFvbTests\n"));
+    Status = EFI_OUT_OF_RESOURCES;
+    goto EXIT;
+  }
+
+  AddTestCase (SpiFvbTests, "Should only clear bits when programming", "SpiFvbService.Program", ProgramOnlyClearsBits, NULL, NULL, NULL);
+  AddTestCase (SpiFvbTests, "Should skip the pages that hold the data", "SpiFvbService.SkipWrite", UnchangedWriteIsSkipped, NULL, NULL, NULL);
+  AddTestCase (SpiFvbTests, "Should erase a merged run at once with 4KB erases", "SpiFvbService.Erase4KB", EraseMergesRuns, NULL, NULL, &mEraseSizes4KB);
+  AddTestCase (SpiFvbTests, "Should erase a merged run at once with 64KB erases", "SpiFvbService.Erase64KB", EraseMergesRuns, NULL, NULL, &mEraseSizesAll);
+  AddTestCase (SpiFvbTests, "Should keep the read cache coherent", "SpiFvbService.ReadCache", ReadCacheIsCoherent, NULL, NULL, NULL);
+  AddTestCase (SpiFvbTests, "Should count and save the wear of the blocks", "SpiFvbService.Wear", WearIsCountedAndSaved, NULL, NULL, NULL);
+  AddTestCase (SpiFvbTests, "Should report the FTW cost with 4KB erases", "SpiFvbService.Ftw4KB", FtwWorkload, NULL, NULL, &mEraseSizes4KB);
+  AddTestCase (SpiFvbTests, "Should report the FTW cost with 64KB erases", "SpiFvbService.Ftw64KB", FtwWorkload, NULL, NULL, &mEraseSizesAll);
+
+  //
+  // Execute the tests.
+  //
+  Status = RunAllTestSuites (Framework);
+
+EXIT:
+  if (Framework != NULL) {
+    FreeUnitTestFramework (Framework);
+  }
+
+  return Status;
+}
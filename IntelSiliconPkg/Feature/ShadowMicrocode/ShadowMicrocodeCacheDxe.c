@@ -0,0 +1,100 @@
+/** @file
+  Save the microcode shadow cache built by ShadowMicrocodePei into LockBox.
+
+  The PEI LockBox library can only restore a LockBox, so the cache is saved
+  here. It is saved at EndOfDxe, before SMM is locked, and ShadowMicrocodePei
+  restores it on S3 resume instead of shadowing the patches from flash.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <PiDxe.h>
+#include <Library/DebugLib.h>
+#include <Library/HobLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/LockBoxLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Guid/EventGroup.h>
+#include <Guid/MicrocodeShadowCache.h>
+
+EDKII_MICROCODE_SHADOW_CACHE_HOB  mCacheInfo;
+
+/**
+  Save the microcode shadow cache into LockBox at EndOfDxe.
+
+  @param[in]  Event               The event.
+  @param[in]  Context             Not used.
+**/
+VOID
+EFIAPI
+SaveMicrocodeShadowCache (
+  IN EFI_EVENT  Event,
+  IN VOID       *Context
+  )
+{
+  EFI_STATUS  Status;
+
+  gBS->CloseEvent (Event);
+
+  Status = SaveLockBox (
+             &gEdkiiMicrocodeShadowCacheGuid,
+             (VOID *)(UINTN)mCacheInfo.CacheBase,
+             (UINTN)mCacheInfo.CacheSize
+             );
+  if (Status == EFI_ALREADY_STARTED) {
+    Status = UpdateLockBox (
+               &gEdkiiMicrocodeShadowCacheGuid,
+               0,
+               (VOID *)(UINTN)mCacheInfo.CacheBase,
+               (UINTN)mCacheInfo.CacheSize
+               );
+  }
+
+  DEBUG ((
+    EFI_ERROR (Status) ? DEBUG_ERROR : DEBUG_INFO,
+    "%a: Save microcode shadow cache at 0x%lx, with size 0x%lx - %r\n",
+    __FUNCTION__,
+    mCacheInfo.CacheBase,
+    mCacheInfo.CacheSize,
+    Status
+    ));
+}
+
+/**
+  The entry point of the driver.
+
+  @param[in]  ImageHandle         The firmware allocated handle for the EFI image.
+  @param[in]  SystemTable         A pointer to the EFI System Table.
+
+  @retval EFI_SUCCESS             The cache will be saved at EndOfDxe.
+  @retval EFI_NOT_FOUND           No cache was built in this boot.
+  @retval Others                  The EndOfDxe event could not be created.
+**/
+EFI_STATUS
+EFIAPI
+ShadowMicrocodeCacheDxeEntryPoint (
+  IN EFI_HANDLE        ImageHandle,
+  IN EFI_SYSTEM_TABLE  *SystemTable
+  )
+{
+  EFI_HOB_GUID_TYPE  *GuidHob;
+  EFI_EVENT          EndOfDxeEvent;
+
+  GuidHob = GetFirstGuidHob (&gEdkiiMicrocodeShadowCacheGuid);
+  if (GuidHob == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  CopyMem (&mCacheInfo, GET_GUID_HOB_DATA (GuidHob), sizeof (mCacheInfo));
+
+  return gBS->CreateEventEx (
+                EVT_NOTIFY_SIGNAL,
+                TPL_CALLBACK,
+                SaveMicrocodeShadowCache,
+                NULL,
+                &gEfiEndOfDxeEventGroupGuid,
+                &EndOfDxeEvent
+                );
+}
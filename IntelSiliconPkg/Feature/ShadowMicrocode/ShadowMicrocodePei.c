@@ -14,10 +14,12 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 #include <Library/BaseMemoryLib.h>
 #include <Library/MemoryAllocationLib.h>
 #include <Library/MicrocodeLib.h>
+#include <Library/LockBoxLib.h>
 #include <IndustryStandard/FirmwareInterfaceTable.h>
 #include <Register/Intel/Microcode.h>
 #include <Register/Intel/Cpuid.h>
 #include <Guid/MicrocodeShadowInfoHob.h>
+#include <Guid/MicrocodeShadowCache.h>
 //
 // Data structure for microcode patch information
 //
@@ -26,6 +28,26 @@ typedef struct {
   UINTN    Size;
 } MICROCODE_PATCH_INFO;
 
+//
+// Data structure hashed for each FIT microcode entry, with the hash of the
+// entries before it. A microcode update on flash changes the entry or the
+// header of the patch it points to.
+//
+typedef struct {
+  UINT32                            Hash;
+  FIRMWARE_INTERFACE_TABLE_ENTRY    FitEntry;
+  CPU_MICROCODE_HEADER              Header;
+} MICROCODE_FIT_HASH_RECORD;
+
+//
+// Data structure hashed for each CPU ID the patches are filtered by, with
+// the hash of the FIT microcode entries and the CPU IDs before it.
+//
+typedef struct {
+  UINT32                        Hash;
+  EDKII_PEI_MICROCODE_CPU_ID    CpuId;
+} MICROCODE_CPU_ID_HASH_RECORD;
+
 /**
   Shadow microcode update patches to memory.
 
@@ -69,9 +91,66 @@ EFI_PEI_PPI_DESCRIPTOR  mPeiShadowMicrocodePpiList[] = {
   }
 };
 
+/**
+  Build the microcode shadow info HOB for the patches in a microcode shadow cache.
+
+  @param[in]  Cache                 The pointer to the microcode shadow cache.
+
+  @retval EFI_SUCCESS               The HOB has been built.
+  @retval EFI_OUT_OF_RESOURCES      The HOB could not be built.
+**/
+EFI_STATUS
+BuildMicrocodeShadowInfoHob (
+  IN EDKII_MICROCODE_SHADOW_CACHE_HEADER  *Cache
+  )
+{
+  UINTN                                     Index;
+  UINT64                                    *CacheAddressInFlash;
+  UINT64                                    *CacheOffsetInData;
+  UINT64                                    DataBase;
+  EDKII_MICROCODE_SHADOW_INFO_HOB           *MicrocodeShadowHob;
+  UINTN                                     HobDataLength;
+  UINT64                                    *MicrocodeAddressInMemory;
+  EFI_MICROCODE_STORAGE_TYPE_FLASH_CONTEXT  *Flashcontext;
+
+  CacheAddressInFlash = (UINT64 *)(Cache + 1);
+  CacheOffsetInData   = CacheAddressInFlash + Cache->PatchCount;
+  DataBase            = (UINT64)(UINTN)Cache + Cache->DataOffset;
+
+  //
+  // Build the microcode shadow info HOB and fill its content in place.
+  //
+  HobDataLength = sizeof (EDKII_MICROCODE_SHADOW_INFO_HOB) +
+                  sizeof (UINT64) * Cache->PatchCount * 2;
+  MicrocodeShadowHob = BuildGuidHob (&gEdkiiMicrocodeShadowInfoHobGuid, HobDataLength);
+  if (MicrocodeShadowHob == NULL) {
+    ASSERT (FALSE);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  MicrocodeShadowHob->MicrocodeCount = Cache->PatchCount;
+  CopyGuid (
+    &MicrocodeShadowHob->StorageType,
+    &gEdkiiMicrocodeStorageTypeFlashGuid
+    );
+  MicrocodeAddressInMemory = (UINT64 *)(MicrocodeShadowHob + 1);
+  Flashcontext             = (EFI_MICROCODE_STORAGE_TYPE_FLASH_CONTEXT *)(MicrocodeAddressInMemory + Cache->PatchCount);
+
+  for (Index = 0; Index < Cache->PatchCount; Index++) {
+    MicrocodeAddressInMemory[Index]              = DataBase + CacheOffsetInData[Index];
+    Flashcontext->MicrocodeAddressInFlash[Index] = CacheAddressInFlash[Index];
+  }
+
+  return EFI_SUCCESS;
+}
+
 /**
   Actual worker function that shadows the required microcode patches into memory.
 
+  The patches are placed behind a microcode shadow cache header. If
+  PcdShadowMicrocodeS3Cache is TRUE, the cache is described by a GUIDed HOB
+  so it can be saved for S3 resume in DXE.
+
   @param[in]       Patches          The pointer to an array of information on
                                     the microcode patches that will be loaded
                                     into memory.
@@ -79,83 +158,103 @@ EFI_PEI_PPI_DESCRIPTOR  mPeiShadowMicrocodePpiList[] = {
                                     be loaded into memory.
   @param[in]       TotalLoadSize    The total size of all the microcode patches
                                     to be loaded.
+  @param[in]       FitHash          The hash of the FIT microcode entries.
   @param[out] BufferSize            Pointer to receive the total size of Buffer.
   @param[out] Buffer                Pointer to receive address of allocated memory
                                     with microcode patches data in it.
+
+  @retval EFI_SUCCESS               The microcode has been shadowed to memory.
+  @retval EFI_OUT_OF_RESOURCES      The operation fails due to lack of resources.
 **/
-VOID
+EFI_STATUS
 ShadowMicrocodePatchWorker (
   IN  MICROCODE_PATCH_INFO  *Patches,
   IN  UINTN                 PatchCount,
   IN  UINTN                 TotalLoadSize,
+  IN  UINT32                FitHash,
   OUT UINTN                 *BufferSize,
   OUT VOID                  **Buffer
   )
 {
-  UINTN                                     Index;
-  VOID                                      *MicrocodePatchInRam;
-  UINT8                                     *Walker;
-  EDKII_MICROCODE_SHADOW_INFO_HOB           *MicrocodeShadowHob;
-  UINTN                                     HobDataLength;
-  UINT64                                    *MicrocodeAddressInMemory;
-  EFI_MICROCODE_STORAGE_TYPE_FLASH_CONTEXT  *Flashcontext;
+  UINTN                                Index;
+  UINTN                                RunIndex;
+  UINTN                                RunOffset;
+  UINTN                                Offset;
+  UINTN                                DataOffset;
+  VOID                                 *MicrocodePatchInRam;
+  EDKII_MICROCODE_SHADOW_CACHE_HEADER  *Cache;
+  UINT64                               *CacheAddressInFlash;
+  UINT64                               *CacheOffsetInData;
+  EDKII_MICROCODE_SHADOW_CACHE_HOB     CacheHob;
 
   ASSERT ((Patches != NULL) && (PatchCount != 0));
 
   //
-  // Init microcode shadow info HOB content.
+  // Allocate memory for microcode shadow operation.
   //
-  HobDataLength = sizeof (EDKII_MICROCODE_SHADOW_INFO_HOB) +
-                  sizeof (UINT64) * PatchCount * 2;
-  MicrocodeShadowHob = AllocatePool (HobDataLength);
-  if (MicrocodeShadowHob == NULL) {
+  DataOffset = ALIGN_VALUE (
+                 sizeof (EDKII_MICROCODE_SHADOW_CACHE_HEADER) + sizeof (UINT64) * PatchCount * 2,
+                 MICROCODE_SHADOW_CACHE_DATA_ALIGNMENT
+                 );
+  Cache = AllocatePages (EFI_SIZE_TO_PAGES (DataOffset + TotalLoadSize));
+  if (Cache == NULL) {
     ASSERT (FALSE);
-    return;
+    return EFI_OUT_OF_RESOURCES;
   }
 
-  MicrocodeShadowHob->MicrocodeCount = PatchCount;
-  CopyGuid (
-    &MicrocodeShadowHob->StorageType,
-    &gEdkiiMicrocodeStorageTypeFlashGuid
-    );
-  MicrocodeAddressInMemory = (UINT64 *)(MicrocodeShadowHob + 1);
-  Flashcontext             = (EFI_MICROCODE_STORAGE_TYPE_FLASH_CONTEXT *)(MicrocodeAddressInMemory + PatchCount);
+  Cache->Signature    = MICROCODE_SHADOW_CACHE_SIGNATURE;
+  Cache->FitHash      = FitHash;
+  Cache->PatchCount   = (UINT32)PatchCount;
+  Cache->DataOffset   = (UINT32)DataOffset;
+  Cache->DataSize     = TotalLoadSize;
+  Cache->Reserved     = 0;
+  CacheAddressInFlash = (UINT64 *)(Cache + 1);
+  CacheOffsetInData   = CacheAddressInFlash + PatchCount;
+  MicrocodePatchInRam = (UINT8 *)Cache + DataOffset;
 
   //
-  // Allocate memory for microcode shadow operation.
+  // Shadow all the required microcode patches into memory. The patches that
+  // are adjacent on flash are copied together, so a packed microcode region
+  // is shadowed with a single copy.
   //
-  MicrocodePatchInRam = AllocatePages (EFI_SIZE_TO_PAGES (TotalLoadSize));
-  if (MicrocodePatchInRam == NULL) {
-    ASSERT (FALSE);
-    return;
+  RunIndex  = 0;
+  RunOffset = 0;
+  Offset    = 0;
+  for (Index = 0; Index < PatchCount; Index++) {
+    CacheAddressInFlash[Index] = (UINT64)Patches[Index].Address;
+    CacheOffsetInData[Index]   = (UINT64)Offset;
+    Offset                    += Patches[Index].Size;
+
+    if ((Index + 1 == PatchCount) ||
+        (Patches[Index + 1].Address != Patches[Index].Address + Patches[Index].Size))
+    {
+      CopyMem (
+        (UINT8 *)MicrocodePatchInRam + RunOffset,
+        (VOID *)Patches[RunIndex].Address,
+        Offset - RunOffset
+        );
+      RunIndex  = Index + 1;
+      RunOffset = Offset;
+    }
   }
 
-  //
-  // Shadow all the required microcode patches into memory
-  //
-  for (Walker = MicrocodePatchInRam, Index = 0; Index < PatchCount; Index++) {
-    CopyMem (
-      Walker,
-      (VOID *)Patches[Index].Address,
-      Patches[Index].Size
-      );
-    MicrocodeAddressInMemory[Index]              = (UINT64)(UINTN)Walker;
-    Flashcontext->MicrocodeAddressInFlash[Index] = (UINT64)Patches[Index].Address;
-    Walker                                      += Patches[Index].Size;
+  if (EFI_ERROR (BuildMicrocodeShadowInfoHob (Cache))) {
+    FreePages (Cache, EFI_SIZE_TO_PAGES (DataOffset + TotalLoadSize));
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  if (FeaturePcdGet (PcdShadowMicrocodeS3Cache)) {
+    CacheHob.CacheBase = (EFI_PHYSICAL_ADDRESS)(UINTN)Cache;
+    CacheHob.CacheSize = DataOffset + TotalLoadSize;
+    BuildGuidDataHob (&gEdkiiMicrocodeShadowCacheGuid, &CacheHob, sizeof (CacheHob));
   }
 
   //
   // Update the microcode patch related fields in CpuMpData
   //
-  *Buffer     = (VOID *)(UINTN)MicrocodePatchInRam;
+  *Buffer     = MicrocodePatchInRam;
   *BufferSize = TotalLoadSize;
 
-  BuildGuidDataHob (
-    &gEdkiiMicrocodeShadowInfoHobGuid,
-    MicrocodeShadowHob,
-    HobDataLength
-    );
-
   DEBUG ((
     DEBUG_INFO,
     "%a: Required microcode patches have been loaded at 0x%lx, with size 0x%lx.\n",
@@ -164,7 +263,174 @@ ShadowMicrocodePatchWorker (
     *BufferSize
     ));
 
-  return;
+  return EFI_SUCCESS;
+}
+
+/**
+  Add a FIT microcode entry to the hash of the FIT microcode entries.
+
+  @param[in]  Hash                 The hash of the FIT microcode entries before
+                                   FitEntry, or 0 for the first one.
+  @param[in]  FitEntry             The pointer to the FIT microcode entry.
+
+  @return The hash of the FIT microcode entries up to FitEntry.
+**/
+UINT32
+UpdateFitMicrocodeHash (
+  IN  UINT32                          Hash,
+  IN  FIRMWARE_INTERFACE_TABLE_ENTRY  *FitEntry
+  )
+{
+  MICROCODE_FIT_HASH_RECORD  Record;
+
+  ZeroMem (&Record, sizeof (Record));
+  Record.Hash = Hash;
+  CopyMem (&Record.FitEntry, FitEntry, sizeof (FIRMWARE_INTERFACE_TABLE_ENTRY));
+  CopyMem (&Record.Header, (VOID *)(UINTN)FitEntry->Address, sizeof (CPU_MICROCODE_HEADER));
+  return CalculateCrc32 (&Record, sizeof (Record));
+}
+
+/**
+  Add the CPU IDs the patches are filtered by to the hash of the FIT
+  microcode entries.
+
+  @param[in]  Hash                 The hash of the FIT microcode entries.
+  @param[in]  CpuIdCount           Number of elements in MicrocodeCpuId array.
+  @param[in]  MicrocodeCpuId       A pointer to an array of EDKII_PEI_MICROCODE_CPU_ID
+                                   structures.
+
+  @return The hash of the FIT microcode entries and the CPU IDs.
+**/
+UINT32
+FinishFitMicrocodeHash (
+  IN  UINT32                      Hash,
+  IN  UINTN                       CpuIdCount,
+  IN  EDKII_PEI_MICROCODE_CPU_ID  *MicrocodeCpuId
+  )
+{
+  MICROCODE_CPU_ID_HASH_RECORD  Record;
+  UINTN                         Index;
+
+  for (Index = 0; Index < CpuIdCount; Index++) {
+    ZeroMem (&Record, sizeof (Record));
+    Record.Hash = Hash;
+    CopyMem (&Record.CpuId, &MicrocodeCpuId[Index], sizeof (EDKII_PEI_MICROCODE_CPU_ID));
+    Hash = CalculateCrc32 (&Record, sizeof (Record));
+  }
+
+  return Hash;
+}
+
+/**
+  Calculate the hash of the FIT microcode entries.
+
+  Only the FIT entries and the headers of the patches they point to are read,
+  so the hash is cheap compared to shadowing the patches from flash.
+
+  @param[in]  FitEntry             The pointer to the FIT.
+  @param[in]  EntryNum             The number of FIT entries.
+  @param[in]  CpuIdCount           Number of elements in MicrocodeCpuId array.
+  @param[in]  MicrocodeCpuId       A pointer to an array of EDKII_PEI_MICROCODE_CPU_ID
+                                   structures.
+
+  @return The hash of the FIT microcode entries and the CPU IDs.
+**/
+UINT32
+CalculateFitMicrocodeHash (
+  IN  FIRMWARE_INTERFACE_TABLE_ENTRY  *FitEntry,
+  IN  UINT32                          EntryNum,
+  IN  UINTN                           CpuIdCount,
+  IN  EDKII_PEI_MICROCODE_CPU_ID      *MicrocodeCpuId
+  )
+{
+  UINT32  Hash;
+  UINT32  Index;
+
+  Hash = 0;
+  for (Index = 0; Index < EntryNum; Index++) {
+    if (FitEntry[Index].Type == FIT_TYPE_01_MICROCODE) {
+      Hash = UpdateFitMicrocodeHash (Hash, &FitEntry[Index]);
+    }
+  }
+
+  return FinishFitMicrocodeHash (Hash, CpuIdCount, MicrocodeCpuId);
+}
+
+/**
+  Restore the microcode patches shadowed in the normal boot from LockBox.
+
+  @param[in]  FitHash              The hash of the FIT microcode entries in this boot.
+  @param[out] BufferSize           Pointer to receive the total size of Buffer.
+  @param[out] Buffer               Pointer to receive address of allocated memory
+                                   with microcode patches data in it.
+
+  @retval EFI_SUCCESS              The microcode has been restored to memory.
+  @retval EFI_NOT_FOUND            No cache was saved, or it does not match the FIT.
+  @retval EFI_OUT_OF_RESOURCES     The operation fails due to lack of resources.
+  @retval Others                   The cache could not be restored from LockBox.
+**/
+EFI_STATUS
+RestoreMicrocodeShadowCache (
+  IN  UINT32  FitHash,
+  OUT UINTN   *BufferSize,
+  OUT VOID    **Buffer
+  )
+{
+  EFI_STATUS                           Status;
+  UINTN                                CacheSize;
+  EDKII_MICROCODE_SHADOW_CACHE_HEADER  *Cache;
+
+  CacheSize = 0;
+  Status    = RestoreLockBox (&gEdkiiMicrocodeShadowCacheGuid, NULL, &CacheSize);
+  if (Status != EFI_BUFFER_TOO_SMALL) {
+    return EFI_NOT_FOUND;
+  }
+
+  if (CacheSize < sizeof (EDKII_MICROCODE_SHADOW_CACHE_HEADER)) {
+    return EFI_NOT_FOUND;
+  }
+
+  Cache = AllocatePages (EFI_SIZE_TO_PAGES (CacheSize));
+  if (Cache == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Status = RestoreLockBox (&gEdkiiMicrocodeShadowCacheGuid, Cache, &CacheSize);
+  if (EFI_ERROR (Status)) {
+    FreePages (Cache, EFI_SIZE_TO_PAGES (CacheSize));
+    return Status;
+  }
+
+  if ((Cache->Signature != MICROCODE_SHADOW_CACHE_SIGNATURE) ||
+      (Cache->FitHash != FitHash) ||
+      (Cache->PatchCount == 0) ||
+      (Cache->DataOffset < sizeof (EDKII_MICROCODE_SHADOW_CACHE_HEADER) + sizeof (UINT64) * Cache->PatchCount * 2) ||
+      (Cache->DataSize != CacheSize - Cache->DataOffset))
+  {
+    DEBUG ((DEBUG_INFO, "%a: Microcode shadow cache does not match the FIT.\n", __FUNCTION__));
+    FreePages (Cache, EFI_SIZE_TO_PAGES (CacheSize));
+    return EFI_NOT_FOUND;
+  }
+
+  Status = BuildMicrocodeShadowInfoHob (Cache);
+  if (EFI_ERROR (Status)) {
+    FreePages (Cache, EFI_SIZE_TO_PAGES (CacheSize));
+    return Status;
+  }
+
+  *Buffer     = (UINT8 *)Cache + Cache->DataOffset;
+  *BufferSize = (UINTN)Cache->DataSize;
+
+  DEBUG ((
+    DEBUG_INFO,
+    "%a: 0x%x microcode patches have been restored at 0x%lx, with size 0x%lx.\n",
+    __FUNCTION__,
+    Cache->PatchCount,
+    *Buffer,
+    *BufferSize
+    ));
+
+  return EFI_SUCCESS;
 }
 
 /**
@@ -289,13 +555,15 @@ ShadowMicrocode (
   UINT64                          FitPointer;
   FIRMWARE_INTERFACE_TABLE_ENTRY  *FitEntry;
   UINT32                          EntryNum;
+  UINT32                          MicrocodeEntryNum;
   UINT32                          Index;
   MICROCODE_PATCH_INFO            *PatchInfoBuffer;
-  UINTN                           MaxPatchNumber;
   CPU_MICROCODE_HEADER            *MicrocodeEntryPoint;
   UINTN                           PatchCount;
   UINTN                           TotalSize;
   UINTN                           TotalLoadSize;
+  UINT32                          FitHash;
+  EFI_BOOT_MODE                   BootMode;
 
   if ((BufferSize == NULL) || (Buffer == NULL)) {
     return EFI_INVALID_PARAMETER;
@@ -310,39 +578,65 @@ ShadowMicrocode (
     return EFI_NOT_FOUND;
   }
 
+  if (FeaturePcdGet (PcdShadowAllMicrocode)) {
+    MicrocodeCpuId = NULL;
+    CpuIdCount     = 0;
+  }
+
+  FitEntry = (FIRMWARE_INTERFACE_TABLE_ENTRY *)(UINTN)FitPointer;
+  EntryNum = *(UINT32 *)(&FitEntry[0].Size[0]) & 0xFFFFFF;
+
   //
-  // Calculate microcode entry number
+  // On S3 resume, restore the patches shadowed in the normal boot from
+  // LockBox, which keeps the flash reads off the resume path. The patches
+  // are shadowed from flash if the microcode on flash has changed since, or
+  // the cache cannot be restored.
+  //
+  if (FeaturePcdGet (PcdShadowMicrocodeS3Cache)) {
+    Status = PeiServicesGetBootMode (&BootMode);
+    if (!EFI_ERROR (Status) && (BootMode == BOOT_ON_S3_RESUME)) {
+      FitHash = CalculateFitMicrocodeHash (FitEntry, EntryNum, CpuIdCount, MicrocodeCpuId);
+      Status  = RestoreMicrocodeShadowCache (FitHash, BufferSize, Buffer);
+      if (!EFI_ERROR (Status)) {
+        return EFI_SUCCESS;
+      }
+    }
+  }
+
   //
-  FitEntry       = (FIRMWARE_INTERFACE_TABLE_ENTRY *)(UINTN)FitPointer;
-  EntryNum       = *(UINT32 *)(&FitEntry[0].Size[0]) & 0xFFFFFF;
-  MaxPatchNumber = 0;
+  // Count the microcode entries to size the patch info buffer. Only the FIT
+  // is read, not the patches.
+  //
+  MicrocodeEntryNum = 0;
   for (Index = 0; Index < EntryNum; Index++) {
     if (FitEntry[Index].Type == FIT_TYPE_01_MICROCODE) {
-      MaxPatchNumber++;
+      MicrocodeEntryNum++;
     }
   }
 
-  if (MaxPatchNumber == 0) {
+  if (MicrocodeEntryNum == 0) {
     return EFI_NOT_FOUND;
   }
 
-  PatchInfoBuffer = AllocatePool (MaxPatchNumber * sizeof (MICROCODE_PATCH_INFO));
+  PatchInfoBuffer = AllocatePool (MicrocodeEntryNum * sizeof (MICROCODE_PATCH_INFO));
   if (PatchInfoBuffer == NULL) {
     return EFI_OUT_OF_RESOURCES;
   }
 
-  if (FeaturePcdGet (PcdShadowAllMicrocode)) {
-    MicrocodeCpuId = NULL;
-    CpuIdCount     = 0;
-  }
-
   //
-  // Fill up microcode patch info buffer according to FIT table.
+  // Fill up microcode patch info buffer according to FIT table. The patches
+  // are filtered by the CPU ID list, without checksum verification. The
+  // hash saved with the cache is calculated in the same walk.
   //
   PatchCount    = 0;
   TotalLoadSize = 0;
+  FitHash       = 0;
   for (Index = 0; Index < EntryNum; Index++) {
     if (FitEntry[Index].Type == FIT_TYPE_01_MICROCODE) {
+      if (FeaturePcdGet (PcdShadowMicrocodeS3Cache)) {
+        FitHash = UpdateFitMicrocodeHash (FitHash, &FitEntry[Index]);
+      }
+
       MicrocodeEntryPoint = (CPU_MICROCODE_HEADER *)(UINTN)FitEntry[Index].Address;
       TotalSize           = GetMicrocodeLength (MicrocodeEntryPoint);
       if (IsValidMicrocode (MicrocodeEntryPoint, TotalSize, 0, MicrocodeCpuId, CpuIdCount, FALSE)) {
@@ -354,6 +648,10 @@ ShadowMicrocode (
     }
   }
 
+  if (FeaturePcdGet (PcdShadowMicrocodeS3Cache)) {
+    FitHash = FinishFitMicrocodeHash (FitHash, CpuIdCount, MicrocodeCpuId);
+  }
+
   if (PatchCount != 0) {
     DEBUG ((
       DEBUG_INFO,
@@ -363,8 +661,7 @@ ShadowMicrocode (
       TotalLoadSize
       ));
 
-    ShadowMicrocodePatchWorker (PatchInfoBuffer, PatchCount, TotalLoadSize, BufferSize, Buffer);
-    Status = EFI_SUCCESS;
+    Status = ShadowMicrocodePatchWorker (PatchInfoBuffer, PatchCount, TotalLoadSize, FitHash, BufferSize, Buffer);
   } else {
     Status = EFI_NOT_FOUND;
   }
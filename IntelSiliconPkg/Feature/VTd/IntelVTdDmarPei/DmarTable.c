@@ -13,11 +13,13 @@
 #include <Library/MemoryAllocationLib.h>
 #include <Library/DebugLib.h>
 #include <Library/HobLib.h>
+#include <Library/DmaBufferAllocatorLib.h>
 #include <Library/PciSegmentLib.h>
 #include <IndustryStandard/Vtd.h>
 #include <IndustryStandard/Pci.h>
 #include <Protocol/IoMmu.h>
 #include <Ppi/VtdInfo.h>
+#include <Guid/VtdPeiStatisticsHob.h>
 
 #include "IntelVTdDmarPei.h"
 
@@ -337,3 +339,45 @@ ParseDmarAcpiTableDrhd (
 
   return VtdIndex;
 }
+
+/**
+  Parse DMAR RMRR table.
+
+  @param[in]  AcpiDmarTable     DMAR ACPI table
+  @param[in]  Callback          Callback function for handle RMRR
+  @param[in]  Context           Callback function Context
+
+  @return the RMRR number.
+
+**/
+UINTN
+ParseDmarAcpiTableRmrr (
+  IN EFI_ACPI_DMAR_HEADER        *AcpiDmarTable,
+  IN PROCESS_RMRR_CALLBACK_FUNC  Callback,
+  IN VOID                        *Context
+  )
+{
+  EFI_ACPI_DMAR_STRUCTURE_HEADER  *DmarHeader;
+  UINTN                           RmrrCount;
+
+  RmrrCount  = 0;
+  DmarHeader = (EFI_ACPI_DMAR_STRUCTURE_HEADER *)((UINTN)(AcpiDmarTable + 1));
+
+  while ((UINTN)DmarHeader < (UINTN)AcpiDmarTable + AcpiDmarTable->Header.Length) {
+    switch (DmarHeader->Type) {
+      case EFI_ACPI_DMAR_TYPE_RMRR:
+        if (Callback != NULL) {
+          Callback (Context, (EFI_ACPI_DMAR_RMRR_HEADER *)DmarHeader);
+        }
+
+        RmrrCount++;
+        break;
+      default:
+        break;
+    }
+
+    DmarHeader = (EFI_ACPI_DMAR_STRUCTURE_HEADER *)((UINTN)DmarHeader + DmarHeader->Length);
+  }
+
+  return RmrrCount;
+}
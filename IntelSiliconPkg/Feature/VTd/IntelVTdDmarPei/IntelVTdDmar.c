@@ -14,10 +14,12 @@
 #include <Library/MemoryAllocationLib.h>
 #include <Library/CacheMaintenanceLib.h>
 #include <Library/PeiServicesLib.h>
+#include <Library/DmaBufferAllocatorLib.h>
 #include <IndustryStandard/Vtd.h>
 #include <Ppi/VtdInfo.h>
 #include <Ppi/VtdNullRootEntryTable.h>
 #include <Ppi/IoMmu.h>
+#include <Guid/VtdPeiStatisticsHob.h>
 #include "IntelVTdDmarPei.h"
 
 /**
@@ -79,11 +81,10 @@ PerpareCacheInvalidationInterface (
   IN VTD_UNIT_INFO  *VTdUnitInfo
   )
 {
-  UINT16        QiDescLength;
-  UINT64        Reg64;
-  UINT32        Reg32;
-  VTD_ECAP_REG  ECapReg;
-  UINTN         VtdUnitBaseAddress;
+  UINT16  QiDescLength;
+  UINT64  Reg64;
+  UINT32  Reg32;
+  UINTN   VtdUnitBaseAddress;
 
   VtdUnitBaseAddress = VTdUnitInfo->VtdUnitBaseAddress;
 
@@ -93,8 +94,7 @@ PerpareCacheInvalidationInterface (
     return EFI_SUCCESS;
   }
 
-  ECapReg.Uint64 = MmioRead64 (VtdUnitBaseAddress + R_ECAP_REG);
-  if (ECapReg.Bits.QI == 0) {
+  if (VTdUnitInfo->ECapReg.Bits.QI == 0) {
     DEBUG ((DEBUG_ERROR, "Hardware does not support queued invalidations interface for engine [0x%x]\n", VtdUnitBaseAddress));
     return EFI_UNSUPPORTED;
   }
@@ -331,11 +331,15 @@ InvalidateIOTLB (
   VTD_ECAP_REG  ECapReg;
   QI_DESC       QiDesc;
 
+  //
+  // The extended capability register is cached by PrepareVtdConfig().
+  //
+  ECapReg = VTdUnitInfo->ECapReg;
+
   if (VTdUnitInfo->EnableQueuedInvalidation == 0) {
     //
     // Register-based Invalidation
     //
-    ECapReg.Uint64 = MmioRead64 (VTdUnitInfo->VtdUnitBaseAddress + R_ECAP_REG);
 
     Reg64 = MmioRead64 (VTdUnitInfo->VtdUnitBaseAddress + (ECapReg.Bits.IRO * 16) + R_IOTLB_REG);
     if ((Reg64 & B_IOTLB_REG_IVT) != 0) {
@@ -354,7 +358,6 @@ InvalidateIOTLB (
     //
     // Queued Invalidation
     //
-    ECapReg.Uint64 = MmioRead64 (VTdUnitInfo->VtdUnitBaseAddress + R_ECAP_REG);
     QiDesc.Low     = QI_IOTLB_DID (0) | QI_IOTLB_DR (CAP_READ_DRAIN (ECapReg.Uint64)) | QI_IOTLB_DW (CAP_WRITE_DRAIN (ECapReg.Uint64)) | QI_IOTLB_GRAN (1) | QI_IOTLB_TYPE;
     QiDesc.High    = QI_IOTLB_ADDR (0) | QI_IOTLB_IH (0) | QI_IOTLB_AM (0);
 
@@ -438,6 +441,7 @@ EnableDmar (
 {
   UINT32  Reg32;
   UINTN   VtdUnitBaseAddress;
+  UINT64  StartTick;
 
   VtdUnitBaseAddress = VTdUnitInfo->VtdUnitBaseAddress;
 
@@ -464,6 +468,7 @@ EnableDmar (
   //
   // Write Buffer Flush before invalidation
   //
+  StartTick = AsmReadTsc ();
   FlushWriteBuffer (VtdUnitBaseAddress);
 
   //
@@ -475,6 +480,7 @@ EnableDmar (
   // Invalidate the IOTLB cache
   //
   InvalidateIOTLB (VTdUnitInfo);
+  RecordVTdPeiPhase (VtdPeiPhaseInvalidation, StartTick);
 
   //
   // Enable VTd
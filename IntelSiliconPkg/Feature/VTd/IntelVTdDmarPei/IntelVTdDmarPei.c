@@ -15,12 +15,16 @@
 #include <Library/DebugLib.h>
 #include <Library/PeiServicesLib.h>
 #include <Library/HobLib.h>
+#include <Library/DmaBufferAllocatorLib.h>
 #include <IndustryStandard/Vtd.h>
+#include <Register/Intel/Cpuid.h>
 #include <Ppi/IoMmu.h>
 #include <Ppi/VtdInfo.h>
+#include <Ppi/VtdDmaBuffer.h>
 #include <Ppi/MemoryDiscovered.h>
 #include <Ppi/EndOfPeiPhase.h>
 #include <Guid/VtdPmrInfoHob.h>
+#include <Guid/VtdPeiStatisticsHob.h>
 #include "IntelVTdDmarPei.h"
 
 #define VTD_UNIT_MAX  42
@@ -33,14 +37,163 @@ EFI_GUID  mDmaBufferInfoGuid = {
   0x7b624ec7, 0xfb67, 0x4f9c, { 0xb6, 0xb0, 0x4d, 0xfa, 0x9c, 0x88, 0x20, 0x39 }
 };
 
-#define MAP_INFO_SIGNATURE  SIGNATURE_32 ('D', 'M', 'A', 'P')
+
+#define IOMMU_PPI_PRIVATE_SIGNATURE  SIGNATURE_32 ('V', 'T', 'I', 'P')
 typedef struct {
-  UINT32                   Signature;
-  EDKII_IOMMU_OPERATION    Operation;
-  UINTN                    NumberOfBytes;
-  EFI_PHYSICAL_ADDRESS     HostAddress;
-  EFI_PHYSICAL_ADDRESS     DeviceAddress;
-} MAP_INFO;
+  UINT32                    Signature;
+  EDKII_IOMMU_PPI           IoMmuPpi;
+  EDKII_VTD_DMA_BUFFER_PPI  DmaBufferPpi;
+  EFI_PEI_PPI_DESCRIPTOR    PpiList;
+  EFI_PEI_PPI_DESCRIPTOR    DmaBufferPpiList;
+  //
+  // Cached pointer to the DMA buffer information HOB data. It is only set
+  // once permanent memory is installed, so it is never migrated afterwards.
+  //
+  DMA_BUFFER_INFO           *DmaBufferInfo;
+  //
+  // Cached pointer to the statistics HOB data, NULL if it is not built.
+  //
+  VTD_PEI_STATISTICS_HOB    *Statistics;
+} IOMMU_PPI_PRIVATE;
+
+#define IOMMU_PPI_PRIVATE_FROM_THIS(a)            CR (a, IOMMU_PPI_PRIVATE, IoMmuPpi, IOMMU_PPI_PRIVATE_SIGNATURE)
+#define IOMMU_PPI_PRIVATE_FROM_DMA_BUFFER_PPI(a)  CR (a, IOMMU_PPI_PRIVATE, DmaBufferPpi, IOMMU_PPI_PRIVATE_SIGNATURE)
+
+/**
+  Get the DMA buffer information cached in the IOMMU PPI instance.
+
+  @param[in]  This                  The PPI instance pointer.
+
+  @return The DMA buffer information.
+  @retval NULL                      The DMA buffer is not available to be allocated yet.
+**/
+DMA_BUFFER_INFO *
+GetDmaBufferInfo (
+  IN EDKII_IOMMU_PPI  *This
+  )
+{
+  IOMMU_PPI_PRIVATE  *Private;
+
+  Private = IOMMU_PPI_PRIVATE_FROM_THIS (This);
+  if ((Private->DmaBufferInfo == NULL) ||
+      !DmaBufferAllocatorIsReady (&Private->DmaBufferInfo->Allocator))
+  {
+    return NULL;
+  }
+
+  return Private->DmaBufferInfo;
+}
+
+/**
+  Get the VTd PEI statistics from the statistics HOB.
+
+  @return The VTd PEI statistics.
+  @retval NULL                  The statistics HOB is not built.
+**/
+VTD_PEI_STATISTICS_HOB *
+GetVTdPeiStatistics (
+  VOID
+  )
+{
+  VOID  *Hob;
+
+  Hob = GetFirstGuidHob (&gVtdPeiStatisticsHobGuid);
+  if (Hob == NULL) {
+    return NULL;
+  }
+
+  return GET_GUID_HOB_DATA (Hob);
+}
+
+/**
+  Get the frequency of the TSC the VTd PEI phases are timed with.
+
+  @return The TSC frequency in Hz.
+  @retval 0                     The CPU does not report the TSC frequency.
+**/
+UINT64
+GetVTdPeiTickFrequency (
+  VOID
+  )
+{
+  UINT32  MaxLeaf;
+  UINT32  Denominator;
+  UINT32  Numerator;
+  UINT32  CrystalFrequency;
+
+  AsmCpuid (CPUID_SIGNATURE, &MaxLeaf, NULL, NULL, NULL);
+  if (MaxLeaf < CPUID_TIME_STAMP_COUNTER) {
+    return 0;
+  }
+
+  AsmCpuid (CPUID_TIME_STAMP_COUNTER, &Denominator, &Numerator, &CrystalFrequency, NULL);
+  if ((Denominator == 0) || (Numerator == 0) || (CrystalFrequency == 0)) {
+    return 0;
+  }
+
+  return DivU64x32 (MultU64x32 (CrystalFrequency, Numerator), Denominator);
+}
+
+/**
+  Accumulate the time spent in a VTd PEI phase.
+
+  @param[in]  Statistics        The VTd PEI statistics, may be NULL.
+  @param[in]  Phase             The phase.
+  @param[in]  StartTick         The TSC value when the phase was entered.
+**/
+VOID
+AddVTdPeiPhaseTicks (
+  IN VTD_PEI_STATISTICS_HOB  *Statistics,
+  IN VTD_PEI_PHASE           Phase,
+  IN UINT64                  StartTick
+  )
+{
+  if (Statistics == NULL) {
+    return;
+  }
+
+  Statistics->Phase[Phase].Ticks += AsmReadTsc () - StartTick;
+  Statistics->Phase[Phase].Count++;
+}
+
+/**
+  Record the time spent in a VTd PEI phase in the statistics HOB.
+
+  @param[in]  Phase             The phase.
+  @param[in]  StartTick         The TSC value when the phase was entered.
+**/
+VOID
+RecordVTdPeiPhase (
+  IN VTD_PEI_PHASE  Phase,
+  IN UINT64         StartTick
+  )
+{
+  AddVTdPeiPhaseTicks (GetVTdPeiStatistics (), Phase, StartTick);
+}
+
+/**
+  Update the peak DMA buffer usage in the VTd PEI statistics.
+
+  @param[in]  Statistics        The VTd PEI statistics, may be NULL.
+  @param[in]  DmaBufferInfo     The DMA buffer information.
+**/
+VOID
+RecordDmaBufferUsage (
+  IN VTD_PEI_STATISTICS_HOB  *Statistics,
+  IN DMA_BUFFER_INFO         *DmaBufferInfo
+  )
+{
+  UINT64  Usage;
+
+  if (Statistics == NULL) {
+    return;
+  }
+
+  Usage = DmaBufferInfo->DmaBufferSize - DmaBufferInfo->Allocator.FreeSize;
+  if (Usage > Statistics->PeakDmaBufferUsage) {
+    Statistics->PeakDmaBufferUsage = Usage;
+  }
+}
 
 /**
   Set IOMMU attribute for a system memory.
@@ -75,16 +228,10 @@ PeiIoMmuSetAttribute (
   IN UINT64           IoMmuAccess
   )
 {
-  VOID             *Hob;
-  DMA_BUFFER_INFO  *DmaBufferInfo;
-
   DEBUG ((DEBUG_INFO, "PeiIoMmuSetAttribute:\n"));
 
-  Hob           = GetFirstGuidHob (&mDmaBufferInfoGuid);
-  DmaBufferInfo = GET_GUID_HOB_DATA (Hob);
-
-  if (DmaBufferInfo->DmaBufferCurrentTop == 0) {
-    DEBUG ((DEBUG_INFO, "PeiIoMmuSetAttribute: DmaBufferCurrentTop == 0\n"));
+  if (GetDmaBufferInfo (This) == NULL) {
+    DEBUG ((DEBUG_INFO, "PeiIoMmuSetAttribute: DMA buffer is not ready\n"));
     return EFI_NOT_AVAILABLE_YET;
   }
 
@@ -123,42 +270,65 @@ PeiIoMmuMap (
   OUT    VOID                   **Mapping
   )
 {
-  MAP_INFO         *MapInfo;
-  UINTN            Length;
-  VOID             *Hob;
-  DMA_BUFFER_INFO  *DmaBufferInfo;
-
-  Hob           = GetFirstGuidHob (&mDmaBufferInfoGuid);
-  DmaBufferInfo = GET_GUID_HOB_DATA (Hob);
+  EFI_STATUS              Status;
+  MAP_INFO                *MapInfo;
+  UINTN                   Index;
+  UINTN                   Address;
+  DMA_BUFFER_INFO         *DmaBufferInfo;
+  VTD_PEI_STATISTICS_HOB  *Statistics;
+  UINT64                  StartTick;
 
   DEBUG ((DEBUG_INFO, "PeiIoMmuMap - HostAddress - 0x%x, NumberOfBytes - %x\n", HostAddress, *NumberOfBytes));
-  DEBUG ((DEBUG_INFO, "  DmaBufferCurrentTop - %x\n", DmaBufferInfo->DmaBufferCurrentTop));
-  DEBUG ((DEBUG_INFO, "  DmaBufferCurrentBottom - %x\n", DmaBufferInfo->DmaBufferCurrentBottom));
   DEBUG ((DEBUG_INFO, "  Operation - %x\n", Operation));
 
-  if (DmaBufferInfo->DmaBufferCurrentTop == 0) {
+  DmaBufferInfo = GetDmaBufferInfo (This);
+  if (DmaBufferInfo == NULL) {
     return EFI_NOT_AVAILABLE_YET;
   }
 
+  DEBUG ((DEBUG_INFO, "  DmaBufferFreeSize - %x\n", DmaBufferInfo->Allocator.FreeSize));
+
+  Statistics = IOMMU_PPI_PRIVATE_FROM_THIS (This)->Statistics;
+
+  //
+  // A NULL mapping means no bounce buffer is used. This is the case for
+  // common buffers and for buffers that are already inside the DMA buffer
+  // window, e.g. allocated through EDKII_VTD_DMA_BUFFER_PPI.
+  //
   if ((Operation == EdkiiIoMmuOperationBusMasterCommonBuffer) ||
-      (Operation == EdkiiIoMmuOperationBusMasterCommonBuffer64))
+      (Operation == EdkiiIoMmuOperationBusMasterCommonBuffer64) ||
+      DmaBufferIsInWindow (&DmaBufferInfo->Allocator, (UINTN)HostAddress, *NumberOfBytes))
   {
     *DeviceAddress = (UINTN)HostAddress;
     *Mapping       = NULL;
+    if (Statistics != NULL) {
+      Statistics->MapCount++;
+    }
+
     return EFI_SUCCESS;
   }
 
-  Length = *NumberOfBytes + sizeof (MAP_INFO);
-  if (Length > DmaBufferInfo->DmaBufferCurrentTop - DmaBufferInfo->DmaBufferCurrentBottom) {
+  MapInfo = NULL;
+  for (Index = 0; Index < MAP_INFO_COUNT; Index++) {
+    if (DmaBufferInfo->MapInfo[Index].Signature != MAP_INFO_SIGNATURE) {
+      MapInfo = &DmaBufferInfo->MapInfo[Index];
+      break;
+    }
+  }
+
+  Status = EFI_OUT_OF_RESOURCES;
+  if ((MapInfo != NULL) && (*NumberOfBytes <= DmaBufferInfo->DmaBufferSize)) {
+    Status = DmaBufferAllocate (&DmaBufferInfo->Allocator, MAP_INFO_BUFFER_SIZE (*NumberOfBytes), 0, FALSE, &Address);
+  }
+
+  if (EFI_ERROR (Status)) {
     DEBUG ((DEBUG_ERROR, "PeiIoMmuMap - OUT_OF_RESOURCE\n"));
     ASSERT (FALSE);
     return EFI_OUT_OF_RESOURCES;
   }
 
-  *DeviceAddress                         = DmaBufferInfo->DmaBufferCurrentBottom;
-  DmaBufferInfo->DmaBufferCurrentBottom += Length;
+  *DeviceAddress = Address;
 
-  MapInfo                = (VOID *)(UINTN)(*DeviceAddress + *NumberOfBytes);
   MapInfo->Signature     = MAP_INFO_SIGNATURE;
   MapInfo->Operation     = Operation;
   MapInfo->NumberOfBytes = *NumberOfBytes;
@@ -167,6 +337,12 @@ PeiIoMmuMap (
   *Mapping               = MapInfo;
   DEBUG ((DEBUG_INFO, "  Op(%x):DeviceAddress - %x, Mapping - %x\n", Operation, (UINTN)*DeviceAddress, MapInfo));
 
+  if (Statistics != NULL) {
+    Statistics->MapCount++;
+    Statistics->BounceCount++;
+    RecordDmaBufferUsage (Statistics, DmaBufferInfo);
+  }
+
   //
   // If this is a read operation from the Bus Master's point of view,
   // then copy the contents of the real buffer into the mapped buffer
@@ -175,11 +351,16 @@ PeiIoMmuMap (
   if ((Operation == EdkiiIoMmuOperationBusMasterRead) ||
       (Operation == EdkiiIoMmuOperationBusMasterRead64))
   {
+    StartTick = AsmReadTsc ();
     CopyMem (
       (VOID *)(UINTN)MapInfo->DeviceAddress,
       (VOID *)(UINTN)MapInfo->HostAddress,
       MapInfo->NumberOfBytes
       );
+    if (Statistics != NULL) {
+      AddVTdPeiPhaseTicks (Statistics, VtdPeiPhaseBounceCopy, StartTick);
+      Statistics->BytesBounced += MapInfo->NumberOfBytes;
+    }
   }
 
   return EFI_SUCCESS;
@@ -204,28 +385,35 @@ PeiIoMmuUnmap (
   IN  VOID             *Mapping
   )
 {
-  MAP_INFO         *MapInfo;
-  UINTN            Length;
-  VOID             *Hob;
-  DMA_BUFFER_INFO  *DmaBufferInfo;
-
-  Hob           = GetFirstGuidHob (&mDmaBufferInfoGuid);
-  DmaBufferInfo = GET_GUID_HOB_DATA (Hob);
+  EFI_STATUS              Status;
+  MAP_INFO                *MapInfo;
+  DMA_BUFFER_INFO         *DmaBufferInfo;
+  VTD_PEI_STATISTICS_HOB  *Statistics;
+  UINT64                  StartTick;
 
   DEBUG ((DEBUG_INFO, "PeiIoMmuUnmap - Mapping - %x\n", Mapping));
-  DEBUG ((DEBUG_INFO, "  DmaBufferCurrentTop - %x\n", DmaBufferInfo->DmaBufferCurrentTop));
-  DEBUG ((DEBUG_INFO, "  DmaBufferCurrentBottom - %x\n", DmaBufferInfo->DmaBufferCurrentBottom));
 
-  if (DmaBufferInfo->DmaBufferCurrentTop == 0) {
+  DmaBufferInfo = GetDmaBufferInfo (This);
+  if (DmaBufferInfo == NULL) {
     return EFI_NOT_AVAILABLE_YET;
   }
 
+  DEBUG ((DEBUG_INFO, "  DmaBufferFreeSize - %x\n", DmaBufferInfo->Allocator.FreeSize));
+
   if (Mapping == NULL) {
     return EFI_SUCCESS;
   }
 
   MapInfo = Mapping;
+  ASSERT ((MapInfo >= &DmaBufferInfo->MapInfo[0]) && (MapInfo < &DmaBufferInfo->MapInfo[MAP_INFO_COUNT]));
+  if ((MapInfo < &DmaBufferInfo->MapInfo[0]) || (MapInfo >= &DmaBufferInfo->MapInfo[MAP_INFO_COUNT])) {
+    return EFI_INVALID_PARAMETER;
+  }
+
   ASSERT (MapInfo->Signature == MAP_INFO_SIGNATURE);
+  if (MapInfo->Signature != MAP_INFO_SIGNATURE) {
+    return EFI_INVALID_PARAMETER;
+  }
   DEBUG ((DEBUG_INFO, "  Op(%x):DeviceAddress - %x, NumberOfBytes - %x\n", MapInfo->Operation, (UINTN)MapInfo->DeviceAddress, MapInfo->NumberOfBytes));
 
   //
@@ -236,17 +424,22 @@ PeiIoMmuUnmap (
   if ((MapInfo->Operation == EdkiiIoMmuOperationBusMasterWrite) ||
       (MapInfo->Operation == EdkiiIoMmuOperationBusMasterWrite64))
   {
+    StartTick = AsmReadTsc ();
     CopyMem (
       (VOID *)(UINTN)MapInfo->HostAddress,
       (VOID *)(UINTN)MapInfo->DeviceAddress,
       MapInfo->NumberOfBytes
       );
+    Statistics = IOMMU_PPI_PRIVATE_FROM_THIS (This)->Statistics;
+    if (Statistics != NULL) {
+      AddVTdPeiPhaseTicks (Statistics, VtdPeiPhaseBounceCopy, StartTick);
+      Statistics->BytesBounced += MapInfo->NumberOfBytes;
+    }
   }
 
-  Length = MapInfo->NumberOfBytes + sizeof (MAP_INFO);
-  if (DmaBufferInfo->DmaBufferCurrentBottom == MapInfo->DeviceAddress + Length) {
-    DmaBufferInfo->DmaBufferCurrentBottom -= Length;
-  }
+  MapInfo->Signature = 0;
+  Status             = DmaBufferFree (&DmaBufferInfo->Allocator, (UINTN)MapInfo->DeviceAddress, MAP_INFO_BUFFER_SIZE (MapInfo->NumberOfBytes));
+  ASSERT_EFI_ERROR (Status);
 
   return EFI_SUCCESS;
 }
@@ -281,30 +474,32 @@ PeiIoMmuAllocateBuffer (
   IN     UINT64           Attributes
   )
 {
-  UINTN            Length;
-  VOID             *Hob;
+  EFI_STATUS       Status;
+  UINTN            Address;
   DMA_BUFFER_INFO  *DmaBufferInfo;
 
-  Hob           = GetFirstGuidHob (&mDmaBufferInfoGuid);
-  DmaBufferInfo = GET_GUID_HOB_DATA (Hob);
-
   DEBUG ((DEBUG_INFO, "PeiIoMmuAllocateBuffer - page - %x\n", Pages));
-  DEBUG ((DEBUG_INFO, "  DmaBufferCurrentTop - %x\n", DmaBufferInfo->DmaBufferCurrentTop));
-  DEBUG ((DEBUG_INFO, "  DmaBufferCurrentBottom - %x\n", DmaBufferInfo->DmaBufferCurrentBottom));
 
-  if (DmaBufferInfo->DmaBufferCurrentTop == 0) {
+  DmaBufferInfo = GetDmaBufferInfo (This);
+  if (DmaBufferInfo == NULL) {
     return EFI_NOT_AVAILABLE_YET;
   }
 
-  Length = EFI_PAGES_TO_SIZE (Pages);
-  if (Length > DmaBufferInfo->DmaBufferCurrentTop - DmaBufferInfo->DmaBufferCurrentBottom) {
+  DEBUG ((DEBUG_INFO, "  DmaBufferFreeSize - %x\n", DmaBufferInfo->Allocator.FreeSize));
+
+  Status = EFI_OUT_OF_RESOURCES;
+  if (Pages <= EFI_SIZE_TO_PAGES (DmaBufferInfo->DmaBufferSize)) {
+    Status = DmaBufferAllocate (&DmaBufferInfo->Allocator, EFI_PAGES_TO_SIZE (Pages), EFI_PAGE_SIZE, TRUE, &Address);
+  }
+
+  if (EFI_ERROR (Status)) {
     DEBUG ((DEBUG_ERROR, "PeiIoMmuAllocateBuffer - OUT_OF_RESOURCE\n"));
     ASSERT (FALSE);
     return EFI_OUT_OF_RESOURCES;
   }
 
-  *HostAddress                        = (VOID *)(UINTN)(DmaBufferInfo->DmaBufferCurrentTop - Length);
-  DmaBufferInfo->DmaBufferCurrentTop -= Length;
+  *HostAddress = (VOID *)Address;
+  RecordDmaBufferUsage (IOMMU_PPI_PRIVATE_FROM_THIS (This)->Statistics, DmaBufferInfo);
 
   DEBUG ((DEBUG_INFO, "PeiIoMmuAllocateBuffer - allocate - %x\n", *HostAddress));
   return EFI_SUCCESS;
@@ -331,44 +526,211 @@ PeiIoMmuFreeBuffer (
   IN  VOID             *HostAddress
   )
 {
-  UINTN            Length;
-  VOID             *Hob;
+  EFI_STATUS       Status;
   DMA_BUFFER_INFO  *DmaBufferInfo;
 
-  Hob           = GetFirstGuidHob (&mDmaBufferInfoGuid);
-  DmaBufferInfo = GET_GUID_HOB_DATA (Hob);
-
   DEBUG ((DEBUG_INFO, "PeiIoMmuFreeBuffer - page - %x, HostAddr - %x\n", Pages, HostAddress));
-  DEBUG ((DEBUG_INFO, "  DmaBufferCurrentTop - %x\n", DmaBufferInfo->DmaBufferCurrentTop));
-  DEBUG ((DEBUG_INFO, "  DmaBufferCurrentBottom - %x\n", DmaBufferInfo->DmaBufferCurrentBottom));
 
-  if (DmaBufferInfo->DmaBufferCurrentTop == 0) {
+  DmaBufferInfo = GetDmaBufferInfo (This);
+  if (DmaBufferInfo == NULL) {
     return EFI_NOT_AVAILABLE_YET;
   }
 
-  Length = EFI_PAGES_TO_SIZE (Pages);
-  if ((UINTN)HostAddress == DmaBufferInfo->DmaBufferCurrentTop) {
-    DmaBufferInfo->DmaBufferCurrentTop += Length;
+  DEBUG ((DEBUG_INFO, "  DmaBufferFreeSize - %x\n", DmaBufferInfo->Allocator.FreeSize));
+
+  if (Pages > EFI_SIZE_TO_PAGES (DmaBufferInfo->DmaBufferSize)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Status = DmaBufferFree (&DmaBufferInfo->Allocator, (UINTN)HostAddress, EFI_PAGES_TO_SIZE (Pages));
+  if (EFI_ERROR (Status)) {
+    return EFI_INVALID_PARAMETER;
   }
 
   return EFI_SUCCESS;
 }
 
-EDKII_IOMMU_PPI  mIoMmuPpi = {
-  EDKII_IOMMU_PPI_REVISION,
-  PeiIoMmuSetAttribute,
-  PeiIoMmuMap,
-  PeiIoMmuUnmap,
-  PeiIoMmuAllocateBuffer,
-  PeiIoMmuFreeBuffer,
-};
+/**
+  Allocate a buffer from the DMA buffer window.
+
+  @param[in]  This              The PPI instance pointer.
+  @param[in]  Length            The number of bytes to allocate.
+  @param[in]  Alignment         The required alignment of the buffer. Must be
+                                0 or a power of 2.
+  @param[out] HostAddress       The allocated buffer.
+
+  @retval EFI_SUCCESS            The buffer is allocated.
+  @retval EFI_INVALID_PARAMETER  One or more parameters are invalid.
+  @retval EFI_OUT_OF_RESOURCES   The DMA buffer window is exhausted.
+  @retval EFI_NOT_AVAILABLE_YET  The DMA buffer window is not available yet.
+**/
+EFI_STATUS
+EFIAPI
+PeiVTdDmaBufferAllocate (
+  IN  EDKII_VTD_DMA_BUFFER_PPI  *This,
+  IN  UINTN                     Length,
+  IN  UINTN                     Alignment,
+  OUT VOID                      **HostAddress
+  )
+{
+  EFI_STATUS         Status;
+  UINTN              Address;
+  IOMMU_PPI_PRIVATE  *Private;
+  DMA_BUFFER_INFO    *DmaBufferInfo;
+
+  DEBUG ((DEBUG_INFO, "PeiVTdDmaBufferAllocate - Length - %x, Alignment - %x\n", Length, Alignment));
+
+  if (HostAddress == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
 
-CONST EFI_PEI_PPI_DESCRIPTOR  mIoMmuPpiList = {
-  EFI_PEI_PPI_DESCRIPTOR_PPI | EFI_PEI_PPI_DESCRIPTOR_TERMINATE_LIST,
-  &gEdkiiIoMmuPpiGuid,
-  (VOID *)&mIoMmuPpi
+  Private       = IOMMU_PPI_PRIVATE_FROM_DMA_BUFFER_PPI (This);
+  DmaBufferInfo = GetDmaBufferInfo (&Private->IoMmuPpi);
+  if (DmaBufferInfo == NULL) {
+    return EFI_NOT_AVAILABLE_YET;
+  }
+
+  Status = DmaBufferAllocate (&DmaBufferInfo->Allocator, Length, Alignment, TRUE, &Address);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "PeiVTdDmaBufferAllocate - %r\n", Status));
+    return Status;
+  }
+
+  *HostAddress = (VOID *)Address;
+  RecordDmaBufferUsage (Private->Statistics, DmaBufferInfo);
+  DEBUG ((DEBUG_INFO, "PeiVTdDmaBufferAllocate - allocate - %x\n", *HostAddress));
+  return EFI_SUCCESS;
+}
+
+/**
+  Free a buffer allocated with PeiVTdDmaBufferAllocate().
+
+  @param[in]  This              The PPI instance pointer.
+  @param[in]  HostAddress       The buffer returned by PeiVTdDmaBufferAllocate().
+  @param[in]  Length            The length passed to PeiVTdDmaBufferAllocate().
+
+  @retval EFI_SUCCESS            The buffer is freed.
+  @retval EFI_INVALID_PARAMETER  The buffer was not allocated with PeiVTdDmaBufferAllocate().
+  @retval EFI_NOT_AVAILABLE_YET  The DMA buffer window is not available yet.
+**/
+EFI_STATUS
+EFIAPI
+PeiVTdDmaBufferFree (
+  IN  EDKII_VTD_DMA_BUFFER_PPI  *This,
+  IN  VOID                      *HostAddress,
+  IN  UINTN                     Length
+  )
+{
+  EFI_STATUS         Status;
+  IOMMU_PPI_PRIVATE  *Private;
+  DMA_BUFFER_INFO    *DmaBufferInfo;
+
+  DEBUG ((DEBUG_INFO, "PeiVTdDmaBufferFree - HostAddr - %x, Length - %x\n", HostAddress, Length));
+
+  Private       = IOMMU_PPI_PRIVATE_FROM_DMA_BUFFER_PPI (This);
+  DmaBufferInfo = GetDmaBufferInfo (&Private->IoMmuPpi);
+  if (DmaBufferInfo == NULL) {
+    return EFI_NOT_AVAILABLE_YET;
+  }
+
+  Status = DmaBufferFree (&DmaBufferInfo->Allocator, (UINTN)HostAddress, Length);
+  if (EFI_ERROR (Status)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  return EFI_SUCCESS;
+}
+
+//
+// The IOMMU PPI installed before the DMA buffer is available. It is copied
+// to permanent memory once the DMA buffer is allocated.
+//
+CONST IOMMU_PPI_PRIVATE  mIoMmuPpiPrivate = {
+  IOMMU_PPI_PRIVATE_SIGNATURE,
+  {
+    EDKII_IOMMU_PPI_REVISION,
+    PeiIoMmuSetAttribute,
+    PeiIoMmuMap,
+    PeiIoMmuUnmap,
+    PeiIoMmuAllocateBuffer,
+    PeiIoMmuFreeBuffer,
+  },
+  {
+    EDKII_VTD_DMA_BUFFER_PPI_REVISION,
+    PeiVTdDmaBufferAllocate,
+    PeiVTdDmaBufferFree,
+  },
+  {
+    EFI_PEI_PPI_DESCRIPTOR_PPI | EFI_PEI_PPI_DESCRIPTOR_TERMINATE_LIST,
+    &gEdkiiIoMmuPpiGuid,
+    (VOID *)&mIoMmuPpiPrivate.IoMmuPpi
+  },
+  {
+    EFI_PEI_PPI_DESCRIPTOR_PPI | EFI_PEI_PPI_DESCRIPTOR_TERMINATE_LIST,
+    &gEdkiiVTdDmaBufferPpiGuid,
+    (VOID *)&mIoMmuPpiPrivate.DmaBufferPpi
+  },
+  NULL,
+  NULL
 };
 
+/**
+  (Re)Install the IOMMU PPI and install the DMA buffer PPI bound to the DMA buffer.
+
+  @param[in]  DmaBufferInfo     The DMA buffer information.
+
+  @retval EFI_SUCCESS           The PPIs are installed.
+  @retval EFI_OUT_OF_RESOURCES  No enough resource to install the PPIs.
+**/
+EFI_STATUS
+InstallIoMmuPpi (
+  IN DMA_BUFFER_INFO  *DmaBufferInfo
+  )
+{
+  EFI_STATUS              Status;
+  EFI_PEI_PPI_DESCRIPTOR  *OldDescriptor;
+  EDKII_IOMMU_PPI         *OldIoMmuPpi;
+  IOMMU_PPI_PRIVATE       *Private;
+
+  Status = PeiServicesLocatePpi (
+             &gEdkiiIoMmuPpiGuid,
+             0,
+             &OldDescriptor,
+             (VOID **)&OldIoMmuPpi
+             );
+  if (!EFI_ERROR (Status) && (OldIoMmuPpi != &mIoMmuPpiPrivate.IoMmuPpi)) {
+    //
+    // The PPI already lives in permanent memory, just rebind it.
+    //
+    Private                = IOMMU_PPI_PRIVATE_FROM_THIS (OldIoMmuPpi);
+    Private->DmaBufferInfo = DmaBufferInfo;
+    Private->Statistics    = GetVTdPeiStatistics ();
+    return EFI_SUCCESS;
+  }
+
+  Private = AllocateCopyPool (sizeof (IOMMU_PPI_PRIVATE), &mIoMmuPpiPrivate);
+  if (Private == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Private->PpiList.Ppi          = &Private->IoMmuPpi;
+  Private->DmaBufferPpiList.Ppi = &Private->DmaBufferPpi;
+  Private->DmaBufferInfo        = DmaBufferInfo;
+  Private->Statistics           = GetVTdPeiStatistics ();
+
+  if (!EFI_ERROR (Status)) {
+    Status = PeiServicesReInstallPpi (OldDescriptor, &Private->PpiList);
+  } else {
+    Status = PeiServicesInstallPpi (&Private->PpiList);
+  }
+
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  return PeiServicesInstallPpi (&Private->DmaBufferPpiList);
+}
+
 /**
   Get ACPI DMAT Table from EdkiiVTdInfo PPI
 
@@ -395,8 +757,6 @@ GetAcpiDmarTable (
   if (EFI_ERROR (Status)) {
     DEBUG ((DEBUG_ERROR, "Fail to get ACPI DMAR Table : %r\n", Status));
     AcpiDmarTable = NULL;
-  } else {
-    DumpAcpiDMAR (AcpiDmarTable);
   }
 
   return AcpiDmarTable;
@@ -503,6 +863,10 @@ ProcessDrhdPostMemory (
 /**
   Initializes the Intel VTd Info in post memory phase.
 
+  If the DMAR table is unchanged since the last call, the VTd unit
+  information table is already up to date and the DMAR table is not
+  parsed again.
+
   @retval EFI_SUCCESS           Usb bot driver is successfully initialized.
   @retval EFI_OUT_OF_RESOURCES  Can't initialize the driver.
 **/
@@ -515,6 +879,7 @@ InitVTdInfo (
   EFI_ACPI_DMAR_HEADER  *AcpiDmarTable;
   UINTN                 VtdUnitNumber;
   VTD_UNIT_INFO         *VtdUnitInfo;
+  UINT32                AcpiDmarTableCrc;
 
   VTdInfo = GetVTdInfoHob ();
   ASSERT (VTdInfo != NULL);
@@ -522,6 +887,15 @@ InitVTdInfo (
   AcpiDmarTable = GetAcpiDmarTable ();
   ASSERT (AcpiDmarTable != NULL);
 
+  AcpiDmarTableCrc = CalculateCrc32 (AcpiDmarTable, AcpiDmarTable->Header.Length);
+  if ((VTdInfo->VTdEngineCount != 0) && (VTdInfo->AcpiDmarTableCrc == AcpiDmarTableCrc)) {
+    DEBUG ((DEBUG_INFO, "DMAR table unchanged, reuse VTdInfo\n"));
+    VTdInfo->AcpiDmarTable = AcpiDmarTable;
+    return EFI_SUCCESS;
+  }
+
+  DumpAcpiDMAR (AcpiDmarTable);
+
   if (VTdInfo->VtdUnitInfo == NULL) {
     //
     // Genrate a new Vtd Unit Info Table
@@ -560,7 +934,8 @@ InitVTdInfo (
     }
   }
 
-  VTdInfo->AcpiDmarTable = AcpiDmarTable;
+  VTdInfo->AcpiDmarTable    = AcpiDmarTable;
+  VTdInfo->AcpiDmarTableCrc = AcpiDmarTableCrc;
 
   return EFI_SUCCESS;
 }
@@ -584,6 +959,8 @@ InitVTdDmarBlockAll (
   AcpiDmarTable = GetAcpiDmarTable ();
   ASSERT (AcpiDmarTable != NULL);
 
+  DumpAcpiDMAR (AcpiDmarTable);
+
   //
   // Parse the DMAR table and block all DMA
   //
@@ -602,10 +979,12 @@ InitDmaBuffer (
   VOID
   )
 {
+  EFI_STATUS        Status;
   DMA_BUFFER_INFO   *DmaBufferInfo;
   VOID              *Hob;
   VOID              *VtdPmrHobPtr;
   VTD_PMR_INFO_HOB  *VtdPmrHob;
+  UINTN             Alignment;
 
   DEBUG ((DEBUG_INFO, "InitDmaBuffer :\n"));
 
@@ -646,9 +1025,11 @@ InitDmaBuffer (
       DmaBufferInfo->DmaBufferBase = VtdPmrHob->ProtectedLowLimit;
     } else {
       //
-      // Allocate memory for DMA buffer
+      // Allocate memory for DMA buffer.
+      // A 2MB aligned DMA buffer can be mapped with large pages only.
       //
-      DmaBufferInfo->DmaBufferBase = (UINTN)AllocateAlignedPages (EFI_SIZE_TO_PAGES (DmaBufferInfo->DmaBufferSize), 0);
+      Alignment                    = ((DmaBufferInfo->DmaBufferSize & (SIZE_2MB - 1)) == 0) ? SIZE_2MB : 0;
+      DmaBufferInfo->DmaBufferBase = (UINTN)AllocateAlignedPages (EFI_SIZE_TO_PAGES (DmaBufferInfo->DmaBufferSize), Alignment);
       if (DmaBufferInfo->DmaBufferBase == 0) {
         DEBUG ((DEBUG_ERROR, " InitDmaBuffer : OutOfResource\n"));
         return EFI_OUT_OF_RESOURCES;
@@ -657,15 +1038,17 @@ InitDmaBuffer (
       DEBUG ((DEBUG_INFO, "Alloc DMA buffer success.\n"));
     }
 
-    DmaBufferInfo->DmaBufferCurrentTop    = DmaBufferInfo->DmaBufferBase + DmaBufferInfo->DmaBufferSize;
-    DmaBufferInfo->DmaBufferCurrentBottom = DmaBufferInfo->DmaBufferBase;
+    Status = DmaBufferAllocatorInit (&DmaBufferInfo->Allocator, DmaBufferInfo->DmaBufferBase, DmaBufferInfo->DmaBufferSize);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((DEBUG_ERROR, " InitDmaBuffer : Invalid DMA buffer - %r\n", Status));
+      return Status;
+    }
 
     DEBUG ((DEBUG_INFO, " DmaBufferSize          : 0x%x\n", DmaBufferInfo->DmaBufferSize));
     DEBUG ((DEBUG_INFO, " DmaBufferBase          : 0x%x\n", DmaBufferInfo->DmaBufferBase));
   }
 
-  DEBUG ((DEBUG_INFO, " DmaBufferCurrentTop    : 0x%x\n", DmaBufferInfo->DmaBufferCurrentTop));
-  DEBUG ((DEBUG_INFO, " DmaBufferCurrentBottom : 0x%x\n", DmaBufferInfo->DmaBufferCurrentBottom));
+  DEBUG ((DEBUG_INFO, " DmaBufferFreeSize      : 0x%x\n", DmaBufferInfo->Allocator.FreeSize));
 
   return EFI_SUCCESS;
 }
@@ -684,9 +1067,8 @@ InitVTdDmarForDma (
 {
   VTD_INFO  *VTdInfo;
 
-  EFI_STATUS              Status;
-  EFI_PEI_PPI_DESCRIPTOR  *OldDescriptor;
-  EDKII_IOMMU_PPI         *OldIoMmuPpi;
+  EFI_STATUS  Status;
+  UINT64      StartTick;
 
   VTdInfo = GetVTdInfoHob ();
   ASSERT (VTdInfo != NULL);
@@ -700,35 +1082,27 @@ InitVTdDmarForDma (
 
   // create root entry table
   DEBUG ((DEBUG_INFO, "SetupTranslationTable\n"));
-  Status = SetupTranslationTable (VTdInfo);
+  StartTick = AsmReadTsc ();
+  Status    = SetupTranslationTable (VTdInfo);
+  RecordVTdPeiPhase (VtdPeiPhaseTranslationTable, StartTick);
   if (EFI_ERROR (Status)) {
     ASSERT_EFI_ERROR (Status);
     return Status;
   }
 
   DEBUG ((DEBUG_INFO, "EnableVtdDmar\n"));
-  Status = EnableVTdTranslationProtection (VTdInfo);
+  StartTick = AsmReadTsc ();
+  Status    = EnableVTdTranslationProtection (VTdInfo);
+  RecordVTdPeiPhase (VtdPeiPhaseProtection, StartTick);
   if (EFI_ERROR (Status)) {
     return Status;
   }
 
   DEBUG ((DEBUG_INFO, "Install gEdkiiIoMmuPpiGuid\n"));
-  // install protocol
   //
   // (Re)Install PPI.
   //
-  Status = PeiServicesLocatePpi (
-             &gEdkiiIoMmuPpiGuid,
-             0,
-             &OldDescriptor,
-             (VOID **)&OldIoMmuPpi
-             );
-  if (!EFI_ERROR (Status)) {
-    Status = PeiServicesReInstallPpi (OldDescriptor, &mIoMmuPpiList);
-  } else {
-    Status = PeiServicesInstallPpi (&mIoMmuPpiList);
-  }
-
+  Status = InstallIoMmuPpi (GET_GUID_HOB_DATA (GetFirstGuidHob (&mDmaBufferInfoGuid)));
   ASSERT_EFI_ERROR (Status);
 
   return Status;
@@ -788,6 +1162,7 @@ VTdInfoNotify (
   EFI_STATUS  Status;
   VOID        *MemoryDiscovered;
   BOOLEAN     MemoryInitialized;
+  UINT64      StartTick;
 
   DEBUG ((DEBUG_INFO, "VTdInfoNotify\n"));
 
@@ -813,12 +1188,14 @@ VTdInfoNotify (
     // Protect all system memory
     //
 
+    StartTick = AsmReadTsc ();
     InitVTdDmarBlockAll ();
+    RecordVTdPeiPhase (VtdPeiPhaseProtection, StartTick);
 
     //
     // Install PPI.
     //
-    Status = PeiServicesInstallPpi (&mIoMmuPpiList);
+    Status = PeiServicesInstallPpi (&mIoMmuPpiPrivate.PpiList);
     ASSERT_EFI_ERROR (Status);
   } else {
     //
@@ -826,13 +1203,17 @@ VTdInfoNotify (
     // Allocate DMA buffer and protect rest system memory
     //
 
-    Status = InitDmaBuffer ();
+    StartTick = AsmReadTsc ();
+    Status    = InitDmaBuffer ();
+    RecordVTdPeiPhase (VtdPeiPhaseDmaBufferInit, StartTick);
     ASSERT_EFI_ERROR (Status);
 
     //
     // NOTE: We need reinit VTdInfo because previous information might be overriden.
     //
-    Status = InitVTdInfo ();
+    StartTick = AsmReadTsc ();
+    Status    = InitVTdInfo ();
+    RecordVTdPeiPhase (VtdPeiPhaseParseDmar, StartTick);
     ASSERT_EFI_ERROR (Status);
 
     Status = InitVTdDmarForDma ();
@@ -864,9 +1245,10 @@ IntelVTdDmarInitialize (
   IN CONST EFI_PEI_SERVICES  **PeiServices
   )
 {
-  EFI_STATUS       Status;
-  EFI_BOOT_MODE    BootMode;
-  DMA_BUFFER_INFO  *DmaBufferInfo;
+  EFI_STATUS              Status;
+  EFI_BOOT_MODE           BootMode;
+  DMA_BUFFER_INFO         *DmaBufferInfo;
+  VTD_PEI_STATISTICS_HOB  *Statistics;
 
   DEBUG ((DEBUG_INFO, "IntelVTdDmarInitialize\n"));
 
@@ -890,6 +1272,18 @@ IntelVTdDmarInitialize (
     DmaBufferInfo->DmaBufferSize = PcdGet32 (PcdVTdPeiDmaBufferSize);
   }
 
+  //
+  // The statistics are only informational, so a failure to build the HOB
+  // does not stop the driver.
+  //
+  Statistics = BuildGuidHob (&gVtdPeiStatisticsHobGuid, sizeof (VTD_PEI_STATISTICS_HOB));
+  if (Statistics != NULL) {
+    ZeroMem (Statistics, sizeof (VTD_PEI_STATISTICS_HOB));
+    Statistics->Revision      = VTD_PEI_STATISTICS_HOB_REVISION;
+    Statistics->DmaBufferSize = DmaBufferInfo->DmaBufferSize;
+    Statistics->TickFrequency = GetVTdPeiTickFrequency ();
+  }
+
   Status = PeiServicesNotifyPpi (&mVTdInfoNotifyDesc);
   ASSERT_EFI_ERROR (Status);
 
@@ -33,16 +33,41 @@ typedef struct {
 
 typedef struct {
   EFI_ACPI_DMAR_HEADER    *AcpiDmarTable;
+  UINT32                  AcpiDmarTableCrc;
   UINT8                   HostAddressWidth;
   UINTN                   VTdEngineCount;
   VTD_UNIT_INFO           *VtdUnitInfo;
 } VTD_INFO;
 
+#define MAP_INFO_SIGNATURE  SIGNATURE_32 ('D', 'M', 'A', 'P')
 typedef struct {
-  UINTN    DmaBufferBase;
-  UINTN    DmaBufferSize;
-  UINTN    DmaBufferCurrentTop;
-  UINTN    DmaBufferCurrentBottom;
+  UINT32                   Signature;
+  EDKII_IOMMU_OPERATION    Operation;
+  UINTN                    NumberOfBytes;
+  EFI_PHYSICAL_ADDRESS     HostAddress;
+  EFI_PHYSICAL_ADDRESS     DeviceAddress;
+} MAP_INFO;
+
+//
+// The number of bounce buffer mappings that can be live at once.
+//
+#define MAP_INFO_COUNT  64
+
+//
+// The size of the bounce buffer of a mapping. A mapping of 0 bytes still
+// gets a buffer, so it has a device address.
+//
+#define MAP_INFO_BUFFER_SIZE(NumberOfBytes)  MAX (NumberOfBytes, 1)
+
+typedef struct {
+  UINTN                   DmaBufferBase;
+  UINTN                   DmaBufferSize;
+  DMA_BUFFER_ALLOCATOR    Allocator;
+  //
+  // The mappings of the bounce buffers. They are kept here, outside the DMA
+  // window, so a bus master cannot change how a buffer is copied or freed.
+  //
+  MAP_INFO                MapInfo[MAP_INFO_COUNT];
 } DMA_BUFFER_INFO;
 
 typedef
@@ -53,6 +78,13 @@ VOID
   IN     EFI_ACPI_DMAR_DRHD_HEADER  *DmarDrhd
   );
 
+typedef
+VOID
+(*PROCESS_RMRR_CALLBACK_FUNC) (
+  IN OUT VOID                       *Context,
+  IN     EFI_ACPI_DMAR_RMRR_HEADER  *DmarRmrr
+  );
+
 /**
   Enable VTd translation table protection for block DMA
 
@@ -106,6 +138,23 @@ ParseDmarAcpiTableDrhd (
   IN VOID                        *Context
   );
 
+/**
+  Parse DMAR RMRR table.
+
+  @param[in]  AcpiDmarTable     DMAR ACPI table
+  @param[in]  Callback          Callback function for handle RMRR
+  @param[in]  Context           Callback function Context
+
+  @return the RMRR number.
+
+**/
+UINTN
+ParseDmarAcpiTableRmrr (
+  IN EFI_ACPI_DMAR_HEADER        *AcpiDmarTable,
+  IN PROCESS_RMRR_CALLBACK_FUNC  Callback,
+  IN VOID                        *Context
+  );
+
 /**
   Dump DMAR ACPI table.
 
@@ -200,6 +249,18 @@ GetPciDataIndex (
   IN VTD_SOURCE_ID  SourceId
   );
 
+/**
+  Record the time spent in a VTd PEI phase in the statistics HOB.
+
+  @param[in]  Phase             The phase.
+  @param[in]  StartTick         The TSC value when the phase was entered.
+**/
+VOID
+RecordVTdPeiPhase (
+  IN VTD_PEI_PHASE  Phase,
+  IN UINT64         StartTick
+  );
+
 extern EFI_GUID  mVTdInfoGuid;
 extern EFI_GUID  mDmaBufferInfoGuid;
 
@@ -15,12 +15,14 @@
 #include <Library/DebugLib.h>
 #include <Library/PeiServicesLib.h>
 #include <Library/HobLib.h>
+#include <Library/DmaBufferAllocatorLib.h>
 #include <IndustryStandard/Vtd.h>
 #include <Ppi/IoMmu.h>
 #include <Ppi/VtdInfo.h>
 #include <Ppi/MemoryDiscovered.h>
 #include <Ppi/EndOfPeiPhase.h>
 #include <Guid/VtdPmrInfoHob.h>
+#include <Guid/VtdPeiStatisticsHob.h>
 #include <Library/CacheMaintenanceLib.h>
 #include "IntelVTdDmarPei.h"
 
@@ -69,198 +71,6 @@ SetSecondLevelPagingEntryAttribute (
   DEBUG ((DEBUG_VERBOSE, "SetSecondLevelPagingEntryAttribute - 0x%x - 0x%x\n", PtEntry, IoMmuAccess));
 }
 
-/**
-  Create second level paging entry table.
-
-  @param[in]  VTdUnitInfo               The VTd engine unit information.
-  @param[in]  SecondLevelPagingEntry    The second level paging entry.
-  @param[in]  MemoryBase                The base of the memory.
-  @param[in]  MemoryLimit               The limit of the memory.
-  @param[in]  IoMmuAccess               The IOMMU access.
-
-  @return The second level paging entry.
-**/
-VTD_SECOND_LEVEL_PAGING_ENTRY *
-CreateSecondLevelPagingEntryTable (
-  IN VTD_UNIT_INFO                  *VTdUnitInfo,
-  IN VTD_SECOND_LEVEL_PAGING_ENTRY  *SecondLevelPagingEntry,
-  IN UINT64                         MemoryBase,
-  IN UINT64                         MemoryLimit,
-  IN UINT64                         IoMmuAccess
-  )
-{
-  UINTN                          Index5;
-  UINTN                          Index4;
-  UINTN                          Index3;
-  UINTN                          Index2;
-  UINTN                          Lvl5Start;
-  UINTN                          Lvl5End;
-  UINTN                          Lvl4PagesStart;
-  UINTN                          Lvl4PagesEnd;
-  UINTN                          Lvl4Start;
-  UINTN                          Lvl4End;
-  UINTN                          Lvl3Start;
-  UINTN                          Lvl3End;
-  VTD_SECOND_LEVEL_PAGING_ENTRY  *Lvl5PtEntry;
-  VTD_SECOND_LEVEL_PAGING_ENTRY  *Lvl4PtEntry;
-  VTD_SECOND_LEVEL_PAGING_ENTRY  *Lvl3PtEntry;
-  VTD_SECOND_LEVEL_PAGING_ENTRY  *Lvl2PtEntry;
-  UINT64                         BaseAddress;
-  UINT64                         EndAddress;
-  BOOLEAN                        Is5LevelPaging;
-
-  if (MemoryLimit == 0) {
-    return EFI_SUCCESS;
-  }
-
-  Lvl4PagesStart = 0;
-  Lvl4PagesEnd   = 0;
-  Lvl4PtEntry    = NULL;
-  Lvl5PtEntry    = NULL;
-
-  BaseAddress = ALIGN_VALUE_LOW (MemoryBase, SIZE_2MB);
-  EndAddress  = ALIGN_VALUE_UP (MemoryLimit, SIZE_2MB);
-  DEBUG ((DEBUG_INFO, "CreateSecondLevelPagingEntryTable: BaseAddress - 0x%016lx, EndAddress - 0x%016lx\n", BaseAddress, EndAddress));
-
-  if (SecondLevelPagingEntry == NULL) {
-    SecondLevelPagingEntry = AllocateZeroPages (1);
-    if (SecondLevelPagingEntry == NULL) {
-      DEBUG ((DEBUG_ERROR, "Could not Alloc LVL4 or LVL5 PT. \n"));
-      return NULL;
-    }
-
-    FlushPageTableMemory (VTdUnitInfo, (UINTN)SecondLevelPagingEntry, EFI_PAGES_TO_SIZE (1));
-  }
-
-  DEBUG ((DEBUG_INFO, " SecondLevelPagingEntry:0x%016lx\n", (UINT64)(UINTN)SecondLevelPagingEntry));
-  //
-  // If no access is needed, just create not present entry.
-  //
-  if (IoMmuAccess == 0) {
-    DEBUG ((DEBUG_INFO, " SecondLevelPagingEntry:0x%016lx Access 0\n", (UINT64)(UINTN)SecondLevelPagingEntry));
-    return SecondLevelPagingEntry;
-  }
-
-  Is5LevelPaging = VTdUnitInfo->Is5LevelPaging;
-
-  if (Is5LevelPaging) {
-    Lvl5Start = RShiftU64 (BaseAddress, 48) & 0x1FF;
-    Lvl5End   = RShiftU64 (EndAddress - 1, 48) & 0x1FF;
-    DEBUG ((DEBUG_INFO, "  Lvl5Start - 0x%x, Lvl5End - 0x%x\n", Lvl5Start, Lvl5End));
-
-    Lvl4Start = RShiftU64 (BaseAddress, 39) & 0x1FF;
-    Lvl4End   = RShiftU64 (EndAddress - 1, 39) & 0x1FF;
-
-    Lvl4PagesStart = (Lvl5Start<<9) | Lvl4Start;
-    Lvl4PagesEnd   = (Lvl5End<<9) | Lvl4End;
-    DEBUG ((DEBUG_INFO, "  Lvl4PagesStart - 0x%x, Lvl4PagesEnd - 0x%x\n", Lvl4PagesStart, Lvl4PagesEnd));
-
-    Lvl5PtEntry = (VTD_SECOND_LEVEL_PAGING_ENTRY *)SecondLevelPagingEntry;
-  } else {
-    Lvl5Start = RShiftU64 (BaseAddress, 48) & 0x1FF;
-    Lvl5End   = Lvl5Start;
-
-    Lvl4Start = RShiftU64 (BaseAddress, 39) & 0x1FF;
-    Lvl4End   = RShiftU64 (EndAddress - 1, 39) & 0x1FF;
-    DEBUG ((DEBUG_INFO, "  Lvl4Start - 0x%x, Lvl4End - 0x%x\n", Lvl4Start, Lvl4End));
-
-    Lvl4PtEntry = (VTD_SECOND_LEVEL_PAGING_ENTRY *)SecondLevelPagingEntry;
-  }
-
-  for (Index5 = Lvl5Start; Index5 <= Lvl5End; Index5++) {
-    if (Is5LevelPaging) {
-      if (Lvl5PtEntry[Index5].Uint64 == 0) {
-        Lvl5PtEntry[Index5].Uint64 = (UINT64)(UINTN)AllocateZeroPages (1);
-        if (Lvl5PtEntry[Index5].Uint64 == 0) {
-          DEBUG ((DEBUG_ERROR, "!!!!!! ALLOCATE LVL4 PAGE FAIL (0x%x)!!!!!!\n", Index5));
-          ASSERT (FALSE);
-          return NULL;
-        }
-
-        FlushPageTableMemory (VTdUnitInfo, (UINTN)Lvl5PtEntry[Index5].Uint64, SIZE_4KB);
-        SetSecondLevelPagingEntryAttribute (&Lvl5PtEntry[Index5], EDKII_IOMMU_ACCESS_READ | EDKII_IOMMU_ACCESS_WRITE);
-      }
-
-      Lvl4Start = Lvl4PagesStart & 0x1FF;
-      if (((Index5+1)<<9) > Lvl4PagesEnd) {
-        Lvl4End        = SIZE_4KB/sizeof (VTD_SECOND_LEVEL_PAGING_ENTRY) - 1;
-        Lvl4PagesStart = (Index5+1)<<9;
-      } else {
-        Lvl4End = Lvl4PagesEnd & 0x1FF;
-      }
-
-      DEBUG ((DEBUG_INFO, "  Lvl5(0x%x): Lvl4Start - 0x%x, Lvl4End - 0x%x\n", Index5, Lvl4Start, Lvl4End));
-      Lvl4PtEntry = (VTD_SECOND_LEVEL_PAGING_ENTRY *)(UINTN)VTD_64BITS_ADDRESS (Lvl5PtEntry[Index5].Bits.AddressLo, Lvl5PtEntry[Index5].Bits.AddressHi);
-    }
-
-    for (Index4 = Lvl4Start; Index4 <= Lvl4End; Index4++) {
-      if (Lvl4PtEntry[Index4].Uint64 == 0) {
-        Lvl4PtEntry[Index4].Uint64 = (UINT64)(UINTN)AllocateZeroPages (1);
-        if (Lvl4PtEntry[Index4].Uint64 == 0) {
-          DEBUG ((DEBUG_ERROR, "!!!!!! ALLOCATE LVL4 PAGE FAIL (0x%x)!!!!!!\n", Index4));
-          ASSERT (FALSE);
-          return NULL;
-        }
-
-        FlushPageTableMemory (VTdUnitInfo, (UINTN)Lvl4PtEntry[Index4].Uint64, SIZE_4KB);
-        SetSecondLevelPagingEntryAttribute (&Lvl4PtEntry[Index4], EDKII_IOMMU_ACCESS_READ | EDKII_IOMMU_ACCESS_WRITE);
-      }
-
-      Lvl3Start = RShiftU64 (BaseAddress, 30) & 0x1FF;
-      if (ALIGN_VALUE_LOW (BaseAddress + SIZE_1GB, SIZE_1GB) <= EndAddress) {
-        Lvl3End = SIZE_4KB / sizeof (VTD_SECOND_LEVEL_PAGING_ENTRY) - 1;
-      } else {
-        Lvl3End = RShiftU64 (EndAddress - 1, 30) & 0x1FF;
-      }
-
-      DEBUG ((DEBUG_INFO, "  Lvl4(0x%x): Lvl3Start - 0x%x, Lvl3End - 0x%x\n", Index4, Lvl3Start, Lvl3End));
-
-      Lvl3PtEntry = (VTD_SECOND_LEVEL_PAGING_ENTRY *)(UINTN)VTD_64BITS_ADDRESS (Lvl4PtEntry[Index4].Bits.AddressLo, Lvl4PtEntry[Index4].Bits.AddressHi);
-      for (Index3 = Lvl3Start; Index3 <= Lvl3End; Index3++) {
-        if (Lvl3PtEntry[Index3].Uint64 == 0) {
-          Lvl3PtEntry[Index3].Uint64 = (UINT64)(UINTN)AllocateZeroPages (1);
-          if (Lvl3PtEntry[Index3].Uint64 == 0) {
-            DEBUG ((DEBUG_ERROR, "!!!!!! ALLOCATE LVL3 PAGE FAIL (0x%x, 0x%x)!!!!!!\n", Index4, Index3));
-            ASSERT (FALSE);
-            return NULL;
-          }
-
-          FlushPageTableMemory (VTdUnitInfo, (UINTN)Lvl3PtEntry[Index3].Uint64, SIZE_4KB);
-          SetSecondLevelPagingEntryAttribute (&Lvl3PtEntry[Index3], EDKII_IOMMU_ACCESS_READ | EDKII_IOMMU_ACCESS_WRITE);
-        }
-
-        Lvl2PtEntry = (VTD_SECOND_LEVEL_PAGING_ENTRY *)(UINTN)VTD_64BITS_ADDRESS (Lvl3PtEntry[Index3].Bits.AddressLo, Lvl3PtEntry[Index3].Bits.AddressHi);
-        for (Index2 = 0; Index2 < SIZE_4KB/sizeof (VTD_SECOND_LEVEL_PAGING_ENTRY); Index2++) {
-          Lvl2PtEntry[Index2].Uint64 = BaseAddress;
-          SetSecondLevelPagingEntryAttribute (&Lvl2PtEntry[Index2], IoMmuAccess);
-          Lvl2PtEntry[Index2].Bits.PageSize = 1;
-          BaseAddress                      += SIZE_2MB;
-          if (BaseAddress >= MemoryLimit) {
-            break;
-          }
-        }
-
-        FlushPageTableMemory (VTdUnitInfo, (UINTN)Lvl2PtEntry, SIZE_4KB);
-        if (BaseAddress >= MemoryLimit) {
-          break;
-        }
-      }
-
-      FlushPageTableMemory (VTdUnitInfo, (UINTN)&Lvl3PtEntry[Lvl3Start], (UINTN)&Lvl3PtEntry[Lvl3End + 1] - (UINTN)&Lvl3PtEntry[Lvl3Start]);
-      if (BaseAddress >= MemoryLimit) {
-        break;
-      }
-    }
-
-    FlushPageTableMemory (VTdUnitInfo, (UINTN)&Lvl4PtEntry[Lvl4Start], (UINTN)&Lvl4PtEntry[Lvl4End + 1] - (UINTN)&Lvl4PtEntry[Lvl4Start]);
-  }
-
-  FlushPageTableMemory (VTdUnitInfo, (UINTN)&Lvl5PtEntry[Lvl5Start], (UINTN)&Lvl5PtEntry[Lvl5End + 1] - (UINTN)&Lvl5PtEntry[Lvl5Start]);
-
-  DEBUG ((DEBUG_INFO, " SecondLevelPagingEntry:0x%016lx\n", (UINT64)(UINTN)SecondLevelPagingEntry));
-  return SecondLevelPagingEntry;
-}
-
 /**
   Create context entry.
 
@@ -849,9 +659,165 @@ SetSecondLevelPagingAttribute (
   return EFI_SUCCESS;
 }
 
+/**
+  Map a memory range in a second level paging structure.
+
+  Each piece of the range is mapped with the largest page size allowed by its
+  alignment and by the VTd engine, so a 2MB aligned DMA buffer only needs one
+  page per paging level. Pieces that overlap an existing mapping are updated
+  through SetSecondLevelPagingAttribute().
+
+  @param[in]  VTdUnitInfo             The VTd engine unit information.
+  @param[in]  SecondLevelPagingEntry  The second level paging entry in VTd table for the device.
+  @param[in]  BaseAddress             The base of the memory range.
+  @param[in]  Length                  The length of the memory range.
+  @param[in]  IoMmuAccess             The IOMMU access.
+
+  @retval EFI_SUCCESS            The memory range is mapped.
+  @retval EFI_UNSUPPORTED        BaseAddress or Length is not 4KB aligned.
+  @retval EFI_OUT_OF_RESOURCES   There are not enough resources to build the paging structure.
+**/
+EFI_STATUS
+MapSecondLevelPagingRange (
+  IN VTD_UNIT_INFO                  *VTdUnitInfo,
+  IN VTD_SECOND_LEVEL_PAGING_ENTRY  *SecondLevelPagingEntry,
+  IN UINT64                         BaseAddress,
+  IN UINT64                         Length,
+  IN UINT64                         IoMmuAccess
+  )
+{
+  EFI_STATUS  Status;
+  UINT64      *PageTable;
+  UINT64      PageLength;
+  UINTN       Level;
+  UINTN       LeafLevel;
+  UINTN       Index;
+
+  DEBUG ((DEBUG_INFO, "MapSecondLevelPagingRange (0x%016lx - 0x%016lx : %x)\n", BaseAddress, Length, IoMmuAccess));
+
+  if ((BaseAddress != ALIGN_VALUE (BaseAddress, SIZE_4KB)) ||
+      (Length != ALIGN_VALUE (Length, SIZE_4KB)))
+  {
+    DEBUG ((DEBUG_ERROR, "MapSecondLevelPagingRange - Invalid Alignment\n"));
+    return EFI_UNSUPPORTED;
+  }
+
+  while (Length != 0) {
+    //
+    // SLLPS BIT1 reports 1GB page support. 2MB pages are used unconditionally
+    // elsewhere in this driver.
+    //
+    if (((VTdUnitInfo->CapReg.Bits.SLLPS & BIT1) != 0) &&
+        ((BaseAddress & PAGING_1G_MASK) == 0) && (Length >= SIZE_1GB))
+    {
+      LeafLevel = 3;
+    } else if (((BaseAddress & PAGING_2M_MASK) == 0) && (Length >= SIZE_2MB)) {
+      LeafLevel = 2;
+    } else {
+      LeafLevel = 1;
+    }
+
+    PageLength = LShiftU64 (SIZE_4KB, (UINTN)(9 * (LeafLevel - 1)));
+
+    //
+    // Walk down to the leaf level, creating the missing paging structures.
+    //
+    PageTable = (UINT64 *)SecondLevelPagingEntry;
+    for (Level = VTdUnitInfo->Is5LevelPaging ? 5 : 4; Level > LeafLevel; Level--) {
+      Index = (UINTN)RShiftU64 (BaseAddress, 12 + 9 * (Level - 1)) & PAGING_VTD_INDEX_MASK;
+      if (PageTable[Index] == 0) {
+        PageTable[Index] = (UINT64)(UINTN)AllocateZeroPages (1);
+        if (PageTable[Index] == 0) {
+          DEBUG ((DEBUG_ERROR, "!!!!!! ALLOCATE LVL%x PAGE FAIL (0x%x)!!!!!!\n", Level - 1, Index));
+          return EFI_OUT_OF_RESOURCES;
+        }
+
+        FlushPageTableMemory (VTdUnitInfo, (UINTN)PageTable[Index], SIZE_4KB);
+        SetSecondLevelPagingEntryAttribute ((VTD_SECOND_LEVEL_PAGING_ENTRY *)&PageTable[Index], EDKII_IOMMU_ACCESS_READ | EDKII_IOMMU_ACCESS_WRITE);
+        FlushPageTableMemory (VTdUnitInfo, (UINTN)&PageTable[Index], sizeof (PageTable[Index]));
+      } else if ((PageTable[Index] & VTD_PG_PS) != 0) {
+        break;
+      }
+
+      PageTable = (UINT64 *)(UINTN)(PageTable[Index] & PAGING_4K_ADDRESS_MASK_64);
+    }
+
+    Index = (UINTN)RShiftU64 (BaseAddress, 12 + 9 * (Level - 1)) & PAGING_VTD_INDEX_MASK;
+    if ((Level != LeafLevel) || (PageTable[Index] != 0)) {
+      //
+      // The piece overlaps an existing mapping, which may need to be split.
+      //
+      Status = SetSecondLevelPagingAttribute (VTdUnitInfo, SecondLevelPagingEntry, BaseAddress, PageLength, IoMmuAccess);
+      if (EFI_ERROR (Status)) {
+        return Status;
+      }
+    } else {
+      PageTable[Index] = BaseAddress;
+      SetSecondLevelPagingEntryAttribute ((VTD_SECOND_LEVEL_PAGING_ENTRY *)&PageTable[Index], IoMmuAccess);
+      if (LeafLevel > 1) {
+        PageTable[Index] |= VTD_PG_PS;
+      }
+
+      FlushPageTableMemory (VTdUnitInfo, (UINTN)&PageTable[Index], sizeof (PageTable[Index]));
+    }
+
+    BaseAddress += PageLength;
+    Length      -= PageLength;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Callback function of parse DMAR RMRR table.
+
+  Identity map the reserved memory region into the fixed second level paging
+  structure of the VTd engine in the same segment.
+
+  @param [in] [out] Context          The VTd engine unit information.
+  @param [in]       DmarRmrr         The RMRR table.
+
+**/
+VOID
+ProcessRmrr (
+  IN OUT VOID                       *Context,
+  IN     EFI_ACPI_DMAR_RMRR_HEADER  *DmarRmrr
+  )
+{
+  VTD_UNIT_INFO  *VTdUnitInfo;
+  EFI_STATUS     Status;
+
+  VTdUnitInfo = (VTD_UNIT_INFO *)Context;
+
+  if ((DmarRmrr->SegmentNumber != VTdUnitInfo->Segment) ||
+      (DmarRmrr->ReservedMemoryRegionBaseAddress == 0) ||
+      (DmarRmrr->ReservedMemoryRegionLimitAddress < DmarRmrr->ReservedMemoryRegionBaseAddress))
+  {
+    return;
+  }
+
+  DEBUG ((DEBUG_INFO, "  RMRR (Base 0x%016lx, Limit 0x%016lx)\n", DmarRmrr->ReservedMemoryRegionBaseAddress, DmarRmrr->ReservedMemoryRegionLimitAddress));
+
+  Status = MapSecondLevelPagingRange (
+             VTdUnitInfo,
+             (VTD_SECOND_LEVEL_PAGING_ENTRY *)VTdUnitInfo->FixedSecondLevelPagingEntry,
+             DmarRmrr->ReservedMemoryRegionBaseAddress,
+             DmarRmrr->ReservedMemoryRegionLimitAddress + 1 - DmarRmrr->ReservedMemoryRegionBaseAddress,
+             EDKII_IOMMU_ACCESS_READ | EDKII_IOMMU_ACCESS_WRITE
+             );
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Map RMRR failed - %r\n", Status));
+  }
+}
+
 /**
   Create Fixed Second Level Paging Entry.
 
+  Only the DMA buffer, and the RMRR regions if requested by
+  PcdVTdPolicyPropertyMask BIT3, are mapped. Everything else stays not
+  present, so no paging structure is built for the rest of the memory.
+
+  @param[in]  VTdInfo           The VTd engine context information.
   @param[in]  VTdUnitInfo       The VTd engine unit information.
 
   @retval EFI_SUCCESS           Setup translation table successfully.
@@ -860,6 +826,7 @@ SetSecondLevelPagingAttribute (
 **/
 EFI_STATUS
 CreateFixedSecondLevelPagingEntry (
+  IN VTD_INFO       *VTdInfo,
   IN VTD_UNIT_INFO  *VTdUnitInfo
   )
 {
@@ -874,12 +841,14 @@ CreateFixedSecondLevelPagingEntry (
     return EFI_SUCCESS;
   }
 
-  VTdUnitInfo->FixedSecondLevelPagingEntry = (UINTN)CreateSecondLevelPagingEntryTable (VTdUnitInfo, NULL, 0, SIZE_4GB, 0);
+  VTdUnitInfo->FixedSecondLevelPagingEntry = (UINTN)AllocateZeroPages (1);
   if (VTdUnitInfo->FixedSecondLevelPagingEntry == 0) {
     DEBUG ((DEBUG_ERROR, "FixedSecondLevelPagingEntry is empty\n"));
     return EFI_OUT_OF_RESOURCES;
   }
 
+  FlushPageTableMemory (VTdUnitInfo, VTdUnitInfo->FixedSecondLevelPagingEntry, EFI_PAGES_TO_SIZE (1));
+
   Hob           = GetFirstGuidHob (&mDmaBufferInfoGuid);
   DmaBufferInfo = GET_GUID_HOB_DATA (Hob);
   BaseAddress   = DmaBufferInfo->DmaBufferBase;
@@ -890,9 +859,16 @@ CreateFixedSecondLevelPagingEntry (
   DEBUG ((DEBUG_INFO, "  Length = 0x%lx\n", Length));
   DEBUG ((DEBUG_INFO, "  IoMmuAccess = 0x%lx\n", IoMmuAccess));
 
-  Status = SetSecondLevelPagingAttribute (VTdUnitInfo, (VTD_SECOND_LEVEL_PAGING_ENTRY *)VTdUnitInfo->FixedSecondLevelPagingEntry, BaseAddress, Length, IoMmuAccess);
+  Status = MapSecondLevelPagingRange (VTdUnitInfo, (VTD_SECOND_LEVEL_PAGING_ENTRY *)VTdUnitInfo->FixedSecondLevelPagingEntry, BaseAddress, Length, IoMmuAccess);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if ((PcdGet8 (PcdVTdPolicyPropertyMask) & BIT3) != 0) {
+    ParseDmarAcpiTableRmrr (VTdInfo->AcpiDmarTable, ProcessRmrr, VTdUnitInfo);
+  }
 
-  return Status;
+  return EFI_SUCCESS;
 }
 
 /**
@@ -919,7 +895,7 @@ SetupTranslationTable (
       continue;
     }
 
-    Status = CreateFixedSecondLevelPagingEntry (VtdUnitInfo);
+    Status = CreateFixedSecondLevelPagingEntry (VTdInfo, VtdUnitInfo);
     if (EFI_ERROR (Status)) {
       DEBUG ((DEBUG_INFO, "CreateFixedSecondLevelPagingEntry failed - %r\n", Status));
       return Status;
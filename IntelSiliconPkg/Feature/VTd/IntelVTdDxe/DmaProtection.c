@@ -469,6 +469,71 @@ InitializePlatformVTdPolicy (
   }
 }
 
+//
+// The names of the VTd PEI phases, in VTD_PEI_PHASE order.
+//
+CONST CHAR8  *mVtdPeiPhaseName[VtdPeiPhaseMax] = {
+  "ParseDmar",
+  "DmaBufferInit",
+  "TranslationTable",
+  "Protection",
+  "Invalidation",
+  "BounceCopy"
+};
+
+/**
+  Dump the VTd PEI statistics passed in the VTd PEI statistics HOB.
+**/
+VOID
+DumpVtdPeiStatistics (
+  VOID
+  )
+{
+  VOID                    *Hob;
+  VTD_PEI_STATISTICS_HOB  *Statistics;
+  UINTN                   Index;
+
+  Hob = GetFirstGuidHob (&gVtdPeiStatisticsHobGuid);
+  if (Hob == NULL) {
+    return;
+  }
+
+  Statistics = GET_GUID_HOB_DATA (Hob);
+  if ((GET_GUID_HOB_DATA_SIZE (Hob) < sizeof (VTD_PEI_STATISTICS_HOB)) ||
+      (Statistics->Revision != VTD_PEI_STATISTICS_HOB_REVISION))
+  {
+    return;
+  }
+
+  DEBUG ((DEBUG_INFO, "VTd PEI statistics (TSC ticks, TSC frequency %ld Hz):\n", Statistics->TickFrequency));
+  for (Index = 0; Index < VtdPeiPhaseMax; Index++) {
+    if (Statistics->TickFrequency != 0) {
+      DEBUG ((
+        DEBUG_INFO,
+        "  %-16a - Count: %ld, Ticks: %ld, Time: %ld us\n",
+        mVtdPeiPhaseName[Index],
+        Statistics->Phase[Index].Count,
+        Statistics->Phase[Index].Ticks,
+        DivU64x64Remainder (MultU64x32 (Statistics->Phase[Index].Ticks, 1000000), Statistics->TickFrequency, NULL)
+        ));
+    } else {
+      DEBUG ((
+        DEBUG_INFO,
+        "  %-16a - Count: %ld, Ticks: %ld\n",
+        mVtdPeiPhaseName[Index],
+        Statistics->Phase[Index].Count,
+        Statistics->Phase[Index].Ticks
+        ));
+    }
+  }
+
+  DEBUG ((DEBUG_INFO, "  MapCount           : %ld\n", Statistics->MapCount));
+  DEBUG ((DEBUG_INFO, "  BounceCount        : %ld\n", Statistics->BounceCount));
+  DEBUG ((DEBUG_INFO, "  BytesBounced       : 0x%lx\n", Statistics->BytesBounced));
+  DEBUG ((DEBUG_INFO, "  DmaBufferSize      : 0x%lx\n", Statistics->DmaBufferSize));
+  DEBUG ((DEBUG_INFO, "  PeakDmaBufferUsage : 0x%lx\n", Statistics->PeakDmaBufferUsage));
+}
+
 /**
   Setup VTd engine.
 **/
@@ -555,6 +620,8 @@ SetupVtd (
 
   DEBUG ((DEBUG_INFO, "DumpVtdRegs\n"));
   DumpVtdRegsAll ();
+
+  DumpVtdPeiStatistics ();
 }
 
 /**
@@ -23,9 +23,11 @@
 #include <Library/PerformanceLib.h>
 #include <Library/PrintLib.h>
 #include <Library/ReportStatusCodeLib.h>
+#include <Library/HobLib.h>
 
 #include <Guid/EventGroup.h>
 #include <Guid/Acpi.h>
+#include <Guid/VtdPeiStatisticsHob.h>
 
 #include <Protocol/DxeSmmReadyToLock.h>
 #include <Protocol/PciRootBridgeIo.h>
@@ -11,8 +11,10 @@
 #include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
 #include <Library/HobLib.h>
+#include <Library/IoLib.h>
 #include <IndustryStandard/Vtd.h>
 #include <Ppi/VtdInfo.h>
+#include <Guid/VtdPeiStatisticsHob.h>
 
 #include "IntelVTdPmrPei.h"
 
@@ -418,8 +420,15 @@ ProcessDrhd (
   IN EFI_ACPI_DMAR_DRHD_HEADER  *DmarDrhd
   )
 {
+  VTD_UNIT_INFO  *VtdUnitInfo;
+
   DEBUG ((DEBUG_INFO, "  VTD (%d) BaseAddress -  0x%016lx\n", VtdIndex, DmarDrhd->RegisterBaseAddress));
-  VTdInfo->VTdEngineAddress[VtdIndex] = DmarDrhd->RegisterBaseAddress;
+  VtdUnitInfo                     = &VTdInfo->VtdUnitInfo[VtdIndex];
+  VtdUnitInfo->VtdUnitBaseAddress = (UINTN)DmarDrhd->RegisterBaseAddress;
+  VtdUnitInfo->CapReg.Uint64      = MmioRead64 (VtdUnitInfo->VtdUnitBaseAddress + R_CAP_REG);
+  VtdUnitInfo->PlmrAlignment      = 0;
+  VtdUnitInfo->PhmrAlignment      = 0;
+  DEBUG ((DEBUG_INFO, "  CapReg - 0x%016lx\n", VtdUnitInfo->CapReg.Uint64));
 }
 
 /**
@@ -444,7 +453,7 @@ ParseDmarAcpiTableDrhd (
     return EFI_UNSUPPORTED;
   }
 
-  VTdInfo = BuildGuidHob (&mVTdInfoGuid, sizeof (VTD_INFO) + (VtdUnitNumber - 1) * sizeof (UINT64));
+  VTdInfo = BuildGuidHob (&mVTdInfoGuid, sizeof (VTD_INFO) + (VtdUnitNumber - 1) * sizeof (VTD_UNIT_INFO));
   ASSERT (VTdInfo != NULL);
   if (VTdInfo == NULL) {
     return EFI_OUT_OF_RESOURCES;
@@ -454,6 +463,7 @@ ParseDmarAcpiTableDrhd (
   // Initialize the engine mask to all.
   //
   VTdInfo->AcpiDmarTable    = AcpiDmarTable;
+  VTdInfo->AcpiDmarTableCrc = 0;
   VTdInfo->EngineMask       = LShiftU64 (1, VtdUnitNumber) - 1;
   VTdInfo->HostAddressWidth = AcpiDmarTable->HostAddressWidth;
   VTdInfo->VTdEngineCount   = VtdUnitNumber;
@@ -13,54 +13,69 @@
 #include <Library/DebugLib.h>
 #include <IndustryStandard/Vtd.h>
 #include <Ppi/VtdInfo.h>
+#include <Guid/VtdPeiStatisticsHob.h>
 
 #include "IntelVTdPmrPei.h"
 
 /**
   Get protected low memory alignment.
 
+  The alignment is probed from the VTd engine on first use and cached in
+  the VTd unit information.
+
   @param HostAddressWidth   The host address width.
-  @param VtdUnitBaseAddress The base address of the VTd engine.
+  @param VtdUnitInfo        The VTd engine unit information.
 
   @return protected low memory alignment.
 **/
 UINT32
 GetPlmrAlignment (
-  IN UINT8  HostAddressWidth,
-  IN UINTN  VtdUnitBaseAddress
+  IN     UINT8          HostAddressWidth,
+  IN OUT VTD_UNIT_INFO  *VtdUnitInfo
   )
 {
   UINT32  Data32;
 
-  MmioWrite32 (VtdUnitBaseAddress + R_PMEN_LOW_BASE_REG, 0xFFFFFFFF);
-  Data32 = MmioRead32 (VtdUnitBaseAddress + R_PMEN_LOW_BASE_REG);
-  Data32 = ~Data32 + 1;
+  if (VtdUnitInfo->PlmrAlignment == 0) {
+    MmioWrite32 (VtdUnitInfo->VtdUnitBaseAddress + R_PMEN_LOW_BASE_REG, 0xFFFFFFFF);
+    Data32 = MmioRead32 (VtdUnitInfo->VtdUnitBaseAddress + R_PMEN_LOW_BASE_REG);
+    Data32 = ~Data32 + 1;
+
+    VtdUnitInfo->PlmrAlignment = Data32;
+  }
 
-  return Data32;
+  return VtdUnitInfo->PlmrAlignment;
 }
 
 /**
   Get protected high memory alignment.
 
+  The alignment is probed from the VTd engine on first use and cached in
+  the VTd unit information.
+
   @param HostAddressWidth   The host address width.
-  @param VtdUnitBaseAddress The base address of the VTd engine.
+  @param VtdUnitInfo        The VTd engine unit information.
 
   @return protected high memory alignment.
 **/
 UINT64
 GetPhmrAlignment (
-  IN UINT8  HostAddressWidth,
-  IN UINTN  VtdUnitBaseAddress
+  IN     UINT8          HostAddressWidth,
+  IN OUT VTD_UNIT_INFO  *VtdUnitInfo
   )
 {
   UINT64  Data64;
 
-  MmioWrite64 (VtdUnitBaseAddress + R_PMEN_HIGH_BASE_REG, 0xFFFFFFFFFFFFFFFF);
-  Data64 = MmioRead64 (VtdUnitBaseAddress + R_PMEN_HIGH_BASE_REG);
-  Data64 = ~Data64 + 1;
-  Data64 = Data64 & (LShiftU64 (1, HostAddressWidth) - 1);
+  if (VtdUnitInfo->PhmrAlignment == 0) {
+    MmioWrite64 (VtdUnitInfo->VtdUnitBaseAddress + R_PMEN_HIGH_BASE_REG, 0xFFFFFFFFFFFFFFFF);
+    Data64 = MmioRead64 (VtdUnitInfo->VtdUnitBaseAddress + R_PMEN_HIGH_BASE_REG);
+    Data64 = ~Data64 + 1;
+    Data64 = Data64 & (LShiftU64 (1, HostAddressWidth) - 1);
+
+    VtdUnitInfo->PhmrAlignment = Data64;
+  }
 
-  return Data64;
+  return VtdUnitInfo->PhmrAlignment;
 }
 
 /**
@@ -87,7 +102,7 @@ GetLowMemoryAlignment (
       continue;
     }
 
-    Alignment = GetPlmrAlignment (VTdInfo->HostAddressWidth, (UINTN)VTdInfo->VTdEngineAddress[Index]);
+    Alignment = GetPlmrAlignment (VTdInfo->HostAddressWidth, &VTdInfo->VtdUnitInfo[Index]);
     if (FinalAlignment < Alignment) {
       FinalAlignment = Alignment;
     }
@@ -120,7 +135,7 @@ GetHighMemoryAlignment (
       continue;
     }
 
-    Alignment = GetPhmrAlignment (VTdInfo->HostAddressWidth, (UINTN)VTdInfo->VTdEngineAddress[Index]);
+    Alignment = GetPhmrAlignment (VTdInfo->HostAddressWidth, &VTdInfo->VtdUnitInfo[Index]);
     if (FinalAlignment < Alignment) {
       FinalAlignment = Alignment;
     }
@@ -132,23 +147,24 @@ GetHighMemoryAlignment (
 /**
   Enable PMR in the VTd engine.
 
-  @param VtdUnitBaseAddress The base address of the VTd engine.
+  @param VtdUnitInfo        The VTd engine unit information.
 
   @retval EFI_SUCCESS      The PMR is enabled.
   @retval EFI_UNSUPPORTED  The PMR is not supported.
 **/
 EFI_STATUS
 EnablePmr (
-  IN UINTN  VtdUnitBaseAddress
+  IN VTD_UNIT_INFO  *VtdUnitInfo
   )
 {
-  UINT32       Reg32;
-  VTD_CAP_REG  CapReg;
+  UINT32  Reg32;
+  UINTN   VtdUnitBaseAddress;
+
+  VtdUnitBaseAddress = VtdUnitInfo->VtdUnitBaseAddress;
 
   DEBUG ((DEBUG_INFO, "EnablePmr - %x\n", VtdUnitBaseAddress));
 
-  CapReg.Uint64 = MmioRead64 (VtdUnitBaseAddress + R_CAP_REG);
-  if ((CapReg.Bits.PLMR == 0) || (CapReg.Bits.PHMR == 0)) {
+  if ((VtdUnitInfo->CapReg.Bits.PLMR == 0) || (VtdUnitInfo->CapReg.Bits.PHMR == 0)) {
     return EFI_UNSUPPORTED;
   }
 
@@ -173,21 +189,22 @@ EnablePmr (
 /**
   Disable PMR in the VTd engine.
 
-  @param VtdUnitBaseAddress The base address of the VTd engine.
+  @param VtdUnitInfo        The VTd engine unit information.
 
   @retval EFI_SUCCESS      The PMR is disabled.
   @retval EFI_UNSUPPORTED  The PMR is not supported.
 **/
 EFI_STATUS
 DisablePmr (
-  IN UINTN  VtdUnitBaseAddress
+  IN VTD_UNIT_INFO  *VtdUnitInfo
   )
 {
-  UINT32       Reg32;
-  VTD_CAP_REG  CapReg;
+  UINT32  Reg32;
+  UINTN   VtdUnitBaseAddress;
+
+  VtdUnitBaseAddress = VtdUnitInfo->VtdUnitBaseAddress;
 
-  CapReg.Uint64 = MmioRead64 (VtdUnitBaseAddress + R_CAP_REG);
-  if ((CapReg.Bits.PLMR == 0) || (CapReg.Bits.PHMR == 0)) {
+  if ((VtdUnitInfo->CapReg.Bits.PLMR == 0) || (VtdUnitInfo->CapReg.Bits.PHMR == 0)) {
     return EFI_UNSUPPORTED;
   }
 
@@ -211,7 +228,7 @@ DisablePmr (
   Set PMR region in the VTd engine.
 
   @param HostAddressWidth   The host address width.
-  @param VtdUnitBaseAddress The base address of the VTd engine.
+  @param VtdUnitInfo        The VTd engine unit information.
   @param LowMemoryBase      The protected low memory region base.
   @param LowMemoryLength    The protected low memory region length.
   @param HighMemoryBase     The protected high memory region base.
@@ -222,29 +239,30 @@ DisablePmr (
 **/
 EFI_STATUS
 SetPmrRegion (
-  IN UINT8   HostAddressWidth,
-  IN UINTN   VtdUnitBaseAddress,
-  IN UINT32  LowMemoryBase,
-  IN UINT32  LowMemoryLength,
-  IN UINT64  HighMemoryBase,
-  IN UINT64  HighMemoryLength
+  IN     UINT8          HostAddressWidth,
+  IN OUT VTD_UNIT_INFO  *VtdUnitInfo,
+  IN     UINT32         LowMemoryBase,
+  IN     UINT32         LowMemoryLength,
+  IN     UINT64         HighMemoryBase,
+  IN     UINT64         HighMemoryLength
   )
 {
-  VTD_CAP_REG  CapReg;
-  UINT32       PlmrAlignment;
-  UINT64       PhmrAlignment;
+  UINT32  PlmrAlignment;
+  UINT64  PhmrAlignment;
+  UINTN   VtdUnitBaseAddress;
+
+  VtdUnitBaseAddress = VtdUnitInfo->VtdUnitBaseAddress;
 
   DEBUG ((DEBUG_INFO, "VtdUnitBaseAddress - 0x%x\n", VtdUnitBaseAddress));
 
-  CapReg.Uint64 = MmioRead64 (VtdUnitBaseAddress + R_CAP_REG);
-  if ((CapReg.Bits.PLMR == 0) || (CapReg.Bits.PHMR == 0)) {
+  if ((VtdUnitInfo->CapReg.Bits.PLMR == 0) || (VtdUnitInfo->CapReg.Bits.PHMR == 0)) {
     DEBUG ((DEBUG_ERROR, "PLMR/PHMR unsupported\n"));
     return EFI_UNSUPPORTED;
   }
 
-  PlmrAlignment = GetPlmrAlignment (HostAddressWidth, VtdUnitBaseAddress);
+  PlmrAlignment = GetPlmrAlignment (HostAddressWidth, VtdUnitInfo);
   DEBUG ((DEBUG_INFO, "PlmrAlignment - 0x%x\n", PlmrAlignment));
-  PhmrAlignment = GetPhmrAlignment (HostAddressWidth, VtdUnitBaseAddress);
+  PhmrAlignment = GetPhmrAlignment (HostAddressWidth, VtdUnitInfo);
   DEBUG ((DEBUG_INFO, "PhmrAlignment - 0x%lx\n", PhmrAlignment));
 
   if ((LowMemoryBase    != ALIGN_VALUE (LowMemoryBase, PlmrAlignment)) ||
@@ -307,10 +325,10 @@ SetDmaProtectedRange (
       continue;
     }
 
-    DisablePmr ((UINTN)VTdInfo->VTdEngineAddress[Index]);
+    DisablePmr (&VTdInfo->VtdUnitInfo[Index]);
     Status = SetPmrRegion (
                VTdInfo->HostAddressWidth,
-               (UINTN)VTdInfo->VTdEngineAddress[Index],
+               &VTdInfo->VtdUnitInfo[Index],
                LowMemoryBase,
                LowMemoryLength,
                HighMemoryBase,
@@ -320,7 +338,7 @@ SetDmaProtectedRange (
       return Status;
     }
 
-    Status = EnablePmr ((UINTN)VTdInfo->VTdEngineAddress[Index]);
+    Status = EnablePmr (&VTdInfo->VtdUnitInfo[Index]);
     if (EFI_ERROR (Status)) {
       return Status;
     }
@@ -355,7 +373,7 @@ DisableDmaProtection (
       continue;
     }
 
-    Status = DisablePmr ((UINTN)VTdInfo->VTdEngineAddress[Index]);
+    Status = DisablePmr (&VTdInfo->VtdUnitInfo[Index]);
     if (EFI_ERROR (Status)) {
       return Status;
     }
@@ -367,25 +385,23 @@ DisableDmaProtection (
 /**
   Return if the PMR is enabled.
 
-  @param VtdUnitBaseAddress The base address of the VTd engine.
+  @param VtdUnitInfo        The VTd engine unit information.
 
   @retval TRUE  PMR is enabled.
   @retval FALSE PMR is disabled or unsupported.
 **/
 BOOLEAN
 IsPmrEnabled (
-  IN UINTN  VtdUnitBaseAddress
+  IN VTD_UNIT_INFO  *VtdUnitInfo
   )
 {
-  UINT32       Reg32;
-  VTD_CAP_REG  CapReg;
+  UINT32  Reg32;
 
-  CapReg.Uint64 = MmioRead64 (VtdUnitBaseAddress + R_CAP_REG);
-  if ((CapReg.Bits.PLMR == 0) || (CapReg.Bits.PHMR == 0)) {
+  if ((VtdUnitInfo->CapReg.Bits.PLMR == 0) || (VtdUnitInfo->CapReg.Bits.PHMR == 0)) {
     return FALSE;
   }
 
-  Reg32 = MmioRead32 (VtdUnitBaseAddress + R_PMEN_ENABLE_REG);
+  Reg32 = MmioRead32 (VtdUnitInfo->VtdUnitBaseAddress + R_PMEN_ENABLE_REG);
   if ((Reg32 & BIT0) == 0) {
     return FALSE;
   }
@@ -419,7 +435,7 @@ GetDmaProtectionEnabledEngineMask (
       continue;
     }
 
-    Result = IsPmrEnabled ((UINTN)VTdInfo->VTdEngineAddress[Index]);
+    Result = IsPmrEnabled (&VTdInfo->VtdUnitInfo[Index]);
     if (Result) {
       EnabledEngineMask |= LShiftU64 (1, Index);
     }
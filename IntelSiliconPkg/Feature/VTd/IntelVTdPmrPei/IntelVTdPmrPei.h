@@ -9,12 +9,23 @@
 #ifndef __DMA_ACCESS_LIB_H__
 #define __DMA_ACCESS_LIB_H__
 
+typedef struct {
+  UINTN          VtdUnitBaseAddress;
+  VTD_CAP_REG    CapReg;
+  //
+  // PMR alignments are probed on first use and cached, 0 means not probed yet.
+  //
+  UINT32         PlmrAlignment;
+  UINT64         PhmrAlignment;
+} VTD_UNIT_INFO;
+
 typedef struct {
   EFI_ACPI_DMAR_HEADER    *AcpiDmarTable;
+  UINT32                  AcpiDmarTableCrc;
   UINT64                  EngineMask;
   UINT8                   HostAddressWidth;
   UINTN                   VTdEngineCount;
-  UINT64                  VTdEngineAddress[1];
+  VTD_UNIT_INFO           VtdUnitInfo[1];
 } VTD_INFO;
 
 /**
@@ -168,6 +179,18 @@ DumpAcpiDMAR (
   IN EFI_ACPI_DMAR_HEADER  *Dmar
   );
 
+/**
+  Record the time spent in a VTd PEI phase in the statistics HOB.
+
+  @param[in]  Phase             The phase.
+  @param[in]  StartTick         The TSC value when the phase was entered.
+**/
+VOID
+RecordVTdPeiPhase (
+  IN VTD_PEI_PHASE  Phase,
+  IN UINT64         StartTick
+  );
+
 extern EFI_GUID  mVTdInfoGuid;
 
 #endif
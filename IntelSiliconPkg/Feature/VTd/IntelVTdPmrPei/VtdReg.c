@@ -17,6 +17,7 @@
 #include <IndustryStandard/Vtd.h>
 #include <Ppi/VtdInfo.h>
 #include <Ppi/VtdNullRootEntryTable.h>
+#include <Guid/VtdPeiStatisticsHob.h>
 
 #include "IntelVTdPmrPei.h"
 
@@ -138,6 +139,7 @@ EnableDmar (
   )
 {
   UINT32  Reg32;
+  UINT64  StartTick;
 
   DEBUG ((DEBUG_INFO, ">>>>>>EnableDmar() for engine [%x] \n", VtdUnitBaseAddress));
 
@@ -159,6 +161,7 @@ EnableDmar (
   //
   // Write Buffer Flush before invalidation
   //
+  StartTick = AsmReadTsc ();
   FlushWriteBuffer (VtdUnitBaseAddress);
 
   //
@@ -170,6 +173,7 @@ EnableDmar (
   // Invalidate the IOTLB cache
   //
   InvalidateIOTLB (VtdUnitBaseAddress);
+  RecordVTdPeiPhase (VtdPeiPhaseInvalidation, StartTick);
 
   //
   // Enable VTd
@@ -288,7 +292,7 @@ PreMemoryEnableVTdTranslationProtection (
       continue;
     }
 
-    EnableDmar ((UINTN)VTdInfo->VTdEngineAddress[Index], (UINTN)*RootEntryTable);
+    EnableDmar (VTdInfo->VtdUnitInfo[Index].VtdUnitBaseAddress, (UINTN)*RootEntryTable);
   }
 
   return EFI_SUCCESS;
@@ -326,7 +330,7 @@ EnableVTdTranslationProtection (
       continue;
     }
 
-    EnableDmar ((UINTN)VTdInfo->VTdEngineAddress[Index], (UINTN)RootEntryTable);
+    EnableDmar (VTdInfo->VtdUnitInfo[Index].VtdUnitBaseAddress, (UINTN)RootEntryTable);
   }
 
   return;
@@ -353,7 +357,7 @@ DisableVTdTranslationProtection (
       continue;
     }
 
-    DisableDmar ((UINTN)VTdInfo->VTdEngineAddress[Index]);
+    DisableDmar (VTdInfo->VtdUnitInfo[Index].VtdUnitBaseAddress);
   }
 
   return;
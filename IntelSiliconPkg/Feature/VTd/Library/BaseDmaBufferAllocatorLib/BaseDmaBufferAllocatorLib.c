@@ -0,0 +1,402 @@
+/** @file
+  Range allocator for the DMA buffer window used by the VTd PEI drivers.
+
+  Free space is tracked as an address ordered array of non-adjacent ranges.
+  Freed ranges are merged with their neighbours, so buffers can be released
+  in any order and the window returns to a single range once everything is
+  released.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/DmaBufferAllocatorLib.h>
+
+/**
+  Remove one entry from the free range list.
+
+  @param[in]  Allocator     The allocator.
+  @param[in]  Index         The index of the entry to remove.
+**/
+STATIC
+VOID
+RemoveFreeRange (
+  IN DMA_BUFFER_ALLOCATOR  *Allocator,
+  IN UINTN                 Index
+  )
+{
+  ASSERT (Index < Allocator->FreeRangeCount);
+
+  CopyMem (
+    &Allocator->FreeRange[Index],
+    &Allocator->FreeRange[Index + 1],
+    (Allocator->FreeRangeCount - Index - 1) * sizeof (DMA_BUFFER_RANGE)
+    );
+  Allocator->FreeRangeCount--;
+}
+
+/**
+  Insert one entry into the free range list.
+
+  @param[in]  Allocator     The allocator.
+  @param[in]  Index         The index the new entry will occupy.
+  @param[in]  Base          The base of the free range.
+  @param[in]  Length        The length of the free range.
+
+  @retval TRUE   The entry is inserted.
+  @retval FALSE  The free range list is full.
+**/
+STATIC
+BOOLEAN
+InsertFreeRange (
+  IN DMA_BUFFER_ALLOCATOR  *Allocator,
+  IN UINTN                 Index,
+  IN UINTN                 Base,
+  IN UINTN                 Length
+  )
+{
+  ASSERT (Index <= Allocator->FreeRangeCount);
+
+  if (Allocator->FreeRangeCount >= DMA_BUFFER_ALLOCATOR_MAX_FREE_RANGES) {
+    return FALSE;
+  }
+
+  CopyMem (
+    &Allocator->FreeRange[Index + 1],
+    &Allocator->FreeRange[Index],
+    (Allocator->FreeRangeCount - Index) * sizeof (DMA_BUFFER_RANGE)
+    );
+  Allocator->FreeRange[Index].Base   = Base;
+  Allocator->FreeRange[Index].Length = Length;
+  Allocator->FreeRangeCount++;
+
+  return TRUE;
+}
+
+/**
+  Carve [Start, Start + Length) out of a free range.
+
+  @param[in]  Allocator     The allocator.
+  @param[in]  Index         The index of the free range containing the allocation.
+  @param[in]  Start         The start of the allocation.
+  @param[in]  Length        The length of the allocation.
+
+  @retval TRUE   The allocation is carved out.
+  @retval FALSE  The remaining space would need a new free range entry and
+                 the list is full.
+**/
+STATIC
+BOOLEAN
+CarveFreeRange (
+  IN DMA_BUFFER_ALLOCATOR  *Allocator,
+  IN UINTN                 Index,
+  IN UINTN                 Start,
+  IN UINTN                 Length
+  )
+{
+  DMA_BUFFER_RANGE  *Range;
+  UINTN             Head;
+  UINTN             Tail;
+
+  Range = &Allocator->FreeRange[Index];
+  Head  = Start - Range->Base;
+  Tail  = (Range->Base + Range->Length) - (Start + Length);
+
+  if ((Head != 0) && (Tail != 0)) {
+    if (!InsertFreeRange (Allocator, Index + 1, Start + Length, Tail)) {
+      return FALSE;
+    }
+
+    Range->Length = Head;
+  } else if (Head != 0) {
+    Range->Length = Head;
+  } else if (Tail != 0) {
+    Range->Base   = Start + Length;
+    Range->Length = Tail;
+  } else {
+    RemoveFreeRange (Allocator, Index);
+  }
+
+  Allocator->FreeSize -= Length;
+  return TRUE;
+}
+
+/**
+  Initialize an allocator to manage the window [Base, Base + Size).
+
+  @param[out] Allocator     The allocator to initialize.
+  @param[in]  Base          The base address of the DMA window.
+  @param[in]  Size          The size of the DMA window in bytes.
+
+  @retval EFI_SUCCESS            The allocator is initialized.
+  @retval EFI_INVALID_PARAMETER  Allocator is NULL, Size is 0, or Base/Size
+                                 are not aligned to DMA_BUFFER_ALLOCATOR_GRANULARITY.
+**/
+EFI_STATUS
+EFIAPI
+DmaBufferAllocatorInit (
+  OUT DMA_BUFFER_ALLOCATOR  *Allocator,
+  IN  UINTN                 Base,
+  IN  UINTN                 Size
+  )
+{
+  if ((Allocator == NULL) || (Size == 0)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (((Base | Size) & (DMA_BUFFER_ALLOCATOR_GRANULARITY - 1)) != 0) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (Size - 1 > MAX_UINTN - Base) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  ZeroMem (Allocator, sizeof (DMA_BUFFER_ALLOCATOR));
+  Allocator->Base                = Base;
+  Allocator->Size                = Size;
+  Allocator->FreeSize            = Size;
+  Allocator->FreeRangeCount      = 1;
+  Allocator->FreeRange[0].Base   = Base;
+  Allocator->FreeRange[0].Length = Size;
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Return if the allocator has been initialized.
+
+  @param[in]  Allocator     The allocator.
+
+  @retval TRUE   The allocator manages a DMA window.
+  @retval FALSE  The allocator has not been initialized yet.
+**/
+BOOLEAN
+EFIAPI
+DmaBufferAllocatorIsReady (
+  IN CONST DMA_BUFFER_ALLOCATOR  *Allocator
+  )
+{
+  return (BOOLEAN)((Allocator != NULL) && (Allocator->Size != 0));
+}
+
+/**
+  Allocate a range from the DMA window.
+
+  Allocations from the bottom return the lowest fitting address and are
+  intended for short lived bounce buffers. Allocations from the top return
+  the highest fitting address and are intended for long lived common buffers,
+  which keeps the two kinds from fragmenting each other.
+
+  @param[in]  Allocator     The allocator.
+  @param[in]  Length        The number of bytes to allocate.
+  @param[in]  Alignment     The required alignment of the returned address.
+                            Must be 0 or a power of 2.
+  @param[in]  FromTop       TRUE to allocate from the top of the window.
+  @param[out] Address       The allocated address.
+
+  @retval EFI_SUCCESS            The range is allocated.
+  @retval EFI_INVALID_PARAMETER  A parameter is invalid.
+  @retval EFI_NOT_READY          The allocator is not initialized.
+  @retval EFI_OUT_OF_RESOURCES   No free range can satisfy the request.
+**/
+EFI_STATUS
+EFIAPI
+DmaBufferAllocate (
+  IN  DMA_BUFFER_ALLOCATOR  *Allocator,
+  IN  UINTN                 Length,
+  IN  UINTN                 Alignment,
+  IN  BOOLEAN               FromTop,
+  OUT UINTN                 *Address
+  )
+{
+  DMA_BUFFER_RANGE  *Range;
+  UINTN             Index;
+  UINTN             Start;
+  UINTN             End;
+
+  if ((Allocator == NULL) || (Address == NULL) || (Length == 0)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if ((Alignment & (Alignment - 1)) != 0) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (!DmaBufferAllocatorIsReady (Allocator)) {
+    return EFI_NOT_READY;
+  }
+
+  if (Length > Allocator->FreeSize) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Length = ALIGN_VALUE (Length, DMA_BUFFER_ALLOCATOR_GRANULARITY);
+  if (Alignment < DMA_BUFFER_ALLOCATOR_GRANULARITY) {
+    Alignment = DMA_BUFFER_ALLOCATOR_GRANULARITY;
+  }
+
+  if (!FromTop) {
+    for (Index = 0; Index < Allocator->FreeRangeCount; Index++) {
+      Range = &Allocator->FreeRange[Index];
+      End   = Range->Base + Range->Length;
+      Start = ALIGN_VALUE (Range->Base, Alignment);
+      if ((Start < Range->Base) || (Start >= End) || (End - Start < Length)) {
+        continue;
+      }
+
+      if (CarveFreeRange (Allocator, Index, Start, Length)) {
+        *Address = Start;
+        return EFI_SUCCESS;
+      }
+    }
+  } else {
+    for (Index = Allocator->FreeRangeCount; Index > 0; Index--) {
+      Range = &Allocator->FreeRange[Index - 1];
+      if (Range->Length < Length) {
+        continue;
+      }
+
+      End   = Range->Base + Range->Length;
+      Start = (End - Length) & ~(Alignment - 1);
+      if (Start < Range->Base) {
+        continue;
+      }
+
+      if (CarveFreeRange (Allocator, Index - 1, Start, Length)) {
+        *Address = Start;
+        return EFI_SUCCESS;
+      }
+    }
+  }
+
+  return EFI_OUT_OF_RESOURCES;
+}
+
+/**
+  Return a range to the DMA window, merging it with adjacent free ranges.
+
+  @param[in]  Allocator     The allocator.
+  @param[in]  Address       The address returned by DmaBufferAllocate().
+  @param[in]  Length        The length passed to DmaBufferAllocate().
+
+  @retval EFI_SUCCESS            The range is freed.
+  @retval EFI_INVALID_PARAMETER  The range is outside the window or overlaps
+                                 a range that is already free.
+  @retval EFI_NOT_READY          The allocator is not initialized.
+  @retval EFI_OUT_OF_RESOURCES   The free range list is full. The range is
+                                 not reclaimed.
+**/
+EFI_STATUS
+EFIAPI
+DmaBufferFree (
+  IN DMA_BUFFER_ALLOCATOR  *Allocator,
+  IN UINTN                 Address,
+  IN UINTN                 Length
+  )
+{
+  DMA_BUFFER_RANGE  *Prev;
+  DMA_BUFFER_RANGE  *Next;
+  UINTN             Index;
+  UINTN             End;
+  BOOLEAN           MergePrev;
+  BOOLEAN           MergeNext;
+
+  if ((Allocator == NULL) || (Length == 0)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (!DmaBufferAllocatorIsReady (Allocator)) {
+    return EFI_NOT_READY;
+  }
+
+  if ((Address < Allocator->Base) || (Length > Allocator->Size) ||
+      ((Address & (DMA_BUFFER_ALLOCATOR_GRANULARITY - 1)) != 0))
+  {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Length = ALIGN_VALUE (Length, DMA_BUFFER_ALLOCATOR_GRANULARITY);
+  if (Address - Allocator->Base > Allocator->Size - Length) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  End = Address + Length;
+
+  //
+  // Find the first free range above the freed one.
+  //
+  for (Index = 0; Index < Allocator->FreeRangeCount; Index++) {
+    if (Allocator->FreeRange[Index].Base > Address) {
+      break;
+    }
+  }
+
+  Prev = (Index > 0) ? &Allocator->FreeRange[Index - 1] : NULL;
+  Next = (Index < Allocator->FreeRangeCount) ? &Allocator->FreeRange[Index] : NULL;
+
+  //
+  // Reject double free and partial overlap.
+  //
+  if ((Prev != NULL) && (Prev->Base + Prev->Length > Address)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if ((Next != NULL) && (Next->Base < End)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  MergePrev = (BOOLEAN)((Prev != NULL) && (Prev->Base + Prev->Length == Address));
+  MergeNext = (BOOLEAN)((Next != NULL) && (Next->Base == End));
+
+  if (MergePrev && MergeNext) {
+    Prev->Length += Length + Next->Length;
+    RemoveFreeRange (Allocator, Index);
+  } else if (MergePrev) {
+    Prev->Length += Length;
+  } else if (MergeNext) {
+    Next->Base    = Address;
+    Next->Length += Length;
+  } else if (!InsertFreeRange (Allocator, Index, Address, Length)) {
+    DEBUG ((DEBUG_ERROR, "DmaBufferFree - free range list full, 0x%x bytes at 0x%x not reclaimed\n", Length, Address));
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  Allocator->FreeSize += Length;
+  return EFI_SUCCESS;
+}
+
+/**
+  Return if [Address, Address + Length) lies entirely inside the DMA window.
+
+  @param[in]  Allocator     The allocator.
+  @param[in]  Address       The start of the range.
+  @param[in]  Length        The length of the range.
+
+  @retval TRUE   The range is inside the window.
+  @retval FALSE  The range is not inside the window, or the allocator is not
+                 initialized.
+**/
+BOOLEAN
+EFIAPI
+DmaBufferIsInWindow (
+  IN CONST DMA_BUFFER_ALLOCATOR  *Allocator,
+  IN UINTN                       Address,
+  IN UINTN                       Length
+  )
+{
+  if (!DmaBufferAllocatorIsReady (Allocator)) {
+    return FALSE;
+  }
+
+  if ((Address < Allocator->Base) || (Length > Allocator->Size)) {
+    return FALSE;
+  }
+
+  return (BOOLEAN)(Address - Allocator->Base <= Allocator->Size - Length);
+}
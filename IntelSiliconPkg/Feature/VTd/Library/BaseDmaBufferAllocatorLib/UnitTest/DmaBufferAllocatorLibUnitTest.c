@@ -0,0 +1,420 @@
+/** @file
+UnitTest for...
+Range allocator for the VTd PEI DMA buffer window.
+
+Copyright (c) Microsoft Corporation.
+SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <Uefi.h>
+#include <Library/DebugLib.h>
+#include <Library/UnitTestLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DmaBufferAllocatorLib.h>
+
+#define UNIT_TEST_NAME     "DMA Buffer Allocator Lib UnitTest"
+#define UNIT_TEST_VERSION  "0.9"
+
+/// === TEST DATA ==================================================================================
+
+//
+// The allocator never touches the window, so any aligned address will do.
+//
+#define TEST_WINDOW_BASE  0x10000000
+#define TEST_WINDOW_SIZE  SIZE_64KB
+
+#define TRACE_SLOT_MAX  16
+
+typedef enum {
+  TraceMap,
+  TraceUnmap,
+  TraceAllocate,
+  TraceFree
+} TRACE_OP;
+
+typedef struct {
+  TRACE_OP    Op;
+  UINT8       Slot;
+  UINT32      Length;
+} TRACE_ENTRY;
+
+typedef struct {
+  UINTN    Address;
+  UINTN    Length;
+} TRACE_SLOT;
+
+//
+// Recovery storage and USB mapping buffers concurrently and releasing them in
+// completion order rather than mapping order. A bump allocator loses every
+// buffer that is not released last.
+//
+STATIC CONST TRACE_ENTRY  mInterleavedTrace[] = {
+  { TraceAllocate, 0, SIZE_4KB * 2 },
+  { TraceMap,      1, 0x200        },
+  { TraceMap,      2, 0x1F         },
+  { TraceMap,      3, 0x800        },
+  { TraceUnmap,    1, 0            },
+  { TraceMap,      4, 0x10         },
+  { TraceUnmap,    3, 0            },
+  { TraceMap,      5, 0x1000       },
+  { TraceUnmap,    2, 0            },
+  { TraceAllocate, 6, SIZE_4KB     },
+  { TraceUnmap,    5, 0            },
+  { TraceMap,      7, 0x33         },
+  { TraceFree,     0, 0            },
+  { TraceUnmap,    4, 0            },
+  { TraceUnmap,    7, 0            },
+  { TraceFree,     6, 0            },
+};
+
+/// === HELPER FUNCTIONS ===========================================================================
+
+/**
+  Check that the free range list is ordered, non-adjacent and accounts for
+  exactly FreeSize bytes.
+
+  @param[in]  Allocator     The allocator.
+
+  @retval TRUE   The free range list is consistent.
+  @retval FALSE  The free range list is corrupted.
+**/
+STATIC
+BOOLEAN
+IsFreeListConsistent (
+  IN DMA_BUFFER_ALLOCATOR  *Allocator
+  )
+{
+  UINTN  Index;
+  UINTN  Total;
+
+  Total = 0;
+  for (Index = 0; Index < Allocator->FreeRangeCount; Index++) {
+    if (Allocator->FreeRange[Index].Length == 0) {
+      return FALSE;
+    }
+
+    if ((Index > 0) &&
+        (Allocator->FreeRange[Index - 1].Base + Allocator->FreeRange[Index - 1].Length >= Allocator->FreeRange[Index].Base))
+    {
+      return FALSE;
+    }
+
+    Total += Allocator->FreeRange[Index].Length;
+  }
+
+  return (BOOLEAN)(Total == Allocator->FreeSize);
+}
+
+/**
+  Replay an allocation trace against an allocator.
+
+  @param[in]  Allocator     The allocator.
+  @param[in]  Trace         The trace to replay.
+  @param[in]  Count         The number of trace entries.
+  @param[in]  Slots         The per-slot outstanding allocations.
+
+  @retval EFI_SUCCESS  Every operation in the trace succeeded.
+  @retval Others       The status of the first failing operation.
+**/
+STATIC
+EFI_STATUS
+ReplayTrace (
+  IN DMA_BUFFER_ALLOCATOR  *Allocator,
+  IN CONST TRACE_ENTRY     *Trace,
+  IN UINTN                 Count,
+  IN TRACE_SLOT            *Slots
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       Index;
+  TRACE_SLOT  *Slot;
+
+  for (Index = 0; Index < Count; Index++) {
+    Slot = &Slots[Trace[Index].Slot];
+    switch (Trace[Index].Op) {
+      case TraceMap:
+      case TraceAllocate:
+        Slot->Length = Trace[Index].Length;
+        Status       = DmaBufferAllocate (
+                         Allocator,
+                         Slot->Length,
+                         (Trace[Index].Op == TraceAllocate) ? EFI_PAGE_SIZE : 0,
+                         (BOOLEAN)(Trace[Index].Op == TraceAllocate),
+                         &Slot->Address
+                         );
+        break;
+      default:
+        Status = DmaBufferFree (Allocator, Slot->Address, Slot->Length);
+        break;
+    }
+
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    if (!IsFreeListConsistent (Allocator)) {
+      return EFI_VOLUME_CORRUPTED;
+    }
+  }
+
+  return EFI_SUCCESS;
+}
+
+/// === TEST CASES =================================================================================
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+ShouldRejectBadWindow (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  DMA_BUFFER_ALLOCATOR  Allocator;
+
+  UT_ASSERT_STATUS_EQUAL (DmaBufferAllocatorInit (&Allocator, TEST_WINDOW_BASE, 0), EFI_INVALID_PARAMETER);
+  UT_ASSERT_STATUS_EQUAL (DmaBufferAllocatorInit (&Allocator, TEST_WINDOW_BASE + 1, TEST_WINDOW_SIZE), EFI_INVALID_PARAMETER);
+  UT_ASSERT_STATUS_EQUAL (DmaBufferAllocatorInit (&Allocator, TEST_WINDOW_BASE, TEST_WINDOW_SIZE + 1), EFI_INVALID_PARAMETER);
+  UT_ASSERT_NOT_EFI_ERROR (DmaBufferAllocatorInit (&Allocator, TEST_WINDOW_BASE, TEST_WINDOW_SIZE));
+  UT_ASSERT_TRUE (DmaBufferAllocatorIsReady (&Allocator));
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+ShouldReclaimOutOfOrderUnmaps (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  DMA_BUFFER_ALLOCATOR  Allocator;
+  TRACE_SLOT            Slots[TRACE_SLOT_MAX];
+
+  UT_ASSERT_NOT_EFI_ERROR (DmaBufferAllocatorInit (&Allocator, TEST_WINDOW_BASE, TEST_WINDOW_SIZE));
+  UT_ASSERT_NOT_EFI_ERROR (ReplayTrace (&Allocator, mInterleavedTrace, ARRAY_SIZE (mInterleavedTrace), Slots));
+
+  UT_ASSERT_EQUAL (Allocator.FreeSize, TEST_WINDOW_SIZE);
+  UT_ASSERT_EQUAL (Allocator.FreeRangeCount, 1);
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+ShouldNotLeakOverManyInterleavedTraces (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  DMA_BUFFER_ALLOCATOR  Allocator;
+  TRACE_SLOT            Slots[TRACE_SLOT_MAX];
+  UINTN                 Round;
+
+  //
+  // The trace holds at most ~20KB at a time. Replaying it 1000 times moves
+  // far more than the window size through the allocator.
+  //
+  UT_ASSERT_NOT_EFI_ERROR (DmaBufferAllocatorInit (&Allocator, TEST_WINDOW_BASE, SIZE_32KB));
+  for (Round = 0; Round < 1000; Round++) {
+    UT_ASSERT_NOT_EFI_ERROR (ReplayTrace (&Allocator, mInterleavedTrace, ARRAY_SIZE (mInterleavedTrace), Slots));
+  }
+
+  UT_ASSERT_EQUAL (Allocator.FreeSize, SIZE_32KB);
+  UT_ASSERT_EQUAL (Allocator.FreeRangeCount, 1);
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+ShouldKeepCommonBuffersPageAlignedAtTop (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  DMA_BUFFER_ALLOCATOR  Allocator;
+  UINTN                 Low;
+  UINTN                 High;
+
+  UT_ASSERT_NOT_EFI_ERROR (DmaBufferAllocatorInit (&Allocator, TEST_WINDOW_BASE, TEST_WINDOW_SIZE));
+
+  UT_ASSERT_NOT_EFI_ERROR (DmaBufferAllocate (&Allocator, 0x123, 0, FALSE, &Low));
+  UT_ASSERT_EQUAL (Low, TEST_WINDOW_BASE);
+
+  UT_ASSERT_NOT_EFI_ERROR (DmaBufferAllocate (&Allocator, SIZE_4KB, EFI_PAGE_SIZE, TRUE, &High));
+  UT_ASSERT_EQUAL (High, TEST_WINDOW_BASE + TEST_WINDOW_SIZE - SIZE_4KB);
+
+  //
+  // An odd sized top allocation must still come back page aligned and leave
+  // the slack above it usable.
+  //
+  UT_ASSERT_NOT_EFI_ERROR (DmaBufferAllocate (&Allocator, 0x100, EFI_PAGE_SIZE, TRUE, &High));
+  UT_ASSERT_EQUAL (High & EFI_PAGE_MASK, 0);
+  UT_ASSERT_TRUE (IsFreeListConsistent (&Allocator));
+  UT_ASSERT_EQUAL (Allocator.FreeRangeCount, 2);
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+ShouldRejectDoubleFree (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  DMA_BUFFER_ALLOCATOR  Allocator;
+  UINTN                 Address;
+
+  UT_ASSERT_NOT_EFI_ERROR (DmaBufferAllocatorInit (&Allocator, TEST_WINDOW_BASE, TEST_WINDOW_SIZE));
+  UT_ASSERT_NOT_EFI_ERROR (DmaBufferAllocate (&Allocator, 0x400, 0, FALSE, &Address));
+  UT_ASSERT_NOT_EFI_ERROR (DmaBufferFree (&Allocator, Address, 0x400));
+  UT_ASSERT_STATUS_EQUAL (DmaBufferFree (&Allocator, Address, 0x400), EFI_INVALID_PARAMETER);
+  UT_ASSERT_STATUS_EQUAL (DmaBufferFree (&Allocator, TEST_WINDOW_BASE + TEST_WINDOW_SIZE, 0x40), EFI_INVALID_PARAMETER);
+  UT_ASSERT_EQUAL (Allocator.FreeSize, TEST_WINDOW_SIZE);
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+ShouldRecoverAfterExhaustion (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  DMA_BUFFER_ALLOCATOR  Allocator;
+  UINTN                 Address[TEST_WINDOW_SIZE / SIZE_4KB];
+  UINTN                 Extra;
+  UINTN                 Index;
+
+  UT_ASSERT_NOT_EFI_ERROR (DmaBufferAllocatorInit (&Allocator, TEST_WINDOW_BASE, TEST_WINDOW_SIZE));
+  for (Index = 0; Index < ARRAY_SIZE (Address); Index++) {
+    UT_ASSERT_NOT_EFI_ERROR (DmaBufferAllocate (&Allocator, SIZE_4KB, 0, FALSE, &Address[Index]));
+  }
+
+  UT_ASSERT_STATUS_EQUAL (DmaBufferAllocate (&Allocator, 0x40, 0, FALSE, &Extra), EFI_OUT_OF_RESOURCES);
+
+  //
+  // Release every other buffer, then the rest. The window must coalesce back
+  // into one range.
+  //
+  for (Index = 0; Index < ARRAY_SIZE (Address); Index += 2) {
+    UT_ASSERT_NOT_EFI_ERROR (DmaBufferFree (&Allocator, Address[Index], SIZE_4KB));
+  }
+
+  UT_ASSERT_STATUS_EQUAL (DmaBufferAllocate (&Allocator, SIZE_8KB, 0, FALSE, &Extra), EFI_OUT_OF_RESOURCES);
+
+  for (Index = 1; Index < ARRAY_SIZE (Address); Index += 2) {
+    UT_ASSERT_NOT_EFI_ERROR (DmaBufferFree (&Allocator, Address[Index], SIZE_4KB));
+  }
+
+  UT_ASSERT_EQUAL (Allocator.FreeRangeCount, 1);
+  UT_ASSERT_NOT_EFI_ERROR (DmaBufferAllocate (&Allocator, TEST_WINDOW_SIZE, 0, FALSE, &Extra));
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+ShouldDetectInWindowRanges (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  DMA_BUFFER_ALLOCATOR  Allocator;
+
+  ZeroMem (&Allocator, sizeof (Allocator));
+  UT_ASSERT_FALSE (DmaBufferIsInWindow (&Allocator, TEST_WINDOW_BASE, 1));
+
+  UT_ASSERT_NOT_EFI_ERROR (DmaBufferAllocatorInit (&Allocator, TEST_WINDOW_BASE, TEST_WINDOW_SIZE));
+  UT_ASSERT_TRUE (DmaBufferIsInWindow (&Allocator, TEST_WINDOW_BASE, TEST_WINDOW_SIZE));
+  UT_ASSERT_TRUE (DmaBufferIsInWindow (&Allocator, TEST_WINDOW_BASE + TEST_WINDOW_SIZE - 1, 1));
+  UT_ASSERT_FALSE (DmaBufferIsInWindow (&Allocator, TEST_WINDOW_BASE - 1, 2));
+  UT_ASSERT_FALSE (DmaBufferIsInWindow (&Allocator, TEST_WINDOW_BASE + TEST_WINDOW_SIZE - 1, 2));
+  UT_ASSERT_FALSE (DmaBufferIsInWindow (&Allocator, TEST_WINDOW_BASE + 1, MAX_UINTN));
+
+  return UNIT_TEST_PASSED;
+}
+
+/// === TEST ENGINE ================================================================================
+
+/**
+  SampleUnitTestApp
+
+  @param[in] ImageHandle  The firmware allocated handle for the EFI image.
+  @param[in] SystemTable  A pointer to the EFI System Table.
+
+  @retval EFI_SUCCESS     The entry point executed successfully.
+  @retval other           Some error occurred when executing this entry point.
+
+**/
+int
+main (
+  )
+{
+  EFI_STATUS                  Status;
+  UNIT_TEST_FRAMEWORK_HANDLE  Framework = NULL;
+  UNIT_TEST_SUITE_HANDLE      AllocatorTests;
+
+  DEBUG ((DEBUG_INFO, "%a v%a\n", UNIT_TEST_NAME, UNIT_TEST_VERSION));
+
+  //
+  // Start setting up the test framework for running the tests.
+  //
+  Status = InitUnitTestFramework (&Framework, UNIT_TEST_NAME, gEfiCallerBaseName, UNIT_TEST_VERSION);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in InitUnitTestFramework. Status = %r\n", Status));
+    goto EXIT;
+  }
+
+  Status = CreateUnitTestSuite (&AllocatorTests, Framework, "DMA Buffer Allocator Tests", "DmaBufferAllocator", NULL, NULL);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in CreateUnitTestSuite for AllocatorTests\n"));
+    Status = EFI_OUT_OF_RESOURCES;
+    goto EXIT;
+  }
+
+  AddTestCase (AllocatorTests, "Should reject a bad DMA window", "DmaBufferAllocator.BadWindow", ShouldRejectBadWindow, NULL, NULL, NULL);
+  AddTestCase (AllocatorTests, "Should reclaim buffers unmapped out of order", "DmaBufferAllocator.OutOfOrder", ShouldReclaimOutOfOrderUnmaps, NULL, NULL, NULL);
+  AddTestCase (AllocatorTests, "Should not leak over many interleaved traces", "DmaBufferAllocator.NoLeak", ShouldNotLeakOverManyInterleavedTraces, NULL, NULL, NULL);
+  AddTestCase (AllocatorTests, "Should keep common buffers page aligned at the top", "DmaBufferAllocator.TopAligned", ShouldKeepCommonBuffersPageAlignedAtTop, NULL, NULL, NULL);
+  AddTestCase (AllocatorTests, "Should reject a double free", "DmaBufferAllocator.DoubleFree", ShouldRejectDoubleFree, NULL, NULL, NULL);
+  AddTestCase (AllocatorTests, "Should recover after exhaustion", "DmaBufferAllocator.Exhaustion", ShouldRecoverAfterExhaustion, NULL, NULL, NULL);
+  AddTestCase (AllocatorTests, "Should detect ranges inside the window", "DmaBufferAllocator.InWindow", ShouldDetectInWindowRanges, NULL, NULL, NULL);
+
+  //
+  // Execute the tests.
+  //
+  Status = RunAllTestSuites (Framework);
+
+EXIT:
+  if (Framework != NULL) {
+    FreeUnitTestFramework (Framework);
+  }
+
+  return Status;
+}
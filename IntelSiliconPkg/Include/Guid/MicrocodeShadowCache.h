@@ -0,0 +1,78 @@
+/** @file
+  The definition for the Microcode Shadow Cache.
+
+  ShadowMicrocodePei lays the shadowed microcode patches out behind a cache
+  header and describes the cache with a GUIDed HOB. ShadowMicrocodeCacheDxe
+  saves the cache into a LockBox with the same GUID, so ShadowMicrocodePei
+  can restore the patches on S3 resume without reading them from flash.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+**/
+
+#ifndef _MICROCODE_SHADOW_CACHE_H_
+#define _MICROCODE_SHADOW_CACHE_H_
+
+///
+/// The Global ID of the GUIDed HOB and the LockBox of the microcode shadow cache.
+///
+#define EDKII_MICROCODE_SHADOW_CACHE_GUID \
+  { \
+    0x3f1c2a87, 0x5b0e, 0x4d8a, { 0x9e, 0x61, 0x2c, 0x47, 0xd0, 0x93, 0xb8, 0x1a } \
+  }
+
+extern EFI_GUID  gEdkiiMicrocodeShadowCacheGuid;
+
+#define MICROCODE_SHADOW_CACHE_SIGNATURE  SIGNATURE_32 ('M', 'C', 'S', 'C')
+
+///
+/// The microcode patches are placed at DataOffset, which keeps the 16-byte
+/// alignment required by the microcode update trigger.
+///
+#define MICROCODE_SHADOW_CACHE_DATA_ALIGNMENT  16
+
+typedef struct {
+  //
+  // MICROCODE_SHADOW_CACHE_SIGNATURE.
+  //
+  UINT32    Signature;
+  //
+  // CRC32 of the FIT microcode entries, the headers of the patches they
+  // point to and the CPU IDs the patches were filtered by. Each of them is
+  // hashed with the CRC32 of the ones before it.
+  //
+  UINT32    FitHash;
+  //
+  // Number of the microcode patches in the cache.
+  //
+  UINT32    PatchCount;
+  //
+  // Offset of the microcode patch data from the start of the cache.
+  //
+  UINT32    DataOffset;
+  //
+  // Total size of the microcode patch data.
+  //
+  UINT64    DataSize;
+  UINT64    Reserved;
+  //
+  // An array with PatchCount elements that stores the original microcode
+  // patch address on flash.
+  //
+  // UINT64  MicrocodeAddressInFlash[PatchCount];
+  //
+  // An array with PatchCount elements that stores the offset of each
+  // microcode patch from the start of the patch data.
+  //
+  // UINT64  MicrocodeOffsetInData[PatchCount];
+} EDKII_MICROCODE_SHADOW_CACHE_HEADER;
+
+///
+/// The content of the GUIDed HOB that describes the cache built in this boot.
+///
+typedef struct {
+  EFI_PHYSICAL_ADDRESS    CacheBase;
+  UINT64                  CacheSize;
+} EDKII_MICROCODE_SHADOW_CACHE_HOB;
+
+#endif
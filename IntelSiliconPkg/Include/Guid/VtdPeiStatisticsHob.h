@@ -0,0 +1,92 @@
+/** @file
+  The definition for VTd PEI Statistics Hob.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+**/
+
+#ifndef _VTD_PEI_STATISTICS_HOB_H_
+#define _VTD_PEI_STATISTICS_HOB_H_
+
+///
+/// The Global ID of a GUIDed HOB used by the VTd PEI drivers to pass their
+/// boot time statistics to the VTd DXE driver.
+///
+#define VTD_PEI_STATISTICS_HOB_GUID \
+  { \
+    0xa2508d3c, 0x0201, 0x4cd5, { 0xb6, 0x97, 0x56, 0x19, 0x32, 0x72, 0x95, 0xf7 } \
+  }
+
+extern EFI_GUID  gVtdPeiStatisticsHobGuid;
+
+#define VTD_PEI_STATISTICS_HOB_REVISION  2
+
+typedef enum {
+  //
+  // DMAR ACPI table parsing and VTd engine information setup.
+  //
+  VtdPeiPhaseParseDmar,
+  //
+  // DMA buffer allocation and initialization.
+  //
+  VtdPeiPhaseDmaBufferInit,
+  //
+  // Translation table construction.
+  //
+  VtdPeiPhaseTranslationTable,
+  //
+  // PMR programming or DMAR translation enabling.
+  //
+  VtdPeiPhaseProtection,
+  //
+  // Context cache and IOTLB invalidations. This time is also accounted to
+  // the enclosing translation table or protection phase.
+  //
+  VtdPeiPhaseInvalidation,
+  //
+  // Bounce buffer copies in IoMmu Map/Unmap.
+  //
+  VtdPeiPhaseBounceCopy,
+  VtdPeiPhaseMax
+} VTD_PEI_PHASE;
+
+typedef struct {
+  //
+  // Accumulated time spent in the phase, in TSC ticks. See TickFrequency.
+  //
+  UINT64    Ticks;
+  //
+  // Number of times the phase was entered.
+  //
+  UINT64    Count;
+} VTD_PEI_PHASE_STATISTICS;
+
+typedef struct {
+  UINT32                      Revision;
+  UINT32                      Reserved;
+  VTD_PEI_PHASE_STATISTICS    Phase[VtdPeiPhaseMax];
+  //
+  // Number of successful IoMmu Map calls.
+  //
+  UINT64                      MapCount;
+  //
+  // Number of Map calls that used a bounce buffer.
+  //
+  UINT64                      BounceCount;
+  //
+  // Total bytes copied to or from bounce buffers.
+  //
+  UINT64                      BytesBounced;
+  //
+  // Size of the DMA buffer window and the peak number of bytes in use.
+  //
+  UINT64                      DmaBufferSize;
+  UINT64                      PeakDmaBufferUsage;
+  //
+  // The frequency of the TSC in Hz, from CPUID leaf 0x15. 0 if the CPU does
+  // not report it.
+  //
+  UINT64                      TickFrequency;
+} VTD_PEI_STATISTICS_HOB;
+
+#endif // _VTD_PEI_STATISTICS_HOB_H_
@@ -0,0 +1,146 @@
+/** @file
+  Range allocator for the DMA buffer window used by the VTd PEI drivers.
+
+  The allocator keeps an address ordered list of free ranges in the caller
+  provided DMA_BUFFER_ALLOCATOR structure. None of the allocator state lives
+  inside the DMA window itself, so a bus master that can write the window
+  cannot corrupt it. Callers must keep their own bookkeeping of the ranges,
+  such as the mappings of the bounce buffers, outside the window as well.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef __DMA_BUFFER_ALLOCATOR_LIB_H__
+#define __DMA_BUFFER_ALLOCATOR_LIB_H__
+
+//
+// Every allocation is rounded up to this size, so all free range boundaries
+// stay aligned to it.
+//
+#define DMA_BUFFER_ALLOCATOR_GRANULARITY  0x40
+
+//
+// Maximum number of discontiguous free ranges that can be tracked.
+//
+#define DMA_BUFFER_ALLOCATOR_MAX_FREE_RANGES  64
+
+typedef struct {
+  UINTN    Base;
+  UINTN    Length;
+} DMA_BUFFER_RANGE;
+
+typedef struct {
+  UINTN               Base;
+  UINTN               Size;
+  UINTN               FreeSize;
+  UINTN               FreeRangeCount;
+  DMA_BUFFER_RANGE    FreeRange[DMA_BUFFER_ALLOCATOR_MAX_FREE_RANGES];
+} DMA_BUFFER_ALLOCATOR;
+
+/**
+  Initialize an allocator to manage the window [Base, Base + Size).
+
+  @param[out] Allocator     The allocator to initialize.
+  @param[in]  Base          The base address of the DMA window.
+  @param[in]  Size          The size of the DMA window in bytes.
+
+  @retval EFI_SUCCESS            The allocator is initialized.
+  @retval EFI_INVALID_PARAMETER  Allocator is NULL, Size is 0, or Base/Size
+                                 are not aligned to DMA_BUFFER_ALLOCATOR_GRANULARITY.
+**/
+EFI_STATUS
+EFIAPI
+DmaBufferAllocatorInit (
+  OUT DMA_BUFFER_ALLOCATOR  *Allocator,
+  IN  UINTN                 Base,
+  IN  UINTN                 Size
+  );
+
+/**
+  Return if the allocator has been initialized.
+
+  @param[in]  Allocator     The allocator.
+
+  @retval TRUE   The allocator manages a DMA window.
+  @retval FALSE  The allocator has not been initialized yet.
+**/
+BOOLEAN
+EFIAPI
+DmaBufferAllocatorIsReady (
+  IN CONST DMA_BUFFER_ALLOCATOR  *Allocator
+  );
+
+/**
+  Allocate a range from the DMA window.
+
+  Allocations from the bottom return the lowest fitting address and are
+  intended for short lived bounce buffers. Allocations from the top return
+  the highest fitting address and are intended for long lived common buffers,
+  which keeps the two kinds from fragmenting each other.
+
+  @param[in]  Allocator     The allocator.
+  @param[in]  Length        The number of bytes to allocate.
+  @param[in]  Alignment     The required alignment of the returned address.
+                            Must be 0 or a power of 2.
+  @param[in]  FromTop       TRUE to allocate from the top of the window.
+  @param[out] Address       The allocated address.
+
+  @retval EFI_SUCCESS            The range is allocated.
+  @retval EFI_INVALID_PARAMETER  A parameter is invalid.
+  @retval EFI_NOT_READY          The allocator is not initialized.
+  @retval EFI_OUT_OF_RESOURCES   No free range can satisfy the request.
+**/
+EFI_STATUS
+EFIAPI
+DmaBufferAllocate (
+  IN  DMA_BUFFER_ALLOCATOR  *Allocator,
+  IN  UINTN                 Length,
+  IN  UINTN                 Alignment,
+  IN  BOOLEAN               FromTop,
+  OUT UINTN                 *Address
+  );
+
+/**
+  Return a range to the DMA window, merging it with adjacent free ranges.
+
+  @param[in]  Allocator     The allocator.
+  @param[in]  Address       The address returned by DmaBufferAllocate().
+  @param[in]  Length        The length passed to DmaBufferAllocate().
+
+  @retval EFI_SUCCESS            The range is freed.
+  @retval EFI_INVALID_PARAMETER  The range is outside the window or overlaps
+                                 a range that is already free.
+  @retval EFI_NOT_READY          The allocator is not initialized.
+  @retval EFI_OUT_OF_RESOURCES   The free range list is full. The range is
+                                 not reclaimed.
+**/
+EFI_STATUS
+EFIAPI
+DmaBufferFree (
+  IN DMA_BUFFER_ALLOCATOR  *Allocator,
+  IN UINTN                 Address,
+  IN UINTN                 Length
+  );
+
+/**
+  Return if [Address, Address + Length) lies entirely inside the DMA window.
+
+  @param[in]  Allocator     The allocator.
+  @param[in]  Address       The start of the range.
+  @param[in]  Length        The length of the range.
+
+  @retval TRUE   The range is inside the window.
+  @retval FALSE  The range is not inside the window, or the allocator is not
+                 initialized.
+**/
+BOOLEAN
+EFIAPI
+DmaBufferIsInWindow (
+  IN CONST DMA_BUFFER_ALLOCATOR  *Allocator,
+  IN UINTN                       Address,
+  IN UINTN                       Length
+  );
+
+#endif
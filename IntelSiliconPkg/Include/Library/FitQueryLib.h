@@ -27,6 +27,36 @@ typedef UINT8 FIT_ENTRY_TYPE;
 #define GET_SIZE_FROM_FIT_ENTRY(FitEntry) \
     ((*((UINT32*)(&FitEntry.Size))) & 0x00FFFFFF)
 
+//
+// The type field of a FIT entry is 7 bits wide.
+//
+#define FIT_TYPE_COUNT  0x80
+
+//
+// Per-type index of the FIT, built once by BuildFitRecordIndex().
+// Entries holds the FIT entry numbers grouped by type, in FIT order within
+// a type. The entries of type T are Entries[TypeStart[T]] up to, but not
+// including, Entries[TypeStart[T + 1]].
+//
+typedef struct _FIT_RECORD_INDEX {
+  CONST FIRMWARE_INTERFACE_TABLE_ENTRY    *FitBase;
+  UINT32                                  *Entries;
+  UINT32                                  EntryCount;
+  UINT32                                  TypeStart[FIT_TYPE_COUNT + 1];
+} FIT_RECORD_INDEX;
+
+//
+// State of a walk over the FIT records of one type.
+// It is initialized by InitFitRecordIterator() and must not be modified by the caller.
+//
+typedef struct _FIT_RECORD_ITERATOR {
+  CONST FIRMWARE_INTERFACE_TABLE_ENTRY    *FitBase;
+  CONST FIT_RECORD_INDEX                  *Index;
+  UINT32                                  EntryCount;
+  UINT32                                  Next;
+  UINT8                                   RecordType;
+} FIT_RECORD_ITERATOR;
+
 /**
   This helper will walk the FIT and locate a record.
 
@@ -50,4 +80,99 @@ GetFitRecord (
   OUT FIT_QUERY_RESULT  *Result
   );
 
+/**
+  Start a walk over the FIT records of one type.
+
+  Enumerating all the records of a type with GetNextFitRecord() reads every
+  FIT entry at most once, instead of walking the FIT again for each record.
+
+  @param[in]  RecordType    The type identifier of the records.
+  @param[in]  Index         Optional index built by BuildFitRecordIndex(). If it is
+                            provided, only the records of RecordType are read.
+  @param[out] Iterator      Pointer to the FIT_RECORD_ITERATOR to initialize.
+
+  @retval     EFI_SUCCESS             The iterator is initialized.
+  @retval     EFI_INVALID_PARAMETER   RecordType does not match a known record.
+  @retval     EFI_INVALID_PARAMETER   Iterator is NULL.
+  @retval     EFI_COMPROMISED_DATA    Could not locate the FIT at all.
+
+**/
+EFI_STATUS
+EFIAPI
+InitFitRecordIterator (
+  IN UINT8                   RecordType,
+  IN CONST FIT_RECORD_INDEX  *Index  OPTIONAL,
+  OUT FIT_RECORD_ITERATOR    *Iterator
+  );
+
+/**
+  Return the next FIT record of a walk started by InitFitRecordIterator().
+
+  @param[in, out] Iterator    Pointer to the FIT_RECORD_ITERATOR.
+  @param[out]     Result      Pointer to the FIT_QUERY_RESULT output structure.
+
+  @retval     EFI_SUCCESS             Record was returned.
+  @retval     EFI_INVALID_PARAMETER   Iterator or Result is NULL.
+  @retval     EFI_NOT_FOUND           There are no more records of the type.
+
+**/
+EFI_STATUS
+EFIAPI
+GetNextFitRecord (
+  IN OUT FIT_RECORD_ITERATOR  *Iterator,
+  OUT FIT_QUERY_RESULT        *Result
+  );
+
+/**
+  Build a per-type index of the FIT with a counting sort of its entries.
+
+  The FIT is walked twice: the first pass counts the entries of each type,
+  and the second places each entry number in the range of its type, in FIT
+  order. After that, GetIndexedFitRecord() returns any record without
+  walking the FIT.
+
+  @param[out]     Index       Pointer to the FIT_RECORD_INDEX to build.
+  @param[out]     Buffer      The buffer that receives the entry numbers. It is referenced by Index,
+                              and must stay valid while Index is used.
+  @param[in, out] BufferCount On input, the number of UINT32 elements in Buffer.
+                              On output, the number of FIT entries.
+
+  @retval     EFI_SUCCESS             The index is built.
+  @retval     EFI_INVALID_PARAMETER   Index or BufferCount is NULL.
+  @retval     EFI_BUFFER_TOO_SMALL    Buffer is too small. BufferCount returns the required count.
+  @retval     EFI_COMPROMISED_DATA    Could not locate the FIT at all.
+
+**/
+EFI_STATUS
+EFIAPI
+BuildFitRecordIndex (
+  OUT FIT_RECORD_INDEX  *Index,
+  OUT UINT32            *Buffer  OPTIONAL,
+  IN OUT UINT32         *BufferCount
+  );
+
+/**
+  Locate a record with an index built by BuildFitRecordIndex().
+
+  @param[in]  Index         Pointer to the FIT_RECORD_INDEX.
+  @param[in]  RecordType    The type identifier of the record.
+  @param[in]  RecordIndex   For records that allow multiple entries, this is the entry
+                            being requested. 0-based.
+  @param[out] Result        Pointer to the FIT_QUERY_RESULT output structure.
+
+  @retval     EFI_SUCCESS             Record was returned.
+  @retval     EFI_INVALID_PARAMETER   RecordType does not match a known record.
+  @retval     EFI_INVALID_PARAMETER   Index or Result is NULL.
+  @retval     EFI_NOT_FOUND           A matching record could not be found.
+
+**/
+EFI_STATUS
+EFIAPI
+GetIndexedFitRecord (
+  IN CONST FIT_RECORD_INDEX  *Index,
+  IN UINT8                   RecordType,
+  IN UINT16                  RecordIndex,
+  OUT FIT_QUERY_RESULT       *Result
+  );
+
 #endif // _FIT_QUERY_LIB_H_
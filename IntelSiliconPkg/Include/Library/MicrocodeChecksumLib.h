@@ -0,0 +1,38 @@
+/** @file
+  Checksum services for microcode patches.
+
+  Microcode patches are hundreds of KB and are summed as 32-bit dwords when
+  they are verified. The library selects an SSE2 or AVX2 kernel by CPUID and
+  falls back to the scalar CalculateSum32() otherwise.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef __MICROCODE_CHECKSUM_LIB_H__
+#define __MICROCODE_CHECKSUM_LIB_H__
+
+/**
+  Return the sum of all 32-bit elements of a buffer.
+
+  The result is identical to CalculateSum32() in BaseLib.
+
+  If Buffer is NULL, then ASSERT().
+  If Buffer is not aligned on a 32-bit boundary, then ASSERT().
+  If Length is not aligned on a 32-bit boundary, then ASSERT().
+  If Length is greater than (MAX_ADDRESS - Buffer + 1), then ASSERT().
+
+  @param[in]  Buffer      The pointer to the buffer to sum.
+  @param[in]  Length      The size, in bytes, of Buffer.
+
+  @return The sum of all 32-bit elements of Buffer.
+**/
+UINT32
+EFIAPI
+MicrocodeCalculateSum32 (
+  IN CONST UINT32  *Buffer,
+  IN UINTN         Length
+  );
+
+#endif
@@ -21,6 +21,38 @@
 
 #define SECTOR_SIZE_4KB  0x1000       // Common 4kBytes sector size
 
+///
+/// One range of a vectored flash write.
+///
+typedef struct {
+  UINTN     Address;  ///< The starting physical address of the write.
+  UINT32    NumBytes; ///< On input, the number of bytes to write. On output, the number of bytes written.
+  UINT8     *Buffer;  ///< The source data buffer for the write.
+} SPI_FLASH_WRITE_VECTOR;
+
+//
+// The fast read modes of SPI_FLASH_GEOMETRY, named by the number of data
+// lines used for the command, the address and the data.
+//
+#define SPI_FLASH_FAST_READ_1_1_2  BIT0
+#define SPI_FLASH_FAST_READ_1_2_2  BIT1
+#define SPI_FLASH_FAST_READ_1_1_4  BIT2
+#define SPI_FLASH_FAST_READ_1_4_4  BIT3
+#define SPI_FLASH_FAST_READ_2_2_2  BIT4
+#define SPI_FLASH_FAST_READ_4_4_4  BIT5
+#define SPI_FLASH_FAST_READ_DTR    BIT6
+
+///
+/// The geometry of the flash part, as discovered from its SFDP.
+///
+typedef struct {
+  UINT64    FlashSize;     ///< The size of the part in bytes.
+  UINT32    EraseSizes;    ///< The erase sizes of the part. Bit N set means 2^N bytes.
+  UINT32    PageSize;      ///< The page program size in bytes.
+  UINT32    FastReadModes; ///< The SPI_FLASH_FAST_READ_* modes of the part.
+  UINT8     AddressBytes;  ///< The largest number of address bytes the part accepts.
+} SPI_FLASH_GEOMETRY;
+
 /**
   Enable block protection on the Serial Flash device.
 
@@ -76,6 +108,29 @@ SpiFlashWrite (
   IN     UINT8   *Buffer
   );
 
+/**
+  Write a list of ranges to the flash, then enable block protection and
+  flush the data cache once over the union of the ranges.
+
+  Every range is checked before any of them is written. Each range is sent
+  to the flash controller as a single write.
+
+  @param[in,out]  Vector          The ranges to write. On output, NumBytes of each
+                                  range is the actual number of bytes written.
+  @param[in]      VectorCount     The number of ranges in Vector.
+
+  @retval         EFI_SUCCESS            Operation is successful.
+  @retval         EFI_DEVICE_ERROR       If there is any device errors.
+  @retval         EFI_INVALID_PARAMETER  Invalid parameter.
+
+**/
+EFI_STATUS
+EFIAPI
+SpiFlashWriteVector (
+  IN OUT SPI_FLASH_WRITE_VECTOR  *Vector,
+  IN     UINTN                   VectorCount
+  );
+
 /**
   Erase the block starting at Address.
 
@@ -96,4 +151,23 @@ SpiFlashBlockErase (
   IN    UINTN  *NumBytes
   );
 
+/**
+  Get the geometry of the flash part.
+
+  The geometry is read from the SFDP of the part when the library is
+  initialized.
+
+  @param[out] Geometry        The geometry of the flash part.
+
+  @retval     EFI_SUCCESS            Geometry is filled.
+  @retval     EFI_INVALID_PARAMETER  Geometry is NULL.
+  @retval     EFI_UNSUPPORTED        The geometry of the part is not known.
+
+**/
+EFI_STATUS
+EFIAPI
+SpiFlashGetGeometry (
+  OUT SPI_FLASH_GEOMETRY  *Geometry
+  );
+
 #endif
@@ -0,0 +1,76 @@
+/** @file
+  The definition for VTD DMA buffer PPI.
+
+  This PPI is produced by the VTd PEI drivers once the DMA buffer window is
+  available. Buffers allocated through it are already reachable by bus
+  masters, so a later Map() of such a buffer through EDKII_IOMMU_PPI returns
+  the buffer itself and no bounce copy is made.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef __VTD_DMA_BUFFER_PPI_H__
+#define __VTD_DMA_BUFFER_PPI_H__
+
+#define EDKII_VTD_DMA_BUFFER_PPI_GUID \
+    { \
+      0x03f89d08, 0xd7ff, 0x48ee, { 0x90, 0x00, 0xf6, 0x82, 0x80, 0xfe, 0x82, 0xb2 } \
+    }
+
+typedef struct _EDKII_VTD_DMA_BUFFER_PPI EDKII_VTD_DMA_BUFFER_PPI;
+
+#define EDKII_VTD_DMA_BUFFER_PPI_REVISION  0x00010000
+
+/**
+  Allocate a buffer from the DMA buffer window.
+
+  @param[in]  This              The PPI instance pointer.
+  @param[in]  Length            The number of bytes to allocate.
+  @param[in]  Alignment         The required alignment of the buffer. Must be
+                                0 or a power of 2.
+  @param[out] HostAddress       The allocated buffer.
+
+  @retval EFI_SUCCESS            The buffer is allocated.
+  @retval EFI_INVALID_PARAMETER  One or more parameters are invalid.
+  @retval EFI_OUT_OF_RESOURCES   The DMA buffer window is exhausted.
+  @retval EFI_NOT_AVAILABLE_YET  The DMA buffer window is not available yet.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EDKII_VTD_DMA_BUFFER_ALLOCATE)(
+  IN  EDKII_VTD_DMA_BUFFER_PPI  *This,
+  IN  UINTN                     Length,
+  IN  UINTN                     Alignment,
+  OUT VOID                      **HostAddress
+  );
+
+/**
+  Free a buffer allocated with AllocateBuffer().
+
+  @param[in]  This              The PPI instance pointer.
+  @param[in]  HostAddress       The buffer returned by AllocateBuffer().
+  @param[in]  Length            The length passed to AllocateBuffer().
+
+  @retval EFI_SUCCESS            The buffer is freed.
+  @retval EFI_INVALID_PARAMETER  The buffer was not allocated with AllocateBuffer().
+  @retval EFI_NOT_AVAILABLE_YET  The DMA buffer window is not available yet.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EDKII_VTD_DMA_BUFFER_FREE)(
+  IN  EDKII_VTD_DMA_BUFFER_PPI  *This,
+  IN  VOID                      *HostAddress,
+  IN  UINTN                     Length
+  );
+
+struct _EDKII_VTD_DMA_BUFFER_PPI {
+  UINT64                           Revision;
+  EDKII_VTD_DMA_BUFFER_ALLOCATE    AllocateBuffer;
+  EDKII_VTD_DMA_BUFFER_FREE        FreeBuffer;
+};
+
+extern EFI_GUID  gEdkiiVTdDmaBufferPpiGuid;
+
+#endif
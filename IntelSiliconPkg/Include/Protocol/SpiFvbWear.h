@@ -0,0 +1,100 @@
+/** @file
+  SPI FVB Wear Protocol definition
+
+  The SPI FVB service counts the erases and programs of each block of the
+  firmware volumes it manages, and saves the counters to flash from time to
+  time. This MM protocol, and the MMI handler registered with the same GUID,
+  report the counters so the wear of the flash can be monitored.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef __SPI_FVB_WEAR_PROTOCOL_H__
+#define __SPI_FVB_WEAR_PROTOCOL_H__
+
+#include <Uefi.h>
+
+#define SPI_FVB_WEAR_PROTOCOL_GUID \
+  { \
+    0x4ac4b171, 0xc225, 0x4584, { 0xbb, 0x85, 0xc3, 0xac, 0xf9, 0x12, 0x6a, 0xa0 } \
+  }
+
+typedef struct _SPI_FVB_WEAR_PROTOCOL SPI_FVB_WEAR_PROTOCOL;
+
+///
+/// The wear counters of one firmware volume block.
+///
+typedef struct {
+  UINT64    Address;      ///< The memory mapped flash address of the block.
+  UINT32    Length;       ///< The size of the block in bytes.
+  UINT32    EraseCount;   ///< The number of times the block was erased.
+  UINT32    ProgramCount; ///< The number of writes that programmed the block.
+  UINT32    Reserved;
+} SPI_FVB_WEAR_BLOCK;
+
+/**
+  Get the wear counters of every block.
+
+  @param[in]      This            The protocol instance.
+  @param[in, out] BlockCount      On input, the number of entries in Blocks. On output,
+                                  the number of blocks with counters.
+  @param[out]     Blocks          The counters of the blocks.
+
+  @retval EFI_SUCCESS             Blocks is filled.
+  @retval EFI_BUFFER_TOO_SMALL    Blocks is too small. BlockCount is the number of entries needed.
+  @retval EFI_INVALID_PARAMETER   BlockCount is NULL, or Blocks is NULL and *BlockCount is not 0.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *SPI_FVB_WEAR_GET_COUNTERS)(
+  IN     SPI_FVB_WEAR_PROTOCOL  *This,
+  IN OUT UINTN                  *BlockCount,
+  OUT    SPI_FVB_WEAR_BLOCK     *Blocks
+  );
+
+/**
+  Save the wear counters to flash now.
+
+  @param[in]      This            The protocol instance.
+
+  @retval EFI_SUCCESS             The counters are saved.
+  @retval EFI_UNSUPPORTED         No flash area is reserved for the counters.
+  @retval Others                  The counters could not be written to flash.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *SPI_FVB_WEAR_SAVE)(
+  IN SPI_FVB_WEAR_PROTOCOL  *This
+  );
+
+struct _SPI_FVB_WEAR_PROTOCOL {
+  SPI_FVB_WEAR_GET_COUNTERS    GetCounters;
+  SPI_FVB_WEAR_SAVE            Save;
+};
+
+//
+// The functions of the MMI handler. SPI_FVB_WEAR_FUNCTION_SAVE returns
+// EFI_ACCESS_DENIED once MM is locked.
+//
+#define SPI_FVB_WEAR_FUNCTION_GET_COUNTERS  1
+#define SPI_FVB_WEAR_FUNCTION_SAVE          2
+
+///
+/// The communicate buffer of the MMI handler. For
+/// SPI_FVB_WEAR_FUNCTION_GET_COUNTERS, the SPI_FVB_WEAR_BLOCK entries follow
+/// the header, as many as fit in the communicate buffer.
+///
+typedef struct {
+  UINT64    Function;
+  UINT64    ReturnStatus;
+  //
+  // On output, the number of blocks with counters.
+  //
+  UINT64    BlockCount;
+} SPI_FVB_WEAR_COMMUNICATE_HEADER;
+
+extern EFI_GUID  gSpiFvbWearProtocolGuid;
+
+#endif
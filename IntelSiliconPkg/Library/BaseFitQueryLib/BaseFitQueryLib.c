@@ -42,6 +42,67 @@ InternalGetFitBase (
   return (FIRMWARE_INTERFACE_TABLE_ENTRY *)(UINTN)*FitBase;
 }
 
+/**
+  Internal helper that locates the FIT and checks that the FIT pointer is sane.
+
+  @retval     NULL    The FIT pointer is invalid.
+  @retval     Others  32-bit system address of the FIT base.
+
+**/
+STATIC
+CONST FIRMWARE_INTERFACE_TABLE_ENTRY *
+InternalGetCheckedFitBase (
+  VOID
+  )
+{
+  CONST FIRMWARE_INTERFACE_TABLE_ENTRY  *FitBase;
+
+  FitBase = InternalGetFitBase ();
+  if (((UINT32)(UINTN)FitBase < MIN_FIT_ADDRESS) || ((UINTN)FitBase > FIT_POINTER_ADDRESS)) {
+    return NULL;
+  }
+
+  return FitBase;
+}
+
+/**
+  Internal helper that checks if a record type can be queried.
+
+  @param[in]  RecordType    The type identifier of the record.
+
+  @retval     TRUE    RecordType is a known record type.
+  @retval     FALSE   RecordType is reserved or undefined.
+
+**/
+STATIC
+BOOLEAN
+InternalIsKnownFitRecordType (
+  IN UINT8  RecordType
+  )
+{
+  if ((RecordType >= FIT_TYPE_PLAT_MIN) && (RecordType <= FIT_TYPE_PLAT_MAX)) {
+    return TRUE;
+  }
+
+  switch (RecordType) {
+    case FIT_TYPE_00_HEADER:
+    case FIT_TYPE_01_MICROCODE:
+    case FIT_TYPE_02_STARTUP_ACM:
+    case FIT_TYPE_07_BIOS_STARTUP_MODULE:
+    case FIT_TYPE_08_TPM_POLICY:
+    case FIT_TYPE_09_BIOS_POLICY:
+    case FIT_TYPE_0A_TXT_POLICY:
+    case FIT_TYPE_0B_KEY_MANIFEST:
+    case FIT_TYPE_0C_BOOT_POLICY_MANIFEST:
+    case FIT_TYPE_10_CSE_SECURE_BOOT:
+    case FIT_TYPE_2D_TXTSX_POLICY:      // cspell:disable-line
+    case FIT_TYPE_2F_JMP_DEBUG_POLICY:
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
 /**
   This internal helper does all the heavy lifting for GetFitRecord(), but in a testable way.
 
@@ -73,24 +134,8 @@ InternalGetFitRecord (
   }
 
   // Check to make sure the requested record type is valid.
-  if ((RecordType < FIT_TYPE_PLAT_MIN) || (RecordType > FIT_TYPE_PLAT_MAX)) {
-    switch (RecordType) {
-      case FIT_TYPE_00_HEADER:
-      case FIT_TYPE_01_MICROCODE:
-      case FIT_TYPE_02_STARTUP_ACM:
-      case FIT_TYPE_07_BIOS_STARTUP_MODULE:
-      case FIT_TYPE_08_TPM_POLICY:
-      case FIT_TYPE_09_BIOS_POLICY:
-      case FIT_TYPE_0A_TXT_POLICY:
-      case FIT_TYPE_0B_KEY_MANIFEST:
-      case FIT_TYPE_0C_BOOT_POLICY_MANIFEST:
-      case FIT_TYPE_10_CSE_SECURE_BOOT:
-      case FIT_TYPE_2D_TXTSX_POLICY:      // cspell:disable-line
-      case FIT_TYPE_2F_JMP_DEBUG_POLICY:
-        break;
-      default:
-        return EFI_INVALID_PARAMETER;
-    }
+  if (!InternalIsKnownFitRecordType (RecordType)) {
+    return EFI_INVALID_PARAMETER;
   }
 
   // Now that we're sure we have a good request, let's check the FIT.
@@ -118,6 +163,125 @@ InternalGetFitRecord (
   return Status;
 }
 
+/**
+  This internal helper does all the heavy lifting for InitFitRecordIterator(), but in a testable way.
+
+  @param[in]  FitBase       A pointer to the FIT. Ignored if Index is provided.
+  @param[in]  RecordType    Same as InitFitRecordIterator()
+  @param[in]  Index         Same as InitFitRecordIterator()
+  @param[out] Iterator      Same as InitFitRecordIterator()
+
+  @retval     Others  Same as InitFitRecordIterator()
+
+**/
+STATIC
+EFI_STATUS
+InternalInitFitRecordIterator (
+  IN CONST FIRMWARE_INTERFACE_TABLE_ENTRY  *FitBase,
+  IN UINT8                                 RecordType,
+  IN CONST FIT_RECORD_INDEX                *Index  OPTIONAL,
+  OUT FIT_RECORD_ITERATOR                  *Iterator
+  )
+{
+  if ((Iterator == NULL) || ((FitBase == NULL) && (Index == NULL))) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (!InternalIsKnownFitRecordType (RecordType)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Iterator->RecordType = RecordType;
+  Iterator->Index      = Index;
+
+  // With an index, walk only the entry numbers of this type.
+  if (Index != NULL) {
+    Iterator->FitBase    = Index->FitBase;
+    Iterator->Next       = Index->TypeStart[RecordType];
+    Iterator->EntryCount = Index->TypeStart[RecordType + 1];
+    return EFI_SUCCESS;
+  }
+
+  if (FitBase->Address != FIT_TYPE_00_SIGNATURE) {
+    return EFI_COMPROMISED_DATA;
+  }
+
+  Iterator->FitBase    = FitBase;
+  Iterator->Next       = 0;
+  Iterator->EntryCount = GET_SIZE_FROM_FIT_ENTRY (FitBase[0]);  // For the header entry, the size IS the count.
+  return EFI_SUCCESS;
+}
+
+/**
+  This internal helper does all the heavy lifting for BuildFitRecordIndex(), but in a testable way.
+
+  @param[in]      FitBase       A pointer to the FIT.
+  @param[out]     Index         Same as BuildFitRecordIndex()
+  @param[out]     Buffer        Same as BuildFitRecordIndex()
+  @param[in, out] BufferCount   Same as BuildFitRecordIndex()
+
+  @retval     Others  Same as BuildFitRecordIndex()
+
+**/
+STATIC
+EFI_STATUS
+InternalBuildFitRecordIndex (
+  IN CONST FIRMWARE_INTERFACE_TABLE_ENTRY  *FitBase,
+  OUT FIT_RECORD_INDEX                     *Index,
+  OUT UINT32                               *Buffer  OPTIONAL,
+  IN OUT UINT32                            *BufferCount
+  )
+{
+  UINT32  Count;
+  UINT32  Entry;
+  UINT32  Type;
+  UINT32  Cursor[FIT_TYPE_COUNT];
+
+  if ((FitBase == NULL) || (Index == NULL) || (BufferCount == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (FitBase->Address != FIT_TYPE_00_SIGNATURE) {
+    return EFI_COMPROMISED_DATA;
+  }
+
+  Count = GET_SIZE_FROM_FIT_ENTRY (FitBase[0]);  // For the header entry, the size IS the count.
+  if ((Buffer == NULL) || (*BufferCount < Count)) {
+    *BufferCount = Count;
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  *BufferCount = Count;
+
+  for (Type = 0; Type <= FIT_TYPE_COUNT; Type++) {
+    Index->TypeStart[Type] = 0;
+  }
+
+  // Count the entries of each type.
+  for (Entry = 0; Entry < Count; Entry++) {
+    Index->TypeStart[FitBase[Entry].Type + 1] += 1;
+  }
+
+  for (Type = 1; Type <= FIT_TYPE_COUNT; Type++) {
+    Index->TypeStart[Type] += Index->TypeStart[Type - 1];
+  }
+
+  // Place each entry at the cursor of its type. Walking the FIT in order
+  // keeps the entries of one type in FIT order.
+  for (Type = 0; Type < FIT_TYPE_COUNT; Type++) {
+    Cursor[Type] = Index->TypeStart[Type];
+  }
+
+  for (Entry = 0; Entry < Count; Entry++) {
+    Buffer[Cursor[FitBase[Entry].Type]++] = Entry;
+  }
+
+  Index->FitBase    = FitBase;
+  Index->Entries    = Buffer;
+  Index->EntryCount = Count;
+  return EFI_SUCCESS;
+}
+
 /**
   This helper will walk the FIT and locate a record.
 
@@ -144,10 +308,181 @@ GetFitRecord (
 {
   CONST FIRMWARE_INTERFACE_TABLE_ENTRY  *FitBase;
 
-  FitBase = InternalGetFitBase ();
-  if (((UINT32)(UINTN)FitBase < MIN_FIT_ADDRESS) || ((UINTN)FitBase > FIT_POINTER_ADDRESS)) {
+  FitBase = InternalGetCheckedFitBase ();
+  if (FitBase == NULL) {
     return EFI_COMPROMISED_DATA;
   }
 
   return InternalGetFitRecord (FitBase, RecordType, RecordIndex, Result);
 }
+
+/**
+  Start a walk over the FIT records of one type.
+
+  Enumerating all the records of a type with GetNextFitRecord() reads every
+  FIT entry at most once, instead of walking the FIT again for each record.
+
+  @param[in]  RecordType    The type identifier of the records.
+  @param[in]  Index         Optional index built by BuildFitRecordIndex(). If it is
+                            provided, only the records of RecordType are read.
+  @param[out] Iterator      Pointer to the FIT_RECORD_ITERATOR to initialize.
+
+  @retval     EFI_SUCCESS             The iterator is initialized.
+  @retval     EFI_INVALID_PARAMETER   RecordType does not match a known record.
+  @retval     EFI_INVALID_PARAMETER   Iterator is NULL.
+  @retval     EFI_COMPROMISED_DATA    FIT pointer is invalid.
+  @retval     EFI_COMPROMISED_DATA    Could not locate the FIT at all.
+
+**/
+EFI_STATUS
+EFIAPI
+InitFitRecordIterator (
+  IN UINT8                   RecordType,
+  IN CONST FIT_RECORD_INDEX  *Index  OPTIONAL,
+  OUT FIT_RECORD_ITERATOR    *Iterator
+  )
+{
+  CONST FIRMWARE_INTERFACE_TABLE_ENTRY  *FitBase;
+
+  FitBase = NULL;
+  if (Index == NULL) {
+    FitBase = InternalGetCheckedFitBase ();
+    if (FitBase == NULL) {
+      return EFI_COMPROMISED_DATA;
+    }
+  }
+
+  return InternalInitFitRecordIterator (FitBase, RecordType, Index, Iterator);
+}
+
+/**
+  Return the next FIT record of a walk started by InitFitRecordIterator().
+
+  @param[in, out] Iterator    Pointer to the FIT_RECORD_ITERATOR.
+  @param[out]     Result      Pointer to the FIT_QUERY_RESULT output structure.
+
+  @retval     EFI_SUCCESS             Record was returned.
+  @retval     EFI_INVALID_PARAMETER   Iterator or Result is NULL.
+  @retval     EFI_NOT_FOUND           There are no more records of the type.
+
+**/
+EFI_STATUS
+EFIAPI
+GetNextFitRecord (
+  IN OUT FIT_RECORD_ITERATOR  *Iterator,
+  OUT FIT_QUERY_RESULT        *Result
+  )
+{
+  CONST FIRMWARE_INTERFACE_TABLE_ENTRY  *FitEntry;
+
+  if ((Iterator == NULL) || (Result == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (Iterator->Index == NULL) {
+    while ((Iterator->Next < Iterator->EntryCount) &&
+           (Iterator->FitBase[Iterator->Next].Type != Iterator->RecordType))
+    {
+      Iterator->Next++;
+    }
+  }
+
+  if (Iterator->Next >= Iterator->EntryCount) {
+    return EFI_NOT_FOUND;
+  }
+
+  if (Iterator->Index == NULL) {
+    FitEntry = &Iterator->FitBase[Iterator->Next];
+  } else {
+    FitEntry = &Iterator->FitBase[Iterator->Index->Entries[Iterator->Next]];
+  }
+
+  Iterator->Next++;
+
+  Result->BaseAddress = FitEntry->Address;
+  Result->Size        = GET_SIZE_FROM_FIT_ENTRY ((*FitEntry));
+  return EFI_SUCCESS;
+}
+
+/**
+  Build a per-type index of the FIT with a counting sort of its entries.
+
+  The FIT is walked twice: the first pass counts the entries of each type,
+  and the second places each entry number in the range of its type, in FIT
+  order. After that, GetIndexedFitRecord() returns any record without
+  walking the FIT.
+
+  @param[out]     Index       Pointer to the FIT_RECORD_INDEX to build.
+  @param[out]     Buffer      The buffer that receives the entry numbers. It is referenced by Index,
+                              and must stay valid while Index is used.
+  @param[in, out] BufferCount On input, the number of UINT32 elements in Buffer.
+                              On output, the number of FIT entries.
+
+  @retval     EFI_SUCCESS             The index is built.
+  @retval     EFI_INVALID_PARAMETER   Index or BufferCount is NULL.
+  @retval     EFI_BUFFER_TOO_SMALL    Buffer is too small. BufferCount returns the required count.
+  @retval     EFI_COMPROMISED_DATA    FIT pointer is invalid.
+  @retval     EFI_COMPROMISED_DATA    Could not locate the FIT at all.
+
+**/
+EFI_STATUS
+EFIAPI
+BuildFitRecordIndex (
+  OUT FIT_RECORD_INDEX  *Index,
+  OUT UINT32            *Buffer  OPTIONAL,
+  IN OUT UINT32         *BufferCount
+  )
+{
+  CONST FIRMWARE_INTERFACE_TABLE_ENTRY  *FitBase;
+
+  FitBase = InternalGetCheckedFitBase ();
+  if (FitBase == NULL) {
+    return EFI_COMPROMISED_DATA;
+  }
+
+  return InternalBuildFitRecordIndex (FitBase, Index, Buffer, BufferCount);
+}
+
+/**
+  Locate a record with an index built by BuildFitRecordIndex().
+
+  @param[in]  Index         Pointer to the FIT_RECORD_INDEX.
+  @param[in]  RecordType    The type identifier of the record.
+  @param[in]  RecordIndex   For records that allow multiple entries, this is the entry
+                            being requested. 0-based.
+  @param[out] Result        Pointer to the FIT_QUERY_RESULT output structure.
+
+  @retval     EFI_SUCCESS             Record was returned.
+  @retval     EFI_INVALID_PARAMETER   RecordType does not match a known record.
+  @retval     EFI_INVALID_PARAMETER   Index or Result is NULL.
+  @retval     EFI_NOT_FOUND           A matching record could not be found.
+
+**/
+EFI_STATUS
+EFIAPI
+GetIndexedFitRecord (
+  IN CONST FIT_RECORD_INDEX  *Index,
+  IN UINT8                   RecordType,
+  IN UINT16                  RecordIndex,
+  OUT FIT_QUERY_RESULT       *Result
+  )
+{
+  CONST FIRMWARE_INTERFACE_TABLE_ENTRY  *FitEntry;
+
+  if ((Index == NULL) || (Result == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (!InternalIsKnownFitRecordType (RecordType)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if ((UINT32)RecordIndex >= Index->TypeStart[RecordType + 1] - Index->TypeStart[RecordType]) {
+    return EFI_NOT_FOUND;
+  }
+
+  FitEntry            = &Index->FitBase[Index->Entries[Index->TypeStart[RecordType] + RecordIndex]];
+  Result->BaseAddress = FitEntry->Address;
+  Result->Size        = GET_SIZE_FROM_FIT_ENTRY ((*FitEntry));
+  return EFI_SUCCESS;
+}
@@ -12,12 +12,14 @@ SPDX-License-Identifier: BSD-2-Clause-Patent
 #include <stdarg.h>
 #include <stddef.h>
 #include <setjmp.h>
+#include <time.h>
 #include <cmocka.h>
 
 #include <Uefi.h>
 #include <Library/DebugLib.h>
 #include <Library/UnitTestLib.h>
 #include <Library/BaseLib.h>
+#include <Library/MemoryAllocationLib.h>
 #include <Library/FitQueryLib.h>
 
 #ifndef INTERNAL_UNIT_TEST
@@ -49,8 +51,118 @@ STATIC UINT8  SimpleFitData[] = {
   0x00, 0x20, 0xE8, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x5D, 0x05, 0x00, 0x00, 0x00, 0x01, 0x0C, 0x00,
 };
 
+//
+// Entry types of UnsortedFitData, in FIT order.
+//
+STATIC UINT8  UnsortedFitTypes[] = {
+  FIT_TYPE_00_HEADER,
+  FIT_TYPE_07_BIOS_STARTUP_MODULE,
+  FIT_TYPE_01_MICROCODE,
+  FIT_TYPE_02_STARTUP_ACM,
+  FIT_TYPE_01_MICROCODE,
+  FIT_TYPE_7F_SKIP,
+  FIT_TYPE_07_BIOS_STARTUP_MODULE,
+  FIT_TYPE_01_MICROCODE,
+};
+
+//
+// The number of entries in the synthetic FIT used to benchmark the queries,
+// and how many of them are microcode records.
+//
+#define LARGE_FIT_ENTRY_COUNT      0x2000
+#define LARGE_FIT_MICROCODE_COUNT  0x1800
+
 /// === HELPER FUNCTIONS ===========================================================================
 
+/**
+  Build a synthetic FIT. The address of every entry but the header is its entry number.
+
+  @param[in]  Types       The type of every entry, starting with the header.
+  @param[in]  EntryCount  The number of entries, including the header.
+
+  @return The FIT. The caller frees it with FreePool().
+**/
+STATIC
+FIRMWARE_INTERFACE_TABLE_ENTRY *
+BuildSyntheticFit (
+  IN CONST UINT8  *Types,
+  IN UINT32       EntryCount
+  )
+{
+  FIRMWARE_INTERFACE_TABLE_ENTRY  *Fit;
+  UINT32                          Index;
+
+  Fit = AllocateZeroPool (sizeof (FIRMWARE_INTERFACE_TABLE_ENTRY) * EntryCount);
+  if (Fit == NULL) {
+    return NULL;
+  }
+
+  for (Index = 0; Index < EntryCount; Index++) {
+    Fit[Index].Address = Index;
+    Fit[Index].Type    = Types[Index];
+    Fit[Index].Size[0] = (UINT8)Index;
+    Fit[Index].Size[1] = (UINT8)(Index >> 8);
+    Fit[Index].Size[2] = (UINT8)(Index >> 16);
+  }
+
+  Fit[0].Address = FIT_TYPE_00_SIGNATURE;
+  Fit[0].Size[0] = (UINT8)EntryCount;
+  Fit[0].Size[1] = (UINT8)(EntryCount >> 8);
+  Fit[0].Size[2] = (UINT8)(EntryCount >> 16);
+  return Fit;
+}
+
+/**
+  Build the synthetic FIT used to benchmark the queries. The microcode
+  records come first, as in a real FIT.
+
+  @return The FIT. The caller frees it with FreePool().
+**/
+STATIC
+FIRMWARE_INTERFACE_TABLE_ENTRY *
+BuildLargeFit (
+  VOID
+  )
+{
+  FIRMWARE_INTERFACE_TABLE_ENTRY  *Fit;
+  UINT8                           *Types;
+  UINT32                          Index;
+
+  Types = AllocatePool (LARGE_FIT_ENTRY_COUNT);
+  if (Types == NULL) {
+    return NULL;
+  }
+
+  Types[0] = FIT_TYPE_00_HEADER;
+  for (Index = 1; Index < LARGE_FIT_ENTRY_COUNT; Index++) {
+    if (Index <= LARGE_FIT_MICROCODE_COUNT) {
+      Types[Index] = FIT_TYPE_01_MICROCODE;
+    } else {
+      Types[Index] = FIT_TYPE_PLAT_MIN + (UINT8)(Index % (FIT_TYPE_PLAT_MAX - FIT_TYPE_PLAT_MIN + 1));
+    }
+  }
+
+  Fit = BuildSyntheticFit (Types, LARGE_FIT_ENTRY_COUNT);
+  FreePool (Types);
+  return Fit;
+}
+
+/**
+  Return the milliseconds elapsed since a clock() value.
+
+  @param[in]  Start   The clock() value at the start.
+
+  @return The elapsed milliseconds.
+**/
+STATIC
+UINT64
+ElapsedMilliseconds (
+  IN clock_t  Start
+  )
+{
+  return DivU64x32 (MultU64x32 ((UINT64)(clock () - Start), 1000), CLOCKS_PER_SEC);
+}
+
 /// === TEST CASES =================================================================================
 
 /// === INTERNAL PROTOTYPES ========================================================================
@@ -63,6 +175,22 @@ InternalGetFitRecord (
   OUT FIT_QUERY_RESULT                     *Result
   );
 
+EFI_STATUS
+InternalInitFitRecordIterator (
+  IN CONST FIRMWARE_INTERFACE_TABLE_ENTRY  *FitBase,
+  IN UINT8                                 RecordType,
+  IN CONST FIT_RECORD_INDEX                *Index  OPTIONAL,
+  OUT FIT_RECORD_ITERATOR                  *Iterator
+  );
+
+EFI_STATUS
+InternalBuildFitRecordIndex (
+  IN CONST FIRMWARE_INTERFACE_TABLE_ENTRY  *FitBase,
+  OUT FIT_RECORD_INDEX                     *Index,
+  OUT UINT32                               *Buffer  OPTIONAL,
+  IN OUT UINT32                            *BufferCount
+  );
+
 /// ===== INTERNAL FUNCTION SUITE ==============================================
 
 /**
@@ -200,6 +328,210 @@ ShouldReturnEfiNotFoundIfMissing (
   return UNIT_TEST_PASSED;
 }
 
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+ShouldIterateAllRecordsOfAType (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  FIT_RECORD_INDEX     Index;
+  UINT32               Buffer[7];
+  UINT32               BufferCount;
+  FIT_RECORD_ITERATOR  Iterator;
+  FIT_QUERY_RESULT     QueryResult;
+  UINTN                Pass;
+
+  BufferCount = ARRAY_SIZE (Buffer);
+  UT_ASSERT_NOT_EFI_ERROR (InternalBuildFitRecordIndex ((FIRMWARE_INTERFACE_TABLE_ENTRY *)SimpleFitData, &Index, Buffer, &BufferCount));
+  UT_ASSERT_EQUAL (BufferCount, 7);
+
+  //
+  // The first pass walks the FIT, the second one uses the index.
+  //
+  for (Pass = 0; Pass < 2; Pass++) {
+    UT_ASSERT_NOT_EFI_ERROR (
+      InternalInitFitRecordIterator (
+        (FIRMWARE_INTERFACE_TABLE_ENTRY *)SimpleFitData,
+        FIT_TYPE_01_MICROCODE,
+        (Pass == 0) ? NULL : &Index,
+        &Iterator
+        )
+      );
+
+    UT_ASSERT_NOT_EFI_ERROR (GetNextFitRecord (&Iterator, &QueryResult));
+    UT_ASSERT_EQUAL (QueryResult.BaseAddress, 0xFFB80060);
+    UT_ASSERT_NOT_EFI_ERROR (GetNextFitRecord (&Iterator, &QueryResult));
+    UT_ASSERT_EQUAL (QueryResult.BaseAddress, 0xFFB00060);
+    UT_ASSERT_STATUS_EQUAL (GetNextFitRecord (&Iterator, &QueryResult), EFI_NOT_FOUND);
+    UT_ASSERT_STATUS_EQUAL (GetNextFitRecord (&Iterator, &QueryResult), EFI_NOT_FOUND);
+  }
+
+  UT_ASSERT_NOT_EFI_ERROR (GetIndexedFitRecord (&Index, FIT_TYPE_0C_BOOT_POLICY_MANIFEST, 0, &QueryResult));
+  UT_ASSERT_EQUAL (QueryResult.BaseAddress, 0xFFE82000);
+  UT_ASSERT_EQUAL (QueryResult.Size, 0x055D);
+  UT_ASSERT_STATUS_EQUAL (GetIndexedFitRecord (&Index, FIT_TYPE_0C_BOOT_POLICY_MANIFEST, 1, &QueryResult), EFI_NOT_FOUND);
+  UT_ASSERT_STATUS_EQUAL (GetIndexedFitRecord (&Index, 0x14, 0, &QueryResult), EFI_INVALID_PARAMETER);
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+ShouldKeepFitOrderWithinAType (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  FIRMWARE_INTERFACE_TABLE_ENTRY  *Fit;
+  FIT_RECORD_INDEX                Index;
+  UINT32                          Buffer[ARRAY_SIZE (UnsortedFitTypes)];
+  UINT32                          BufferCount;
+  FIT_QUERY_RESULT                QueryResult;
+
+  Fit = BuildSyntheticFit (UnsortedFitTypes, ARRAY_SIZE (UnsortedFitTypes));
+  UT_ASSERT_NOT_NULL (Fit);
+
+  BufferCount = ARRAY_SIZE (Buffer);
+  UT_ASSERT_NOT_EFI_ERROR (InternalBuildFitRecordIndex (Fit, &Index, Buffer, &BufferCount));
+
+  UT_ASSERT_NOT_EFI_ERROR (GetIndexedFitRecord (&Index, FIT_TYPE_01_MICROCODE, 0, &QueryResult));
+  UT_ASSERT_EQUAL (QueryResult.BaseAddress, 2);
+  UT_ASSERT_NOT_EFI_ERROR (GetIndexedFitRecord (&Index, FIT_TYPE_01_MICROCODE, 1, &QueryResult));
+  UT_ASSERT_EQUAL (QueryResult.BaseAddress, 4);
+  UT_ASSERT_NOT_EFI_ERROR (GetIndexedFitRecord (&Index, FIT_TYPE_01_MICROCODE, 2, &QueryResult));
+  UT_ASSERT_EQUAL (QueryResult.BaseAddress, 7);
+  UT_ASSERT_EQUAL (QueryResult.Size, 7);
+  UT_ASSERT_STATUS_EQUAL (GetIndexedFitRecord (&Index, FIT_TYPE_01_MICROCODE, 3, &QueryResult), EFI_NOT_FOUND);
+
+  UT_ASSERT_NOT_EFI_ERROR (GetIndexedFitRecord (&Index, FIT_TYPE_07_BIOS_STARTUP_MODULE, 1, &QueryResult));
+  UT_ASSERT_EQUAL (QueryResult.BaseAddress, 6);
+  UT_ASSERT_NOT_EFI_ERROR (GetIndexedFitRecord (&Index, FIT_TYPE_02_STARTUP_ACM, 0, &QueryResult));
+  UT_ASSERT_EQUAL (QueryResult.BaseAddress, 3);
+
+  FreePool (Fit);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+ShouldFailToIndexABadFit (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  FIT_RECORD_INDEX     Index;
+  UINT32               Buffer[7];
+  UINT32               BufferCount;
+  FIT_RECORD_ITERATOR  Iterator;
+
+  BufferCount = ARRAY_SIZE (Buffer);
+  UT_ASSERT_STATUS_EQUAL (
+    InternalBuildFitRecordIndex ((FIRMWARE_INTERFACE_TABLE_ENTRY *)MalformedFitData, &Index, Buffer, &BufferCount),
+    EFI_COMPROMISED_DATA
+    );
+  UT_ASSERT_STATUS_EQUAL (
+    InternalInitFitRecordIterator ((FIRMWARE_INTERFACE_TABLE_ENTRY *)MalformedFitData, FIT_TYPE_01_MICROCODE, NULL, &Iterator),
+    EFI_COMPROMISED_DATA
+    );
+  UT_ASSERT_STATUS_EQUAL (
+    InternalInitFitRecordIterator ((FIRMWARE_INTERFACE_TABLE_ENTRY *)SimpleFitData, 0x14, NULL, &Iterator),
+    EFI_INVALID_PARAMETER
+    );
+
+  //
+  // The required count is returned for a buffer that is too small.
+  //
+  BufferCount = 3;
+  UT_ASSERT_STATUS_EQUAL (
+    InternalBuildFitRecordIndex ((FIRMWARE_INTERFACE_TABLE_ENTRY *)SimpleFitData, &Index, Buffer, &BufferCount),
+    EFI_BUFFER_TOO_SMALL
+    );
+  UT_ASSERT_EQUAL (BufferCount, 7);
+
+  BufferCount = 0;
+  UT_ASSERT_STATUS_EQUAL (
+    InternalBuildFitRecordIndex ((FIRMWARE_INTERFACE_TABLE_ENTRY *)SimpleFitData, &Index, NULL, &BufferCount),
+    EFI_BUFFER_TOO_SMALL
+    );
+  UT_ASSERT_EQUAL (BufferCount, 7);
+
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+BenchmarkLargeFit (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  FIRMWARE_INTERFACE_TABLE_ENTRY  *Fit;
+  FIT_RECORD_INDEX                *Index;
+  UINT32                          *Buffer;
+  UINT32                          BufferCount;
+  FIT_RECORD_ITERATOR             Iterator;
+  FIT_QUERY_RESULT                QueryResult;
+  UINT16                          RecordIndex;
+  UINT64                          Sum;
+  clock_t                         Start;
+
+  Fit    = BuildLargeFit ();
+  Index  = AllocatePool (sizeof (FIT_RECORD_INDEX));
+  Buffer = AllocatePool (sizeof (UINT32) * LARGE_FIT_ENTRY_COUNT);
+  UT_ASSERT_NOT_NULL (Fit);
+  UT_ASSERT_NOT_NULL (Index);
+  UT_ASSERT_NOT_NULL (Buffer);
+
+  //
+  // The address of microcode record N is N + 1, so every method must sum to the same value.
+  //
+  Sum   = 0;
+  Start = clock ();
+  for (RecordIndex = 0; !EFI_ERROR (InternalGetFitRecord (Fit, FIT_TYPE_01_MICROCODE, RecordIndex, &QueryResult)); RecordIndex++) {
+    Sum += QueryResult.BaseAddress;
+  }
+
+  UT_LOG_INFO ("GetFitRecord loop: %ld ms\n", ElapsedMilliseconds (Start));
+  UT_ASSERT_EQUAL (RecordIndex, LARGE_FIT_MICROCODE_COUNT);
+  UT_ASSERT_EQUAL (Sum, (UINT64)LARGE_FIT_MICROCODE_COUNT * (LARGE_FIT_MICROCODE_COUNT + 1) / 2);
+
+  Sum   = 0;
+  Start = clock ();
+  UT_ASSERT_NOT_EFI_ERROR (InternalInitFitRecordIterator (Fit, FIT_TYPE_01_MICROCODE, NULL, &Iterator));
+  while (!EFI_ERROR (GetNextFitRecord (&Iterator, &QueryResult))) {
+    Sum += QueryResult.BaseAddress;
+  }
+
+  UT_LOG_INFO ("Iterator: %ld ms\n", ElapsedMilliseconds (Start));
+  UT_ASSERT_EQUAL (Sum, (UINT64)LARGE_FIT_MICROCODE_COUNT * (LARGE_FIT_MICROCODE_COUNT + 1) / 2);
+
+  Sum         = 0;
+  Start       = clock ();
+  BufferCount = LARGE_FIT_ENTRY_COUNT;
+  UT_ASSERT_NOT_EFI_ERROR (InternalBuildFitRecordIndex (Fit, Index, Buffer, &BufferCount));
+  for (RecordIndex = 0; !EFI_ERROR (GetIndexedFitRecord (Index, FIT_TYPE_01_MICROCODE, RecordIndex, &QueryResult)); RecordIndex++) {
+    Sum += QueryResult.BaseAddress;
+  }
+
+  UT_LOG_INFO ("Index build and lookups: %ld ms\n", ElapsedMilliseconds (Start));
+  UT_ASSERT_EQUAL (RecordIndex, LARGE_FIT_MICROCODE_COUNT);
+  UT_ASSERT_EQUAL (Sum, (UINT64)LARGE_FIT_MICROCODE_COUNT * (LARGE_FIT_MICROCODE_COUNT + 1) / 2);
+
+  FreePool (Buffer);
+  FreePool (Index);
+  FreePool (Fit);
+  return UNIT_TEST_PASSED;
+}
+
 /// === TEST ENGINE ================================================================================
 
 /**
@@ -274,6 +606,42 @@ main (
     NULL,
     NULL
     );
+  AddTestCase (
+    InternalTests,
+    "Should iterate all the records of a type, with and without an index",
+    "FitQuery.Internal.Iterator",
+    ShouldIterateAllRecordsOfAType,
+    NULL,
+    NULL,
+    NULL
+    );
+  AddTestCase (
+    InternalTests,
+    "Should keep the FIT order within a type when the FIT is not sorted",
+    "FitQuery.Internal.UnsortedIndex",
+    ShouldKeepFitOrderWithinAType,
+    NULL,
+    NULL,
+    NULL
+    );
+  AddTestCase (
+    InternalTests,
+    "Should fail to index or iterate a bad FIT",
+    "FitQuery.Internal.BadIndex",
+    ShouldFailToIndexABadFit,
+    NULL,
+    NULL,
+    NULL
+    );
+  AddTestCase (
+    InternalTests,
+    "Should return the same records from a large FIT with every method",
+    "FitQuery.Internal.Benchmark",
+    BenchmarkLargeFit,
+    NULL,
+    NULL,
+    NULL
+    );
 
   //
   // Execute the tests.
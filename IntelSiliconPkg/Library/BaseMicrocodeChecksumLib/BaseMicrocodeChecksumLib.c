@@ -0,0 +1,206 @@
+/** @file
+  Checksum services for microcode patches.
+
+  The SIMD kernels sum whole blocks with unaligned loads and return the
+  partial sum. The remaining dwords are summed by CalculateSum32().
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Base.h>
+
+#include <Library/BaseLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MicrocodeChecksumLib.h>
+
+#include <Register/Intel/Cpuid.h>
+
+//
+// This library was designed with advanced unit-test features.
+// This define handles the configuration.
+#ifdef INTERNAL_UNIT_TEST
+  #undef STATIC
+#define STATIC    // Nothing...
+#endif
+
+//
+// Bytes summed by one loop iteration of each kernel.
+//
+#define MICROCODE_SUM32_SSE2_BLOCK_SIZE  0x40
+#define MICROCODE_SUM32_AVX2_BLOCK_SIZE  0x80
+
+//
+// Below this length the CPUID and XGETBV probing costs more than the
+// kernel saves, so the scalar path is used directly.
+//
+#define MICROCODE_SUM32_SIMD_THRESHOLD  SIZE_1KB
+
+//
+// XCR0 bits that must be set by the firmware before AVX registers are used.
+//
+#define XCR0_SSE_STATE  BIT1
+#define XCR0_AVX_STATE  BIT2
+
+typedef enum {
+  MicrocodeSum32Scalar,
+  MicrocodeSum32Sse2,
+  MicrocodeSum32Avx2
+} MICROCODE_SUM32_KERNEL;
+
+/**
+  Sum the 32-bit elements of whole 64-byte blocks with SSE2.
+
+  @param[in]  Buffer      The pointer to the buffer to sum. No alignment is required.
+  @param[in]  Length      The size, in bytes, of Buffer. Must be a multiple of 64.
+
+  @return The sum of all 32-bit elements of Buffer.
+**/
+UINT32
+EFIAPI
+InternalMicrocodeSum32Sse2 (
+  IN CONST VOID  *Buffer,
+  IN UINTN       Length
+  );
+
+/**
+  Sum the 32-bit elements of whole 128-byte blocks with AVX2.
+
+  @param[in]  Buffer      The pointer to the buffer to sum. No alignment is required.
+  @param[in]  Length      The size, in bytes, of Buffer. Must be a multiple of 128.
+
+  @return The sum of all 32-bit elements of Buffer.
+**/
+UINT32
+EFIAPI
+InternalMicrocodeSum32Avx2 (
+  IN CONST VOID  *Buffer,
+  IN UINTN       Length
+  );
+
+/**
+  Select the fastest summing kernel supported by the processor.
+
+  SSE2 is architectural on every processor that loads microcode through
+  this package, and the SEC phase enables it together with the FPU. AVX2
+  additionally requires the firmware to have enabled the AVX state in XCR0.
+
+  @return The kernel to use.
+**/
+STATIC
+MICROCODE_SUM32_KERNEL
+InternalGetMicrocodeSum32Kernel (
+  VOID
+  )
+{
+  UINT32                                       MaxLeaf;
+  CPUID_VERSION_INFO_ECX                       VersionInfoEcx;
+  CPUID_VERSION_INFO_EDX                       VersionInfoEdx;
+  CPUID_STRUCTURED_EXTENDED_FEATURE_FLAGS_EBX  ExtendedFeatureEbx;
+
+  AsmCpuid (CPUID_SIGNATURE, &MaxLeaf, NULL, NULL, NULL);
+  AsmCpuid (CPUID_VERSION_INFO, NULL, NULL, &VersionInfoEcx.Uint32, &VersionInfoEdx.Uint32);
+  if (VersionInfoEdx.Bits.SSE2 == 0) {
+    return MicrocodeSum32Scalar;
+  }
+
+  if ((MaxLeaf < CPUID_STRUCTURED_EXTENDED_FEATURE_FLAGS) ||
+      (VersionInfoEcx.Bits.AVX == 0) ||
+      (VersionInfoEcx.Bits.OSXSAVE == 0))
+  {
+    return MicrocodeSum32Sse2;
+  }
+
+  AsmCpuidEx (
+    CPUID_STRUCTURED_EXTENDED_FEATURE_FLAGS,
+    CPUID_STRUCTURED_EXTENDED_FEATURE_FLAGS_SUB_LEAF_INFO,
+    NULL,
+    &ExtendedFeatureEbx.Uint32,
+    NULL,
+    NULL
+    );
+  if ((ExtendedFeatureEbx.Bits.AVX2 == 0) ||
+      ((AsmXGetBv (0) & (XCR0_SSE_STATE | XCR0_AVX_STATE)) != (XCR0_SSE_STATE | XCR0_AVX_STATE)))
+  {
+    return MicrocodeSum32Sse2;
+  }
+
+  return MicrocodeSum32Avx2;
+}
+
+/**
+  Return the sum of all 32-bit elements of a buffer with the given kernel.
+
+  @param[in]  Kernel      The kernel to use.
+  @param[in]  Buffer      The pointer to the buffer to sum.
+  @param[in]  Length      The size, in bytes, of Buffer.
+
+  @return The sum of all 32-bit elements of Buffer.
+**/
+STATIC
+UINT32
+InternalMicrocodeCalculateSum32 (
+  IN MICROCODE_SUM32_KERNEL  Kernel,
+  IN CONST UINT32            *Buffer,
+  IN UINTN                   Length
+  )
+{
+  UINTN   BlockLength;
+  UINT32  Sum;
+
+  switch (Kernel) {
+    case MicrocodeSum32Avx2:
+      BlockLength = Length & ~((UINTN)MICROCODE_SUM32_AVX2_BLOCK_SIZE - 1);
+      Sum         = InternalMicrocodeSum32Avx2 (Buffer, BlockLength);
+      break;
+    case MicrocodeSum32Sse2:
+      BlockLength = Length & ~((UINTN)MICROCODE_SUM32_SSE2_BLOCK_SIZE - 1);
+      Sum         = InternalMicrocodeSum32Sse2 (Buffer, BlockLength);
+      break;
+    default:
+      BlockLength = 0;
+      Sum         = 0;
+      break;
+  }
+
+  if (BlockLength < Length) {
+    Sum += CalculateSum32 ((CONST UINT32 *)((CONST UINT8 *)Buffer + BlockLength), Length - BlockLength);
+  }
+
+  return Sum;
+}
+
+/**
+  Return the sum of all 32-bit elements of a buffer.
+
+  The result is identical to CalculateSum32() in BaseLib.
+
+  If Buffer is NULL, then ASSERT().
+  If Buffer is not aligned on a 32-bit boundary, then ASSERT().
+  If Length is not aligned on a 32-bit boundary, then ASSERT().
+  If Length is greater than (MAX_ADDRESS - Buffer + 1), then ASSERT().
+
+  @param[in]  Buffer      The pointer to the buffer to sum.
+  @param[in]  Length      The size, in bytes, of Buffer.
+
+  @return The sum of all 32-bit elements of Buffer.
+**/
+UINT32
+EFIAPI
+MicrocodeCalculateSum32 (
+  IN CONST UINT32  *Buffer,
+  IN UINTN         Length
+  )
+{
+  ASSERT (Buffer != NULL);
+  ASSERT (((UINTN)Buffer & 0x3) == 0);
+  ASSERT ((Length & 0x3) == 0);
+  ASSERT (Length <= (MAX_ADDRESS - ((UINTN)Buffer) + 1));
+
+  if (Length < MICROCODE_SUM32_SIMD_THRESHOLD) {
+    return CalculateSum32 (Buffer, Length);
+  }
+
+  return InternalMicrocodeCalculateSum32 (InternalGetMicrocodeSum32Kernel (), Buffer, Length);
+}
@@ -0,0 +1,327 @@
+/** @file
+UnitTest for...
+Checksum services for microcode patches.
+
+The kernels are checked against CalculateSum32() and timed on a buffer the
+size of a large microcode patch. The host BaseLib emulates CPUID, so kernel
+support is probed with the host compiler instead.
+
+Copyright (c) Microsoft Corporation.
+SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <time.h>
+#include <cmocka.h>
+#if defined (_MSC_VER)
+  #include <intrin.h>
+#endif
+
+#include <Uefi.h>
+#include <Library/DebugLib.h>
+#include <Library/UnitTestLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/MicrocodeChecksumLib.h>
+
+#ifndef INTERNAL_UNIT_TEST
+  #error Make sure to build thie with INTERNAL_UNIT_TEST enabled! Otherwise, some important tests may be skipped!
+#endif
+
+#define UNIT_TEST_NAME     "Microcode Checksum Lib UnitTest"
+#define UNIT_TEST_VERSION  "0.9"
+
+/// === TEST DATA ==================================================================================
+
+//
+// Lengths up to this are checked exhaustively, in dword steps.
+//
+#define TEST_EXHAUSTIVE_LENGTH  SIZE_4KB
+
+//
+// The size of a large microcode patch, and the number of passes timed.
+//
+#define TEST_BENCHMARK_LENGTH      SIZE_512KB
+#define TEST_BENCHMARK_ITERATIONS  256
+
+/// === INTERNAL PROTOTYPES ========================================================================
+
+typedef enum {
+  MicrocodeSum32Scalar,
+  MicrocodeSum32Sse2,
+  MicrocodeSum32Avx2
+} MICROCODE_SUM32_KERNEL;
+
+UINT32
+InternalMicrocodeCalculateSum32 (
+  IN MICROCODE_SUM32_KERNEL  Kernel,
+  IN CONST UINT32            *Buffer,
+  IN UINTN                   Length
+  );
+
+/// === HELPER FUNCTIONS ===========================================================================
+
+STATIC CONST CHAR8  *mKernelName[] = {
+  "Scalar",
+  "SSE2",
+  "AVX2"
+};
+
+/**
+  Return if the host processor and OS support a kernel.
+
+  @param[in]  Kernel      The kernel.
+
+  @retval TRUE   The kernel can run on the host.
+  @retval FALSE  The kernel cannot run on the host.
+**/
+STATIC
+BOOLEAN
+IsKernelSupportedOnHost (
+  IN MICROCODE_SUM32_KERNEL  Kernel
+  )
+{
+ #if defined (_MSC_VER)
+  INT32  CpuInfo[4];
+ #endif
+
+  if (Kernel == MicrocodeSum32Scalar) {
+    return TRUE;
+  }
+
+ #if defined (__GNUC__)
+  __builtin_cpu_init ();
+  if (Kernel == MicrocodeSum32Sse2) {
+    return (BOOLEAN)(__builtin_cpu_supports ("sse2") != 0);
+  }
+
+  return (BOOLEAN)(__builtin_cpu_supports ("avx2") != 0);
+ #elif defined (_MSC_VER)
+  __cpuid (CpuInfo, 1);
+  if (Kernel == MicrocodeSum32Sse2) {
+    return (BOOLEAN)((CpuInfo[3] & BIT26) != 0);
+  }
+
+  if ((CpuInfo[2] & (BIT27 | BIT28)) != (BIT27 | BIT28)) {
+    return FALSE;
+  }
+
+  __cpuidex (CpuInfo, 7, 0);
+  return (BOOLEAN)(((CpuInfo[1] & BIT5) != 0) && ((_xgetbv (0) & (BIT1 | BIT2)) == (BIT1 | BIT2)));
+ #else
+  return FALSE;
+ #endif
+}
+
+/**
+  Fill a buffer with a repeatable pseudo random pattern.
+
+  @param[out] Buffer      The buffer to fill.
+  @param[in]  Length      The size, in bytes, of Buffer. Must be a multiple of 4.
+**/
+STATIC
+VOID
+FillPattern (
+  OUT UINT32  *Buffer,
+  IN  UINTN   Length
+  )
+{
+  UINTN   Index;
+  UINT32  Seed;
+
+  Seed = 0x2545F491;
+  for (Index = 0; Index < Length / sizeof (UINT32); Index++) {
+    Seed         ^= Seed << 13;
+    Seed         ^= Seed >> 17;
+    Seed         ^= Seed << 5;
+    Buffer[Index] = Seed;
+  }
+}
+
+/// === TEST CASES =================================================================================
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+ShouldMatchCalculateSum32 (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  UINT32                  *Buffer;
+  MICROCODE_SUM32_KERNEL  Kernel;
+  UINTN                   Offset;
+  UINTN                   Length;
+  CONST UINT32            *Start;
+
+  Buffer = AllocatePool (TEST_EXHAUSTIVE_LENGTH + 16);
+  UT_ASSERT_NOT_NULL (Buffer);
+  FillPattern (Buffer, TEST_EXHAUSTIVE_LENGTH + 16);
+
+  for (Kernel = MicrocodeSum32Scalar; Kernel <= MicrocodeSum32Avx2; Kernel++) {
+    if (!IsKernelSupportedOnHost (Kernel)) {
+      UT_LOG_INFO ("%a kernel is not supported on this host\n", mKernelName[Kernel]);
+      continue;
+    }
+
+    //
+    // Every dword offset within a 16-byte line covers the unaligned loads.
+    //
+    for (Offset = 0; Offset < 16; Offset += sizeof (UINT32)) {
+      Start = (CONST UINT32 *)((UINT8 *)Buffer + Offset);
+      for (Length = 0; Length <= TEST_EXHAUSTIVE_LENGTH; Length += sizeof (UINT32)) {
+        UT_ASSERT_EQUAL (InternalMicrocodeCalculateSum32 (Kernel, Start, Length), CalculateSum32 (Start, Length));
+      }
+    }
+  }
+
+  FreePool (Buffer);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+ShouldVerifyPatchChecksum (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  UINT32  *Buffer;
+  UINTN   Count;
+
+  Buffer = AllocatePool (TEST_BENCHMARK_LENGTH);
+  UT_ASSERT_NOT_NULL (Buffer);
+  FillPattern (Buffer, TEST_BENCHMARK_LENGTH);
+
+  //
+  // Make the buffer sum to zero, the way a microcode checksum field does.
+  //
+  Count             = TEST_BENCHMARK_LENGTH / sizeof (UINT32);
+  Buffer[Count - 1] = 0;
+  Buffer[Count - 1] = (UINT32)(0 - CalculateSum32 (Buffer, TEST_BENCHMARK_LENGTH));
+  UT_ASSERT_EQUAL (MicrocodeCalculateSum32 (Buffer, TEST_BENCHMARK_LENGTH), 0);
+
+  Buffer[Count / 2] ^= BIT0;
+  UT_ASSERT_NOT_EQUAL (MicrocodeCalculateSum32 (Buffer, TEST_BENCHMARK_LENGTH), 0);
+
+  FreePool (Buffer);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+BenchmarkKernels (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  UINT32                  *Buffer;
+  MICROCODE_SUM32_KERNEL  Kernel;
+  UINTN                   Iteration;
+  UINT32                  Expected;
+  UINT32                  Sum;
+  clock_t                 Start;
+  clock_t                 Elapsed;
+  UINT64                  Bytes;
+
+  Buffer = AllocatePool (TEST_BENCHMARK_LENGTH);
+  UT_ASSERT_NOT_NULL (Buffer);
+  FillPattern (Buffer, TEST_BENCHMARK_LENGTH);
+  Expected = CalculateSum32 (Buffer, TEST_BENCHMARK_LENGTH);
+
+  for (Kernel = MicrocodeSum32Scalar; Kernel <= MicrocodeSum32Avx2; Kernel++) {
+    if (!IsKernelSupportedOnHost (Kernel)) {
+      continue;
+    }
+
+    Sum   = 0;
+    Start = clock ();
+    for (Iteration = 0; Iteration < TEST_BENCHMARK_ITERATIONS; Iteration++) {
+      Sum += InternalMicrocodeCalculateSum32 (Kernel, Buffer, TEST_BENCHMARK_LENGTH);
+    }
+
+    Elapsed = clock () - Start;
+    UT_ASSERT_EQUAL (Sum, (UINT32)(Expected * TEST_BENCHMARK_ITERATIONS));
+
+    Bytes = (UINT64)TEST_BENCHMARK_LENGTH * TEST_BENCHMARK_ITERATIONS;
+    if (Elapsed == 0) {
+      UT_LOG_INFO ("%a: 0x%lx bytes in less than one clock tick\n", mKernelName[Kernel], Bytes);
+    } else {
+      UT_LOG_INFO (
+        "%a: %ld MB/s\n",
+        mKernelName[Kernel],
+        DivU64x64Remainder (MultU64x32 (Bytes, CLOCKS_PER_SEC), MultU64x32 ((UINT64)Elapsed, SIZE_1MB), NULL)
+        );
+    }
+  }
+
+  FreePool (Buffer);
+  return UNIT_TEST_PASSED;
+}
+
+/// === TEST ENGINE ================================================================================
+
+/**
+  Standard UEFI entry point for target based
+  unit test execution from UEFI Shell.
+
+  @param[in]  ImageHandle     The firmware allocated handle for the EFI image.
+  @param[in]  SystemTable     A pointer to the EFI System Table.
+
+  @retval EFI_SUCCESS     The entry point executed successfully.
+  @retval other           Some error occurred when executing this entry point.
+
+**/
+int
+main (
+  )
+{
+  EFI_STATUS                  Status;
+  UNIT_TEST_FRAMEWORK_HANDLE  Framework = NULL;
+  UNIT_TEST_SUITE_HANDLE      ChecksumTests;
+
+  DEBUG ((DEBUG_INFO, "%a v%a\n", UNIT_TEST_NAME, UNIT_TEST_VERSION));
+
+  //
+  // Start setting up the test framework for running the tests.
+  //
+  Status = InitUnitTestFramework (&Framework, UNIT_TEST_NAME, gEfiCallerBaseName, UNIT_TEST_VERSION);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in InitUnitTestFramework. Status = %r\n", Status));
+    goto EXIT;
+  }
+
+  Status = CreateUnitTestSuite (&ChecksumTests, Framework, "Microcode Checksum Tests", "MicrocodeChecksum", NULL, NULL);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in CreateUnitTestSuite for ChecksumTests\n"));
+    Status = EFI_OUT_OF_RESOURCES;
+    goto EXIT;
+  }
+
+  AddTestCase (ChecksumTests, "Should match CalculateSum32 for every kernel", "MicrocodeChecksum.MatchBaseLib", ShouldMatchCalculateSum32, NULL, NULL, NULL);
+  AddTestCase (ChecksumTests, "Should verify a patch sized checksum", "MicrocodeChecksum.Verify", ShouldVerifyPatchChecksum, NULL, NULL, NULL);
+  AddTestCase (ChecksumTests, "Should report the throughput of every kernel", "MicrocodeChecksum.Benchmark", BenchmarkKernels, NULL, NULL, NULL);
+
+  //
+  // Execute the tests.
+  //
+  Status = RunAllTestSuites (Framework);
+
+EXIT:
+  if (Framework != NULL) {
+    FreeUnitTestFramework (Framework);
+  }
+
+  return Status;
+}
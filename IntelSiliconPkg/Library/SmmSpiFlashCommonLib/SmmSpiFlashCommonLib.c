@@ -11,12 +11,64 @@
 #include <Protocol/Spi2.h>
 #include <Library/DebugLib.h>
 
+#include "SpiFlashReadCache.h"
+#include "SpiFlashSfdp.h"
+#include "SpiFlashStreamRead.h"
+
+//
+// The largest SFDP read sent to the flash controller at once.
+//
+#define SFDP_READ_CHUNK_SIZE  64
+
 extern PCH_SPI2_PROTOCOL  *mSpi2Protocol;
 
 extern UINTN  mBiosAreaBaseAddress;
 extern UINTN  mBiosSize;
 extern UINTN  mBiosOffset;
 
+extern SPI_FLASH_GEOMETRY  mSpiFlashGeometry;
+extern BOOLEAN             mSpiFlashGeometryValid;
+
+/**
+  Read data from the SFDP of the first flash component.
+
+  @param[in]  Context         The PCH_SPI2_PROTOCOL instance.
+  @param[in]  Address         The SFDP address to read from.
+  @param[in]  ByteCount       The number of bytes to read.
+  @param[out] Buffer          The destination buffer.
+
+  @retval EFI_SUCCESS         The data was read.
+  @retval Others              The status of FlashReadSfdp().
+**/
+STATIC
+EFI_STATUS
+SmmSpiFlashReadSfdp (
+  IN  VOID    *Context,
+  IN  UINT32  Address,
+  IN  UINT32  ByteCount,
+  OUT UINT8   *Buffer
+  )
+{
+  PCH_SPI2_PROTOCOL  *Spi2;
+  UINT32             Length;
+  EFI_STATUS         Status;
+
+  Spi2 = (PCH_SPI2_PROTOCOL *)Context;
+  while (ByteCount > 0) {
+    Length = MIN (ByteCount, SFDP_READ_CHUNK_SIZE);
+    Status = Spi2->FlashReadSfdp (Spi2, 0, Address, Length, Buffer);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    Address   += Length;
+    ByteCount -= Length;
+    Buffer    += Length;
+  }
+
+  return EFI_SUCCESS;
+}
+
 /**
   The library constructor.
 
@@ -38,6 +90,8 @@ SmmSpiFlashCommonLibConstructor (
   )
 {
   EFI_STATUS  Status;
+  EFI_STATUS  SfdpStatus;
+  EFI_STATUS  CacheStatus;
   UINT32      BaseAddr;
   UINT32      RegionSize;
 
@@ -56,5 +110,32 @@ SmmSpiFlashCommonLibConstructor (
 
   mSpi2Protocol->GetRegionAddress (mSpi2Protocol, &gFlashRegionBiosGuid, &BaseAddr, &RegionSize);
   mBiosOffset = BaseAddr;
+
+  //
+  // The geometry is optional. Without it, SpiFlashGetGeometry() returns
+  // EFI_UNSUPPORTED.
+  //
+  SfdpStatus             = SpiFlashParseSfdp (SmmSpiFlashReadSfdp, mSpi2Protocol, &mSpiFlashGeometry);
+  mSpiFlashGeometryValid = !EFI_ERROR (SfdpStatus);
+  if (mSpiFlashGeometryValid) {
+    DEBUG ((
+      DEBUG_INFO,
+      "SPI flash: 0x%lx bytes, erase sizes 0x%x, page 0x%x, fast read modes 0x%x\n",
+      mSpiFlashGeometry.FlashSize,
+      mSpiFlashGeometry.EraseSizes,
+      mSpiFlashGeometry.PageSize,
+      mSpiFlashGeometry.FastReadModes
+      ));
+  } else {
+    DEBUG ((DEBUG_WARN, "SPI flash: SFDP is not usable - %r\n", SfdpStatus));
+  }
+
+  SpiFlashStreamReadInitialize ();
+
+  CacheStatus = SpiFlashReadCacheInitialize (PcdGet32 (PcdSpiFlashReadCacheBlocks));
+  if (EFI_ERROR (CacheStatus)) {
+    DEBUG ((DEBUG_WARN, "SPI flash: The read cache is disabled - %r\n", CacheStatus));
+  }
+
   return Status;
 }
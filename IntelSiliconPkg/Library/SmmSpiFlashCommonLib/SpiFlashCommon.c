@@ -8,8 +8,17 @@
 
 #include <Library/SpiFlashCommonLib.h>
 #include <Library/IoLib.h>
+#include <Library/CacheMaintenanceLib.h>
 #include <Protocol/Spi2.h>
 
+#include "SpiFlashReadCache.h"
+#include "SpiFlashStreamRead.h"
+
+//
+// Reads of this size or more bypass the read cache.
+//
+#define SPI_FLASH_STREAM_READ_SIZE  SECTOR_SIZE_4KB
+
 PCH_SPI2_PROTOCOL  *mSpi2Protocol;
 
 //
@@ -19,6 +28,13 @@ UINTN  mBiosAreaBaseAddress = 0;
 UINTN  mBiosSize            = 0;
 UINTN  mBiosOffset          = 0;
 
+//
+// The geometry of the flash part, valid if the library read it from the
+// SFDP of the part.
+//
+SPI_FLASH_GEOMETRY  mSpiFlashGeometry;
+BOOLEAN             mSpiFlashGeometryValid = FALSE;
+
 /**
   Enable block protection on the Serial Flash device.
 
@@ -63,10 +79,20 @@ SpiFlashRead (
 
   //
   // This function is implemented specifically for those platforms
-  // at which the SPI device is memory mapped for read. So this
-  // function just do a memory copy for Spi Flash Read.
+  // at which the SPI device is memory mapped for read. Small reads of the
+  // BIOS region go through the read cache. Larger reads are copied from
+  // the flash straight into Buffer with streaming loads, so they do not
+  // evict the blocks the small reads use.
   //
-  CopyMem (Buffer, (VOID *)Address, *NumBytes);
+  if ((*NumBytes < SPI_FLASH_STREAM_READ_SIZE) &&
+      (Address >= mBiosAreaBaseAddress) &&
+      (Address - mBiosAreaBaseAddress <= mBiosSize) &&
+      (*NumBytes <= mBiosSize - (Address - mBiosAreaBaseAddress)))
+  {
+    SpiFlashReadCacheRead (Address, *NumBytes, Buffer);
+  } else {
+    SpiFlashStreamRead (Address, *NumBytes, Buffer);
+  }
 
   return EFI_SUCCESS;
 }
@@ -133,9 +159,11 @@ SpiFlashWrite (
                               Buffer
                               );
     if (EFI_ERROR (Status)) {
+      SpiFlashReadCacheInvalidate (mBiosAreaBaseAddress + Offset, Length);
       break;
     }
 
+    SpiFlashReadCacheProgram (mBiosAreaBaseAddress + Offset, Length, Buffer);
     RemainingBytes -= Length;
     Offset         += Length;
     Buffer         += Length;
@@ -149,9 +177,117 @@ SpiFlashWrite (
   return Status;
 }
 
+/**
+  Write a list of ranges to the flash, then enable block protection and
+  flush the data cache once over the union of the ranges.
+
+  Every range is checked before any of them is written. Each range is sent
+  to the flash controller as a single write, which the controller issues as
+  back to back maximum size hardware cycles, instead of one write per 4KB.
+
+  @param[in,out]  Vector          The ranges to write. On output, NumBytes of each
+                                  range is the actual number of bytes written.
+  @param[in]      VectorCount     The number of ranges in Vector.
+
+  @retval         EFI_SUCCESS            Operation is successful.
+  @retval         EFI_DEVICE_ERROR       If there is any device errors.
+  @retval         EFI_INVALID_PARAMETER  Invalid parameter.
+
+**/
+EFI_STATUS
+EFIAPI
+SpiFlashWriteVector (
+  IN OUT SPI_FLASH_WRITE_VECTOR  *Vector,
+  IN     UINTN                   VectorCount
+  )
+{
+  EFI_STATUS  Status;
+  EFI_STATUS  LockStatus;
+  UINTN       Index;
+  UINTN       Offset;
+  UINTN       UnionStart;
+  UINTN       UnionEnd;
+
+  ASSERT ((Vector != NULL) && (VectorCount != 0));
+  if ((Vector == NULL) || (VectorCount == 0)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  UnionStart = MAX_UINTN;
+  UnionEnd   = 0;
+  for (Index = 0; Index < VectorCount; Index++) {
+    ASSERT (Vector[Index].Buffer != NULL);
+    if (Vector[Index].Buffer == NULL) {
+      return EFI_INVALID_PARAMETER;
+    }
+
+    ASSERT (Vector[Index].Address >= mBiosAreaBaseAddress);
+    if (Vector[Index].Address < mBiosAreaBaseAddress) {
+      return EFI_INVALID_PARAMETER;
+    }
+
+    Offset = Vector[Index].Address - mBiosAreaBaseAddress;
+
+    ASSERT ((Offset <= mBiosSize) && (Vector[Index].NumBytes <= mBiosSize - Offset));
+    if ((Offset > mBiosSize) || (Vector[Index].NumBytes > mBiosSize - Offset)) {
+      return EFI_INVALID_PARAMETER;
+    }
+
+    if (Vector[Index].NumBytes != 0) {
+      UnionStart = MIN (UnionStart, Vector[Index].Address);
+      UnionEnd   = MAX (UnionEnd, Vector[Index].Address + Vector[Index].NumBytes);
+    }
+  }
+
+  Status = EFI_SUCCESS;
+  for (Index = 0; Index < VectorCount; Index++) {
+    if (EFI_ERROR (Status) || (Vector[Index].NumBytes == 0)) {
+      //
+      // Nothing is written behind a failed range.
+      //
+      Vector[Index].NumBytes = 0;
+      continue;
+    }
+
+    Status = mSpi2Protocol->FlashWrite (
+                              mSpi2Protocol,
+                              &gFlashRegionBiosGuid,
+                              (UINT32)(Vector[Index].Address - mBiosAreaBaseAddress),
+                              Vector[Index].NumBytes,
+                              Vector[Index].Buffer
+                              );
+    if (EFI_ERROR (Status)) {
+      SpiFlashReadCacheInvalidate (Vector[Index].Address, Vector[Index].NumBytes);
+      Vector[Index].NumBytes = 0;
+    } else {
+      SpiFlashReadCacheProgram (Vector[Index].Address, Vector[Index].NumBytes, Vector[Index].Buffer);
+    }
+  }
+
+  if (!EFI_ERROR (Status)) {
+    LockStatus = SpiFlashLock ();
+    if (EFI_ERROR (LockStatus)) {
+      Status = LockStatus;
+    }
+  }
+
+  //
+  // The flash may have changed even if a write failed, so the cache is
+  // flushed in any case.
+  //
+  if (UnionEnd > UnionStart) {
+    WriteBackInvalidateDataCacheRange ((VOID *)UnionStart, UnionEnd - UnionStart);
+  }
+
+  return Status;
+}
+
 /**
   Erase the block starting at Address.
 
+  The whole range is sent to the flash controller as one request. The
+  controller picks the erase commands that cover it.
+
   @param[in]  Address         The starting physical address of the block to be erased.
                               This library assume that caller garantee that the PAddress
                               is at the starting address of this block.
@@ -205,5 +341,42 @@ SpiFlashBlockErase (
                             (UINT32)Offset,
                             (UINT32)RemainingBytes
                             );
+  if (EFI_ERROR (Status)) {
+    SpiFlashReadCacheInvalidate (Address, RemainingBytes);
+  } else {
+    SpiFlashReadCacheErase (Address, RemainingBytes);
+  }
+
   return Status;
 }
+
+/**
+  Get the geometry of the flash part.
+
+  The geometry is read from the SFDP of the part when the library is
+  initialized.
+
+  @param[out] Geometry        The geometry of the flash part.
+
+  @retval     EFI_SUCCESS            Geometry is filled.
+  @retval     EFI_INVALID_PARAMETER  Geometry is NULL.
+  @retval     EFI_UNSUPPORTED        The geometry of the part is not known.
+
+**/
+EFI_STATUS
+EFIAPI
+SpiFlashGetGeometry (
+  OUT SPI_FLASH_GEOMETRY  *Geometry
+  )
+{
+  if (Geometry == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  if (!mSpiFlashGeometryValid) {
+    return EFI_UNSUPPORTED;
+  }
+
+  CopyMem (Geometry, &mSpiFlashGeometry, sizeof (SPI_FLASH_GEOMETRY));
+  return EFI_SUCCESS;
+}
@@ -0,0 +1,248 @@
+/** @file
+  Read cache of the memory mapped SPI flash.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
+
+#include "SpiFlashReadCache.h"
+
+typedef enum {
+  SpiFlashReadCacheOpProgram,
+  SpiFlashReadCacheOpErase,
+  SpiFlashReadCacheOpInvalidate
+} SPI_FLASH_READ_CACHE_OP;
+
+SPI_FLASH_READ_CACHE  mSpiFlashReadCache;
+
+/**
+  Get the cache entry a flash block can be in.
+
+  @param[in]  BlockAddress    The flash address of the block.
+
+  @return The index of the entry.
+**/
+STATIC
+UINTN
+SpiFlashReadCacheEntry (
+  IN UINTN  BlockAddress
+  )
+{
+  return (BlockAddress / SPI_FLASH_READ_CACHE_BLOCK_SIZE) % mSpiFlashReadCache.BlockCount;
+}
+
+/**
+  Apply a change of the flash to the cached blocks of a range.
+
+  @param[in]  Address         The flash address of the range.
+  @param[in]  Length          The size of the range in bytes.
+  @param[in]  Buffer          The data programmed, for SpiFlashReadCacheOpProgram.
+  @param[in]  Operation       The change of the flash.
+**/
+STATIC
+VOID
+SpiFlashReadCacheUpdate (
+  IN UINTN                    Address,
+  IN UINTN                    Length,
+  IN CONST UINT8              *Buffer,
+  IN SPI_FLASH_READ_CACHE_OP  Operation
+  )
+{
+  UINTN  BlockAddress;
+  UINTN  Offset;
+  UINTN  Size;
+  UINTN  Entry;
+  UINTN  Index;
+  UINT8  *Data;
+
+  if (mSpiFlashReadCache.BlockCount == 0) {
+    return;
+  }
+
+  while (Length > 0) {
+    BlockAddress = Address & ~((UINTN)SPI_FLASH_READ_CACHE_BLOCK_SIZE - 1);
+    Offset       = Address - BlockAddress;
+    Size         = MIN (SPI_FLASH_READ_CACHE_BLOCK_SIZE - Offset, Length);
+    Entry        = SpiFlashReadCacheEntry (BlockAddress);
+
+    if (mSpiFlashReadCache.Tags[Entry] == BlockAddress) {
+      Data = mSpiFlashReadCache.Data + Entry * SPI_FLASH_READ_CACHE_BLOCK_SIZE + Offset;
+      switch (Operation) {
+        case SpiFlashReadCacheOpProgram:
+          for (Index = 0; Index < Size; Index++) {
+            Data[Index] &= Buffer[Index];
+          }
+
+          break;
+        case SpiFlashReadCacheOpErase:
+          SetMem (Data, Size, 0xFF);
+          break;
+        default:
+          mSpiFlashReadCache.Tags[Entry] = SPI_FLASH_READ_CACHE_INVALID;
+          break;
+      }
+    }
+
+    if (Buffer != NULL) {
+      Buffer += Size;
+    }
+
+    Address += Size;
+    Length  -= Size;
+  }
+}
+
+/**
+  Allocate the read cache. A cache of 0 blocks is disabled.
+
+  @param[in]  BlockCount      The number of blocks the cache holds.
+
+  @retval EFI_SUCCESS           The cache is ready.
+  @retval EFI_OUT_OF_RESOURCES  The cache could not be allocated. It is disabled.
+**/
+EFI_STATUS
+SpiFlashReadCacheInitialize (
+  IN UINT32  BlockCount
+  )
+{
+  SpiFlashReadCacheFree ();
+  if (BlockCount == 0) {
+    return EFI_SUCCESS;
+  }
+
+  mSpiFlashReadCache.Tags = AllocatePool (BlockCount * sizeof (UINTN));
+  mSpiFlashReadCache.Data = AllocatePool (BlockCount * SPI_FLASH_READ_CACHE_BLOCK_SIZE);
+  if ((mSpiFlashReadCache.Tags == NULL) || (mSpiFlashReadCache.Data == NULL)) {
+    SpiFlashReadCacheFree ();
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  //
+  // All bits set is SPI_FLASH_READ_CACHE_INVALID.
+  //
+  SetMem (mSpiFlashReadCache.Tags, BlockCount * sizeof (UINTN), 0xFF);
+  mSpiFlashReadCache.BlockCount = BlockCount;
+  return EFI_SUCCESS;
+}
+
+/**
+  Free the read cache and disable it.
+**/
+VOID
+SpiFlashReadCacheFree (
+  VOID
+  )
+{
+  if (mSpiFlashReadCache.Tags != NULL) {
+    FreePool (mSpiFlashReadCache.Tags);
+  }
+
+  if (mSpiFlashReadCache.Data != NULL) {
+    FreePool (mSpiFlashReadCache.Data);
+  }
+
+  ZeroMem (&mSpiFlashReadCache, sizeof (mSpiFlashReadCache));
+}
+
+/**
+  Read a range of the memory mapped flash through the cache. The blocks of
+  the range that are not cached are read in whole from the flash.
+
+  @param[in]  Address         The flash address of the range.
+  @param[in]  Length          The size of the range in bytes.
+  @param[out] Buffer          The destination buffer.
+**/
+VOID
+SpiFlashReadCacheRead (
+  IN  UINTN  Address,
+  IN  UINTN  Length,
+  OUT UINT8  *Buffer
+  )
+{
+  UINTN  BlockAddress;
+  UINTN  Offset;
+  UINTN  Size;
+  UINTN  Entry;
+  UINT8  *Data;
+
+  if (mSpiFlashReadCache.BlockCount == 0) {
+    CopyMem (Buffer, (VOID *)Address, Length);
+    return;
+  }
+
+  while (Length > 0) {
+    BlockAddress = Address & ~((UINTN)SPI_FLASH_READ_CACHE_BLOCK_SIZE - 1);
+    Offset       = Address - BlockAddress;
+    Size         = MIN (SPI_FLASH_READ_CACHE_BLOCK_SIZE - Offset, Length);
+    Entry        = SpiFlashReadCacheEntry (BlockAddress);
+    Data         = mSpiFlashReadCache.Data + Entry * SPI_FLASH_READ_CACHE_BLOCK_SIZE;
+
+    if (mSpiFlashReadCache.Tags[Entry] == BlockAddress) {
+      mSpiFlashReadCache.HitCount++;
+    } else {
+      CopyMem (Data, (VOID *)BlockAddress, SPI_FLASH_READ_CACHE_BLOCK_SIZE);
+      mSpiFlashReadCache.Tags[Entry] = BlockAddress;
+      mSpiFlashReadCache.MissCount++;
+    }
+
+    CopyMem (Buffer, Data + Offset, Size);
+
+    Buffer  += Size;
+    Address += Size;
+    Length  -= Size;
+  }
+}
+
+/**
+  Update the cached blocks of a range that was programmed. Programming only
+  clears bits, so each cached byte becomes itself AND the data programmed.
+
+  @param[in]  Address         The flash address of the range.
+  @param[in]  Length          The size of the range in bytes.
+  @param[in]  Buffer          The data programmed.
+**/
+VOID
+SpiFlashReadCacheProgram (
+  IN UINTN        Address,
+  IN UINTN        Length,
+  IN CONST UINT8  *Buffer
+  )
+{
+  SpiFlashReadCacheUpdate (Address, Length, Buffer, SpiFlashReadCacheOpProgram);
+}
+
+/**
+  Update the cached blocks of a range that was erased.
+
+  @param[in]  Address         The flash address of the range.
+  @param[in]  Length          The size of the range in bytes.
+**/
+VOID
+SpiFlashReadCacheErase (
+  IN UINTN  Address,
+  IN UINTN  Length
+  )
+{
+  SpiFlashReadCacheUpdate (Address, Length, NULL, SpiFlashReadCacheOpErase);
+}
+
+/**
+  Drop the cached blocks of a range whose flash content is not known.
+
+  @param[in]  Address         The flash address of the range.
+  @param[in]  Length          The size of the range in bytes.
+**/
+VOID
+SpiFlashReadCacheInvalidate (
+  IN UINTN  Address,
+  IN UINTN  Length
+  )
+{
+  SpiFlashReadCacheUpdate (Address, Length, NULL, SpiFlashReadCacheOpInvalidate);
+}
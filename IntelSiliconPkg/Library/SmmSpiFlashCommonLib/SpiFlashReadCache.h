@@ -0,0 +1,117 @@
+/** @file
+  Read cache of the memory mapped SPI flash.
+
+  The cache holds copies of 4KB flash blocks in SMRAM, so repeated small
+  reads of the same blocks do not go to the SPI bus. It is direct mapped:
+  a block can only be in the entry of its block number modulo the number
+  of entries. The cache is write-through: the writes and the erases of
+  SpiFlashCommonLib update the cached copies of the blocks they touch, and
+  a failed write or erase drops them.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef _SPI_FLASH_READ_CACHE_H_
+#define _SPI_FLASH_READ_CACHE_H_
+
+#include <Uefi.h>
+#include <Library/SpiFlashCommonLib.h>
+
+#define SPI_FLASH_READ_CACHE_BLOCK_SIZE  SECTOR_SIZE_4KB
+
+//
+// The tag of an empty entry.
+//
+#define SPI_FLASH_READ_CACHE_INVALID  MAX_UINTN
+
+typedef struct {
+  UINT32    BlockCount;
+  //
+  // The flash address of the block in each entry.
+  //
+  UINTN     *Tags;
+  UINT8     *Data;
+  UINT64    HitCount;
+  UINT64    MissCount;
+} SPI_FLASH_READ_CACHE;
+
+extern SPI_FLASH_READ_CACHE  mSpiFlashReadCache;
+
+/**
+  Allocate the read cache. A cache of 0 blocks is disabled.
+
+  @param[in]  BlockCount      The number of blocks the cache holds.
+
+  @retval EFI_SUCCESS           The cache is ready.
+  @retval EFI_OUT_OF_RESOURCES  The cache could not be allocated. It is disabled.
+**/
+EFI_STATUS
+SpiFlashReadCacheInitialize (
+  IN UINT32  BlockCount
+  );
+
+/**
+  Free the read cache and disable it.
+**/
+VOID
+SpiFlashReadCacheFree (
+  VOID
+  );
+
+/**
+  Read a range of the memory mapped flash through the cache. The blocks of
+  the range that are not cached are read in whole from the flash.
+
+  @param[in]  Address         The flash address of the range.
+  @param[in]  Length          The size of the range in bytes.
+  @param[out] Buffer          The destination buffer.
+**/
+VOID
+SpiFlashReadCacheRead (
+  IN  UINTN  Address,
+  IN  UINTN  Length,
+  OUT UINT8  *Buffer
+  );
+
+/**
+  Update the cached blocks of a range that was programmed. Programming only
+  clears bits, so each cached byte becomes itself AND the data programmed.
+
+  @param[in]  Address         The flash address of the range.
+  @param[in]  Length          The size of the range in bytes.
+  @param[in]  Buffer          The data programmed.
+**/
+VOID
+SpiFlashReadCacheProgram (
+  IN UINTN        Address,
+  IN UINTN        Length,
+  IN CONST UINT8  *Buffer
+  );
+
+/**
+  Update the cached blocks of a range that was erased.
+
+  @param[in]  Address         The flash address of the range.
+  @param[in]  Length          The size of the range in bytes.
+**/
+VOID
+SpiFlashReadCacheErase (
+  IN UINTN  Address,
+  IN UINTN  Length
+  );
+
+/**
+  Drop the cached blocks of a range whose flash content is not known.
+
+  @param[in]  Address         The flash address of the range.
+  @param[in]  Length          The size of the range in bytes.
+**/
+VOID
+SpiFlashReadCacheInvalidate (
+  IN UINTN  Address,
+  IN UINTN  Length
+  );
+
+#endif
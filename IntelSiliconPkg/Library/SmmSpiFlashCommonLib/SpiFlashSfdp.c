@@ -0,0 +1,225 @@
+/** @file
+  Parser of the JEDEC Serial Flash Discoverable Parameters (SFDP, JESD216).
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "SpiFlashSfdp.h"
+
+/**
+  Get the geometry of a flash part from its Basic Flash Parameter Table.
+
+  @param[in]  Bfpt            The DWORDs of the table.
+  @param[in]  DwordCount      The number of DWORDs in Bfpt, at least SFDP_BFPT_MIN_DWORDS.
+  @param[out] Geometry        The geometry of the part.
+
+  @retval EFI_SUCCESS           Geometry is filled.
+  @retval EFI_VOLUME_CORRUPTED  The table is malformed.
+**/
+STATIC
+EFI_STATUS
+SfdpParseBfpt (
+  IN  CONST UINT32        *Bfpt,
+  IN  UINTN               DwordCount,
+  OUT SPI_FLASH_GEOMETRY  *Geometry
+  )
+{
+  UINT32  Density;
+  UINT32  EraseType;
+  UINT32  SizeShift;
+  UINT32  PageShift;
+
+  ZeroMem (Geometry, sizeof (SPI_FLASH_GEOMETRY));
+
+  //
+  // The density is in bits: either the size minus one, or a power of 2.
+  //
+  Density = Bfpt[1];
+  if ((Density & SFDP_BFPT_DW2_DENSITY_POWER_OF_2) != 0) {
+    Density &= ~SFDP_BFPT_DW2_DENSITY_POWER_OF_2;
+    if ((Density < 3) || (Density > 66)) {
+      return EFI_VOLUME_CORRUPTED;
+    }
+
+    Geometry->FlashSize = LShiftU64 (1, Density - 3);
+  } else {
+    Geometry->FlashSize = RShiftU64 ((UINT64)Density + 1, 3);
+  }
+
+  //
+  // The erase types, and the 4KB erase of JESD216 DWORD 1.
+  //
+  for (EraseType = 0; EraseType < SFDP_BFPT_ERASE_TYPE_COUNT; EraseType++) {
+    SizeShift = (Bfpt[7 + EraseType / 2] >> ((EraseType % 2) * 16)) & 0xFF;
+    if (SizeShift == 0) {
+      continue;
+    }
+
+    if (SizeShift > 31) {
+      return EFI_VOLUME_CORRUPTED;
+    }
+
+    Geometry->EraseSizes |= 1u << SizeShift;
+  }
+
+  if ((Bfpt[0] & SFDP_BFPT_DW1_4KB_ERASE_MASK) == SFDP_BFPT_DW1_4KB_ERASE) {
+    Geometry->EraseSizes |= SIZE_4KB;
+  }
+
+  if (Geometry->EraseSizes == 0) {
+    return EFI_VOLUME_CORRUPTED;
+  }
+
+  if (DwordCount >= SFDP_BFPT_PAGE_SIZE_DWORDS) {
+    PageShift          = (Bfpt[10] >> SFDP_BFPT_DW11_PAGE_SIZE_SHIFT) & SFDP_BFPT_DW11_PAGE_SIZE_MASK;
+    Geometry->PageSize = 1u << PageShift;
+  } else if ((Bfpt[0] & SFDP_BFPT_DW1_WRITE_GRANULARITY) != 0) {
+    Geometry->PageSize = SFDP_DEFAULT_PAGE_SIZE;
+  } else {
+    Geometry->PageSize = 1;
+  }
+
+  switch (Bfpt[0] & SFDP_BFPT_DW1_ADDRESS_BYTES) {
+    case SFDP_BFPT_DW1_ADDRESS_3_ONLY:
+      Geometry->AddressBytes = 3;
+      break;
+    case SFDP_BFPT_DW1_ADDRESS_3_OR_4:
+    case SFDP_BFPT_DW1_ADDRESS_4_ONLY:
+      Geometry->AddressBytes = 4;
+      break;
+    default:
+      return EFI_VOLUME_CORRUPTED;
+  }
+
+  if ((Bfpt[0] & SFDP_BFPT_DW1_FAST_READ_1_1_2) != 0) {
+    Geometry->FastReadModes |= SPI_FLASH_FAST_READ_1_1_2;
+  }
+
+  if ((Bfpt[0] & SFDP_BFPT_DW1_FAST_READ_1_2_2) != 0) {
+    Geometry->FastReadModes |= SPI_FLASH_FAST_READ_1_2_2;
+  }
+
+  if ((Bfpt[0] & SFDP_BFPT_DW1_FAST_READ_1_1_4) != 0) {
+    Geometry->FastReadModes |= SPI_FLASH_FAST_READ_1_1_4;
+  }
+
+  if ((Bfpt[0] & SFDP_BFPT_DW1_FAST_READ_1_4_4) != 0) {
+    Geometry->FastReadModes |= SPI_FLASH_FAST_READ_1_4_4;
+  }
+
+  if ((Bfpt[4] & SFDP_BFPT_DW5_FAST_READ_2_2_2) != 0) {
+    Geometry->FastReadModes |= SPI_FLASH_FAST_READ_2_2_2;
+  }
+
+  if ((Bfpt[4] & SFDP_BFPT_DW5_FAST_READ_4_4_4) != 0) {
+    Geometry->FastReadModes |= SPI_FLASH_FAST_READ_4_4_4;
+  }
+
+  if ((Bfpt[0] & SFDP_BFPT_DW1_DTR) != 0) {
+    Geometry->FastReadModes |= SPI_FLASH_FAST_READ_DTR;
+  }
+
+  return EFI_SUCCESS;
+}
+
+/**
+  Get the geometry of a flash part from its SFDP.
+
+  The newest JESD216 revision of the Basic Flash Parameter Table is used.
+
+  @param[in]  Read            The function that reads the SFDP of the part.
+  @param[in]  Context         The context passed to Read.
+  @param[out] Geometry        The geometry of the part.
+
+  @retval EFI_SUCCESS             Geometry is filled.
+  @retval EFI_INVALID_PARAMETER   Read or Geometry is NULL.
+  @retval EFI_UNSUPPORTED         The part has no SFDP, or its major revision is not supported.
+  @retval EFI_NOT_FOUND           The SFDP has no Basic Flash Parameter Table.
+  @retval EFI_VOLUME_CORRUPTED    The Basic Flash Parameter Table is malformed.
+  @retval Others                  The status of Read.
+**/
+EFI_STATUS
+SpiFlashParseSfdp (
+  IN  SPI_FLASH_SFDP_READ  Read,
+  IN  VOID                 *Context,
+  OUT SPI_FLASH_GEOMETRY   *Geometry
+  )
+{
+  EFI_STATUS             Status;
+  SFDP_HEADER            Header;
+  SFDP_PARAMETER_HEADER  ParameterHeader;
+  SFDP_PARAMETER_HEADER  BfptHeader;
+  BOOLEAN                BfptFound;
+  UINT32                 Bfpt[SFDP_BFPT_MAX_DWORDS];
+  UINT32                 DwordCount;
+  UINT32                 Address;
+  UINT32                 Index;
+
+  if ((Read == NULL) || (Geometry == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  Status = Read (Context, 0, sizeof (Header), (UINT8 *)&Header);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if ((Header.Signature != SFDP_SIGNATURE) || (Header.MajorRevision != SFDP_SUPPORTED_MAJOR_REV)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  //
+  // A part may have more than one revision of the table. Use the newest one
+  // of the supported major revision.
+  //
+  ZeroMem (&BfptHeader, sizeof (BfptHeader));
+  BfptFound = FALSE;
+  for (Index = 0; Index <= Header.NumberOfParameterHeaders; Index++) {
+    Status = Read (
+               Context,
+               sizeof (SFDP_HEADER) + Index * sizeof (SFDP_PARAMETER_HEADER),
+               sizeof (ParameterHeader),
+               (UINT8 *)&ParameterHeader
+               );
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    if ((((ParameterHeader.IdMsb << 8) | ParameterHeader.IdLsb) != SFDP_BFPT_ID) ||
+        (ParameterHeader.MajorRevision != SFDP_SUPPORTED_MAJOR_REV))
+    {
+      continue;
+    }
+
+    if (!BfptFound || (ParameterHeader.MinorRevision > BfptHeader.MinorRevision)) {
+      CopyMem (&BfptHeader, &ParameterHeader, sizeof (ParameterHeader));
+      BfptFound = TRUE;
+    }
+  }
+
+  if (!BfptFound) {
+    return EFI_NOT_FOUND;
+  }
+
+  if (BfptHeader.Length < SFDP_BFPT_MIN_DWORDS) {
+    return EFI_VOLUME_CORRUPTED;
+  }
+
+  DwordCount = MIN (BfptHeader.Length, SFDP_BFPT_MAX_DWORDS);
+  Address    = BfptHeader.TablePointer[0] |
+               (BfptHeader.TablePointer[1] << 8) |
+               (BfptHeader.TablePointer[2] << 16);
+
+  Status = Read (Context, Address, DwordCount * sizeof (UINT32), (UINT8 *)Bfpt);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  return SfdpParseBfpt (Bfpt, DwordCount, Geometry);
+}
@@ -0,0 +1,152 @@
+/** @file
+  Parser of the JEDEC Serial Flash Discoverable Parameters (SFDP, JESD216).
+
+  The SFDP of a flash part describes its geometry and the commands it
+  supports. Only the JEDEC Basic Flash Parameter Table is used, to find the
+  density, the erase sizes, the page program size and the fast read modes
+  of the part.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef _SPI_FLASH_SFDP_H_
+#define _SPI_FLASH_SFDP_H_
+
+#include <Uefi.h>
+#include <Library/SpiFlashCommonLib.h>
+
+#define SFDP_SIGNATURE  SIGNATURE_32 ('S', 'F', 'D', 'P')
+
+//
+// The ID of the JEDEC Basic Flash Parameter Table, and the only major
+// revision of the tables this parser understands.
+//
+#define SFDP_BFPT_ID              0xFF00
+#define SFDP_SUPPORTED_MAJOR_REV  0x01
+
+//
+// A JESD216 table has at least 9 DWORDs. The page size is in DWORD 11,
+// added by JESD216A.
+//
+#define SFDP_BFPT_MIN_DWORDS        9
+#define SFDP_BFPT_PAGE_SIZE_DWORDS  11
+
+//
+// The number of BFPT DWORDs read. The later DWORDs do not describe the
+// geometry of the part.
+//
+#define SFDP_BFPT_MAX_DWORDS  16
+
+#pragma pack(1)
+
+typedef struct {
+  UINT32    Signature;
+  UINT8     MinorRevision;
+  UINT8     MajorRevision;
+  //
+  // The number of parameter headers minus one.
+  //
+  UINT8     NumberOfParameterHeaders;
+  UINT8     AccessProtocol;
+} SFDP_HEADER;
+
+typedef struct {
+  UINT8     IdLsb;
+  UINT8     MinorRevision;
+  UINT8     MajorRevision;
+  //
+  // The length of the table in DWORDs.
+  //
+  UINT8     Length;
+  //
+  // The 24-bit SFDP address of the table.
+  //
+  UINT8     TablePointer[3];
+  UINT8     IdMsb;
+} SFDP_PARAMETER_HEADER;
+
+#pragma pack()
+
+//
+// Fields of the Basic Flash Parameter Table. Dword N of JESD216 is at
+// index N - 1.
+//
+#define SFDP_BFPT_DW1_4KB_ERASE_MASK     (BIT1 | BIT0)
+#define SFDP_BFPT_DW1_4KB_ERASE          BIT0
+#define SFDP_BFPT_DW1_WRITE_GRANULARITY  BIT2
+#define SFDP_BFPT_DW1_FAST_READ_1_1_2    BIT16
+#define SFDP_BFPT_DW1_ADDRESS_BYTES      (BIT18 | BIT17)
+#define SFDP_BFPT_DW1_ADDRESS_3_ONLY     0
+#define SFDP_BFPT_DW1_ADDRESS_3_OR_4     BIT17
+#define SFDP_BFPT_DW1_ADDRESS_4_ONLY     BIT18
+#define SFDP_BFPT_DW1_DTR                BIT19
+#define SFDP_BFPT_DW1_FAST_READ_1_2_2    BIT20
+#define SFDP_BFPT_DW1_FAST_READ_1_4_4    BIT21
+#define SFDP_BFPT_DW1_FAST_READ_1_1_4    BIT22
+
+#define SFDP_BFPT_DW2_DENSITY_POWER_OF_2  BIT31
+
+#define SFDP_BFPT_DW5_FAST_READ_2_2_2  BIT0
+#define SFDP_BFPT_DW5_FAST_READ_4_4_4  BIT4
+
+//
+// Each of DWORD 8 and 9 holds two erase types: a size exponent and an
+// opcode per 16 bits. A size exponent of 0 means the type does not exist.
+//
+#define SFDP_BFPT_ERASE_TYPE_COUNT  4
+
+#define SFDP_BFPT_DW11_PAGE_SIZE_SHIFT  4
+#define SFDP_BFPT_DW11_PAGE_SIZE_MASK   0xF
+
+//
+// The page size when the table does not have one: JESD216 only tells if
+// the part programs single bytes, or pages of 64 bytes or more.
+//
+#define SFDP_DEFAULT_PAGE_SIZE  64
+
+/**
+  Read data from the SFDP address space of a flash part.
+
+  @param[in]  Context         The context passed to SpiFlashParseSfdp().
+  @param[in]  Address         The SFDP address to read from.
+  @param[in]  ByteCount       The number of bytes to read.
+  @param[out] Buffer          The destination buffer.
+
+  @retval EFI_SUCCESS         The data was read.
+  @retval Others              The data could not be read.
+**/
+typedef
+EFI_STATUS
+(*SPI_FLASH_SFDP_READ)(
+  IN  VOID    *Context,
+  IN  UINT32  Address,
+  IN  UINT32  ByteCount,
+  OUT UINT8   *Buffer
+  );
+
+/**
+  Get the geometry of a flash part from its SFDP.
+
+  The newest JESD216 revision of the Basic Flash Parameter Table is used.
+
+  @param[in]  Read            The function that reads the SFDP of the part.
+  @param[in]  Context         The context passed to Read.
+  @param[out] Geometry        The geometry of the part.
+
+  @retval EFI_SUCCESS             Geometry is filled.
+  @retval EFI_INVALID_PARAMETER   Read or Geometry is NULL.
+  @retval EFI_UNSUPPORTED         The part has no SFDP, or its major revision is not supported.
+  @retval EFI_NOT_FOUND           The SFDP has no Basic Flash Parameter Table.
+  @retval EFI_VOLUME_CORRUPTED    The Basic Flash Parameter Table is malformed.
+  @retval Others                  The status of Read.
+**/
+EFI_STATUS
+SpiFlashParseSfdp (
+  IN  SPI_FLASH_SFDP_READ  Read,
+  IN  VOID                 *Context,
+  OUT SPI_FLASH_GEOMETRY   *Geometry
+  );
+
+#endif
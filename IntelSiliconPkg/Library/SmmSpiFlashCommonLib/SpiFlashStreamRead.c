@@ -0,0 +1,94 @@
+/** @file
+  Streaming reads of the memory mapped SPI flash.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Register/Intel/Cpuid.h>
+
+#include "SpiFlashStreamRead.h"
+
+//
+// The bytes copied by one iteration of the streaming kernel, and the
+// alignment MOVNTDQA requires of its source.
+//
+#define SPI_FLASH_STREAM_BLOCK_SIZE  0x40
+#define SPI_FLASH_STREAM_ALIGNMENT   0x10
+
+BOOLEAN  mSpiFlashStreamLoad = FALSE;
+
+/**
+  Copy whole 64-byte blocks with SSE4.1 streaming loads.
+
+  @param[out] Destination     The destination buffer. No alignment is required.
+  @param[in]  Source          The source. Must be 16-byte aligned.
+  @param[in]  Length          The size, in bytes, to copy. Must be a multiple of 64.
+**/
+VOID
+EFIAPI
+InternalSpiFlashStreamCopySse41 (
+  OUT VOID       *Destination,
+  IN  CONST VOID *Source,
+  IN  UINTN      Length
+  );
+
+/**
+  Select the streaming kernel supported by the processor.
+
+  MOVNTDQA is only used when CPUID reports SSE4.1. The kernel only touches
+  the XMM registers, never the AVX state.
+**/
+VOID
+SpiFlashStreamReadInitialize (
+  VOID
+  )
+{
+  CPUID_VERSION_INFO_ECX  VersionInfoEcx;
+
+  AsmCpuid (CPUID_VERSION_INFO, NULL, NULL, &VersionInfoEcx.Uint32, NULL);
+  mSpiFlashStreamLoad = (BOOLEAN)(VersionInfoEcx.Bits.SSE4_1 != 0);
+}
+
+/**
+  Copy a range of the memory mapped flash into a buffer.
+
+  The head of the range up to the first 16-byte aligned address and the
+  tail after the last whole 64-byte block are copied with CopyMem.
+
+  @param[in]  Address         The flash address of the range.
+  @param[in]  Length          The size of the range in bytes.
+  @param[out] Buffer          The destination buffer. No alignment is required.
+**/
+VOID
+SpiFlashStreamRead (
+  IN  UINTN  Address,
+  IN  UINTN  Length,
+  OUT UINT8  *Buffer
+  )
+{
+  UINTN  HeadLength;
+  UINTN  BlockLength;
+
+  if (!mSpiFlashStreamLoad) {
+    CopyMem (Buffer, (VOID *)Address, Length);
+    return;
+  }
+
+  HeadLength = MIN (ALIGN_VALUE (Address, SPI_FLASH_STREAM_ALIGNMENT) - Address, Length);
+  CopyMem (Buffer, (VOID *)Address, HeadLength);
+  Address += HeadLength;
+  Buffer  += HeadLength;
+  Length  -= HeadLength;
+
+  BlockLength = Length & ~((UINTN)SPI_FLASH_STREAM_BLOCK_SIZE - 1);
+  if (BlockLength != 0) {
+    InternalSpiFlashStreamCopySse41 (Buffer, (VOID *)Address, BlockLength);
+  }
+
+  CopyMem (Buffer + BlockLength, (VOID *)(Address + BlockLength), Length - BlockLength);
+}
@@ -0,0 +1,42 @@
+/** @file
+  Streaming reads of the memory mapped SPI flash.
+
+  Large reads that bypass the read cache are copied with the SSE4.1
+  MOVNTDQA streaming load when the processor supports it. On a write
+  combining mapping of the flash the streaming loads fetch whole lines
+  without polluting the cache. On other mappings they behave as ordinary
+  16-byte loads.
+
+  Copyright (c) Microsoft Corporation.
+  SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#ifndef _SPI_FLASH_STREAM_READ_H_
+#define _SPI_FLASH_STREAM_READ_H_
+
+#include <Uefi.h>
+
+/**
+  Select the streaming kernel supported by the processor.
+**/
+VOID
+SpiFlashStreamReadInitialize (
+  VOID
+  );
+
+/**
+  Copy a range of the memory mapped flash into a buffer.
+
+  @param[in]  Address         The flash address of the range.
+  @param[in]  Length          The size of the range in bytes.
+  @param[out] Buffer          The destination buffer. No alignment is required.
+**/
+VOID
+SpiFlashStreamRead (
+  IN  UINTN  Address,
+  IN  UINTN  Length,
+  OUT UINT8  *Buffer
+  );
+
+#endif
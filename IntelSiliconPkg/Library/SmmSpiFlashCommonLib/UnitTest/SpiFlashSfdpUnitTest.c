@@ -0,0 +1,389 @@
+/** @file
+UnitTest for...
+The JEDEC SFDP parser of SmmSpiFlashCommonLib.
+
+The parser reads sample SFDP dumps of flash parts of several JESD216
+revisions, and malformed copies of them.
+
+Copyright (c) Microsoft Corporation.
+SPDX-License-Identifier: BSD-2-Clause-Patent
+
+**/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <Uefi.h>
+#include <Library/DebugLib.h>
+#include <Library/UnitTestLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "../SpiFlashSfdp.h"
+
+#ifndef INTERNAL_UNIT_TEST
+  #error Make sure to build thie with INTERNAL_UNIT_TEST enabled! Otherwise, some important tests may be skipped!
+#endif
+
+#define UNIT_TEST_NAME     "SPI Flash SFDP UnitTest"
+#define UNIT_TEST_VERSION  "0.9"
+
+/// === TEST DATA ==================================================================================
+
+typedef struct {
+  CONST UINT8           *Data;
+  UINTN                 Size;
+  SPI_FLASH_GEOMETRY    Expected;
+} SFDP_SAMPLE;
+
+//
+// Offsets in mSfdp128Mbit patched by the malformed SFDP tests.
+//
+#define TEST_OFFSET_MAJOR_REV      0x05
+#define TEST_OFFSET_BFPT_ID_LSB    0x08
+#define TEST_OFFSET_BFPT_LENGTH    0x0B
+#define TEST_OFFSET_BFPT_POINTER   0x0C
+#define TEST_OFFSET_BFPT_DENSITY   0x34
+#define TEST_OFFSET_BFPT_ERASE_1   0x4C
+
+//
+// A 128Mbit part of JESD216B with 4KB, 32KB and 64KB erases, 256 byte
+// pages, 3-byte addresses and quad reads.
+//
+STATIC CONST UINT8  mSfdp128Mbit[] = {
+  0x53, 0x46, 0x44, 0x50, 0x06, 0x01, 0x00, 0xFF,
+  0x00, 0x06, 0x01, 0x10, 0x30, 0x00, 0x00, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xE5, 0x20, 0xF1, 0xFF, 0xFF, 0xFF, 0xFF, 0x07,
+  0x44, 0xEB, 0x08, 0x6B, 0x08, 0x3B, 0x42, 0xBB,
+  0xFE, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00,
+  0xFF, 0xFF, 0x44, 0xEB, 0x0C, 0x20, 0x0F, 0x52,
+  0x10, 0xD8, 0x00, 0xFF, 0x36, 0x02, 0xA6, 0x00,
+  0x82, 0xEA, 0x14, 0xC9, 0xE9, 0x63, 0x76, 0x33,
+  0x7A, 0x75, 0x7A, 0x75, 0xF7, 0xA2, 0xD5, 0x5C,
+  0x19, 0xF7, 0x4D, 0xFF, 0xE9, 0x30, 0xF8, 0x80
+};
+
+//
+// A 256Mbit part of JESD216B that accepts 3 or 4 byte addresses and DTR
+// reads. Its SFDP also has a 4-byte address instruction table and a vendor
+// table.
+//
+STATIC CONST UINT8  mSfdp256Mbit[] = {
+  0x53, 0x46, 0x44, 0x50, 0x06, 0x01, 0x02, 0xFF,
+  0x00, 0x06, 0x01, 0x10, 0x30, 0x00, 0x00, 0xFF,
+  0x84, 0x00, 0x01, 0x02, 0x70, 0x00, 0x00, 0xFF,
+  0x00, 0x00, 0x01, 0x02, 0x78, 0x00, 0x00, 0xC2,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xE5, 0x20, 0xFB, 0xFF, 0xFF, 0xFF, 0xFF, 0x0F,
+  0x44, 0xEB, 0x08, 0x6B, 0x08, 0x3B, 0x04, 0xBB,
+  0xEE, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0xFF,
+  0xFF, 0xFF, 0x00, 0xFF, 0x0C, 0x20, 0x0F, 0x52,
+  0x10, 0xD8, 0x00, 0xFF, 0x23, 0x72, 0xF5, 0x00,
+  0x82, 0xED, 0x04, 0xB7, 0x44, 0x83, 0x38, 0x44,
+  0x30, 0xB0, 0x30, 0xB0, 0xF7, 0xC4, 0xD5, 0x5C,
+  0x00, 0xBE, 0x29, 0xFF, 0xF0, 0xD0, 0xFF, 0xFF,
+  0xFB, 0x8E, 0x00, 0x00, 0x21, 0x5C, 0xDC, 0xFF,
+  0x00, 0x36, 0x00, 0x27, 0x9D, 0xF9, 0xC0, 0x64
+};
+
+//
+// An 8Mbit part of JESD216, whose table has no page size. It programs
+// pages of 64 bytes or more, and has 4KB and 64KB erases.
+//
+STATIC CONST UINT8  mSfdp8Mbit[] = {
+  0x53, 0x46, 0x44, 0x50, 0x00, 0x01, 0x00, 0xFF,
+  0x00, 0x00, 0x01, 0x09, 0x10, 0x00, 0x00, 0xFF,
+  0xE5, 0x20, 0x81, 0xFF, 0xFF, 0xFF, 0x7F, 0x00,
+  0xFF, 0xFF, 0xFF, 0xFF, 0x08, 0x3B, 0xFF, 0xFF,
+  0xEE, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0x0C, 0x20, 0x10, 0xD8,
+  0x00, 0xFF, 0x00, 0xFF
+};
+
+//
+// A part with a JESD216 table and a newer JESD216B table. The old table
+// only has the 4KB erase.
+//
+STATIC CONST UINT8  mSfdpTwoRevisions[] = {
+  0x53, 0x46, 0x44, 0x50, 0x06, 0x01, 0x01, 0xFF,
+  0x00, 0x00, 0x01, 0x09, 0x18, 0x00, 0x00, 0xFF,
+  0x00, 0x06, 0x01, 0x10, 0x40, 0x00, 0x00, 0xFF,
+  0xE5, 0x20, 0x81, 0xFF, 0xFF, 0xFF, 0x7F, 0x00,
+  0xFF, 0xFF, 0xFF, 0xFF, 0x08, 0x3B, 0xFF, 0xFF,
+  0xEE, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0x0C, 0x20, 0x00, 0xFF,
+  0x00, 0xFF, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xE5, 0x20, 0xF1, 0xFF, 0xFF, 0xFF, 0xFF, 0x07,
+  0x44, 0xEB, 0x08, 0x6B, 0x08, 0x3B, 0x42, 0xBB,
+  0xFE, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00,
+  0xFF, 0xFF, 0x44, 0xEB, 0x0C, 0x20, 0x0F, 0x52,
+  0x10, 0xD8, 0x00, 0xFF, 0x36, 0x02, 0xA6, 0x00,
+  0x82, 0xEA, 0x14, 0xC9, 0xE9, 0x63, 0x76, 0x33,
+  0x7A, 0x75, 0x7A, 0x75, 0xF7, 0xA2, 0xD5, 0x5C,
+  0x19, 0xF7, 0x4D, 0xFF, 0xE9, 0x30, 0xF8, 0x80
+};
+
+STATIC SFDP_SAMPLE  mSample128Mbit = {
+  mSfdp128Mbit,
+  sizeof (mSfdp128Mbit),
+  {
+    SIZE_16MB,
+    SIZE_4KB | SIZE_32KB | SIZE_64KB,
+    0x100,
+    SPI_FLASH_FAST_READ_1_1_2 | SPI_FLASH_FAST_READ_1_2_2 | SPI_FLASH_FAST_READ_1_1_4 |
+    SPI_FLASH_FAST_READ_1_4_4 | SPI_FLASH_FAST_READ_4_4_4,
+    3
+  }
+};
+
+STATIC SFDP_SAMPLE  mSample256Mbit = {
+  mSfdp256Mbit,
+  sizeof (mSfdp256Mbit),
+  {
+    SIZE_32MB,
+    SIZE_4KB | SIZE_32KB | SIZE_64KB,
+    0x100,
+    SPI_FLASH_FAST_READ_1_1_2 | SPI_FLASH_FAST_READ_1_2_2 | SPI_FLASH_FAST_READ_1_1_4 |
+    SPI_FLASH_FAST_READ_1_4_4 | SPI_FLASH_FAST_READ_DTR,
+    4
+  }
+};
+
+STATIC SFDP_SAMPLE  mSample8Mbit = {
+  mSfdp8Mbit,
+  sizeof (mSfdp8Mbit),
+  {
+    SIZE_1MB,
+    SIZE_4KB | SIZE_64KB,
+    SFDP_DEFAULT_PAGE_SIZE,
+    SPI_FLASH_FAST_READ_1_1_2,
+    3
+  }
+};
+
+STATIC SFDP_SAMPLE  mSampleTwoRevisions = {
+  mSfdpTwoRevisions,
+  sizeof (mSfdpTwoRevisions),
+  {
+    SIZE_16MB,
+    SIZE_4KB | SIZE_32KB | SIZE_64KB,
+    0x100,
+    SPI_FLASH_FAST_READ_1_1_2 | SPI_FLASH_FAST_READ_1_2_2 | SPI_FLASH_FAST_READ_1_1_4 |
+    SPI_FLASH_FAST_READ_1_4_4 | SPI_FLASH_FAST_READ_4_4_4,
+    3
+  }
+};
+
+/// === HELPER FUNCTIONS ===========================================================================
+
+/**
+  Read a range of an SFDP dump. The reads past the end of the dump fail
+  like the reads of a part without that data.
+**/
+STATIC
+EFI_STATUS
+SampleSfdpRead (
+  IN  VOID    *Context,
+  IN  UINT32  Address,
+  IN  UINT32  ByteCount,
+  OUT UINT8   *Buffer
+  )
+{
+  SFDP_SAMPLE  *Sample;
+
+  Sample = Context;
+  if ((Address > Sample->Size) || (ByteCount > Sample->Size - Address)) {
+    return EFI_DEVICE_ERROR;
+  }
+
+  CopyMem (Buffer, Sample->Data + Address, ByteCount);
+  return EFI_SUCCESS;
+}
+
+/**
+  Parse a copy of mSfdp128Mbit with one byte changed.
+
+  @param[in]  Offset          The offset of the byte to change.
+  @param[in]  Value           The new value of the byte.
+
+  @return The status of SpiFlashParseSfdp().
+**/
+STATIC
+EFI_STATUS
+ParsePatchedSfdp (
+  IN UINTN  Offset,
+  IN UINT8  Value
+  )
+{
+  UINT8               Data[sizeof (mSfdp128Mbit)];
+  SFDP_SAMPLE         Sample;
+  SPI_FLASH_GEOMETRY  Geometry;
+
+  CopyMem (Data, mSfdp128Mbit, sizeof (Data));
+  Data[Offset] = Value;
+  Sample.Data  = Data;
+  Sample.Size  = sizeof (Data);
+  return SpiFlashParseSfdp (SampleSfdpRead, &Sample, &Geometry);
+}
+
+/// === TEST CASES =================================================================================
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+ShouldParseSampleGeometry (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  SFDP_SAMPLE         *Sample;
+  SPI_FLASH_GEOMETRY  Geometry;
+
+  Sample = Context;
+  SetMem (&Geometry, sizeof (Geometry), 0xA5);
+  UT_ASSERT_NOT_EFI_ERROR (SpiFlashParseSfdp (SampleSfdpRead, Sample, &Geometry));
+
+  UT_ASSERT_EQUAL (Geometry.FlashSize, Sample->Expected.FlashSize);
+  UT_ASSERT_EQUAL (Geometry.EraseSizes, Sample->Expected.EraseSizes);
+  UT_ASSERT_EQUAL (Geometry.PageSize, Sample->Expected.PageSize);
+  UT_ASSERT_EQUAL (Geometry.FastReadModes, Sample->Expected.FastReadModes);
+  UT_ASSERT_EQUAL (Geometry.AddressBytes, Sample->Expected.AddressBytes);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+ShouldParsePowerOf2Density (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  UINT8               Data[sizeof (mSfdp128Mbit)];
+  SFDP_SAMPLE         Sample;
+  SPI_FLASH_GEOMETRY  Geometry;
+
+  //
+  // 2^34 bits.
+  //
+  CopyMem (Data, mSfdp128Mbit, sizeof (Data));
+  Data[TEST_OFFSET_BFPT_DENSITY]     = 0x22;
+  Data[TEST_OFFSET_BFPT_DENSITY + 1] = 0x00;
+  Data[TEST_OFFSET_BFPT_DENSITY + 2] = 0x00;
+  Data[TEST_OFFSET_BFPT_DENSITY + 3] = 0x80;
+  Sample.Data                        = Data;
+  Sample.Size                        = sizeof (Data);
+
+  UT_ASSERT_NOT_EFI_ERROR (SpiFlashParseSfdp (SampleSfdpRead, &Sample, &Geometry));
+  UT_ASSERT_EQUAL (Geometry.FlashSize, SIZE_2GB);
+  return UNIT_TEST_PASSED;
+}
+
+/**
+  Test Case
+*/
+UNIT_TEST_STATUS
+EFIAPI
+ShouldRejectMalformedSfdp (
+  IN UNIT_TEST_CONTEXT  Context
+  )
+{
+  SFDP_SAMPLE         Sample;
+  SPI_FLASH_GEOMETRY  Geometry;
+
+  Sample.Data = mSfdp128Mbit;
+  Sample.Size = sizeof (mSfdp128Mbit);
+  UT_ASSERT_EQUAL (SpiFlashParseSfdp (NULL, &Sample, &Geometry), EFI_INVALID_PARAMETER);
+  UT_ASSERT_EQUAL (SpiFlashParseSfdp (SampleSfdpRead, &Sample, NULL), EFI_INVALID_PARAMETER);
+
+  //
+  // No SFDP, or a revision this parser does not understand.
+  //
+  UT_ASSERT_EQUAL (ParsePatchedSfdp (0, 0xFF), EFI_UNSUPPORTED);
+  UT_ASSERT_EQUAL (ParsePatchedSfdp (TEST_OFFSET_MAJOR_REV, 0x02), EFI_UNSUPPORTED);
+
+  //
+  // No Basic Flash Parameter Table.
+  //
+  UT_ASSERT_EQUAL (ParsePatchedSfdp (TEST_OFFSET_BFPT_ID_LSB, 0x84), EFI_NOT_FOUND);
+
+  //
+  // A table too short, past the end of the SFDP, with a bad density, or
+  // with an erase size that does not fit in 32 bits.
+  //
+  UT_ASSERT_EQUAL (ParsePatchedSfdp (TEST_OFFSET_BFPT_LENGTH, SFDP_BFPT_MIN_DWORDS - 1), EFI_VOLUME_CORRUPTED);
+  UT_ASSERT_EQUAL (ParsePatchedSfdp (TEST_OFFSET_BFPT_POINTER, 0x60), EFI_DEVICE_ERROR);
+  UT_ASSERT_EQUAL (ParsePatchedSfdp (TEST_OFFSET_BFPT_DENSITY + 3, 0x80), EFI_VOLUME_CORRUPTED);
+  UT_ASSERT_EQUAL (ParsePatchedSfdp (TEST_OFFSET_BFPT_ERASE_1, 0x20), EFI_VOLUME_CORRUPTED);
+  return UNIT_TEST_PASSED;
+}
+
+/// === TEST ENGINE ================================================================================
+
+/**
+  Standard UEFI entry point for target based
+  unit test execution from UEFI Shell.
+
+  @param[in]  ImageHandle     The firmware allocated handle for the EFI image.
+  @param[in]  SystemTable     A pointer to the EFI System Table.
+
+  @retval EFI_SUCCESS     The entry point executed successfully.
+  @retval other           Some error occurred when executing this entry point.
+
+**/
+int
+main (
+  )
+{
+  EFI_STATUS                  Status;
+  UNIT_TEST_FRAMEWORK_HANDLE  Framework = NULL;
+  UNIT_TEST_SUITE_HANDLE      SfdpTests;
+
+  DEBUG ((DEBUG_INFO, "%a v%a\n", UNIT_TEST_NAME, UNIT_TEST_VERSION));
+
+  //
+  // Start setting up the test framework for running the tests.
+  //
+  Status = InitUnitTestFramework (&Framework, UNIT_TEST_NAME, gEfiCallerBaseName, UNIT_TEST_VERSION);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in InitUnitTestFramework. Status = %r\n", Status));
+    goto EXIT;
+  }
+
+  Status = CreateUnitTestSuite (&SfdpTests, Framework, "SPI Flash SFDP Tests", "SpiFlashSfdp", NULL, NULL);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((DEBUG_ERROR, "Failed in CreateUnitTestSuite for SfdpTests\n"));
+    Status = EFI_OUT_OF_RESOURCES;
+    goto EXIT;
+  }
+
+  AddTestCase (SfdpTests, "Should parse a 128Mbit JESD216B part", "SpiFlashSfdp.128Mbit", ShouldParseSampleGeometry, NULL, NULL, &mSample128Mbit);
+  AddTestCase (SfdpTests, "Should parse a 256Mbit part with more tables", "SpiFlashSfdp.256Mbit", ShouldParseSampleGeometry, NULL, NULL, &mSample256Mbit);
+  AddTestCase (SfdpTests, "Should parse an 8Mbit JESD216 part", "SpiFlashSfdp.8Mbit", ShouldParseSampleGeometry, NULL, NULL, &mSample8Mbit);
+  AddTestCase (SfdpTests, "Should use the newest table revision", "SpiFlashSfdp.TwoRevisions", ShouldParseSampleGeometry, NULL, NULL, &mSampleTwoRevisions);
+  AddTestCase (SfdpTests, "Should parse a power of 2 density", "SpiFlashSfdp.PowerOf2Density", ShouldParsePowerOf2Density, NULL, NULL, NULL);
+  AddTestCase (SfdpTests, "Should reject a malformed SFDP", "SpiFlashSfdp.Malformed", ShouldRejectMalformedSfdp, NULL, NULL, NULL);
+
+  //
+  // Execute the tests.
+  //
+  Status = RunAllTestSuites (Framework);
+
+EXIT:
+  if (Framework != NULL) {
+    FreeUnitTestFramework (Framework);
+  }
+
+  return Status;
+}
@@ -76,6 +76,29 @@ SpiFlashWrite (
   return EFI_SUCCESS;
 }
 
+/**
+  Write a list of ranges to the flash, then enable block protection and
+  flush the data cache once over the union of the ranges.
+
+  @param[in,out]  Vector          The ranges to write. On output, NumBytes of each
+                                  range is the actual number of bytes written.
+  @param[in]      VectorCount     The number of ranges in Vector.
+
+  @retval         EFI_SUCCESS       Operation is successful.
+  @retval         EFI_DEVICE_ERROR  If there is any device errors.
+
+**/
+EFI_STATUS
+EFIAPI
+SpiFlashWriteVector (
+  IN OUT SPI_FLASH_WRITE_VECTOR  *Vector,
+  IN     UINTN                   VectorCount
+  )
+{
+  ASSERT (FALSE);
+  return EFI_SUCCESS;
+}
+
 /**
   Erase the block starting at Address.
 
@@ -99,3 +122,20 @@ SpiFlashBlockErase (
   ASSERT (FALSE);
   return EFI_SUCCESS;
 }
+
+/**
+  Get the geometry of the flash part.
+
+  @param[out] Geometry        The geometry of the flash part.
+
+  @retval     EFI_UNSUPPORTED  The geometry of the part is not known.
+
+**/
+EFI_STATUS
+EFIAPI
+SpiFlashGetGeometry (
+  OUT SPI_FLASH_GEOMETRY  *Geometry
+  )
+{
+  return EFI_UNSUPPORTED;
+}